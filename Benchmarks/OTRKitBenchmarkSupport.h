@@ -0,0 +1,68 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+NS_ASSUME_NONNULL_BEGIN
+
+/* Monotonic time in seconds */
+extern NSTimeInterval OTRKitBenchmarkNow(void);
+
+/* Summary of samples given in seconds. The summary is in milliseconds:
+ count, mean, min, p50, p99, and max. */
+extern NSDictionary<NSString *, NSNumber *> *OTRKitBenchmarkSummary(NSArray<NSNumber *> *samples);
+
+/* Highest resident set size of the process so far in bytes */
+extern uint64_t OTRKitBenchmarkPeakResidentBytes(void);
+
+/* Number of bytes the process has written so far. Includes
+ writes to standard output and any other file descriptor. */
+extern uint64_t OTRKitBenchmarkBytesWritten(void);
+
+/* Creates an empty directory that is unique to this run */
+extern NSString *OTRKitBenchmarkTemporaryDirectory(NSString *name);
+
+/* Waits up to timeout seconds. Returns NO if the group did not finish in time. */
+extern BOOL OTRKitBenchmarkWaitForGroup(dispatch_group_t group, NSTimeInterval timeout);
+
+/* Writes results as JSON to outputPath, or to standard output when nil. */
+extern BOOL OTRKitBenchmarkWriteResults(NSDictionary *results, NSString * _Nullable outputPath);
+
+/* Options are given as --name value. Lists are comma separated. */
+@interface OTRKitBenchmarkArguments : NSObject
+- (instancetype)initWithArguments:(NSArray<NSString *> *)arguments NS_DESIGNATED_INITIALIZER;
+
+- (nullable NSString *)stringForOption:(NSString *)option;
+- (NSInteger)integerForOption:(NSString *)option defaultValue:(NSInteger)defaultValue;
+- (double)doubleForOption:(NSString *)option defaultValue:(double)defaultValue;
+- (NSArray<NSNumber *> *)integerListForOption:(NSString *)option defaultValue:(NSArray<NSNumber *> *)defaultValue;
+@end
+
+NS_ASSUME_NONNULL_END
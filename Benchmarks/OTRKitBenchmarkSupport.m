@@ -0,0 +1,288 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKitBenchmarkSupport.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#if defined(__APPLE__)
+#include <libproc.h>
+#endif
+
+NS_ASSUME_NONNULL_BEGIN
+
+NSTimeInterval OTRKitBenchmarkNow(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((NSTimeInterval)now.tv_sec + ((NSTimeInterval)now.tv_nsec / NSEC_PER_SEC));
+}
+
+static double OTRKitBenchmarkPercentile(NSArray<NSNumber *> *sortedSamples, double percentile)
+{
+	NSCParameterAssert(sortedSamples.count > 0);
+
+	/* Nearest rank */
+	NSUInteger rank = (NSUInteger)ceil((percentile / 100.0) * sortedSamples.count);
+
+	if (rank > 0) {
+		rank -= 1;
+	}
+
+	return sortedSamples[MIN(rank, (sortedSamples.count - 1))].doubleValue;
+}
+
+NSDictionary<NSString *, NSNumber *> *OTRKitBenchmarkSummary(NSArray<NSNumber *> *samples)
+{
+	NSCParameterAssert(samples != nil);
+
+	if (samples.count == 0) {
+		return @{@"count" : @(0)};
+	}
+
+	NSArray<NSNumber *> *sortedSamples = [samples sortedArrayUsingSelector:@selector(compare:)];
+
+	double total = 0;
+
+	for (NSNumber *sample in sortedSamples) {
+		total += sample.doubleValue;
+	}
+
+	return @{
+		@"count"	: @(sortedSamples.count),
+		@"mean_ms"	: @((total / sortedSamples.count) * 1000.0),
+		@"min_ms"	: @(sortedSamples.firstObject.doubleValue * 1000.0),
+		@"p50_ms"	: @(OTRKitBenchmarkPercentile(sortedSamples, 50.0) * 1000.0),
+		@"p99_ms"	: @(OTRKitBenchmarkPercentile(sortedSamples, 99.0) * 1000.0),
+		@"max_ms"	: @(sortedSamples.lastObject.doubleValue * 1000.0)
+	};
+}
+
+uint64_t OTRKitBenchmarkPeakResidentBytes(void)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+
+#if defined(__APPLE__)
+	return (uint64_t)usage.ru_maxrss;
+#else
+	/* Linux reports kilobytes */
+	return ((uint64_t)usage.ru_maxrss * 1024);
+#endif
+}
+
+uint64_t OTRKitBenchmarkBytesWritten(void)
+{
+#if defined(__APPLE__)
+	struct rusage_info_v2 usage;
+
+	if (proc_pid_rusage(getpid(), RUSAGE_INFO_V2, (rusage_info_t *)&usage) != 0) {
+		return 0;
+	}
+
+	return usage.ri_diskio_byteswritten;
+#else
+	FILE *filePointer = fopen("/proc/self/io", "r");
+
+	if (filePointer == NULL) {
+		return 0;
+	}
+
+	unsigned long long bytesWritten = 0;
+
+	char line[128];
+
+	while (fgets(line, sizeof(line), filePointer)) {
+		if (sscanf(line, "wchar: %llu", &bytesWritten) == 1) {
+			break;
+		}
+	}
+
+	fclose(filePointer);
+
+	return (uint64_t)bytesWritten;
+#endif
+}
+
+NSString *OTRKitBenchmarkTemporaryDirectory(NSString *name)
+{
+	NSCParameterAssert(name != nil);
+
+	NSString *directoryName = [NSString stringWithFormat:@"%@-%@", name, [NSUUID UUID].UUIDString];
+
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:directoryName];
+
+	[[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:YES attributes:nil error:NULL];
+
+	return path;
+}
+
+BOOL OTRKitBenchmarkWaitForGroup(dispatch_group_t group, NSTimeInterval timeout)
+{
+	NSCParameterAssert(group != NULL);
+
+	dispatch_time_t deadline = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC));
+
+	return (dispatch_group_wait(group, deadline) == 0);
+}
+
+BOOL OTRKitBenchmarkWriteResults(NSDictionary *results, NSString * _Nullable outputPath)
+{
+	NSCParameterAssert(results != nil);
+
+	NSError *error = nil;
+
+	NSData *resultsData = [NSJSONSerialization dataWithJSONObject:results options:NSJSONWritingPrettyPrinted error:&error];
+
+	if (resultsData == nil) {
+		fprintf(stderr, "Unable to serialize results: %s\n", error.localizedDescription.UTF8String);
+
+		return NO;
+	}
+
+	if (outputPath) {
+		return [resultsData writeToFile:outputPath atomically:YES];
+	}
+
+	fwrite(resultsData.bytes, 1, resultsData.length, stdout);
+	fputc('\n', stdout);
+
+	return YES;
+}
+
+@interface OTRKitBenchmarkArguments ()
+@property (nonatomic, copy) NSDictionary<NSString *, NSString *> *options;
+@end
+
+@implementation OTRKitBenchmarkArguments
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+- (instancetype)init
+{
+	return nil;
+}
+#pragma clang diagnostic pop
+
+- (instancetype)initWithArguments:(NSArray<NSString *> *)arguments
+{
+	NSParameterAssert(arguments != nil);
+
+	if ((self = [super init])) {
+		NSMutableDictionary<NSString *, NSString *> *options = [NSMutableDictionary dictionary];
+
+		for (NSUInteger i = 0; i < arguments.count; i++) {
+			NSString *argument = arguments[i];
+
+			if ([argument hasPrefix:@"--"] == NO) {
+				continue;
+			}
+
+			NSString *option = [argument substringFromIndex:2];
+
+			if ((i + 1) < arguments.count && [arguments[(i + 1)] hasPrefix:@"--"] == NO) {
+				options[option] = arguments[(i + 1)];
+
+				i++;
+			} else {
+				options[option] = @"1";
+			}
+		}
+
+		self.options = options;
+
+		return self;
+	}
+
+	return nil;
+}
+
+- (nullable NSString *)stringForOption:(NSString *)option
+{
+	NSParameterAssert(option != nil);
+
+	return self.options[option];
+}
+
+- (NSInteger)integerForOption:(NSString *)option defaultValue:(NSInteger)defaultValue
+{
+	NSString *value = [self stringForOption:option];
+
+	if (value == nil) {
+		return defaultValue;
+	}
+
+	return value.integerValue;
+}
+
+- (double)doubleForOption:(NSString *)option defaultValue:(double)defaultValue
+{
+	NSString *value = [self stringForOption:option];
+
+	if (value == nil) {
+		return defaultValue;
+	}
+
+	return value.doubleValue;
+}
+
+- (NSArray<NSNumber *> *)integerListForOption:(NSString *)option defaultValue:(NSArray<NSNumber *> *)defaultValue
+{
+	NSString *value = [self stringForOption:option];
+
+	if (value == nil) {
+		return defaultValue;
+	}
+
+	NSMutableArray<NSNumber *> *list = [NSMutableArray array];
+
+	for (NSString *component in [value componentsSeparatedByString:@","]) {
+		NSInteger integerValue = component.integerValue;
+
+		if (integerValue > 0) {
+			[list addObject:@(integerValue)];
+		}
+	}
+
+	return [list copy];
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
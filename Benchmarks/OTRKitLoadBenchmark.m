@@ -0,0 +1,196 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKit.h"
+#import "OTRKitLoopbackTransport.h"
+#import "OTRKitMetrics.h"
+#import "OTRKitTracer.h"
+
+#import "OTRKitBenchmarkSupport.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/* Drives many conversations at once through OTRKitLoopbackTransport:
+ each account starts encryption with each peer, sends messages, then
+ ends encryption. Results are written as JSON.
+
+ Options:
+	--accounts 4			Number of local accounts
+	--peers 250				Number of simulated peers
+	--messages 10			Messages sent in each direction of each conversation
+	--size 256				Message size in bytes
+	--latency 0.02			One way latency in seconds
+	--jitter 0.01			Random extra latency in seconds
+	--loss 0				Chance a line is lost
+	--reorder 0				Chance a line arrives after the one sent after it
+	--max-line-length 0		Lines longer than this are cut short (0 disables)
+	--seed 1				Seed for loss, reordering, and jitter
+	--data-path path		Keep keys here between runs instead of a temporary directory
+	--timeout 300			Seconds to wait for each step
+	--trace path			Write a Chrome trace of the last messages sent to path
+	--output path			Write results to path instead of standard output */
+
+static NSDictionary *OTRKitBenchmarkDictionaryForStatistics(OTRKitLoopbackTransportStatistics *statistics)
+{
+	return @{
+		@"conversations"			: @(statistics.conversationCount),
+		@"encrypted_conversations"	: @(statistics.encryptedConversationCount),
+		@"messages_sent"			: @(statistics.messagesSent),
+		@"messages_received"		: @(statistics.messagesReceived),
+		@"lines_injected"			: @(statistics.linesInjected),
+		@"bytes_injected"			: @(statistics.bytesInjected),
+		@"lines_delivered"			: @(statistics.linesDelivered),
+		@"lines_lost"				: @(statistics.linesLost),
+		@"lines_reordered"			: @(statistics.linesReordered),
+		@"lines_truncated"			: @(statistics.linesTruncated),
+		@"errors"					: @(statistics.errorCount),
+		@"latency_mean_ms"			: @(statistics.averageLatency * 1000.0),
+		@"latency_max_ms"			: @(statistics.maximumLatency * 1000.0),
+		@"elapsed_s"				: @(statistics.elapsedTime)
+	};
+}
+
+/* Runs script and waits for it to finish */
+static OTRKitLoopbackTransportStatistics *OTRKitBenchmarkRunScript(OTRKitLoopbackTransport *transport, NSArray<OTRKitLoopbackTransportStep *> *script, NSTimeInterval timeout)
+{
+	dispatch_group_t group = dispatch_group_create();
+
+	__block OTRKitLoopbackTransportStatistics *result = nil;
+
+	dispatch_group_enter(group);
+
+	[transport resetStatistics];
+
+	[transport runScript:script timeout:timeout completionHandler:^(OTRKitLoopbackTransportStatistics *statistics) {
+		result = statistics;
+
+		dispatch_group_leave(group);
+	}];
+
+	dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+	return result;
+}
+
+int main(int argc, const char *argv[])
+{
+	@autoreleasepool {
+		OTRKitBenchmarkArguments *arguments = [[OTRKitBenchmarkArguments alloc] initWithArguments:[NSProcessInfo processInfo].arguments];
+
+		OTRKitLoopbackTransportConfiguration *configuration = [OTRKitLoopbackTransportConfiguration new];
+
+		configuration.accountCount = (NSUInteger)MAX([arguments integerForOption:@"accounts" defaultValue:4], 1);
+		configuration.peerCount = (NSUInteger)MAX([arguments integerForOption:@"peers" defaultValue:250], 1);
+
+		configuration.latency = [arguments doubleForOption:@"latency" defaultValue:0.02];
+		configuration.latencyJitter = [arguments doubleForOption:@"jitter" defaultValue:0.01];
+
+		configuration.lossRate = [arguments doubleForOption:@"loss" defaultValue:0];
+		configuration.reorderRate = [arguments doubleForOption:@"reorder" defaultValue:0];
+
+		configuration.maximumLineLength = (NSUInteger)MAX([arguments integerForOption:@"max-line-length" defaultValue:0], 0);
+
+		configuration.randomSeed = (uint64_t)[arguments integerForOption:@"seed" defaultValue:1];
+
+		NSUInteger messageCount = (NSUInteger)MAX([arguments integerForOption:@"messages" defaultValue:10], 0);
+		NSUInteger messageSize = (NSUInteger)MAX([arguments integerForOption:@"size" defaultValue:256], 1);
+
+		NSTimeInterval timeout = [arguments doubleForOption:@"timeout" defaultValue:300];
+
+		NSString *dataPath = [arguments stringForOption:@"data-path"];
+
+		BOOL removeDataPath = (dataPath == nil);
+
+		if (dataPath == nil) {
+			dataPath = OTRKitBenchmarkTemporaryDirectory(@"otrkit-load-benchmark");
+		}
+
+		NSString *tracePath = [arguments stringForOption:@"trace"];
+
+		if (tracePath) {
+			[OTRKitTracer setCapacity:262144];
+
+			[OTRKitTracer setEnabled:YES];
+		}
+
+		OTRKitLoopbackTransport *transport = [[OTRKitLoopbackTransport alloc] initWithConfiguration:configuration dataPath:dataPath];
+
+		/* Each step is run as its own script so that it is timed on its own */
+		OTRKitLoopbackTransportStatistics *startStatistics =
+		OTRKitBenchmarkRunScript(transport, @[[OTRKitLoopbackTransportStep startEncryptionStep]], timeout);
+
+		OTRKitLoopbackTransportStatistics *sendStatistics =
+		OTRKitBenchmarkRunScript(transport, @[[OTRKitLoopbackTransportStep sendStepWithMessageCount:messageCount messageSize:messageSize bidirectional:YES]], timeout);
+
+		OTRKitLoopbackTransportStatistics *endStatistics =
+		OTRKitBenchmarkRunScript(transport, @[[OTRKitLoopbackTransportStep endEncryptionStep]], timeout);
+
+		NSDictionary *results = @{
+			@"benchmark"			: @"load",
+			@"accounts"				: @(configuration.accountCount),
+			@"peers"				: @(configuration.peerCount),
+			@"message_size"			: @(messageSize),
+			@"latency_s"			: @(configuration.latency),
+			@"jitter_s"				: @(configuration.latencyJitter),
+			@"loss"					: @(configuration.lossRate),
+			@"reorder"				: @(configuration.reorderRate),
+			@"max_line_length"		: @(configuration.maximumLineLength),
+			@"start_encryption"		: OTRKitBenchmarkDictionaryForStatistics(startStatistics),
+			@"send_messages"		: OTRKitBenchmarkDictionaryForStatistics(sendStatistics),
+			@"end_encryption"		: OTRKitBenchmarkDictionaryForStatistics(endStatistics),
+			@"local_metrics"		: transport.localOTRKit.metrics.snapshot.dictionaryRepresentation,
+			@"remote_metrics"		: transport.remoteOTRKit.metrics.snapshot.dictionaryRepresentation,
+			@"messages_per_second"	: @((sendStatistics.elapsedTime > 0) ? (sendStatistics.messagesReceived / sendStatistics.elapsedTime) : 0),
+			@"peak_rss_bytes"		: @(OTRKitBenchmarkPeakResidentBytes())
+		};
+
+		if (tracePath) {
+			NSError *traceError = nil;
+
+			if ([OTRKitTracer writeChromeTraceToPath:tracePath error:&traceError] == NO) {
+				fprintf(stderr, "Unable to write trace: %s\n", traceError.localizedDescription.UTF8String);
+			}
+		}
+
+		if (removeDataPath) {
+			[[NSFileManager defaultManager] removeItemAtPath:dataPath error:NULL];
+		}
+
+		if (OTRKitBenchmarkWriteResults(results, [arguments stringForOption:@"output"]) == NO) {
+			return 1;
+		}
+
+		return 0;
+	}
+}
+
+NS_ASSUME_NONNULL_END
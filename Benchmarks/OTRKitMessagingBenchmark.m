@@ -0,0 +1,648 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKit.h"
+
+#import "OTRKitBenchmarkSupport.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/* Two OTRKit instances, each with its own user state, are wired back to back:
+ messages injected by one are decoded by the other. The local peer hosts a single
+ account. The remote peer hosts one account for each contact the local account
+ talks to. Results are written as JSON.
+
+ Options:
+	--sizes 16,256,4096		Message sizes in bytes
+	--contacts 1,8			Numbers of contacts to run with
+	--messages 200			Messages sent to each contact for each size
+	--window 16				Messages in flight at once
+	--smp-rounds 5			Number of SMP exchanges to time
+	--max-message-size 0	Fragment messages larger than this (0 disables fragmentation)
+	--timeout 120			Seconds to wait for each phase
+	--output path			Write results to path instead of standard output */
+
+static NSString * const kOTRKitBenchmarkProtocol	= @"prpl-benchmark";
+static NSString * const kOTRKitBenchmarkAccount		= @"alice@benchmark";
+static NSString * const kOTRKitBenchmarkSecret		= @"benchmark secret";
+
+#pragma mark -
+#pragma mark Peer
+
+@interface OTRKitBenchmarkPeer : NSObject <OTRKitDelegate>
+@property (nonatomic, strong) OTRKit *otrKit;
+@property (nonatomic, weak, nullable) OTRKitBenchmarkPeer *remotePeer;
+
+/* Handlers are called on the delegate queue of the peer */
+@property (copy, nullable) void (^messageStateHandler)(OTRKitMessageState messageState, NSString *username, NSString *accountName);
+@property (copy, nullable) void (^encodedMessageHandler)(id tag);
+@property (copy, nullable) void (^decodedMessageHandler)(NSString *message, NSString *username, NSString *accountName);
+@property (copy, nullable) void (^smpHandler)(OTRKitSMPEvent event, NSString *username, NSString *accountName);
+
+/* Each line is passed to the remote peer twice when set. Reveal Signature
+ messages sent are counted on the delegate queue of the peer. */
+@property (assign) BOOL deliversMessagesTwice;
+@property (assign) NSUInteger revealSignatureCount;
+
+- (instancetype)initWithName:(NSString *)name maximumMessageSize:(int)maximumMessageSize NS_DESIGNATED_INITIALIZER;
+@end
+
+@implementation OTRKitBenchmarkPeer
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+- (instancetype)init
+{
+	return nil;
+}
+#pragma clang diagnostic pop
+
+- (instancetype)initWithName:(NSString *)name maximumMessageSize:(int)maximumMessageSize
+{
+	NSParameterAssert(name != nil);
+
+	if ((self = [super init])) {
+		OTRKit *otrKit = [OTRKit new];
+
+		otrKit.delegate = self;
+
+		/* The main thread waits on results. Delegate callbacks must not need it. */
+		otrKit.delegateQueue = dispatch_queue_create(name.UTF8String, DISPATCH_QUEUE_SERIAL);
+
+		[otrKit setupWithDataPath:OTRKitBenchmarkTemporaryDirectory(name)];
+
+		if (maximumMessageSize > 0) {
+			[otrKit setMaximumProtocolSize:maximumMessageSize forProtocol:kOTRKitBenchmarkProtocol];
+		}
+
+		self.otrKit = otrKit;
+
+		return self;
+	}
+
+	return nil;
+}
+
+- (void)otrKit:(OTRKit *)otrKit injectMessage:(NSString *)message username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol tag:(nullable id)tag
+{
+	/* Whole or as the first fragment */
+	if ([message hasPrefix:@"?OTR:AAMR"] || [message rangeOfString:@",?OTR:AAMR"].location != NSNotFound) {
+		self.revealSignatureCount += 1;
+	}
+
+	/* What is sent to username by accountName arrives at accountName of the remote peer from username */
+	[self.remotePeer.otrKit decodeMessage:message username:accountName accountName:username protocol:protocol asynchronously:YES tag:nil];
+
+	if (self.deliversMessagesTwice) {
+		[self.remotePeer.otrKit decodeMessage:message username:accountName accountName:username protocol:protocol asynchronously:YES tag:nil];
+	}
+}
+
+- (void)otrKit:(OTRKit *)otrKit encodedMessage:(nullable NSString *)encodedMessage wasEncrypted:(BOOL)wasEncrypted username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol tag:(nullable id)tag error:(nullable NSError *)error
+{
+	if (error) {
+		fprintf(stderr, "Encoding failed: %s\n", error.localizedDescription.UTF8String);
+	}
+
+	void (^encodedMessageHandler)(id) = self.encodedMessageHandler;
+
+	if (encodedMessageHandler && tag) {
+		encodedMessageHandler(tag);
+	}
+}
+
+- (void)otrKit:(OTRKit *)otrKit decodedMessage:(nullable NSString *)decodedMessage wasEncrypted:(BOOL)wasEncrypted tlvs:(NSArray<OTRTLV *> *)tlvs username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol tag:(nullable id)tag
+{
+	void (^decodedMessageHandler)(NSString *, NSString *, NSString *) = self.decodedMessageHandler;
+
+	if (decodedMessageHandler && decodedMessage) {
+		decodedMessageHandler(decodedMessage, username, accountName);
+	}
+}
+
+- (void)otrKit:(OTRKit *)otrKit updateMessageState:(OTRKitMessageState)messageState username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	void (^messageStateHandler)(OTRKitMessageState, NSString *, NSString *) = self.messageStateHandler;
+
+	if (messageStateHandler) {
+		messageStateHandler(messageState, username, accountName);
+	}
+}
+
+- (BOOL)otrKit:(OTRKit *)otrKit isUsernameLoggedIn:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	return YES;
+}
+
+- (void)otrKit:(OTRKit *)otrKit showFingerprintConfirmationForTheirHash:(NSString *)theirHash ourHash:(NSString *)ourHash username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+
+}
+
+- (void)otrKit:(OTRKit *)otrKit fingerprintIsVerifiedStateChangedForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol verified:(BOOL)verified
+{
+
+}
+
+- (void)otrKit:(OTRKit *)otrKit handleSMPEvent:(OTRKitSMPEvent)event progress:(double)progress question:(nullable NSString *)question username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol error:(nullable NSError *)error
+{
+	if (event == OTRKitSMPEventAskForSecret) {
+		[otrKit respondToSMPForUsername:username accountName:accountName protocol:protocol secret:kOTRKitBenchmarkSecret];
+	}
+
+	void (^smpHandler)(OTRKitSMPEvent, NSString *, NSString *) = self.smpHandler;
+
+	if (smpHandler) {
+		smpHandler(event, username, accountName);
+	}
+}
+
+- (void)otrKit:(OTRKit *)otrKit handleMessageEvent:(OTRKitMessageEvent)event message:(NSString *)message username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol tag:(nullable id)tag error:(nullable NSError *)error
+{
+	if (error) {
+		fprintf(stderr, "Message event %lu: %s\n", (unsigned long)event, error.localizedDescription.UTF8String);
+	}
+}
+
+- (void)otrKit:(OTRKit *)otrKit receivedSymmetricKey:(NSData *)symmetricKey forUse:(NSUInteger)use useData:(NSData *)useData username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+
+}
+
+- (BOOL)otrKit:(OTRKit *)otrKit ignoreMessage:(NSString *)message messageType:(OTRKitMessageType)messageType username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	return NO;
+}
+
+@end
+
+#pragma mark -
+#pragma mark Scenarios
+
+/* Runs trigger for each contact then waits until the local side of each
+ conversation reports localState and the remote side reports remoteState.
+ The time each conversation took is added to samples. */
+static BOOL OTRKitBenchmarkWaitForMessageStates(OTRKitBenchmarkPeer *localPeer,
+												OTRKitBenchmarkPeer *remotePeer,
+												NSArray<NSString *> *contacts,
+												OTRKitMessageState localState,
+												OTRKitMessageState remoteState,
+												NSTimeInterval timeout,
+												NSMutableArray<NSNumber *> * _Nullable samples,
+												void (^trigger)(NSString *contact))
+{
+	dispatch_group_t group = dispatch_group_create();
+
+	NSMutableDictionary<NSString *, NSMutableSet<NSString *> *> *pendingSides = [NSMutableDictionary dictionary];
+
+	for (NSString *contact in contacts) {
+		pendingSides[contact] = [NSMutableSet setWithObjects:@"local", @"remote", nil];
+
+		dispatch_group_enter(group);
+	}
+
+	__block NSTimeInterval startTime = 0;
+
+	void (^sideReachedState)(NSString *, NSString *) = ^(NSString *contact, NSString *side) {
+		@synchronized (pendingSides) {
+			NSMutableSet<NSString *> *sides = pendingSides[contact];
+
+			if ([sides containsObject:side] == NO) {
+				return;
+			}
+
+			[sides removeObject:side];
+
+			if (sides.count > 0) {
+				return;
+			}
+
+			[pendingSides removeObjectForKey:contact];
+
+			[samples addObject:@(OTRKitBenchmarkNow() - startTime)];
+		}
+
+		dispatch_group_leave(group);
+	};
+
+	localPeer.messageStateHandler = ^(OTRKitMessageState messageState, NSString *username, NSString *accountName) {
+		if (messageState == localState) {
+			sideReachedState(username, @"local");
+		}
+	};
+
+	remotePeer.messageStateHandler = ^(OTRKitMessageState messageState, NSString *username, NSString *accountName) {
+		if (messageState == remoteState) {
+			sideReachedState(accountName, @"remote");
+		}
+	};
+
+	@synchronized (pendingSides) {
+		startTime = OTRKitBenchmarkNow();
+	}
+
+	for (NSString *contact in contacts) {
+		trigger(contact);
+	}
+
+	BOOL finished = OTRKitBenchmarkWaitForGroup(group, timeout);
+
+	localPeer.messageStateHandler = nil;
+	remotePeer.messageStateHandler = nil;
+
+	return finished;
+}
+
+static BOOL OTRKitBenchmarkEstablish(OTRKitBenchmarkPeer *localPeer, OTRKitBenchmarkPeer *remotePeer, NSArray<NSString *> *contacts, NSTimeInterval timeout, NSMutableArray<NSNumber *> *samples)
+{
+	return OTRKitBenchmarkWaitForMessageStates(localPeer, remotePeer, contacts, OTRKitMessageStateEncrypted, OTRKitMessageStateEncrypted, timeout, samples, ^(NSString *contact) {
+		[localPeer.otrKit initiateEncryptionWithUsername:contact accountName:kOTRKitBenchmarkAccount protocol:kOTRKitBenchmarkProtocol asynchronously:YES];
+	});
+}
+
+static BOOL OTRKitBenchmarkTearDown(OTRKitBenchmarkPeer *localPeer, OTRKitBenchmarkPeer *remotePeer, NSArray<NSString *> *contacts, NSTimeInterval timeout)
+{
+	/* The remote side returns to plain text by itself once it learns the conversation finished. */
+	return OTRKitBenchmarkWaitForMessageStates(localPeer, remotePeer, contacts, OTRKitMessageStatePlaintext, OTRKitMessageStatePlaintext, timeout, nil, ^(NSString *contact) {
+		[localPeer.otrKit disableEncryptionWithUsername:contact accountName:kOTRKitBenchmarkAccount protocol:kOTRKitBenchmarkProtocol];
+	});
+}
+
+/* Every line arrives twice, the way a bouncer plays messages back. libotr answers
+ a D-H Key message it receives again with the Reveal Signature message again, so
+ more of those than conversations shows that repeated handshake messages were not
+ dropped as replays. With --max-message-size this covers a fragmented D-H Key. */
+static BOOL OTRKitBenchmarkEstablishWithRepeatedMessages(OTRKitBenchmarkPeer *localPeer, OTRKitBenchmarkPeer *remotePeer, NSArray<NSString *> *contacts, NSTimeInterval timeout, NSMutableArray<NSNumber *> *samples)
+{
+	localPeer.deliversMessagesTwice = YES;
+	remotePeer.deliversMessagesTwice = YES;
+
+	localPeer.revealSignatureCount = 0;
+
+	BOOL established = OTRKitBenchmarkEstablish(localPeer, remotePeer, contacts, timeout, samples);
+
+	NSUInteger revealSignatureCount = localPeer.revealSignatureCount;
+
+	BOOL finished = (established && OTRKitBenchmarkTearDown(localPeer, remotePeer, contacts, timeout));
+
+	localPeer.deliversMessagesTwice = NO;
+	remotePeer.deliversMessagesTwice = NO;
+
+	if (finished == NO) {
+		return NO;
+	}
+
+	if (revealSignatureCount <= contacts.count) {
+		fprintf(stderr, "Repeated D-H Key messages were not answered: %lu Reveal Signature messages for %lu conversations\n",
+				(unsigned long)revealSignatureCount, (unsigned long)contacts.count);
+
+		return NO;
+	}
+
+	return YES;
+}
+
+static NSDictionary *OTRKitBenchmarkMeasureMessages(OTRKitBenchmarkPeer *localPeer,
+													OTRKitBenchmarkPeer *remotePeer,
+													NSArray<NSString *> *contacts,
+													NSUInteger messageSize,
+													NSUInteger messagesPerContact,
+													NSUInteger window,
+													NSTimeInterval timeout)
+{
+	NSUInteger messageCount = (messagesPerContact * contacts.count);
+
+	NSTimeInterval *sendTimes = calloc(messageCount, sizeof(NSTimeInterval));
+
+	NSMutableArray<NSNumber *> *encodeSamples = [NSMutableArray arrayWithCapacity:messageCount];
+
+	NSMutableArray<NSNumber *> *latencySamples = [NSMutableArray arrayWithCapacity:messageCount];
+
+	__block NSTimeInterval lastArrivalTime = 0;
+
+	dispatch_semaphore_t windowSemaphore = dispatch_semaphore_create((long)MAX(window, (NSUInteger)1));
+
+	dispatch_group_t group = dispatch_group_create();
+
+	localPeer.encodedMessageHandler = ^(id tag) {
+		NSUInteger sequence = [tag unsignedIntegerValue];
+
+		@synchronized (encodeSamples) {
+			[encodeSamples addObject:@(OTRKitBenchmarkNow() - sendTimes[sequence])];
+		}
+	};
+
+	remotePeer.decodedMessageHandler = ^(NSString *message, NSString *username, NSString *accountName) {
+		NSRange separatorRange = [message rangeOfString:@"|"];
+
+		if (separatorRange.location == NSNotFound) {
+			return;
+		}
+
+		NSUInteger sequence = (NSUInteger)[message substringToIndex:separatorRange.location].integerValue;
+
+		if (sequence >= messageCount) {
+			return;
+		}
+
+		NSTimeInterval arrivalTime = OTRKitBenchmarkNow();
+
+		@synchronized (latencySamples) {
+			[latencySamples addObject:@(arrivalTime - sendTimes[sequence])];
+
+			lastArrivalTime = arrivalTime;
+		}
+
+		dispatch_semaphore_signal(windowSemaphore);
+
+		dispatch_group_leave(group);
+	};
+
+	NSString *padding = [@"" stringByPaddingToLength:messageSize withString:@"x" startingAtIndex:0];
+
+	NSTimeInterval startTime = OTRKitBenchmarkNow();
+
+	BOOL timedOut = NO;
+
+	for (NSUInteger sequence = 0; sequence < messageCount; sequence++) {
+		dispatch_time_t deadline = dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC));
+
+		if (dispatch_semaphore_wait(windowSemaphore, deadline) != 0) {
+			timedOut = YES;
+
+			break;
+		}
+
+		NSString *contact = contacts[(sequence % contacts.count)];
+
+		NSString *message = [NSString stringWithFormat:@"%lu|%@", (unsigned long)sequence, padding];
+
+		dispatch_group_enter(group);
+
+		sendTimes[sequence] = OTRKitBenchmarkNow();
+
+		[localPeer.otrKit encodeMessage:message
+								   tlvs:nil
+							   username:contact
+							accountName:kOTRKitBenchmarkAccount
+							   protocol:kOTRKitBenchmarkProtocol
+						 asynchronously:YES
+									tag:@(sequence)];
+	}
+
+	if (OTRKitBenchmarkWaitForGroup(group, timeout) == NO) {
+		timedOut = YES;
+	}
+
+	localPeer.encodedMessageHandler = nil;
+	remotePeer.decodedMessageHandler = nil;
+
+	NSDictionary *result = nil;
+
+	@synchronized (latencySamples) {
+		NSTimeInterval elapsedTime = (lastArrivalTime - startTime);
+
+		NSUInteger deliveredCount = latencySamples.count;
+
+		double messagesPerSecond = 0;
+		double bytesPerSecond = 0;
+
+		if (elapsedTime > 0) {
+			messagesPerSecond = (deliveredCount / elapsedTime);
+
+			bytesPerSecond = ((deliveredCount * messageSize) / elapsedTime);
+		}
+
+		@synchronized (encodeSamples) {
+			result = @{
+				@"message_size"			: @(messageSize),
+				@"messages_sent"		: @(messageCount),
+				@"messages_delivered"	: @(deliveredCount),
+				@"window"				: @(window),
+				@"timed_out"			: @(timedOut),
+				@"elapsed_s"			: @(elapsedTime),
+				@"messages_per_second"	: @(messagesPerSecond),
+				@"bytes_per_second"		: @(bytesPerSecond),
+				@"encode"				: OTRKitBenchmarkSummary(encodeSamples),
+				@"latency"				: OTRKitBenchmarkSummary(latencySamples)
+			};
+		}
+	}
+
+	/* Blocks that are still queued may read sendTimes. They are
+	 only freed once everything sent has arrived. */
+	if (timedOut == NO) {
+		free(sendTimes);
+	}
+
+	return result;
+}
+
+static BOOL OTRKitBenchmarkMeasureSMP(OTRKitBenchmarkPeer *localPeer, NSArray<NSString *> *contacts, NSUInteger rounds, NSTimeInterval timeout, NSMutableArray<NSNumber *> *samples)
+{
+	for (NSUInteger round = 0; round < rounds; round++) {
+		NSString *contact = contacts[(round % contacts.count)];
+
+		dispatch_group_t group = dispatch_group_create();
+
+		dispatch_group_enter(group);
+
+		__block BOOL finished = NO;
+
+		__block BOOL succeeded = NO;
+
+		NSTimeInterval startTime = OTRKitBenchmarkNow();
+
+		localPeer.smpHandler = ^(OTRKitSMPEvent event, NSString *username, NSString *accountName) {
+			if (finished || [username isEqualToString:contact] == NO) {
+				return;
+			}
+
+			if (event == OTRKitSMPEventInProgress || event == OTRKitSMPEventAskForSecret) {
+				return;
+			}
+
+			finished = YES;
+
+			succeeded = (event == OTRKitSMPEventSuccess);
+
+			if (succeeded) {
+				[samples addObject:@(OTRKitBenchmarkNow() - startTime)];
+			}
+
+			dispatch_group_leave(group);
+		};
+
+		[localPeer.otrKit initiateSMPForUsername:contact accountName:kOTRKitBenchmarkAccount protocol:kOTRKitBenchmarkProtocol secret:kOTRKitBenchmarkSecret];
+
+		BOOL completed = OTRKitBenchmarkWaitForGroup(group, timeout);
+
+		localPeer.smpHandler = nil;
+
+		if (completed == NO || succeeded == NO) {
+			return NO;
+		}
+	}
+
+	return YES;
+}
+
+#pragma mark -
+#pragma mark Main
+
+int main(int argc, const char *argv[])
+{
+	@autoreleasepool {
+		OTRKitBenchmarkArguments *arguments = [[OTRKitBenchmarkArguments alloc] initWithArguments:[NSProcessInfo processInfo].arguments];
+
+		NSArray<NSNumber *> *messageSizes = [arguments integerListForOption:@"sizes" defaultValue:@[@(16), @(256), @(4096)]];
+
+		NSArray<NSNumber *> *contactCounts = [arguments integerListForOption:@"contacts" defaultValue:@[@(1), @(8)]];
+
+		NSUInteger messagesPerContact = (NSUInteger)MAX([arguments integerForOption:@"messages" defaultValue:200], 1);
+
+		NSUInteger window = (NSUInteger)MAX([arguments integerForOption:@"window" defaultValue:16], 1);
+
+		NSUInteger smpRounds = (NSUInteger)MAX([arguments integerForOption:@"smp-rounds" defaultValue:5], 0);
+
+		int maximumMessageSize = (int)[arguments integerForOption:@"max-message-size" defaultValue:0];
+
+		NSTimeInterval timeout = [arguments doubleForOption:@"timeout" defaultValue:120.0];
+
+		BOOL failed = NO;
+
+		NSMutableArray *runs = [NSMutableArray array];
+
+		for (NSNumber *contactCount in contactCounts) {
+			OTRKitBenchmarkPeer *localPeer = [[OTRKitBenchmarkPeer alloc] initWithName:@"otrkit-benchmark-local" maximumMessageSize:maximumMessageSize];
+
+			OTRKitBenchmarkPeer *remotePeer = [[OTRKitBenchmarkPeer alloc] initWithName:@"otrkit-benchmark-remote" maximumMessageSize:maximumMessageSize];
+
+			localPeer.remotePeer = remotePeer;
+			remotePeer.remotePeer = localPeer;
+
+			NSMutableArray<NSString *> *contacts = [NSMutableArray array];
+
+			for (NSUInteger i = 1; i <= contactCount.unsignedIntegerValue; i++) {
+				[contacts addObject:[NSString stringWithFormat:@"bob-%lu@benchmark", (unsigned long)i]];
+			}
+
+			NSMutableDictionary *run = [NSMutableDictionary dictionary];
+
+			run[@"contacts"] = contactCount;
+
+			/* The first exchange includes generating a private key for every account. */
+			NSMutableArray<NSNumber *> *firstAKESamples = [NSMutableArray array];
+
+			if (OTRKitBenchmarkEstablish(localPeer, remotePeer, contacts, timeout, firstAKESamples) == NO ||
+				OTRKitBenchmarkTearDown(localPeer, remotePeer, contacts, timeout) == NO)
+			{
+				fprintf(stderr, "Unable to establish %lu conversations\n", (unsigned long)contacts.count);
+
+				failed = YES;
+
+				break;
+			}
+
+			NSMutableArray<NSNumber *> *repeatedAKESamples = [NSMutableArray array];
+
+			if (OTRKitBenchmarkEstablishWithRepeatedMessages(localPeer, remotePeer, contacts, timeout, repeatedAKESamples) == NO) {
+				fprintf(stderr, "Unable to establish %lu conversations with repeated messages\n", (unsigned long)contacts.count);
+
+				failed = YES;
+
+				break;
+			}
+
+			NSMutableArray<NSNumber *> *akeSamples = [NSMutableArray array];
+
+			if (OTRKitBenchmarkEstablish(localPeer, remotePeer, contacts, timeout, akeSamples) == NO) {
+				fprintf(stderr, "Unable to establish %lu conversations\n", (unsigned long)contacts.count);
+
+				failed = YES;
+
+				break;
+			}
+
+			run[@"first_ake"] = OTRKitBenchmarkSummary(firstAKESamples);
+
+			run[@"ake"] = OTRKitBenchmarkSummary(akeSamples);
+
+			run[@"repeated_ake"] = OTRKitBenchmarkSummary(repeatedAKESamples);
+
+			NSMutableArray *messageResults = [NSMutableArray array];
+
+			for (NSNumber *messageSize in messageSizes) {
+				NSDictionary *messageResult =
+				OTRKitBenchmarkMeasureMessages(localPeer, remotePeer, contacts, messageSize.unsignedIntegerValue, messagesPerContact, window, timeout);
+
+				[messageResults addObject:messageResult];
+
+				if ([messageResult[@"timed_out"] boolValue]) {
+					failed = YES;
+				}
+			}
+
+			run[@"messages"] = messageResults;
+
+			if (smpRounds > 0) {
+				NSMutableArray<NSNumber *> *smpSamples = [NSMutableArray array];
+
+				if (OTRKitBenchmarkMeasureSMP(localPeer, contacts, smpRounds, timeout, smpSamples) == NO) {
+					failed = YES;
+				}
+
+				run[@"smp"] = OTRKitBenchmarkSummary(smpSamples);
+			}
+
+			[runs addObject:run];
+		}
+
+		NSDictionary *results = @{
+			@"benchmark"			: @"messaging",
+			@"protocol"				: kOTRKitBenchmarkProtocol,
+			@"messages_per_contact"	: @(messagesPerContact),
+			@"max_message_size"		: @(maximumMessageSize),
+			@"runs"					: runs,
+			@"peak_rss_bytes"		: @(OTRKitBenchmarkPeakResidentBytes()),
+			@"failed"				: @(failed)
+		};
+
+		if (OTRKitBenchmarkWriteResults(results, [arguments stringForOption:@"output"]) == NO) {
+			return 1;
+		}
+
+		return ((failed) ? 1 : 0);
+	}
+}
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,280 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKit.h"
+#import "OTRKitConcreteObject.h"
+
+#import "OTRKitBenchmarkSupport.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/* Writes a fingerprint store of accounts × contacts × fingerprints entries
+ in the format libotr reads, then times how OTRKit loads and rewrites it.
+ Results are written as JSON.
+
+ Each timed operation is followed by a synchronous call which returns once
+ the internal queue of OTRKit has finished everything queued before it.
+
+ Options:
+	--accounts 2			Number of local accounts
+	--contacts 1000			Number of contacts for each account
+	--fingerprints 2		Number of fingerprints for each contact
+	--operations 50			Number of deletes and trust changes to time
+	--iterations 5			Number of times to time -requestAllFingerprints
+	--seed 1				Seed used to generate fingerprints
+	--output path			Write results to path instead of standard output */
+
+static NSString * const kOTRKitBenchmarkProtocol = @"prpl-benchmark";
+
+/* xorshift64* - fast and reproducible for a given seed */
+static uint64_t OTRKitBenchmarkRandom(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= (x >> 12);
+	x ^= (x << 25);
+	x ^= (x >> 27);
+
+	*state = x;
+
+	return (x * 0x2545F4914F6CDD1DULL);
+}
+
+static NSString *OTRKitBenchmarkAccountName(NSUInteger accountIndex)
+{
+	return [NSString stringWithFormat:@"account-%lu@benchmark", (unsigned long)accountIndex];
+}
+
+static BOOL OTRKitBenchmarkWriteFingerprintStore(NSString *path, NSUInteger accountCount, NSUInteger contactCount, NSUInteger fingerprintCount, uint64_t seed)
+{
+	FILE *filePointer = fopen(path.fileSystemRepresentation, "wb");
+
+	if (filePointer == NULL) {
+		return NO;
+	}
+
+	uint64_t randomState = ((seed) ?: 1);
+
+	for (NSUInteger accountIndex = 0; accountIndex < accountCount; accountIndex++) {
+		const char *accountName = OTRKitBenchmarkAccountName(accountIndex).UTF8String;
+
+		for (NSUInteger contactIndex = 0; contactIndex < contactCount; contactIndex++) {
+			for (NSUInteger fingerprintIndex = 0; fingerprintIndex < fingerprintCount; fingerprintIndex++) {
+				fprintf(filePointer, "contact-%lu@benchmark\t%s\t%s\t", (unsigned long)contactIndex, accountName, kOTRKitBenchmarkProtocol.UTF8String);
+
+				/* 20 byte fingerprint in hex */
+				for (NSUInteger i = 0; i < 20; i += 4) {
+					fprintf(filePointer, "%08x", (uint32_t)(OTRKitBenchmarkRandom(&randomState) >> 32));
+				}
+
+				fprintf(filePointer, "\t%s\n", (((fingerprintIndex % 2) == 0) ? "verified" : ""));
+			}
+		}
+	}
+
+	BOOL result = (ferror(filePointer) == 0);
+
+	fclose(filePointer);
+
+	return result;
+}
+
+/* Returns once everything queued on the internal queue so far has run
+ and the fingerprint writes it deferred are on disk */
+static void OTRKitBenchmarkDrain(OTRKit *otrKit)
+{
+	(void)[otrKit messageStateForUsername:@"drain" accountName:@"drain" protocol:kOTRKitBenchmarkProtocol];
+
+	[otrKit flushPendingWrites];
+}
+
+static NSUInteger OTRKitBenchmarkFileSize(NSString *path)
+{
+	NSDictionary *attributes = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL];
+
+	return (NSUInteger)[attributes fileSize];
+}
+
+/* Picks count objects spread evenly across fingerprints */
+static NSArray<OTRKitConcreteObject *> *OTRKitBenchmarkSample(NSArray<OTRKitConcreteObject *> *fingerprints, NSUInteger count, NSUInteger offset)
+{
+	NSMutableArray<OTRKitConcreteObject *> *sample = [NSMutableArray arrayWithCapacity:count];
+
+	if (fingerprints.count == 0 || count == 0) {
+		return sample;
+	}
+
+	NSUInteger stride = MAX((fingerprints.count / count), (NSUInteger)1);
+
+	for (NSUInteger i = offset; i < fingerprints.count && sample.count < count; i += stride) {
+		[sample addObject:fingerprints[i]];
+	}
+
+	return sample;
+}
+
+int main(int argc, const char *argv[])
+{
+	@autoreleasepool {
+		OTRKitBenchmarkArguments *arguments = [[OTRKitBenchmarkArguments alloc] initWithArguments:[NSProcessInfo processInfo].arguments];
+
+		NSUInteger accountCount = (NSUInteger)MAX([arguments integerForOption:@"accounts" defaultValue:2], 1);
+
+		NSUInteger contactCount = (NSUInteger)MAX([arguments integerForOption:@"contacts" defaultValue:1000], 1);
+
+		NSUInteger fingerprintCount = (NSUInteger)MAX([arguments integerForOption:@"fingerprints" defaultValue:2], 1);
+
+		NSUInteger operationCount = (NSUInteger)MAX([arguments integerForOption:@"operations" defaultValue:50], 0);
+
+		NSUInteger iterationCount = (NSUInteger)MAX([arguments integerForOption:@"iterations" defaultValue:5], 1);
+
+		uint64_t seed = (uint64_t)[arguments integerForOption:@"seed" defaultValue:1];
+
+		/* Synthesize */
+		NSString *dataPath = OTRKitBenchmarkTemporaryDirectory(@"otrkit-storage-benchmark");
+
+		NSString *fingerprintsPath = [dataPath stringByAppendingPathComponent:@"OTR-Fingerprints"];
+
+		NSTimeInterval synthesizeStartTime = OTRKitBenchmarkNow();
+
+		if (OTRKitBenchmarkWriteFingerprintStore(fingerprintsPath, accountCount, contactCount, fingerprintCount, seed) == NO) {
+			fprintf(stderr, "Unable to write %s\n", fingerprintsPath.UTF8String);
+
+			return 1;
+		}
+
+		NSTimeInterval synthesizeTime = (OTRKitBenchmarkNow() - synthesizeStartTime);
+
+		NSUInteger storeSize = OTRKitBenchmarkFileSize(fingerprintsPath);
+
+		/* Load */
+		OTRKit *otrKit = [OTRKit new];
+
+		NSTimeInterval loadStartTime = OTRKitBenchmarkNow();
+
+		[otrKit setupWithDataPath:dataPath];
+
+		OTRKitBenchmarkDrain(otrKit);
+
+		NSTimeInterval loadTime = (OTRKitBenchmarkNow() - loadStartTime);
+
+		uint64_t peakResidentBytesAfterLoad = OTRKitBenchmarkPeakResidentBytes();
+
+		/* Request all fingerprints */
+		NSMutableArray<NSNumber *> *requestAllSamples = [NSMutableArray array];
+
+		NSArray<OTRKitConcreteObject *> *fingerprints = nil;
+
+		for (NSUInteger iteration = 0; iteration < iterationCount; iteration++) {
+			@autoreleasepool {
+				NSTimeInterval startTime = OTRKitBenchmarkNow();
+
+				fingerprints = otrKit.requestAllFingerprints;
+
+				[requestAllSamples addObject:@(OTRKitBenchmarkNow() - startTime)];
+			}
+		}
+
+		/* Trust changes. Each one rewrites the store. */
+		NSMutableArray<NSNumber *> *trustSamples = [NSMutableArray array];
+
+		uint64_t trustBytesWritten = OTRKitBenchmarkBytesWritten();
+
+		for (OTRKitConcreteObject *fingerprint in OTRKitBenchmarkSample(fingerprints, operationCount, 0)) {
+			NSTimeInterval startTime = OTRKitBenchmarkNow();
+
+			[otrKit setFingerprintVerificationForConcreteObject:fingerprint verified:(fingerprint.fingerprintIsTrusted == NO)];
+
+			OTRKitBenchmarkDrain(otrKit);
+
+			[trustSamples addObject:@(OTRKitBenchmarkNow() - startTime)];
+		}
+
+		trustBytesWritten = (OTRKitBenchmarkBytesWritten() - trustBytesWritten);
+
+		/* Deletes. Each one rewrites the store. A different sample is used
+		 so that a fingerprint whose trust changed isn't also deleted. */
+		NSMutableArray<NSNumber *> *deleteSamples = [NSMutableArray array];
+
+		uint64_t deleteBytesWritten = OTRKitBenchmarkBytesWritten();
+
+		for (OTRKitConcreteObject *fingerprint in OTRKitBenchmarkSample(fingerprints, operationCount, 1)) {
+			NSTimeInterval startTime = OTRKitBenchmarkNow();
+
+			[otrKit deleteFingerprint:fingerprint.fingerprintString
+							 username:fingerprint.username
+						  accountName:fingerprint.accountName
+							 protocol:fingerprint.protocol];
+
+			OTRKitBenchmarkDrain(otrKit);
+
+			[deleteSamples addObject:@(OTRKitBenchmarkNow() - startTime)];
+		}
+
+		deleteBytesWritten = (OTRKitBenchmarkBytesWritten() - deleteBytesWritten);
+
+		NSUInteger remainingFingerprintCount = otrKit.requestAllFingerprints.count;
+
+		NSDictionary *results = @{
+			@"benchmark"				: @"storage",
+			@"accounts"					: @(accountCount),
+			@"contacts_per_account"		: @(contactCount),
+			@"fingerprints_per_contact"	: @(fingerprintCount),
+			@"fingerprints_loaded"		: @(fingerprints.count),
+			@"fingerprints_remaining"	: @(remainingFingerprintCount),
+			@"store_bytes"				: @(storeSize),
+			@"synthesize_s"				: @(synthesizeTime),
+			@"load_s"					: @(loadTime),
+			@"peak_rss_after_load_bytes": @(peakResidentBytesAfterLoad),
+			@"request_all_fingerprints"	: OTRKitBenchmarkSummary(requestAllSamples),
+			@"set_trust"				: @{
+					@"latency"			: OTRKitBenchmarkSummary(trustSamples),
+					@"bytes_written"	: @(trustBytesWritten)
+			},
+			@"delete"					: @{
+					@"latency"			: OTRKitBenchmarkSummary(deleteSamples),
+					@"bytes_written"	: @(deleteBytesWritten)
+			},
+			@"peak_rss_bytes"			: @(OTRKitBenchmarkPeakResidentBytes())
+		};
+
+		[[NSFileManager defaultManager] removeItemAtPath:dataPath error:NULL];
+
+		if (OTRKitBenchmarkWriteResults(results, [arguments stringForOption:@"output"]) == NO) {
+			return 1;
+		}
+
+		return 0;
+	}
+}
+
+NS_ASSUME_NONNULL_END
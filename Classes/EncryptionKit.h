@@ -35,8 +35,18 @@
 
 #import <EncryptionKit/OTRKit.h>
 #import <EncryptionKit/OTRKitConcreteObject.h>
+#import <EncryptionKit/OTRKitDataTransferManager.h>
+#import <EncryptionKit/OTRKitFileCryptor.h>
+#import <EncryptionKit/OTRKitJournalStorage.h>
+#import <EncryptionKit/OTRKitLoopbackTransport.h>
+#import <EncryptionKit/OTRKitMessageResult.h>
+#import <EncryptionKit/OTRKitMetrics.h>
+#import <EncryptionKit/OTRKitStorage.h>
+#import <EncryptionKit/OTRKitTracer.h>
 #import <EncryptionKit/OTRKitAuthenticationDialog.h>
 #import <EncryptionKit/OTRKitFingerprintManagerDialog.h>
 
 #import <EncryptionKit/OTRTLV.h>
 #endif
+
+#include <EncryptionKit/OTRKitC.h>
@@ -70,6 +70,11 @@ NS_ASSUME_NONNULL_BEGIN
 
 @class OTRKit;
 @class OTRKitConcreteObject;
+@class OTRKitDataTransferManager;
+@class OTRKitMessageResult;
+@class OTRKitMetrics;
+
+@protocol OTRKitStorage;
 
 @class OTRTLV;
 
@@ -87,6 +92,39 @@ typedef NS_ENUM(NSUInteger, OTRKitPolicy) {
 	OTRKitPolicyAlways,
 };
 
+/**
+ *  What happens to an asynchronous encode or decode when too many are waiting.
+ */
+typedef NS_ENUM(NSUInteger, OTRKitAdmissionPolicy) {
+	/* Every operation is admitted. This is the default. */
+	OTRKitAdmissionPolicyUnbounded,
+
+	/* The caller waits until there is room */
+	OTRKitAdmissionPolicyBlock,
+
+	/* The new operation fails */
+	OTRKitAdmissionPolicyFailFast,
+
+	/* The operation that has waited longest is dropped to make room */
+	OTRKitAdmissionPolicyDropOldest
+};
+
+/**
+ *  Which lane an asynchronous operation waits in for the internal queue.
+ *  More urgent lanes are served first but a lane is never starved for long.
+ *  Operations for the same conversation always run in the order submitted.
+ */
+typedef NS_ENUM(NSUInteger, OTRKitPriority) {
+	/* Messages the user is waiting on. This is the default. */
+	OTRKitPriorityInteractive,
+
+	/* Backlogs such as history being replayed */
+	OTRKitPriorityBulk,
+
+	/* Work nobody is waiting on such as fingerprint writes */
+	OTRKitPriorityBackground
+};
+
 typedef NS_ENUM(NSUInteger, OTRKitOfferState) {
 	OTRKitOfferStateNone,
 	OTRKitOfferStateSent,
@@ -122,7 +160,9 @@ typedef NS_ENUM(NSUInteger, OTRKitMessageEvent) {
 	OTRKitMessageEventReceivedMessageGeneralError,
 	OTRKitMessageEventReceivedMessageUnencrypted,
 	OTRKitMessageEventReceivedMessageUnrecognized,
-	OTRKitMessageEventReceivedMessageForOtherInstance
+	OTRKitMessageEventReceivedMessageForOtherInstance,
+	OTRKitMessageEventReceivedMessageNotAdmitted,
+	OTRKitMessageEventReceivedMessageCancelled
 };
 
 typedef NS_ENUM(NSUInteger, OTRKitMessageType) {
@@ -155,6 +195,39 @@ extern NSString * const OTRKitListOfFingerprintsDidChangeNotification;
  */
 extern NSString * const OTRKitMessageStateDidChangeNotification;
 
+/**
+ *  Domain of errors created by OTRKit. Errors that originate in libgcrypt
+ *  use the gcrypt error code as their code instead of a value below.
+ */
+extern NSString * const OTRKitErrorDomain;
+
+typedef NS_ENUM(NSInteger, OTRKitErrorCode) {
+	OTRKitErrorCodeSMPQuestionMissing = 1001,
+	OTRKitErrorCodeFileReadFailed = 1101,
+	OTRKitErrorCodeFileWriteFailed,
+	OTRKitErrorCodeFileFormatInvalid,
+	OTRKitErrorCodeFileAuthenticationFailed,
+	OTRKitErrorCodeConversationNotEncrypted = 1201,
+	OTRKitErrorCodeDataTransferTimedOut,
+	OTRKitErrorCodeDataTransferRemoteError,
+	OTRKitErrorCodeOperationRejected = 1301,
+	OTRKitErrorCodeOperationDropped,
+	OTRKitErrorCodeOperationCancelled
+};
+
+/**
+ *  Receives the result of a single encode. The arguments match those of the
+ *  encodedMessage: delegate method.
+ */
+typedef void (^OTRKitEncodeCompletionBlock)(NSString * __nullable encodedMessage, BOOL wasEncrypted, NSError * __nullable error);
+
+/**
+ *  Receives the result of a single decode. Both decodedMessage and tlvs are nil
+ *  when there was nothing to show, such as for a message that was part of the
+ *  OTR protocol. error is set when the decode was turned away or cancelled.
+ */
+typedef void (^OTRKitDecodeCompletionBlock)(NSString * __nullable decodedMessage, BOOL wasEncrypted, NSArray<OTRTLV *> * __nullable tlvs, NSError * __nullable error);
+
 @protocol OTRKitDelegate <NSObject>
 @required
 
@@ -360,6 +433,8 @@ willStartGeneratingPrivateKeyForAccountName:(NSString *)accountName
 
 /**
  *  Called when key generation has finished, canceled, or there was an error.
+ *  Unless error is set, the new key has already been committed to storage.
+ *  A key that storage fails to commit is discarded and reported with an error.
  *
  *  @param otrKit      Reference to shared instance
  *  @param accountName The account name of the local user
@@ -389,6 +464,16 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString *)accountName
 		 username:(NSString *)username
 	  accountName:(NSString *)accountName
 		 protocol:(NSString *)protocol;
+
+/**
+ *  Called instead of the encodedMessage:, decodedMessage: and injectMessage:
+ *  delegate methods while batchesDelegateResults is YES.
+ *
+ *  @param otrKit		Reference to shared instance
+ *  @param results		Results in the order they were produced
+ */
+- (void)      otrKit:(OTRKit *)otrKit
+didProduceMessageResults:(NSArray<OTRKitMessageResult *> *)results;
 @end
 
 @interface OTRKit : NSObject
@@ -399,6 +484,19 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString *)accountName
  */
 @property (nonatomic, strong, nullable) dispatch_queue_t delegateQueue;
 
+/**
+ *  For processes without a main run loop, such as a daemon.
+ *
+ *  When YES, delegate and block callbacks that would default to the main queue
+ *  go to a private serial queue instead, unless delegateQueue is set. The delegate
+ *  methods that return a value, isUsernameLoggedIn: and ignoreMessage:, are called
+ *  directly on the internal queue rather than waiting for the delegate queue.
+ *  They must be thread safe and must not call OTRKit synchronously.
+ *
+ *  Defaults to NO.
+ */
+@property (nonatomic, assign, getter=isHeadless) BOOL headless;
+
 /**
  * By default uses `OTRKitPolicyDefault`
  */
@@ -409,6 +507,14 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString *)accountName
  */
 @property (nonatomic, copy, readonly) NSString *dataPath;
 
+/**
+ *  Where private keys, fingerprints, and instance tags are kept.
+ *  Must be set before calling -setupWithDataPath:. When nil, the default,
+ *  they are kept in the files at privateKeyPath, fingerprintsPath,
+ *  and instanceTagsPath.
+ */
+@property (nonatomic, strong, nullable) id<OTRKitStorage> storage;
+
 /**
  *  Path to the OTR private keys file.
  */
@@ -433,6 +539,132 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString *)accountName
  */
 @property (nonatomic, copy) NSString *accountNameSeparator;
 
+/**
+ *  When enabled, the maximum message size of each conversation is adjusted using
+ *  the feedback given to -transportDidDeliverMessageOfLength:username:accountName:protocol:
+ *  and -transportDidTruncateMessageOfLength:toLength:username:accountName:protocol:
+ *  Conversations with their own maximum message size are not adjusted.
+ *
+ *  Defaults to NO.
+ */
+@property (nonatomic, assign) BOOL adaptiveMessageSizeEnabled;
+
+/**
+ *  The largest message size adaptive mode will try. Defaults to zero which
+ *  means the size configured for the conversation is never exceeded.
+ */
+@property (nonatomic, assign) int adaptiveMessageSizeLimit;
+
+/**
+ *  Bounds the number of asynchronous encodes and decodes that wait for the
+ *  internal queue. When either limit is reached the policy decides what happens.
+ *
+ *  An encode that is turned away or dropped is reported to the encodedMessage:
+ *  delegate method with a nil message and an error in OTRKitErrorDomain. A decode
+ *  is reported to the handleMessageEvent: delegate method with the event
+ *  OTRKitMessageEventReceivedMessageNotAdmitted and the same kind of error.
+ *
+ *  Operations started on the internal queue, such as from within a delegate
+ *  method that libotr calls synchronously, are always admitted.
+ *
+ *  With OTRKitAdmissionPolicyBlock, don't encode or decode on the delegate
+ *  queue. The internal queue may be waiting on it to answer isUsernameLoggedIn:
+ *
+ *  Defaults to OTRKitAdmissionPolicyUnbounded.
+ */
+@property (nonatomic, assign) OTRKitAdmissionPolicy admissionPolicy;
+
+/**
+ *  Most operations that may wait across all conversations. Zero means no limit.
+ */
+@property (nonatomic, assign) NSUInteger maximumPendingOperations;
+
+/**
+ *  Most operations that may wait for each conversation. Zero means no limit.
+ */
+@property (nonatomic, assign) NSUInteger maximumPendingOperationsPerConversation;
+
+/**
+ *  Incoming messages that start or continue an AKE, such as a DH-Commit, wait in
+ *  a lane of their own along with anything their conversation submits after them.
+ *  While both are waiting, this many other operations run between two handshake
+ *  messages so that a burst of handshakes doesn't stall established conversations.
+ *
+ *  Zero treats handshake messages like any other. Defaults to 4.
+ */
+@property (nonatomic, assign) NSUInteger operationsPerHandshake;
+
+/**
+ *  Number of data messages remembered for each conversation. A message
+ *  received again while it's remembered, such as one played back by a
+ *  bouncer or relayed by more than one device, is dropped before libotr
+ *  sees it. Nothing is passed to the delegate for it. Of a fragmented
+ *  message, only the first fragment is remembered. Handshake messages are
+ *  never dropped because libotr relies on receiving them again.
+ *
+ *  Zero passes every message to libotr. Defaults to 64.
+ */
+@property (nonatomic, assign) NSUInteger replayCacheSize;
+
+/**
+ *  When YES and the delegate implements didProduceMessageResults: encoded,
+ *  decoded and injected messages are collected and passed to it in batches
+ *  rather than one delegate call at a time. A batch is delivered once it
+ *  holds maximumResultBatchSize results, once its first result has waited
+ *  maximumResultBatchDelay seconds, or once no operations are waiting.
+ *  Results that are waiting are delivered before any other delegate call,
+ *  such as updateMessageState: or handleSMPEvent:, so that the order of
+ *  events in a conversation is kept.
+ *
+ *  Results of the variants that take a completion block aren't batched.
+ *  Defaults to NO.
+ */
+@property (nonatomic, assign) BOOL batchesDelegateResults;
+
+/**
+ *  Defaults to 64. Zero means no limit.
+ */
+@property (nonatomic, assign) NSUInteger maximumResultBatchSize;
+
+/**
+ *  Defaults to 0.01 seconds.
+ */
+@property (nonatomic, assign) NSTimeInterval maximumResultBatchDelay;
+
+/**
+ *  Number of operations waiting across all conversations.
+ */
+@property (nonatomic, assign, readonly) NSUInteger pendingOperationCount;
+
+/**
+ *  Conversations that haven't been used for this many seconds are forgotten.
+ *  Only conversations in plain text with no fingerprints, no handshake or
+ *  SMP exchange in progress, and no operations waiting are forgotten.
+ *  They are recreated as needed. Zero, the default, keeps them forever.
+ */
+@property (nonatomic, assign) NSTimeInterval contextIdleInterval;
+
+/**
+ *  Once there are more conversations than this, those used least recently
+ *  are forgotten as long as they meet the conditions of contextIdleInterval.
+ *  Checked once a minute so it can be exceeded in between. Zero means no limit.
+ */
+@property (nonatomic, assign) NSUInteger maximumContextCount;
+
+/**
+ *  Transfers files over encrypted conversations using OTRDATA.
+ *  Data TLVs are passed to the decodedMessage: delegate method as
+ *  before until a delegate is set on the manager.
+ */
+@property (nonatomic, strong, readonly) OTRKitDataTransferManager *dataTransferManager;
+
+/**
+ *  Counters and latency histograms covering time spent waiting for and
+ *  running on the internal queue, fragments, message events, key generation,
+ *  and reading and writing the data path.
+ */
+@property (nonatomic, strong, readonly) OTRKitMetrics *metrics;
+
 /**
  *  Always use the sharedInstance. Using two OTRKits within your application
  *  may exhibit strange problems.
@@ -448,6 +680,14 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString *)accountName
  */
 - (void)setupWithDataPath:(nullable NSString *)dataPath;
 
+/**
+ *  Changes to fingerprints, along with new private keys and instance tags,
+ *  are committed to storage in the background lane, several at a time.
+ *  Call this to commit them now, such as before quitting or after
+ *  provisioning accounts.
+ */
+- (void)flushPendingWrites;
+
 /**
  *  For specifying fragmentation for a protocol.
  *
@@ -456,6 +696,137 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString *)accountName
  */
 - (void)setMaximumProtocolSize:(int)maxSize forProtocol:(NSString *)protocol;
 
+/**
+ *  For specifying fragmentation for a single account. Takes precedence over
+ *  the value set for the protocol.
+ *
+ *  @param maxSize		Max size of protocol messages in bytes. Zero removes the value.
+ *  @param accountName	The account name of the local user
+ *  @param protocol		The protocol of the exchange
+ */
+- (void)setMaximumMessageSize:(int)maxSize forAccountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+/**
+ *  For specifying fragmentation for a single conversation. Takes precedence
+ *  over the value set for the account or protocol and over adaptive mode.
+ *  For example, on IRC the space available depends on the length of the
+ *  nickname and hostname the server prefixes each line with.
+ *
+ *  @param maxSize		Max size of protocol messages in bytes. Zero removes the value.
+ *  @param username		The account name of the remote user
+ *  @param accountName	The account name of the local user
+ *  @param protocol		The protocol of the exchange
+ */
+- (void)setMaximumMessageSize:(int)maxSize forUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+/**
+ *  The maximum message size currently used for a conversation.
+ *  Zero means messages are not fragmented.
+ *
+ *  @param username		The account name of the remote user
+ *  @param accountName	The account name of the local user
+ *  @param protocol		The protocol of the exchange
+ */
+- (int)maximumMessageSizeForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+/**
+ *  Inform OTRKit that the transport delivered a message intact. Used by
+ *  adaptive mode to try a larger message size once enough messages that
+ *  filled a whole fragment were delivered.
+ *
+ *  @param length		Length of the message in bytes as it was sent
+ *  @param username		The account name of the remote user
+ *  @param accountName	The account name of the local user
+ *  @param protocol		The protocol of the exchange
+ */
+- (void)transportDidDeliverMessageOfLength:(NSUInteger)length username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+/**
+ *  Inform OTRKit that the transport cut a message short. Adaptive mode
+ *  uses truncatedLength as the message size for the conversation and
+ *  will not try length again.
+ *
+ *  @param length			Length of the message in bytes as it was sent
+ *  @param truncatedLength	Length of the message in bytes as it was delivered
+ *  @param username			The account name of the remote user
+ *  @param accountName		The account name of the local user
+ *  @param protocol			The protocol of the exchange
+ */
+- (void)transportDidTruncateMessageOfLength:(NSUInteger)length toLength:(NSUInteger)truncatedLength username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+/**
+ *  Paces messages passed to the injectMessage: delegate method so that
+ *  a server's flood protection is not tripped when a long message is split
+ *  into many fragments. Each account is given a token bucket that holds up to
+ *  burst messages and refills at messagesPerSecond. Messages beyond the burst
+ *  are held back and released in turn for each conversation of the account.
+ *
+ *  Accounts without an injection rate are not paced.
+ *
+ *  @param messagesPerSecond	Number of messages that may be injected per second once the burst is used up
+ *  @param burst				Number of messages that may be injected back to back
+ *  @param accountName			The account name of the local user. nil applies the rate to each account of the protocol.
+ *  @param protocol				The protocol of the exchange
+ */
+- (void)setInjectionRate:(double)messagesPerSecond burst:(NSUInteger)burst forAccountName:(nullable NSString *)accountName protocol:(NSString *)protocol;
+
+/**
+ *  Remove an injection rate set by -setInjectionRate:burst:forAccountName:protocol:
+ *  Messages that are being held back are released immediately.
+ *
+ *  @param accountName			The account name of the local user, or nil
+ *  @param protocol				The protocol of the exchange
+ */
+- (void)removeInjectionRateForAccountName:(nullable NSString *)accountName protocol:(NSString *)protocol;
+
+/**
+ *  Number of operations waiting for a conversation.
+ *
+ *  @param username		The account name of the remote user
+ *  @param accountName	The account name of the local user
+ *  @param protocol		The protocol of the exchange
+ */
+- (NSUInteger)pendingOperationCountForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+/**
+ *  Cancels asynchronous encodes and decodes that were given a tag equal to tag
+ *  and haven't started yet. Fragments of encoded messages still being held back
+ *  by an injection rate are discarded as well.
+ *
+ *  A cancelled encode is reported to the encodedMessage: delegate method with a
+ *  nil message and the error OTRKitErrorCodeOperationCancelled. A cancelled decode
+ *  is reported to the handleMessageEvent: delegate method with the event
+ *  OTRKitMessageEventReceivedMessageCancelled and the same error.
+ *
+ *  @param tag			The tag that was passed to encodeMessage: or decodeMessage:
+ */
+- (void)cancelOperationsWithTag:(id)tag;
+
+/**
+ *  Cancels asynchronous encodes and decodes for a conversation that haven't
+ *  started yet and discards fragments held back for it.
+ *
+ *  @param username		The account name of the remote user
+ *  @param accountName	The account name of the local user
+ *  @param protocol		The protocol of the exchange
+ */
+- (void)cancelOperationsForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+/**
+ *  Cancels asynchronous encodes and decodes for every conversation of an
+ *  account that haven't started yet and discards fragments held back for them.
+ *
+ *  @param accountName	The account name of the local user
+ *  @param protocol		The protocol of the exchange
+ */
+- (void)cancelOperationsForAccountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+/**
+ *  Forgets idle conversations now rather than waiting for the next check.
+ *  Does nothing unless contextIdleInterval or maximumContextCount is set.
+ */
+- (void)evictIdleContexts;
+
 /**
  * Encodes a message and optional array of OTRTLVs, splits it into fragments,
  * then injects the encoded data via the injectMessage: delegate method.
@@ -476,6 +847,52 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString *)accountName
 	   asynchronously:(BOOL)asynchronously
 				  tag:(nullable id)tag;
 
+/**
+ * Same as encodeMessage:tlvs:username:accountName:protocol:asynchronously:tag:
+ * performed asynchronously in the lane of the priority given. The asynchronous
+ * variant of that method uses OTRKitPriorityInteractive.
+ *
+ * @param message		The message to be encoded
+ * @param tlvs			Array of OTRTLVs
+ * @param username		The account name of the remote user
+ * @param accountName	The account name of the local user
+ * @param protocol		The protocol of the exchange
+ * @param priority		The lane the operation waits in
+ * @param tag			Optional tag to attach additional application-specific data to message. Only used locally.
+ */
+- (void)encodeMessage:(nullable NSString *)message
+				 tlvs:(nullable NSArray<OTRTLV *> *)tlvs
+			 username:(NSString *)username
+		  accountName:(NSString *)accountName
+			 protocol:(NSString *)protocol
+			 priority:(OTRKitPriority)priority
+				  tag:(nullable id)tag;
+
+/**
+ * Same as encodeMessage:tlvs:username:accountName:protocol:priority:tag: except
+ * the result is handed to completion instead of the encodedMessage: delegate
+ * method. Fragments are still injected using the injectMessage: delegate method.
+ *
+ * @param message			The message to be encoded
+ * @param tlvs				Array of OTRTLVs
+ * @param username			The account name of the remote user
+ * @param accountName		The account name of the local user
+ * @param protocol			The protocol of the exchange
+ * @param priority			The lane the operation waits in
+ * @param tag				Optional tag to attach additional application-specific data to message. Only used locally.
+ * @param completionQueue	The queue completion is called on. The main queue is used if this is nil.
+ * @param completion		Called once with the result, including when the operation is turned away or cancelled.
+ */
+- (void)encodeMessage:(nullable NSString *)message
+				 tlvs:(nullable NSArray<OTRTLV *> *)tlvs
+			 username:(NSString *)username
+		  accountName:(NSString *)accountName
+			 protocol:(NSString *)protocol
+			 priority:(OTRKitPriority)priority
+				  tag:(nullable id)tag
+	  completionQueue:(nullable dispatch_queue_t)completionQueue
+		   completion:(OTRKitEncodeCompletionBlock)completion;
+
 /**
  *  All messages should be sent through here before being processed by your program.
  *
@@ -493,6 +910,49 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString *)accountName
 	   asynchronously:(BOOL)asynchronously
 				  tag:(nullable id)tag;
 
+/**
+ *  Same as decodeMessage:username:accountName:protocol:asynchronously:tag:
+ *  performed asynchronously in the lane of the priority given. Use
+ *  OTRKitPriorityBulk when replaying a backlog so live messages go first.
+ *
+ *  @param message			Encoded or plain text incoming message
+ *  @param username			The account name of the remote user
+ *  @param accountName		The account name of the local user
+ *  @param protocol			The protocol of the exchange
+ *  @param priority			The lane the operation waits in
+ *  @param tag				Optional tag to attach additional application-specific data to message. Only used locally.
+ */
+- (void)decodeMessage:(NSString *)message
+			 username:(NSString *)username
+		  accountName:(NSString *)accountName
+			 protocol:(NSString *)protocol
+			 priority:(OTRKitPriority)priority
+				  tag:(nullable id)tag;
+
+/**
+ *  Same as decodeMessage:username:accountName:protocol:priority:tag: except the
+ *  result is handed to completion instead of the decodedMessage: delegate method.
+ *  Turned away and cancelled decodes are reported to completion as an error rather
+ *  than as a message event. Other delegate methods are called as usual.
+ *
+ *  @param message			Encoded or plain text incoming message
+ *  @param username			The account name of the remote user
+ *  @param accountName		The account name of the local user
+ *  @param protocol			The protocol of the exchange
+ *  @param priority			The lane the operation waits in
+ *  @param tag				Optional tag to attach additional application-specific data to message. Only used locally.
+ *  @param completionQueue	The queue completion is called on. The main queue is used if this is nil.
+ *  @param completion		Called once with the result
+ */
+- (void)decodeMessage:(NSString *)message
+			 username:(NSString *)username
+		  accountName:(NSString *)accountName
+			 protocol:(NSString *)protocol
+			 priority:(OTRKitPriority)priority
+				  tag:(nullable id)tag
+	  completionQueue:(nullable dispatch_queue_t)completionQueue
+		   completion:(OTRKitDecodeCompletionBlock)completion;
+
 /**
  *  You can use this method to determine whether or not OTRKit is 
  *  currently generating a private key.
@@ -520,6 +980,9 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString *)accountName
  *  Disable encryption and inform remote user you no longer wish to 
  *  communicate privately.
  *
+ *  Encodes and decodes still waiting for the conversation are cancelled
+ *  as with cancelOperationsForUsername:accountName:protocol:
+ *
  *  @param username		The account name of the remote user
  *  @param accountName	The account name of the local user
  *  @param protocol		The protocol of the exchange
@@ -618,6 +1081,10 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString *)accountName
 /**
  *  Requests a symmetric key for out-of-band crypto like file transfer.
  *
+ *  The remote user is told about the use the first time it's requested.
+ *  Until the session keys change or the session ends, requesting the same
+ *  use and use data again returns the same key without telling them again.
+ *
  *  @param username		The account name of the remote user
  *  @param accountName	The account name of the local user
  *  @param protocol		The protocol of the exchange
@@ -633,6 +1100,23 @@ didFinishGeneratingPrivateKeyForAccountName:(NSString *)accountName
 							   useData:(NSData *)useData
 							completion:(void (^)(NSData * __nullable key, NSError * __nullable error))completion;
 
+/**
+ *  Returns the key an earlier request for the same use and use data
+ *  returned, as long as the session keys haven't changed since.
+ *  Returns nil otherwise. May be called on any thread.
+ *
+ *  @param username		The account name of the remote user
+ *  @param accountName	The account name of the local user
+ *  @param protocol		The protocol of the exchange
+ *  @param use			Integer tag describing the use of the key
+ *  @param useData		Any extra data that may be required to use the key
+ */
+- (nullable NSData *)cachedSymmetricKeyForUsername:(NSString *)username
+									   accountName:(NSString *)accountName
+										  protocol:(NSString *)protocol
+											forUse:(NSUInteger)use
+										   useData:(NSData *)useData;
+
 //////////////////////////////////////////////////////////////////////
 /// @name Fingerprint Verification
 //////////////////////////////////////////////////////////////////////
@@ -74,26 +74,121 @@ static NSString * const kOTRKitPrivateKeyFileName		= @"OTR-PrivateKey";
 static NSString * const kOTRKitFingerprintsFileName		= @"OTR-Fingerprints";
 static NSString * const kOTRKitInstanceTagsFileName		= @"OTR-InstanceTags";
 
-static NSString * const kOTRKitErrorDomain				= @"org.chatsecure.OTRKit";
+/* Number of messages the transport must report as delivered at the
+ learned message size before a larger size is tried. */
+static NSUInteger const kOTRKitAdaptiveMessageSizeProbeThreshold	= 16;
+
+/* Smallest amount a learned message size is grown by when probing. */
+static int const kOTRKitAdaptiveMessageSizeMinimumStep				= 16;
+
+/* Seconds between checks for contexts that can be forgotten. */
+static NSTimeInterval const kOTRKitContextEvictionInterval			= 60.0;
+
+/* Other operations run between two handshake messages while both are waiting. */
+static NSUInteger const kOTRKitDefaultOperationsPerHandshake		= 4;
+
+/* Data messages remembered for each conversation to recognize those delivered twice. */
+static NSUInteger const kOTRKitDefaultReplayCacheSize				= 64;
+
+/* Bytes of the SHA-256 digest of a message that are remembered. */
+static size_t const kOTRKitReplayDigestLength						= 16;
+
+/* Contexts used more recently than this are never forgotten. */
+static NSTimeInterval const kOTRKitContextMinimumIdleInterval		= 30.0;
 
 NSString * const OTRKitListOfFingerprintsDidChangeNotification	= @"OTRKitListOfFingerprintsDidChangeNotification";
 NSString * const OTRKitMessageStateDidChangeNotification		= @"OTRKitMessageStateDidChangeNotification";
 
+NSString * const OTRKitErrorDomain								= @"org.chatsecure.OTRKit";
+
+static void *OTRKitInstanceQueueKey = &OTRKitInstanceQueueKey;
+
+/* Owns a TLV chain returned by libotr. The data of each OTRTLV made
+ from the chain points into it and keeps the owner alive. The chain
+ is freed once the last of them is released. */
+@interface OTRKitTLVChain : NSObject
+@property (nonatomic, assign) OtrlTLV *tlv_chain;
+@end
+
+@implementation OTRKitTLVChain
+
+- (void)dealloc
+{
+	if (self.tlv_chain) {
+		otrl_tlv_free(self.tlv_chain);
+	}
+}
+
+@end
+
+/* Reserves a context while an SMP step is computed on the SMP queue.
+ Nothing on the internal queue may touch the SMP state of the context
+ until the reservation is finished. Operations that would are kept
+ in waitingBlocks and performed once it is. */
+@interface OTRKitSMPReservation : NSObject
+@property (nonatomic, assign) ConnContext *context;
+@property (nonatomic, copy) NSString *submissionKey;
+@property (nonatomic, strong) dispatch_group_t group;
+@property (nonatomic, assign) BOOL initiating;
+@property (nonatomic, copy, nullable) NSString *question;
+@property (nonatomic, assign) gcry_error_t stepError;
+@property (nonatomic, assign, nullable) unsigned char *smpMessage;
+@property (nonatomic, assign) int smpMessageLength;
+@property (nonatomic, strong) NSMutableArray<dispatch_block_t> *waitingBlocks;
+@end
+
+@implementation OTRKitSMPReservation
+
+- (void)dealloc
+{
+	if (self.smpMessage) {
+		free(self.smpMessage);
+	}
+}
+
+@end
+
+/* A fingerprint as it was last committed to storage */
+@interface OTRKitStoredFingerprint : NSObject
+@property (nonatomic, copy) NSString *username;
+@property (nonatomic, copy) NSString *accountName;
+@property (nonatomic, copy) NSString *protocol;
+@property (nonatomic, copy) NSData *fingerprint;
+@property (nonatomic, copy, nullable) NSString *trust;
+@end
+
+@implementation OTRKitStoredFingerprint
+@end
+
 @implementation OTRKit
 
 #pragma mark -
 #pragma mark libotr ui_ops callback functions
 
+/* libotr is only ever called on the internal queue of an OTRKit which
+ means the queue running the callback identifies the instance it is for.
+ This allows more than one instance to exist in the same process. */
+static OTRKit *OTRKitForCallback(void)
+{
+	OTRKit *otrKit = (__bridge OTRKit *)dispatch_get_specific(OTRKitInstanceQueueKey);
+
+	if (otrKit == nil) {
+		otrKit = [OTRKit sharedInstance];
+	}
+
+	return otrKit;
+}
+
 static OtrlPolicy policy_cb(void *opdata, ConnContext *context)
 {
-	OTRKit *otrKit = [OTRKit sharedInstance];
+	OTRKit *otrKit = OTRKitForCallback();
 
 	return [otrKit _otrlPolicy];
 }
 
 static void create_privkey_cb(void *opdata, const char *accountname, const char *protocol)
 {
-	OTRKit *otrKit = [OTRKit sharedInstance];
+	OTRKit *otrKit = OTRKitForCallback();
 
 	/* Inform delegate of intent to create key */
 	NSString *accountNameString = @(accountname);
@@ -103,45 +198,62 @@ static void create_privkey_cb(void *opdata, const char *accountname, const char
 		[otrKit.delegate otrKit:otrKit willStartGeneratingPrivateKeyForAccountName:accountNameString protocol:protocolString];
 	}];
 
-	/* Create key then inform delegate */
-	void *otrKey;
+	/* Create key then inform delegate. libotr only adds a key to the user
+	 state while writing every key to a file and reading that file back,
+	 which would put each private key on disk outside of storage. The key
+	 is made the way libotr makes it and added to the user state here. */
+	uint64_t generateStartTime = OTRKitMetricsNow();
 
-	gcry_error_t generateError = otrl_privkey_generate_start(otrKit.userState, accountname, protocol, &otrKey);
+	gcry_sexp_t generateParameters = NULL;
 
-	NSString *path = otrKit.privateKeyPath;
+	gcry_sexp_t generatedKey = NULL;
 
-	FILE *filePointer = fopen(path.UTF8String, "w+b");
+	gcry_error_t generateError = gcry_sexp_new(&generateParameters, "(genkey (dsa (nbits 4:1024)))", 0, 1);
 
 	if (generateError == gcry_error(GPG_ERR_NO_ERROR)) {
-		otrl_privkey_generate_calculate(otrKey);
+		generateError = gcry_pk_genkey(&generatedKey, generateParameters);
 
-		otrl_privkey_generate_finish_FILEp(otrKit.userState, otrKey, filePointer);
+		gcry_sexp_release(generateParameters);
+	}
 
-		[otrKit _performAsyncOperationOnDelegateQueue:^{
-			[otrKit.delegate otrKit:otrKit didFinishGeneratingPrivateKeyForAccountName:accountNameString protocol:protocolString error:nil];
-		}];
-	} else {
-		NSError *error = [otrKit _errorForGPGError:generateError];
+	if (generateError == gcry_error(GPG_ERR_NO_ERROR)) {
+		gcry_sexp_t privateKey = gcry_sexp_find_token(generatedKey, "private-key", 0);
 
-		[otrKit _performAsyncOperationOnDelegateQueue:^{
-			[otrKit.delegate otrKit:otrKit didFinishGeneratingPrivateKeyForAccountName:accountNameString protocol:protocolString error:error];
-		}];
+		gcry_sexp_release(generatedKey);
+
+		generateError = [otrKit _addPrivateKey:privateKey accountName:accountname protocol:protocol];
+
+		OTRKitMetricsRecordDuration(otrKit.metrics, OTRKitMetricsHistogramKeyGeneration, generateStartTime);
+	}
+
+	NSError *error = nil;
+
+	if (generateError == gcry_error(GPG_ERR_NO_ERROR)) {
+		OTRKitMetricsIncrementCounter(otrKit.metrics, OTRKitMetricsCounterKeysGenerated);
+
+		[otrKit _storeNewPrivateKeyForAccountName:accountNameString protocol:protocolString error:&error];
+	} else {
+		error = [otrKit _errorForGPGError:generateError];
 	}
 
-	fclose(filePointer);
+	[otrKit _performAsyncOperationOnDelegateQueue:^{
+		[otrKit.delegate otrKit:otrKit didFinishGeneratingPrivateKeyForAccountName:accountNameString protocol:protocolString error:error];
+	}];
 }
 
 static int is_logged_in_cb(void *opdata, const char *accountname, const char *protocol, const char *recipient)
 {
-	OTRKit *otrKit = [OTRKit sharedInstance];
+	OTRKit *otrKit = OTRKitForCallback();
+
+	OTRKitConversation *conversation = [otrKit _conversationForUsernameUTF8:recipient accountNameUTF8:accountname protocolUTF8:protocol];
 
 	__block BOOL loggedIn = NO;
 
-	[otrKit _performSyncOperationOnDelegateQueue:^{
+	[otrKit _performQueryOnDelegate:^{
 		loggedIn = [otrKit.delegate otrKit:otrKit
-						isUsernameLoggedIn:@(recipient)
-							   accountName:@(accountname)
-								  protocol:@(protocol)];
+						isUsernameLoggedIn:conversation.username
+							   accountName:conversation.accountName
+								  protocol:conversation.protocol];
 	}];
 
 	if (loggedIn) {
@@ -153,20 +265,15 @@ static int is_logged_in_cb(void *opdata, const char *accountname, const char *pr
 
 static void inject_message_cb(void *opdata, const char *accountname, const char *protocol, const char *recipient, const char *message)
 {
-	OTRKit *otrKit = [OTRKit sharedInstance];
+	OTRKit *otrKit = OTRKitForCallback();
 
 	NSString *messageString = @(message);
 
-	NSString *usernameString = @(recipient);
-	NSString *accountNameString = @(accountname);
-
-	NSString *protocolString = @(protocol);
+	OTRKitConversation *conversation = [otrKit _conversationForUsernameUTF8:recipient accountNameUTF8:accountname protocolUTF8:protocol];
 
 	id tag = (__bridge id)(opdata);
 
-	[otrKit _performAsyncOperationOnDelegateQueue:^{
-		[otrKit.delegate otrKit:otrKit injectMessage:messageString username:usernameString accountName:accountNameString protocol:protocolString tag:tag];
-	}];
+	[otrKit _injectMessage:messageString username:conversation.username accountName:conversation.accountName protocol:conversation.protocol tag:tag];
 }
 
 static void update_context_list_cb(void *opdata)
@@ -175,12 +282,14 @@ static void update_context_list_cb(void *opdata)
 
 static void confirm_fingerprint_cb(void *opdata, OtrlUserState us, const char *accountname, const char *protocol, const char *username, unsigned char fingerprint[20])
 {
-	OTRKit *otrKit = [OTRKit sharedInstance];
+	OTRKit *otrKit = OTRKitForCallback();
 
-	NSString *accountNameString = @(accountname);
-	NSString *usernameString = @(username);
+	OTRKitConversation *conversation = [otrKit _conversationForUsernameUTF8:username accountNameUTF8:accountname protocolUTF8:protocol];
 
-	NSString *protocolString = @(protocol);
+	NSString *usernameString = conversation.username;
+	NSString *accountNameString = conversation.accountName;
+
+	NSString *protocolString = conversation.protocol;
 
 	NSString *ourFingerprintString =
 	[otrKit fingerprintForAccountName:accountNameString protocol:protocolString];
@@ -198,14 +307,20 @@ static void confirm_fingerprint_cb(void *opdata, OtrlUserState us, const char *a
 
 static void write_fingerprints_cb(void *opdata)
 {
-	OTRKit *otrKit = [OTRKit sharedInstance];
+	OTRKit *otrKit = OTRKitForCallback();
+
+	/* libotr doesn't say which fingerprint was added or trusted.
+	 It's one of those of the conversation the operation is running for. */
+	[otrKit _recordFingerprintsForConversation:otrKit.currentConversation];
 
-	[otrKit _writeFingerprintsPath];
+	[otrKit _scheduleStorageWrite];
 }
 
 static void gone_secure_cb(void *opdata, ConnContext *context)
 {
-	OTRKit *otrKit = [OTRKit sharedInstance];
+	OTRKit *otrKit = OTRKitForCallback();
+
+	OTRKitMetricsIncrementCounter(otrKit.metrics, OTRKitMetricsCounterConversationsSecured);
 
 	[otrKit _updateEncryptionStatusWithContext:context];
 }
@@ -215,35 +330,29 @@ static void gone_secure_cb(void *opdata, ConnContext *context)
  */
 static void gone_insecure_cb(void *opdata, ConnContext *context)
 {
-	OTRKit *otrKit = [OTRKit sharedInstance];
+	OTRKit *otrKit = OTRKitForCallback();
 
 	[otrKit _updateEncryptionStatusWithContext:context];
 }
 
 static void still_secure_cb(void *opdata, ConnContext *context, int is_reply)
 {
-	OTRKit *otrKit = [OTRKit sharedInstance];
+	OTRKit *otrKit = OTRKitForCallback();
+
+	OTRKitMetricsIncrementCounter(otrKit.metrics, OTRKitMetricsCounterConversationsRefreshed);
 
 	[otrKit _updateEncryptionStatusWithContext:context];
 }
 
 static int max_message_size_cb(void *opdata, ConnContext *context)
 {
-	NSString *protocolString = @(context->protocol);
-
-	if (protocolString.length == 0) {
+	if (context == NULL) {
 		return 0;
 	}
 
-	OTRKit *otrKit = [OTRKit sharedInstance];
-
-	NSNumber *maxMessageSize = otrKit.protocolMaxSize[protocolString];
-
-	if (maxMessageSize) {
-		return maxMessageSize.intValue;
-	}
+	OTRKit *otrKit = OTRKitForCallback();
 
-	return 0;
+	return [otrKit _maximumMessageSizeForContext:context];
 }
 
 static const char * _Nullable otr_error_message_cb(void *opdata, ConnContext *context, OtrlErrorCode err_code)
@@ -295,7 +404,7 @@ static void otr_error_message_free_cb(void *opdata, const char *err_msg)
 
 static void handle_smp_event_cb(void *opdata, OtrlSMPEvent smp_event, ConnContext *context, unsigned short progress_percent, char *question)
 {
-	OTRKit *otrKit = [OTRKit sharedInstance];
+	OTRKit *otrKit = OTRKitForCallback();
 
 	OTRKitSMPEvent event = OTRKitSMPEventNone;
 
@@ -334,8 +443,8 @@ static void handle_smp_event_cb(void *opdata, OtrlSMPEvent smp_event, ConnContex
 			if (questionString == nil) {
 				event = OTRKitSMPEventError;
 
-				error = [NSError errorWithDomain:kOTRKitErrorDomain
-											code:1001
+				error = [NSError errorWithDomain:OTRKitErrorDomain
+											code:OTRKitErrorCodeSMPQuestionMissing
 										userInfo:@{NSLocalizedDescriptionKey : @"Question value for SMP is nil"}];
 
 				abortSMP = YES;
@@ -389,10 +498,21 @@ static void handle_smp_event_cb(void *opdata, OtrlSMPEvent smp_event, ConnContex
 		otrl_message_abort_smp(otrKit.userState, &ui_ops, opdata, context);
 	}
 
-	NSString *usernameString = @(context->username);
-	NSString *accountNameString = @(context->accountname);
+	if (event == OTRKitSMPEventSuccess) {
+		OTRKitMetricsIncrementCounter(otrKit.metrics, OTRKitMetricsCounterSMPSucceeded);
+	} else if (event == OTRKitSMPEventFailure ||
+			   event == OTRKitSMPEventCheated ||
+			   event == OTRKitSMPEventError)
+	{
+		OTRKitMetricsIncrementCounter(otrKit.metrics, OTRKitMetricsCounterSMPFailed);
+	}
+
+	OTRKitConversation *conversation = [otrKit _conversationForContext:context];
+
+	NSString *usernameString = conversation.username;
+	NSString *accountNameString = conversation.accountName;
 
-	NSString *protocolString = @(context->protocol);
+	NSString *protocolString = conversation.protocol;
 
 	[otrKit _performAsyncOperationOnDelegateQueue:^{
 		[otrKit.delegate otrKit:otrKit handleSMPEvent:event progress:progress_percent question:questionString username:usernameString accountName:accountNameString protocol:protocolString error:error];
@@ -405,7 +525,7 @@ static void handle_msg_event_cb(void *opdata, OtrlMessageEvent msg_event, ConnCo
 		return;
 	}
 
-	OTRKit *otrKit = [OTRKit sharedInstance];
+	OTRKit *otrKit = OTRKitForCallback();
 
 	NSString *messageString = nil;
 
@@ -516,10 +636,25 @@ static void handle_msg_event_cb(void *opdata, OtrlMessageEvent msg_event, ConnCo
 		}
 	}
 
-	NSString *usernameString = @(context->username);
-	NSString *accountNameString = @(context->accountname);
+	OTRKitMetricsIncrementCounter(otrKit.metrics, OTRKitMetricsCounterMessageEvents);
+
+	if (error ||
+		event == OTRKitMessageEventEncryptionError ||
+		event == OTRKitMessageEventSetupError ||
+		event == OTRKitMessageEventReceivedMessageUnreadable ||
+		event == OTRKitMessageEventReceivedMessageMalformed ||
+		event == OTRKitMessageEventReceivedMessageGeneralError ||
+		event == OTRKitMessageEventReceivedMessageUnrecognized)
+	{
+		OTRKitMetricsIncrementCounter(otrKit.metrics, OTRKitMetricsCounterMessageEventErrors);
+	}
+
+	OTRKitConversation *conversation = [otrKit _conversationForContext:context];
 
-	NSString *protocolString = @(context->protocol);
+	NSString *usernameString = conversation.username;
+	NSString *accountNameString = conversation.accountName;
+
+	NSString *protocolString = conversation.protocol;
 
 	id tag = (__bridge id)(opdata);
 
@@ -530,29 +665,45 @@ static void handle_msg_event_cb(void *opdata, OtrlMessageEvent msg_event, ConnCo
 
 static void create_instag_cb(void *opdata, const char *accountname, const char *protocol)
 {
-	OTRKit *otrKit = [OTRKit sharedInstance];
-
-	NSString *path = otrKit.instanceTagsPath;
+	OTRKit *otrKit = OTRKitForCallback();
 
-	FILE *filePointer = fopen(path.UTF8String, "w+b");
+	/* As with private keys, libotr only adds an instance tag while writing
+	 every instance tag to a file. It is added here and stored by itself later. */
+	if ([otrKit _addInstanceTag:otrl_instag_get_new() accountName:accountname protocol:protocol] == NO) {
+		return;
+	}
 
-	otrl_instag_generate_FILEp(otrKit.userState, filePointer, accountname, protocol);
+	OTRKitMetricsIncrementCounter(otrKit.metrics, OTRKitMetricsCounterInstanceTagsGenerated);
 
-	fclose(filePointer);
+	[otrKit _scheduleInstanceTagWriteForAccountName:@(accountname) protocol:@(protocol)];
 }
 
 static void timer_control_cb(void *opdata, unsigned int interval)
 {
-	OTRKit *otrKit = [OTRKit sharedInstance];
+	OTRKit *otrKit = OTRKitForCallback();
 
 	[otrKit _performAsyncOperationOnInternalQueue:^{
 		if ( otrKit.pollTimer) {
-			[otrKit.pollTimer invalidate];
+			dispatch_source_cancel(otrKit.pollTimer);
 			 otrKit.pollTimer = nil;
 		}
 
 		if (interval > 0) {
-			NSTimer *pollTimer = [NSTimer scheduledTimerWithTimeInterval:interval target:otrKit selector:@selector(_messagePoll:) userInfo:nil repeats:YES];
+			/* A dispatch source rather than an NSTimer because the
+			 internal queue has no run loop to schedule a timer on. */
+			dispatch_source_t pollTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, otrKit.internalQueue);
+
+			uint64_t pollInterval = ((uint64_t)interval * NSEC_PER_SEC);
+
+			dispatch_source_set_timer(pollTimer, dispatch_time(DISPATCH_TIME_NOW, pollInterval), pollInterval, (pollInterval / 10));
+
+			__weak OTRKit *weakOTRKit = otrKit;
+
+			dispatch_source_set_event_handler(pollTimer, ^{
+				[weakOTRKit _messagePoll];
+			});
+
+			dispatch_resume(pollTimer);
 
 			otrKit.pollTimer = pollTimer;
 		}
@@ -561,22 +712,29 @@ static void timer_control_cb(void *opdata, unsigned int interval)
 
 static void received_symkey_cb(void *opdata, ConnContext *context, unsigned int use, const unsigned char *usedata, size_t usedatalen, const unsigned char *symkey)
 {
-	OTRKit *otrKit = [OTRKit sharedInstance];
+	OTRKit *otrKit = OTRKitForCallback();
 
 	NSData *symmetricKey = [[NSData alloc] initWithBytes:symkey length:OTRL_EXTRAKEY_BYTES];
 
 	NSData *useDescriptionData = [[NSData alloc] initWithBytes:usedata length:usedatalen];
 
-	NSString *usernameString = @(context->username);
-	NSString *accountNameString = @(context->accountname);
+	OTRKitConversation *conversation = [otrKit _conversationForContext:context];
+
+	NSString *usernameString = conversation.username;
+	NSString *accountNameString = conversation.accountName;
 
-	NSString *protocolString = @(context->protocol);
+	NSString *protocolString = conversation.protocol;
 
 	[otrKit _performAsyncOperationOnDelegateQueue:^{
 		[otrKit.delegate otrKit:otrKit receivedSymmetricKey:symmetricKey forUse:use useData:useDescriptionData username:usernameString accountName:accountNameString protocol:protocolString];
 	}];
 }
 
+static void context_data_free_cb(void *data)
+{
+	CFBridgingRelease(data);
+}
+
 static OtrlMessageAppOps ui_ops = {
 	policy_cb,
 	create_privkey_cb,
@@ -634,21 +792,78 @@ static OtrlMessageAppOps ui_ops = {
 - (void)dealloc
 {
 	if ( self.pollTimer) {
-		[self.pollTimer invalidate];
+		dispatch_source_cancel(self.pollTimer);
 		 self.pollTimer = nil;
 	}
 
+	if (self.evictionTimer) {
+		dispatch_source_cancel(self.evictionTimer);
+	}
+
+	[self.symmetricKeyCache removeAllKeys];
+
 	otrl_userstate_free(self.userState);
 
 	self.userState = NULL;
+
+	pthread_mutex_destroy(&self->_conversationsLock);
 }
 
 - (void)_prepareInitialState
 {
+	/* Created first because each operation on the internal queue is measured */
+	self.metrics = [OTRKitMetrics new];
+
 	self.internalQueue = dispatch_queue_create("OTRKit Internal Queue", DISPATCH_QUEUE_SERIAL);
 
-	IsOnInternalQueueKey = &IsOnInternalQueueKey;
-	dispatch_queue_set_specific(self.internalQueue, IsOnInternalQueueKey, (void *)1, NULL);
+	self.smpQueue = dispatch_queue_create("OTRKit SMP Queue", DISPATCH_QUEUE_CONCURRENT);
+
+	self.headlessDelegateQueue = dispatch_queue_create("OTRKit Headless Delegate Queue", DISPATCH_QUEUE_SERIAL);
+
+	self.smpReservations = [NSMutableDictionary dictionary];
+
+	self.symmetricKeyCache = [OTRKitSymmetricKeyCache new];
+
+	pthread_mutex_init(&self->_conversationsLock, NULL);
+
+	self.conversations = [NSMutableDictionary dictionary];
+
+	self.privateKeysToStore = [NSMutableDictionary dictionary];
+	self.instanceTagsToStore = [NSMutableDictionary dictionary];
+
+	self.fingerprintsToStore = [NSMutableDictionary dictionary];
+	self.fingerprintsToRemove = [NSMutableDictionary dictionary];
+
+	dispatch_queue_set_specific(self.internalQueue, OTRKitInstanceQueueKey, (__bridge void *)self, NULL);
+
+	self.dataTransferManager = [[OTRKitDataTransferManager alloc] initWithOTRKit:self];
+
+	__weak OTRKit *weakSelf = self;
+
+	self.submissionQueue =
+	[[OTRKitSubmissionQueue alloc] initWithScheduleBlock:^(dispatch_block_t block) {
+		[weakSelf _performAsyncOperationOnInternalQueue:^{
+			block();
+
+			[weakSelf _submissionQueueDidPerformOperation];
+		}];
+	}];
+
+	self.resultBatcher =
+	[[OTRKitResultBatcher alloc] initWithDeliveryBlock:^(NSArray<OTRKitMessageResult *> *results) {
+		[weakSelf _deliverResults:results];
+	}];
+
+	/* Injection rates and cancellation reach the scheduler on the
+	 calling thread so it exists before this method returns. */
+	self.fragmentScheduler =
+	[[OTRKitFragmentScheduler alloc] initWithDeliveryBlock:^(NSString *message, NSString *username, NSString *accountName, NSString *protocol, id tag, uint64_t traceOperation) {
+		[weakSelf _deliverInjectedMessage:message username:username accountName:accountName protocol:protocol tag:tag traceOperation:traceOperation];
+	}];
+
+	self.submissionQueue.operationsPerHandshake = kOTRKitDefaultOperationsPerHandshake;
+
+	self->_replayCacheSize = kOTRKitDefaultReplayCacheSize;
 
 	[self _performAsyncOperationOnInternalQueue:^{
 		OTRL_INIT;
@@ -665,6 +880,12 @@ static OtrlMessageAppOps ui_ops = {
 
 		self.protocolMaxSize = protocolDefaults;
 
+		self.accountMaxSize = @{};
+		self.contactMaxSize = @{};
+
+		/* Context data starts at generation zero which forces a lookup. */
+		self.maxSizeGeneration = 1;
+
 		self.userState = otrl_userstate_create();
 	}];
 }
@@ -705,11 +926,7 @@ static OtrlMessageAppOps ui_ops = {
 - (void)_readLibotrConfiguration
 {
 	[self _performAsyncOperationOnInternalQueue:^{
-		[self _readPrivateKeyPath];
-
-		[self _readFingerprintsPath];
-
-		[self _readInstanceTagsPath];
+		[self _loadStorage];
 	}];
 }
 
@@ -724,299 +941,2393 @@ static OtrlMessageAppOps ui_ops = {
 		protocolMaxSizeMutable[protocol] = @(maxSize);
 
 		self.protocolMaxSize = protocolMaxSizeMutable;
+
+		self.maxSizeGeneration += 1;
 	}];
 }
 
-- (void)_messagePoll:(NSTimer *)timer
+- (void)setMaximumMessageSize:(int)maxSize forAccountName:(NSString *)accountName protocol:(NSString *)protocol
 {
+	NSParameterAssert(maxSize >= 0);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
 	[self _performAsyncOperationOnInternalQueue:^{
-		if (self.userState) {
-			otrl_message_poll(self.userState, &ui_ops, NULL);
+		NSMutableDictionary *accountMaxSizeMutable = [self.accountMaxSize mutableCopy];
+
+		NSString *dictKey = [self _maxSizeKeyForUsername:nil accountName:accountName protocol:protocol];
+
+		if (maxSize > 0) {
+			accountMaxSizeMutable[dictKey] = @(maxSize);
 		} else {
-			[timer invalidate];
+			[accountMaxSizeMutable removeObjectForKey:dictKey];
 		}
+
+		self.accountMaxSize = accountMaxSizeMutable;
+
+		self.maxSizeGeneration += 1;
 	}];
 }
 
-#pragma mark -
-#pragma mark Enocoding/Decoding
-
-- (void)decodeMessage:(NSString *)message
-			 username:(NSString *)username
-		  accountName:(NSString *)accountName
-			 protocol:(NSString *)protocol
-	   asynchronously:(BOOL)asynchronously
-				  tag:(nullable id)tag
+- (void)setMaximumMessageSize:(int)maxSize forUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
 {
-	NSParameterAssert(message != nil);
+	NSParameterAssert(maxSize >= 0);
 	NSParameterAssert(username != nil);
 	NSParameterAssert(accountName != nil);
 	NSParameterAssert(protocol != nil);
 
-	dispatch_block_t decodeBlock = ^{
-		OTRKitMessageType otrMessageType = [self _typeOfMessage:message];
+	[self _performAsyncOperationOnInternalQueue:^{
+		NSMutableDictionary *contactMaxSizeMutable = [self.contactMaxSize mutableCopy];
 
-		__block BOOL delegateIgnoreMessage = NO;
+		NSString *dictKey = [self _maxSizeKeyForUsername:username accountName:accountName protocol:protocol];
 
-		if ([self.delegate respondsToSelector:@selector(otrKit:ignoreMessage:messageType:username:accountName:protocol:)] == NO) {
-			[self _performSyncOperationOnDelegateQueue:^{
-				delegateIgnoreMessage =
-				[self.delegate otrKit:self
-						ignoreMessage:message
-						  messageType:otrMessageType
-							 username:username
-						  accountName:accountName
-							 protocol:protocol];
-			}];
+		if (maxSize > 0) {
+			contactMaxSizeMutable[dictKey] = @(maxSize);
+		} else {
+			[contactMaxSizeMutable removeObjectForKey:dictKey];
 		}
 
-		if (delegateIgnoreMessage) {
+		self.contactMaxSize = contactMaxSizeMutable;
+
+		self.maxSizeGeneration += 1;
+	}];
+}
+
+- (int)maximumMessageSizeForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	__block int maxSize = 0;
+
+	[self _performSyncOperationOnInternalQueue:^{
+		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+
+		if (otrContext == NULL) {
 			return;
 		}
 
-		char *otrDecodedMessage = NULL;
+		maxSize = [self _maximumMessageSizeForContext:otrContext];
+	}];
 
-		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+	return maxSize;
+}
 
-		OtrlTLV *otr_tlvs = NULL;
+- (void)transportDidDeliverMessageOfLength:(NSUInteger)length username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
 
-		int otrIgnoreMessage = otrl_message_receiving(self.userState,
-													  &ui_ops,
-													  (__bridge void *)tag,
-													  accountName.UTF8String,
-													  protocol.UTF8String,
-													  username.UTF8String,
-													  message.UTF8String,
-													  &otrDecodedMessage,
-													  &otr_tlvs,
-													  &otrContext,
-													  NULL,
-													  NULL);
+	if (self.adaptiveMessageSizeEnabled == NO) {
+		return;
+	}
 
-		NSString *decodedMessage = nil;
+	[self _performAsyncOperationOnInternalQueue:^{
+		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
 
-		NSArray *tlvs = nil;
+		if (otrContext == NULL) {
+			return;
+		}
 
-		if (otr_tlvs) {
-			tlvs = [self _tlvArrayForTLVChain:otr_tlvs];
+		OTRKitContextData *contextData = [self _contextDataForContext:otrContext];
+
+		int currentSize = [self _maximumMessageSizeForContext:otrContext];
+
+		if (contextData.maximumMessageSizeIsContactOverride) {
+			return;
 		}
 
-		if (otrContext) {
-			if (otrContext->msgstate == OTRL_MSGSTATE_FINISHED) {
-				[self disableEncryptionWithUsername:username accountName:accountName protocol:protocol];
-			}
+		/* Only messages that filled a whole fragment say anything about the limit. */
+		if (currentSize == 0 || length < (NSUInteger)currentSize) {
+			return;
 		}
 
-		BOOL wasEncrypted = (otrMessageType != OTRKitMessageTypeNotOTR &&
-							 otrMessageType != OTRKitMessageTypeTaggedPlainText);
+		if (contextData.learnedMessageSize == 0) {
+			contextData.learnedMessageSize = currentSize;
+		}
 
-		if (otrIgnoreMessage == 0)
-		{
-			if (otrDecodedMessage) {
-				decodedMessage = @(otrDecodedMessage);
-			} else {
-				decodedMessage = message; // Nothing changed...
-			}
+		contextData.deliveriesAtLearnedMessageSize += 1;
 
-			[self _performAsyncOperationOnDelegateQueue:^{
-				[self.delegate otrKit:self
-					   decodedMessage:decodedMessage
-						 wasEncrypted:wasEncrypted
-								 tlvs:tlvs
-							 username:username
-						  accountName:accountName
-							 protocol:protocol
-								  tag:tag];
-			}];
-		}
-		else if (tlvs)
-		{
-			[self _performAsyncOperationOnDelegateQueue:^{
-				[self.delegate otrKit:self
-					   decodedMessage:nil
-						 wasEncrypted:wasEncrypted
-								 tlvs:tlvs
-							 username:username
-						  accountName:accountName
-							 protocol:protocol
-								  tag:tag];
-			}];
+		if (contextData.deliveriesAtLearnedMessageSize < kOTRKitAdaptiveMessageSizeProbeThreshold) {
+			return;
 		}
 
-		if (otrDecodedMessage) {
-			otrl_message_free(otrDecodedMessage);
+		contextData.deliveriesAtLearnedMessageSize = 0;
+
+		/* Try a larger size, but never one known to be truncated
+		 and never more than the application allows. */
+		int upperLimit = self.adaptiveMessageSizeLimit;
+
+		if (upperLimit == 0) {
+			upperLimit = [self _configuredMaximumMessageSizeForContext:otrContext];
 		}
 
-		if (otr_tlvs) {
-			otrl_tlv_free(otr_tlvs);
+		if (contextData.truncatedMessageSize > 0) {
+			upperLimit = MIN(upperLimit, (contextData.truncatedMessageSize - 1));
 		}
-	};
 
-	if (asynchronously) {
-		[self _performAsyncOperationOnInternalQueue:decodeBlock];
-	} else {
-		[self _performSyncOperationOnInternalQueue:decodeBlock];
-	}
+		int learnedSize = contextData.learnedMessageSize;
+
+		int probedSize = (learnedSize + MAX(kOTRKitAdaptiveMessageSizeMinimumStep, (learnedSize / 16)));
+
+		probedSize = MIN(probedSize, upperLimit);
+
+		if (probedSize > learnedSize) {
+			contextData.learnedMessageSize = probedSize;
+		}
+	}];
 }
 
-- (void)encodeMessage:(nullable NSString *)message
-				 tlvs:(nullable NSArray<OTRTLV *> *)tlvs
-			 username:(NSString *)username
-		  accountName:(NSString *)accountName
-			 protocol:(NSString *)protocol
-	   asynchronously:(BOOL)asynchronously
-				  tag:(nullable id)tag
+- (void)transportDidTruncateMessageOfLength:(NSUInteger)length toLength:(NSUInteger)truncatedLength username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
 {
-	NSParameterAssert(message != nil || tlvs != nil);
+	NSParameterAssert(truncatedLength < length);
 	NSParameterAssert(username != nil);
 	NSParameterAssert(accountName != nil);
 	NSParameterAssert(protocol != nil);
 
-	dispatch_block_t encodeBlock = ^{
+	if (self.adaptiveMessageSizeEnabled == NO) {
+		return;
+	}
+
+	[self _performAsyncOperationOnInternalQueue:^{
 		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
 
-		/*
-		 * If our policy is not oppritunistic (automatic) and we are not in an encrypted,
-		 * then return unecnrypted message to delegate. This exception is made because when
-		 * OTRL_POLICY_MANUAL is set, OTR discards outgoing messages altogther.
-		 *
-		 * If our policy is ppritunistic (automatic) and our OTR request was rejected,
-		 * then we will return unecnrypted message to delegate. OTR will refuse to do further
-		 * work when the state is rejected.
-		 */
-		if (/* 1 */ (self.otrPolicy == OTRKitPolicyManual ||
-					 self.otrPolicy == OTRKitPolicyNever) ||
-			/* 2 */ (self.otrPolicy == OTRKitPolicyOpportunistic &&
-					 [self _offerStateForContext:otrContext] == OTRKitOfferStateRejected))
-		{
-			OTRKitMessageState otrMessageState = [self _messageStateForContext:otrContext];
+		if (otrContext == NULL) {
+			return;
+		}
 
-			if (otrMessageState == OTRKitMessageStatePlaintext) {
-				[self _performAsyncOperationOnDelegateQueue:^{
-					[self.delegate otrKit:self
-						   encodedMessage:message
-							 wasEncrypted:NO
-								 username:username
-							  accountName:accountName
-								 protocol:protocol
-									  tag:tag
-									error:nil];
+		OTRKitContextData *contextData = [self _contextDataForContext:otrContext];
 
-					[self.delegate otrKit:self
-							injectMessage:message
-								 username:username
-							  accountName:accountName
-								 protocol:protocol
-									  tag:tag];
-				}];
+		int truncatedSize = (int)MIN(length, (NSUInteger)INT_MAX);
 
-				return;
-			}
+		if (contextData.truncatedMessageSize == 0 || truncatedSize < contextData.truncatedMessageSize) {
+			contextData.truncatedMessageSize = truncatedSize;
 		}
 
-		[self _encodeMessage:message
-						tlvs:tlvs
-					username:username
-				 accountName:accountName
-					protocol:protocol
-						 tag:tag
-				   inContext:otrContext];
-	};
+		/* What made it through is the largest size known to be safe. */
+		int deliveredSize = (int)MIN(truncatedLength, (NSUInteger)INT_MAX);
 
-	if (asynchronously) {
-		[self _performAsyncOperationOnInternalQueue:encodeBlock];
-	} else {
-		[self _performSyncOperationOnInternalQueue:encodeBlock];
+		if (deliveredSize > 0) {
+			contextData.learnedMessageSize = deliveredSize;
+		}
+
+		contextData.deliveriesAtLearnedMessageSize = 0;
+	}];
+}
+
+- (int)_maximumMessageSizeForContext:(ConnContext *)context
+{
+	NSParameterAssert(context != NULL);
+
+	/* This is called by libotr for every message sent which is why
+	 the result is cached on the context instead of building a key. */
+	OTRKitContextData *contextData = [self _contextDataForContext:context];
+
+	if (contextData.maximumMessageSizeGeneration != self.maxSizeGeneration) {
+		contextData.maximumMessageSize = [self _configuredMaximumMessageSizeForContext:context];
+
+		contextData.maximumMessageSizeGeneration = self.maxSizeGeneration;
+	}
+
+	if (self.adaptiveMessageSizeEnabled &&
+		contextData.maximumMessageSizeIsContactOverride == NO &&
+		contextData.learnedMessageSize > 0)
+	{
+		return contextData.learnedMessageSize;
 	}
+
+	return contextData.maximumMessageSize;
 }
 
-- (void)_encodeMessage:(nullable NSString *)message
-				  tlvs:(nullable NSArray<OTRTLV *> *)tlvs
+- (int)_configuredMaximumMessageSizeForContext:(ConnContext *)context
+{
+	NSParameterAssert(context != NULL);
+
+	OTRKitContextData *contextData = [self _contextDataForContext:context];
+
+	contextData.maximumMessageSizeIsContactOverride = NO;
+
+	if (context->protocol == NULL || context->accountname == NULL || context->username == NULL) {
+		return 0;
+	}
+
+	OTRKitConversation *conversation = [self _conversationForContext:context];
+
+	NSString *username = conversation.username;
+	NSString *accountName = conversation.accountName;
+
+	NSString *protocol = conversation.protocol;
+
+	NSNumber *maxMessageSize = self.contactMaxSize[[self _maxSizeKeyForUsername:username accountName:accountName protocol:protocol]];
+
+	if (maxMessageSize) {
+		contextData.maximumMessageSizeIsContactOverride = YES;
+
+		return maxMessageSize.intValue;
+	}
+
+	maxMessageSize = self.accountMaxSize[[self _maxSizeKeyForUsername:nil accountName:accountName protocol:protocol]];
+
+	if (maxMessageSize) {
+		return maxMessageSize.intValue;
+	}
+
+	maxMessageSize = self.protocolMaxSize[protocol];
+
+	if (maxMessageSize) {
+		return maxMessageSize.intValue;
+	}
+
+	return 0;
+}
+
+- (NSString *)_maxSizeKeyForUsername:(nullable NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	if (username == nil) {
+		return [NSString stringWithFormat:@"%@ <-> %@", accountName, protocol];
+	}
+
+	return [NSString stringWithFormat:@"%@ <-> %@ <-> %@", username, accountName, protocol];
+}
+
+- (void)setInjectionRate:(double)messagesPerSecond burst:(NSUInteger)burst forAccountName:(nullable NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(messagesPerSecond > 0);
+	NSParameterAssert(burst > 0);
+	NSParameterAssert(protocol != nil);
+
+	[self.fragmentScheduler setRate:messagesPerSecond burst:burst forAccountName:accountName protocol:protocol];
+}
+
+- (void)removeInjectionRateForAccountName:(nullable NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(protocol != nil);
+
+	[self.fragmentScheduler removeRateForAccountName:accountName protocol:protocol];
+}
+
+/* Called on the internal queue */
+- (void)_messagePoll
+{
+	if (self.userState) {
+		otrl_message_poll(self.userState, &ui_ops, NULL);
+	}
+}
+
+#pragma mark -
+#pragma mark Enocoding/Decoding
+
+- (void)decodeMessage:(NSString *)message
+			 username:(NSString *)username
+		  accountName:(NSString *)accountName
+			 protocol:(NSString *)protocol
+	   asynchronously:(BOOL)asynchronously
+				  tag:(nullable id)tag
+{
+	[self _decodeMessage:message
+				username:username
+			 accountName:accountName
+				protocol:protocol
+		  asynchronously:asynchronously
+				priority:OTRKitPriorityInteractive
+					 tag:tag
+			  completion:nil];
+}
+
+- (void)decodeMessage:(NSString *)message
+			 username:(NSString *)username
+		  accountName:(NSString *)accountName
+			 protocol:(NSString *)protocol
+			 priority:(OTRKitPriority)priority
+				  tag:(nullable id)tag
+{
+	[self _decodeMessage:message
+				username:username
+			 accountName:accountName
+				protocol:protocol
+		  asynchronously:YES
+				priority:priority
+					 tag:tag
+			  completion:nil];
+}
+
+- (void)decodeMessage:(NSString *)message
+			 username:(NSString *)username
+		  accountName:(NSString *)accountName
+			 protocol:(NSString *)protocol
+			 priority:(OTRKitPriority)priority
+				  tag:(nullable id)tag
+	  completionQueue:(nullable dispatch_queue_t)completionQueue
+		   completion:(OTRKitDecodeCompletionBlock)completion
+{
+	NSParameterAssert(completion != nil);
+
+	if (completionQueue == nil) {
+		completionQueue = [self _defaultCallbackQueue];
+	}
+
+	[self _decodeMessage:message
+				username:username
+			 accountName:accountName
+				protocol:protocol
+		  asynchronously:YES
+				priority:priority
+					 tag:tag
+			  completion:^(NSString *decodedMessage, BOOL wasEncrypted, NSArray<OTRTLV *> *tlvs, NSError *error) {
+				  dispatch_async(completionQueue, ^{
+					  completion(decodedMessage, wasEncrypted, tlvs, error);
+				  });
+			  }];
+}
+
+/* When a completion block is given, it is called exactly once, on the internal queue,
+ in place of the decodedMessage: delegate method and the rejection message events. */
+- (void)_decodeMessage:(NSString *)message
 			  username:(NSString *)username
 		   accountName:(NSString *)accountName
 			  protocol:(NSString *)protocol
+		asynchronously:(BOOL)asynchronously
+			  priority:(OTRKitPriority)priority
 				   tag:(nullable id)tag
-			 inContext:(ConnContext *)otrContext
+			completion:(nullable OTRKitDecodeCompletionBlock)completion
 {
-	NSParameterAssert(message != nil || tlvs != nil);
+	NSParameterAssert(message != nil);
 	NSParameterAssert(username != nil);
 	NSParameterAssert(accountName != nil);
 	NSParameterAssert(protocol != nil);
-	NSParameterAssert(otrContext != nil);
 
-	gcry_error_t otrError;
+	/* Delegate methods are handed the strings of the conversation
+	 rather than those of the caller so none are made per message. */
+	OTRKitConversation *conversation = [self _conversationForUsername:username accountName:accountName protocol:protocol];
 
-	char *otrEncodedMessage = NULL;
+	username = conversation.username;
+	accountName = conversation.accountName;
+	protocol = conversation.protocol;
 
-	// Set nil messages to empty string if TLVs are present, otherwise libotr
-	// will silence the message, even though you may have meant to inject a TLV.
-	NSString *messageToEncode = message;
+	/* The lane of the conversation in the submission queue is suspended
+	 while an SMP step is computed for it, so this block never runs during
+	 one. When decoding synchronously, the caller waits for it instead. */
+	dispatch_block_t decodeBlock = ^{
+		OTRKitMessageType otrMessageType = [self _typeOfMessage:message];
 
-	if (messageToEncode == nil) {
-		messageToEncode = @"";
-	}
+		__block BOOL delegateIgnoreMessage = NO;
 
-	OtrlTLV *otr_tlvs = NULL;
+		if ([self.delegate respondsToSelector:@selector(otrKit:ignoreMessage:messageType:username:accountName:protocol:)]) {
+			[self _performQueryOnDelegate:^{
+				delegateIgnoreMessage =
+				[self.delegate otrKit:self
+						ignoreMessage:message
+						  messageType:otrMessageType
+							 username:username
+						  accountName:accountName
+							 protocol:protocol];
+			}];
+		}
 
-	if (tlvs.count > 0) {
-		otr_tlvs = [self _tlvChainForTLVs:tlvs];
-	}
+		if (delegateIgnoreMessage) {
+			if (completion) {
+				completion(nil, NO, nil, nil);
+			}
 
-	otrError = otrl_message_sending(self.userState,
-									 &ui_ops,
-									 (__bridge void *)(tag),
-									 accountName.UTF8String,
-									 protocol.UTF8String,
-									 username.UTF8String,
-									 OTRL_INSTAG_BEST,
-									 messageToEncode.UTF8String,
-									 otr_tlvs,
-									 &otrEncodedMessage,
-									 OTRL_FRAGMENT_SEND_ALL,
-									 &otrContext,
-									 NULL,
-									 NULL);
+			return;
+		}
 
-	if (otr_tlvs) {
-		otrl_tlv_free(otr_tlvs);
-	}
+		char *otrDecodedMessage = NULL;
 
-	BOOL wasEncrypted = NO;
+		ConnContext *otrContext = [self _contextForConversation:conversation];
 
-	NSString *encodedMessage = nil;
+		if (otrContext && [self _messageIsReplayed:message ofType:otrMessageType context:otrContext]) {
+			if (completion) {
+				completion(nil, NO, nil, nil);
+			}
 
-	if (otrEncodedMessage) {
-		encodedMessage = @(otrEncodedMessage);
+			return;
+		}
 
-		otrl_message_free(otrEncodedMessage);
+		OtrlTLV *otr_tlvs = NULL;
 
-		wasEncrypted = ([self _typeOfMessage:encodedMessage] != OTRKitMessageTypeNotOTR);
-	}
+		uint64_t decodeStartTime = OTRKitMetricsNow();
 
-	NSError *errorString = nil;
+		int otrIgnoreMessage = otrl_message_receiving(self.userState,
+													  &ui_ops,
+													  (__bridge void *)tag,
+													  conversation.accountNameUTF8,
+													  conversation.protocolUTF8,
+													  conversation.usernameUTF8,
+													  message.UTF8String,
+													  &otrDecodedMessage,
+													  &otr_tlvs,
+													  &otrContext,
+													  NULL,
+													  NULL);
 
-	if (otrError != 0) {
-		errorString = [self _errorForGPGError:otrError];
+		OTRKitMetricsRecordDuration(self.metrics, OTRKitMetricsHistogramDecode, decodeStartTime);
 
-		encodedMessage = nil;
-	}
+		uint64_t traceOperation = self.traceOperation;
 
-	[self _performAsyncOperationOnDelegateQueue:^{
-		[self.delegate otrKit:self
-			   encodedMessage:encodedMessage
-				 wasEncrypted:wasEncrypted
-					 username:username
-				  accountName:accountName
-					 protocol:protocol
-						  tag:tag
-						error:errorString];
-	}];
-}
+		if (traceOperation) {
+			OTRKitTraceRecordSpan("otrl_message_receiving", traceOperation, decodeStartTime, OTRKitMetricsNow(), tag);
+		}
+
+		OTRKitMetricsIncrementCounter(self.metrics, OTRKitMetricsCounterMessagesDecoded);
+
+		NSString *decodedMessage = nil;
+
+		NSArray *tlvs = nil;
+
+		if (otr_tlvs) {
+			/* The array takes ownership of the chain. */
+			tlvs = [self _tlvArrayForTLVChain:otr_tlvs];
+
+			if (self.dataTransferManager.handlesDataTLVs) {
+				tlvs = [self _tlvArrayByHandlingDataTLVs:tlvs username:username accountName:accountName protocol:protocol];
+			}
+		}
+
+		if (otrContext) {
+			[self _removeSymmetricKeysOutdatedByContext:otrContext];
+
+			/* Messages that are still waiting may be the remote user's
+			 last words in plain text so they aren't cancelled here. */
+			if (otrContext->msgstate == OTRL_MSGSTATE_FINISHED) {
+				[self _disconnectUsername:username accountName:accountName protocol:protocol];
+			}
+		}
+
+		BOOL wasEncrypted = (otrMessageType != OTRKitMessageTypeNotOTR &&
+							 otrMessageType != OTRKitMessageTypeTaggedPlainText);
+
+		if (otrIgnoreMessage == 0)
+		{
+			if (otrDecodedMessage) {
+				decodedMessage = @(otrDecodedMessage);
+			} else {
+				decodedMessage = message; // Nothing changed...
+			}
+		}
+
+		if (completion)
+		{
+			completion(decodedMessage, wasEncrypted, tlvs, nil);
+		}
+		else if ((otrIgnoreMessage == 0 || tlvs) && [self _resultsAreBatched])
+		{
+			[self _batchResultOfType:OTRKitMessageResultTypeDecoded
+							 message:decodedMessage
+						wasEncrypted:wasEncrypted
+								tlvs:tlvs
+							username:username
+						 accountName:accountName
+							protocol:protocol
+								 tag:tag
+							   error:nil];
+		}
+		else if (otrIgnoreMessage == 0)
+		{
+			uint64_t deliveryTime = ((traceOperation) ? OTRKitMetricsNow() : 0);
+
+			[self _performAsyncOperationOnDelegateQueue:^{
+				[self.delegate otrKit:self
+					   decodedMessage:decodedMessage
+						 wasEncrypted:wasEncrypted
+								 tlvs:tlvs
+							 username:username
+						  accountName:accountName
+							 protocol:protocol
+								  tag:tag];
+
+				if (traceOperation) {
+					OTRKitTraceRecordSpan("decodedMessage delegate", traceOperation, deliveryTime, OTRKitMetricsNow(), tag);
+				}
+			}];
+		}
+		else if (tlvs)
+		{
+			uint64_t deliveryTime = ((traceOperation) ? OTRKitMetricsNow() : 0);
+
+			[self _performAsyncOperationOnDelegateQueue:^{
+				[self.delegate otrKit:self
+					   decodedMessage:nil
+						 wasEncrypted:wasEncrypted
+								 tlvs:tlvs
+							 username:username
+						  accountName:accountName
+							 protocol:protocol
+								  tag:tag];
+
+				if (traceOperation) {
+					OTRKitTraceRecordSpan("decodedMessage delegate", traceOperation, deliveryTime, OTRKitMetricsNow(), tag);
+				}
+			}];
+		}
+
+		if (otrDecodedMessage) {
+			otrl_message_free(otrDecodedMessage);
+		}
+	};
+
+	if (OTRKitTracingEnabled) {
+		decodeBlock = [self _tracedBlock:decodeBlock name:"decode" tag:tag];
+	}
+
+	if (asynchronously) {
+		/* Messages that start or continue an AKE cost public key operations
+		 inside otrl_message_receiving(). They wait in the handshake lane so
+		 that a burst of them doesn't hold up established conversations. */
+		BOOL handshake = [self _typeOfMessageIsHandshake:[self _typeOfMessage:message]];
+
+		[self _submitOperation:decodeBlock conversation:conversation priority:priority handshake:handshake tag:tag rejectionBlock:^(NSError *error) {
+			if (completion) {
+				completion(nil, NO, nil, error);
+
+				return;
+			}
+
+			OTRKitMessageEvent event = OTRKitMessageEventReceivedMessageNotAdmitted;
+
+			if (error.code == OTRKitErrorCodeOperationCancelled) {
+				event = OTRKitMessageEventReceivedMessageCancelled;
+			}
+
+			[self _performAsyncOperationOnDelegateQueue:^{
+				[self.delegate otrKit:self
+				   handleMessageEvent:event
+							  message:message
+							 username:username
+						  accountName:accountName
+							 protocol:protocol
+								  tag:tag
+								error:error];
+			}];
+		}];
+	} else {
+		[self _performSyncOperationOnInternalQueue:decodeBlock afterSMPReservationWithKey:conversation.conversationKey];
+	}
+}
+
+- (void)encodeMessage:(nullable NSString *)message
+				 tlvs:(nullable NSArray<OTRTLV *> *)tlvs
+			 username:(NSString *)username
+		  accountName:(NSString *)accountName
+			 protocol:(NSString *)protocol
+	   asynchronously:(BOOL)asynchronously
+				  tag:(nullable id)tag
+{
+	[self _encodeMessage:message
+					tlvs:tlvs
+				username:username
+			 accountName:accountName
+				protocol:protocol
+		  asynchronously:asynchronously
+				priority:OTRKitPriorityInteractive
+					 tag:tag
+			  completion:nil];
+}
+
+- (void)encodeMessage:(nullable NSString *)message
+				 tlvs:(nullable NSArray<OTRTLV *> *)tlvs
+			 username:(NSString *)username
+		  accountName:(NSString *)accountName
+			 protocol:(NSString *)protocol
+			 priority:(OTRKitPriority)priority
+				  tag:(nullable id)tag
+{
+	[self _encodeMessage:message
+					tlvs:tlvs
+				username:username
+			 accountName:accountName
+				protocol:protocol
+		  asynchronously:YES
+				priority:priority
+					 tag:tag
+			  completion:nil];
+}
+
+- (void)encodeMessage:(nullable NSString *)message
+				 tlvs:(nullable NSArray<OTRTLV *> *)tlvs
+			 username:(NSString *)username
+		  accountName:(NSString *)accountName
+			 protocol:(NSString *)protocol
+			 priority:(OTRKitPriority)priority
+				  tag:(nullable id)tag
+	  completionQueue:(nullable dispatch_queue_t)completionQueue
+		   completion:(OTRKitEncodeCompletionBlock)completion
+{
+	NSParameterAssert(completion != nil);
+
+	if (completionQueue == nil) {
+		completionQueue = [self _defaultCallbackQueue];
+	}
+
+	[self _encodeMessage:message
+					tlvs:tlvs
+				username:username
+			 accountName:accountName
+				protocol:protocol
+		  asynchronously:YES
+				priority:priority
+					 tag:tag
+			  completion:^(NSString *encodedMessage, BOOL wasEncrypted, NSError *error) {
+				  dispatch_async(completionQueue, ^{
+					  completion(encodedMessage, wasEncrypted, error);
+				  });
+			  }];
+}
+
+/* When a completion block is given, it is called exactly once, on the
+ internal queue, in place of the encodedMessage: delegate method. */
+- (void)_encodeMessage:(nullable NSString *)message
+				  tlvs:(nullable NSArray<OTRTLV *> *)tlvs
+			  username:(NSString *)username
+		   accountName:(NSString *)accountName
+			  protocol:(NSString *)protocol
+		asynchronously:(BOOL)asynchronously
+			  priority:(OTRKitPriority)priority
+				   tag:(nullable id)tag
+			completion:(nullable OTRKitEncodeCompletionBlock)completion
+{
+	NSParameterAssert(message != nil || tlvs != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	/* The strings of the conversation replace those of the caller as when decoding */
+	OTRKitConversation *conversation = [self _conversationForUsername:username accountName:accountName protocol:protocol];
+
+	username = conversation.username;
+	accountName = conversation.accountName;
+	protocol = conversation.protocol;
+
+	/* Kept out of an SMP step as when decoding */
+	dispatch_block_t encodeBlock = ^{
+		ConnContext *otrContext = [self _contextForConversation:conversation];
+
+		/*
+		 * If our policy is not oppritunistic (automatic) and we are not in an encrypted,
+		 * then return unecnrypted message to delegate. This exception is made because when
+		 * OTRL_POLICY_MANUAL is set, OTR discards outgoing messages altogther.
+		 *
+		 * If our policy is ppritunistic (automatic) and our OTR request was rejected,
+		 * then we will return unecnrypted message to delegate. OTR will refuse to do further
+		 * work when the state is rejected.
+		 */
+		if (/* 1 */ (self.otrPolicy == OTRKitPolicyManual ||
+					 self.otrPolicy == OTRKitPolicyNever) ||
+			/* 2 */ (self.otrPolicy == OTRKitPolicyOpportunistic &&
+					 [self _offerStateForContext:otrContext] == OTRKitOfferStateRejected))
+		{
+			OTRKitMessageState otrMessageState = [self _messageStateForContext:otrContext];
+
+			if (otrMessageState == OTRKitMessageStatePlaintext) {
+				if (completion) {
+					completion(message, NO, nil);
+				} else if ([self _resultsAreBatched]) {
+					[self _batchResultOfType:OTRKitMessageResultTypeEncoded
+									 message:message
+								wasEncrypted:NO
+										tlvs:nil
+									username:username
+								 accountName:accountName
+									protocol:protocol
+										 tag:tag
+									   error:nil];
+				} else {
+					[self _performAsyncOperationOnDelegateQueue:^{
+						[self.delegate otrKit:self
+							   encodedMessage:message
+								 wasEncrypted:NO
+									 username:username
+								  accountName:accountName
+									 protocol:protocol
+										  tag:tag
+										error:nil];
+					}];
+				}
+
+				if (message) {
+					[self _injectMessage:message username:username accountName:accountName protocol:protocol tag:tag];
+				}
+
+				return;
+			}
+		}
+
+		[self _encodeMessage:message
+						tlvs:tlvs
+					username:username
+				 accountName:accountName
+					protocol:protocol
+						 tag:tag
+				   inContext:otrContext
+			  notifyDelegate:YES
+				  completion:completion];
+	};
+
+	if (OTRKitTracingEnabled) {
+		encodeBlock = [self _tracedBlock:encodeBlock name:"encode" tag:tag];
+	}
+
+	if (asynchronously) {
+		[self _submitOperation:encodeBlock conversation:conversation priority:priority handshake:NO tag:tag rejectionBlock:^(NSError *error) {
+			if (completion) {
+				completion(nil, NO, error);
+
+				return;
+			}
+
+			[self _performAsyncOperationOnDelegateQueue:^{
+				[self.delegate otrKit:self
+					   encodedMessage:nil
+						 wasEncrypted:NO
+							 username:username
+						  accountName:accountName
+							 protocol:protocol
+								  tag:tag
+								error:error];
+			}];
+		}];
+	} else {
+		[self _performSyncOperationOnInternalQueue:encodeBlock afterSMPReservationWithKey:conversation.conversationKey];
+	}
+}
+
+- (void)_encodeMessage:(nullable NSString *)message
+				  tlvs:(nullable NSArray<OTRTLV *> *)tlvs
+			  username:(NSString *)username
+		   accountName:(NSString *)accountName
+			  protocol:(NSString *)protocol
+				   tag:(nullable id)tag
+			 inContext:(ConnContext *)otrContext
+{
+	[self _encodeMessage:message
+					tlvs:tlvs
+				username:username
+			 accountName:accountName
+				protocol:protocol
+					 tag:tag
+			   inContext:otrContext
+		  notifyDelegate:YES
+			  completion:nil];
+}
+
+- (void)_encodeMessage:(nullable NSString *)message
+				  tlvs:(nullable NSArray<OTRTLV *> *)tlvs
+			  username:(NSString *)username
+		   accountName:(NSString *)accountName
+			  protocol:(NSString *)protocol
+				   tag:(nullable id)tag
+			 inContext:(ConnContext *)otrContext
+		notifyDelegate:(BOOL)notifyDelegate
+			completion:(nullable OTRKitEncodeCompletionBlock)completion
+{
+	NSParameterAssert(message != nil || tlvs != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+	NSParameterAssert(otrContext != nil);
+
+	gcry_error_t otrError;
+
+	char *otrEncodedMessage = NULL;
+
+	// Set nil messages to empty string if TLVs are present, otherwise libotr
+	// will silence the message, even though you may have meant to inject a TLV.
+	NSString *messageToEncode = message;
+
+	if (messageToEncode == nil) {
+		messageToEncode = @"";
+	}
+
+	OtrlTLV *otr_tlvs = NULL;
+
+	if (tlvs.count > 0) {
+		otr_tlvs = [self _tlvChainForTLVs:tlvs];
+	}
+
+	/* Fragments are injected from within otrl_message_sending() */
+	uint64_t injectedCount = OTRKitMetricsCounterValue(self.metrics, OTRKitMetricsCounterMessagesInjected);
+
+	uint64_t encodeStartTime = OTRKitMetricsNow();
+
+	otrError = otrl_message_sending(self.userState,
+									 &ui_ops,
+									 (__bridge void *)(tag),
+									 otrContext->accountname,
+									 otrContext->protocol,
+									 otrContext->username,
+									 OTRL_INSTAG_BEST,
+									 messageToEncode.UTF8String,
+									 otr_tlvs,
+									 &otrEncodedMessage,
+									 OTRL_FRAGMENT_SEND_ALL,
+									 &otrContext,
+									 NULL,
+									 NULL);
+
+	OTRKitMetricsRecordDuration(self.metrics, OTRKitMetricsHistogramEncode, encodeStartTime);
+
+	uint64_t traceOperation = self.traceOperation;
+
+	if (traceOperation) {
+		OTRKitTraceRecordSpan("otrl_message_sending", traceOperation, encodeStartTime, OTRKitMetricsNow(), tag);
+	}
+
+	OTRKitMetricsRecordValue(self.metrics, OTRKitMetricsHistogramFragmentsPerMessage,
+		(OTRKitMetricsCounterValue(self.metrics, OTRKitMetricsCounterMessagesInjected) - injectedCount));
+
+	OTRKitMetricsIncrementCounter(self.metrics, OTRKitMetricsCounterMessagesEncoded);
+
+	if (otr_tlvs) {
+		free(otr_tlvs);
+	}
+
+	BOOL wasEncrypted = NO;
+
+	NSString *encodedMessage = nil;
+
+	if (otrEncodedMessage) {
+		encodedMessage = @(otrEncodedMessage);
+
+		otrl_message_free(otrEncodedMessage);
+
+		wasEncrypted = ([self _typeOfMessage:encodedMessage] != OTRKitMessageTypeNotOTR);
+	}
+
+	NSError *errorString = nil;
+
+	if (otrError != 0) {
+		errorString = [self _errorForGPGError:otrError];
+
+		encodedMessage = nil;
+
+		OTRKitMetricsIncrementCounter(self.metrics, OTRKitMetricsCounterEncodeErrors);
+	}
+
+	if (notifyDelegate == NO) {
+		return;
+	}
+
+	if (completion) {
+		completion(encodedMessage, wasEncrypted, errorString);
+
+		return;
+	}
+
+	if ([self _resultsAreBatched]) {
+		[self _batchResultOfType:OTRKitMessageResultTypeEncoded
+						 message:encodedMessage
+					wasEncrypted:wasEncrypted
+							tlvs:nil
+						username:username
+					 accountName:accountName
+						protocol:protocol
+							 tag:tag
+						   error:errorString];
+
+		return;
+	}
+
+	uint64_t deliveryTime = ((traceOperation) ? OTRKitMetricsNow() : 0);
+
+	[self _performAsyncOperationOnDelegateQueue:^{
+		[self.delegate otrKit:self
+			   encodedMessage:encodedMessage
+				 wasEncrypted:wasEncrypted
+					 username:username
+				  accountName:accountName
+					 protocol:protocol
+						  tag:tag
+						error:errorString];
+
+		if (traceOperation) {
+			OTRKitTraceRecordSpan("encodedMessage delegate", traceOperation, deliveryTime, OTRKitMetricsNow(), tag);
+		}
+	}];
+}
+
+- (void)initiateEncryptionWithUsername:(NSString *)username
+						   accountName:(NSString *)accountName
+							  protocol:(NSString *)protocol
+						asynchronously:(BOOL)asynchronously
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	/* The context is looked up on the internal queue because
+	 it may be forgotten while the block is waiting to run. */
+	dispatch_block_t encodeBlock = ^{
+		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+
+		[self _encodeMessage:@"?OTR?" tlvs:nil username:username accountName:accountName protocol:protocol tag:nil inContext:otrContext];
+	};
+
+	if (asynchronously) {
+		[self _performAsyncOperationOnInternalQueue:encodeBlock];
+	} else {
+		[self _performSyncOperationOnInternalQueue:encodeBlock];
+	}
+}
+
+- (void)disableEncryptionWithUsername:(NSString *)username
+						  accountName:(NSString *)accountName
+							 protocol:(NSString *)protocol
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	[self cancelOperationsForUsername:username accountName:accountName protocol:protocol];
+
+	[self _disconnectUsername:username accountName:accountName protocol:protocol];
+}
+
+- (void)_disconnectUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	[self _performAsyncOperationOnInternalQueue:^{
+		[self _performOperation:^{
+			otrl_message_disconnect_all_instances(self.userState, &ui_ops, NULL, accountName.UTF8String, protocol.UTF8String, username.UTF8String);
+
+			ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+
+			if (otrContext == NULL) {
+				return;
+			}
+
+			[self _updateEncryptionStatusWithContext:otrContext];
+		} afterSMPReservationForUsername:username accountName:accountName protocol:protocol];
+	}];
+}
+
+- (void)_disableEncryptionForAll
+{
+	[self _performAsyncOperationOnInternalQueue:^{
+		[self _performOperationAfterAllSMPReservations:^{
+			ConnContext *otrContext = self.userState->context_root;
+
+			while (otrContext) {
+				OTRKitMessageState messageState = [self _messageStateForContext:otrContext];
+
+				if (messageState == OTRKitMessageStateEncrypted) {
+					otrl_message_disconnect_all_instances(self.userState, &ui_ops, NULL, otrContext->accountname, otrContext->protocol, otrContext->username);
+
+					[self _updateEncryptionStatusWithContext:otrContext];
+				}
+
+				otrContext = otrContext->next;
+			}
+		}];
+	}];
+}
+
+#pragma mark -
+#pragma mark Admission
+
+- (void)setAdmissionPolicy:(OTRKitAdmissionPolicy)admissionPolicy
+{
+	self.submissionQueue.policy = admissionPolicy;
+}
+
+- (OTRKitAdmissionPolicy)admissionPolicy
+{
+	return self.submissionQueue.policy;
+}
+
+- (void)setMaximumPendingOperations:(NSUInteger)maximumPendingOperations
+{
+	self.submissionQueue.maximumDepth = maximumPendingOperations;
+}
+
+- (NSUInteger)maximumPendingOperations
+{
+	return self.submissionQueue.maximumDepth;
+}
+
+- (void)setMaximumPendingOperationsPerConversation:(NSUInteger)maximumPendingOperationsPerConversation
+{
+	self.submissionQueue.maximumDepthPerConversation = maximumPendingOperationsPerConversation;
+}
+
+- (NSUInteger)maximumPendingOperationsPerConversation
+{
+	return self.submissionQueue.maximumDepthPerConversation;
+}
+
+- (void)setOperationsPerHandshake:(NSUInteger)operationsPerHandshake
+{
+	self.submissionQueue.operationsPerHandshake = operationsPerHandshake;
+}
+
+- (NSUInteger)operationsPerHandshake
+{
+	return self.submissionQueue.operationsPerHandshake;
+}
+
+- (void)setReplayCacheSize:(NSUInteger)replayCacheSize
+{
+	[self _performAsyncOperationOnInternalQueue:^{
+		self->_replayCacheSize = replayCacheSize;
+	}];
+}
+
+- (NSUInteger)pendingOperationCount
+{
+	return self.submissionQueue.depth;
+}
+
+- (NSUInteger)pendingOperationCountForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	OTRKitConversation *conversation = [self _conversationForUsername:username accountName:accountName protocol:protocol create:NO];
+
+	if (conversation == nil) {
+		return 0;
+	}
+
+	return [self.submissionQueue depthForConversation:conversation.conversationKey];
+}
+
+- (void)_submitOperation:(dispatch_block_t)block conversation:(OTRKitConversation *)conversation priority:(OTRKitPriority)priority handshake:(BOOL)handshake tag:(nullable id)tag rejectionBlock:(OTRKitSubmissionQueueRejectionBlock)rejectionBlock
+{
+	NSParameterAssert(block != NULL);
+	NSParameterAssert(conversation != nil);
+	NSParameterAssert(rejectionBlock != NULL);
+
+	/* Waiting for room on the internal queue while on it would never end */
+	if ([self _isOnInternalQueue]) {
+		block();
+
+		return;
+	}
+
+	OTRKitMetrics *metrics = self.metrics;
+
+	[self.submissionQueue submitOperation:block
+						  forConversation:conversation.conversationKey
+								 priority:priority
+								handshake:handshake
+									  tag:tag
+						   rejectionBlock:^(NSError *error) {
+							   if (error.code == OTRKitErrorCodeOperationCancelled) {
+								   OTRKitMetricsIncrementCounter(metrics, OTRKitMetricsCounterOperationsCancelled);
+							   } else if (error.code == OTRKitErrorCodeOperationDropped) {
+								   OTRKitMetricsIncrementCounter(metrics, OTRKitMetricsCounterOperationsDropped);
+							   } else {
+								   OTRKitMetricsIncrementCounter(metrics, OTRKitMetricsCounterOperationsRejected);
+							   }
+
+							   rejectionBlock(error);
+
+							   [self _performAsyncOperationOnInternalQueue:^{
+								   [self _forgetConversationIfUnused:conversation];
+							   }];
+						   }];
+}
+
+/* Operations that aren't tied to a conversation are never turned away */
+- (void)_submitOperation:(dispatch_block_t)block priority:(OTRKitPriority)priority
+{
+	NSParameterAssert(block != NULL);
+
+	[self.submissionQueue submitOperation:block forConversation:nil priority:priority handshake:NO tag:nil rejectionBlock:nil];
+}
+
+- (void)cancelOperationsWithTag:(id)tag
+{
+	NSParameterAssert(tag != nil);
+
+	[self.submissionQueue cancelOperationsPassingTest:^BOOL(NSString *conversation, id operationTag) {
+		return [operationTag isEqual:tag];
+	}];
+
+	[self.fragmentScheduler discardMessagesWithTag:tag];
+}
+
+- (void)cancelOperationsForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	OTRKitConversation *conversation = [self _conversationForUsername:username accountName:accountName protocol:protocol create:NO];
+
+	if (conversation) {
+		NSString *submissionKey = conversation.conversationKey;
+
+		[self.submissionQueue cancelOperationsPassingTest:^BOOL(NSString *operationConversation, id operationTag) {
+			return [operationConversation isEqualToString:submissionKey];
+		}];
+	}
+
+	[self.fragmentScheduler discardMessagesForUsername:username accountName:accountName protocol:protocol];
+}
+
+- (void)cancelOperationsForAccountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	/* Submission keys end with the account name and protocol */
+	NSString *accountSuffix = [NSString stringWithFormat:@" <-> %@ <-> %@", accountName, protocol];
+
+	[self.submissionQueue cancelOperationsPassingTest:^BOOL(NSString *conversation, id operationTag) {
+		return [conversation hasSuffix:accountSuffix];
+	}];
+
+	[self.fragmentScheduler discardMessagesForAccountName:accountName protocol:protocol];
+}
+
+- (void)_performSyncOperation:(dispatch_block_t)block priority:(OTRKitPriority)priority
+{
+	NSParameterAssert(block != NULL);
+
+	if ([self _isOnInternalQueue]) {
+		block();
+
+		return;
+	}
+
+	dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+
+	[self _submitOperation:^{
+		block();
+
+		dispatch_semaphore_signal(semaphore);
+	} priority:priority];
+
+	dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER);
+}
+
+#pragma mark -
+#pragma mark Data Transfer
+
+- (void)_sendDataTransferTLV:(OTRTLV *)tlv username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(tlv != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	[self _performAsyncOperationOnInternalQueue:^{
+		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+
+		if ([self _messageStateForContext:otrContext] != OTRKitMessageStateEncrypted) {
+			return;
+		}
+
+		[self _encodeMessage:nil
+						tlvs:@[tlv]
+					username:username
+				 accountName:accountName
+					protocol:protocol
+						 tag:nil
+				   inContext:otrContext
+			  notifyDelegate:NO
+				  completion:nil];
+	}];
+}
+
+- (nullable NSArray<OTRTLV *> *)_tlvArrayByHandlingDataTLVs:(NSArray<OTRTLV *> *)tlvs username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(tlvs != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	NSMutableArray<OTRTLV *> *remainingTLVs = [NSMutableArray arrayWithCapacity:tlvs.count];
+
+	for (OTRTLV *tlv in tlvs) {
+		if (tlv.type == OTRTLVTypeDataRequest || tlv.type == OTRTLVTypeDataResponse) {
+			[self.dataTransferManager handleTLV:tlv username:username accountName:accountName protocol:protocol];
+		} else {
+			[remainingTLVs addObject:tlv];
+		}
+	}
+
+	if (remainingTLVs.count == 0) {
+		return nil;
+	}
+
+	return [remainingTLVs copy];
+}
+
+#pragma mark -
+#pragma mark Injection
+
+- (void)_injectMessage:(NSString *)message username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol tag:(nullable id)tag
+{
+	NSParameterAssert(message != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	OTRKitMetricsIncrementCounter(self.metrics, OTRKitMetricsCounterMessagesInjected);
+
+	/* Messages pass through the scheduler so that fragments of a long
+	 message are paced for accounts that have an injection rate. */
+	[self.fragmentScheduler enqueueMessage:message username:username accountName:accountName protocol:protocol tag:tag traceOperation:self.traceOperation];
+}
+
+- (void)_deliverInjectedMessage:(NSString *)message username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol tag:(nullable id)tag traceOperation:(uint64_t)traceOperation
+{
+	NSParameterAssert(message != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	if ([self _resultsAreBatched]) {
+		[self _batchResultOfType:OTRKitMessageResultTypeInjected
+						 message:message
+					wasEncrypted:NO
+							tlvs:nil
+						username:username
+					 accountName:accountName
+						protocol:protocol
+							 tag:tag
+						   error:nil];
+
+		return;
+	}
+
+	uint64_t deliveryTime = ((traceOperation) ? OTRKitMetricsNow() : 0);
+
+	[self _performAsyncOperationOnDelegateQueue:^{
+		[self.delegate otrKit:self injectMessage:message username:username accountName:accountName protocol:protocol tag:tag];
+
+		if (traceOperation) {
+			OTRKitTraceRecordSpan("injectMessage delegate", traceOperation, deliveryTime, OTRKitMetricsNow(), tag);
+		}
+	}];
+}
+
+#pragma mark -
+#pragma mark Result Batching
+
+- (void)setMaximumResultBatchSize:(NSUInteger)maximumResultBatchSize
+{
+	self.resultBatcher.maximumBatchSize = maximumResultBatchSize;
+}
+
+- (NSUInteger)maximumResultBatchSize
+{
+	return self.resultBatcher.maximumBatchSize;
+}
+
+- (void)setMaximumResultBatchDelay:(NSTimeInterval)maximumResultBatchDelay
+{
+	NSParameterAssert(maximumResultBatchDelay >= 0);
+
+	self.resultBatcher.maximumDelay = maximumResultBatchDelay;
+}
+
+- (NSTimeInterval)maximumResultBatchDelay
+{
+	return self.resultBatcher.maximumDelay;
+}
+
+- (void)setBatchesDelegateResults:(BOOL)batchesDelegateResults
+{
+	self->_batchesDelegateResults = batchesDelegateResults;
+
+	/* Results collected so far aren't left waiting for the delay */
+	if (batchesDelegateResults == NO) {
+		[self.resultBatcher flush];
+	}
+}
+
+- (BOOL)_resultsAreBatched
+{
+	return (self.batchesDelegateResults &&
+			[self.delegate respondsToSelector:@selector(otrKit:didProduceMessageResults:)]);
+}
+
+- (void)_batchResultOfType:(OTRKitMessageResultType)type
+				   message:(nullable NSString *)message
+			  wasEncrypted:(BOOL)wasEncrypted
+					  tlvs:(nullable NSArray<OTRTLV *> *)tlvs
+				  username:(NSString *)username
+			   accountName:(NSString *)accountName
+				  protocol:(NSString *)protocol
+					   tag:(nullable id)tag
+					 error:(nullable NSError *)error
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	OTRKitMessageResult *result = [OTRKitMessageResult new];
+
+	result.type = type;
+
+	result.message = message;
+
+	result.wasEncrypted = wasEncrypted;
+
+	result.tlvs = tlvs;
+
+	result.username = username;
+	result.accountName = accountName;
+
+	result.protocol = protocol;
+
+	result.tag = tag;
+
+	result.error = error;
+
+	[self.resultBatcher addResult:result];
+}
+
+- (void)_submissionQueueDidPerformOperation
+{
+	/* Everything produced by this drain of the submission queue goes out together */
+	if (self.batchesDelegateResults && self.submissionQueue.depth == 0) {
+		[self.resultBatcher flush];
+	}
+}
+
+- (void)_deliverResults:(NSArray<OTRKitMessageResult *> *)results
+{
+	NSParameterAssert(results != nil);
+
+	/* This is called on the queue of the batcher which
+	 -_performAsyncOperationOnDelegateQueue: waits on. */
+	[self _performBlockOnDelegateQueue:^{
+		[self.delegate otrKit:self didProduceMessageResults:results];
+	} asynchronously:YES];
+}
+
+#pragma mark -
+#pragma mark Helpers
+
+- (nullable NSError *)_errorForGPGError:(gcry_error_t)gpg_error
+{
+	if (gpg_error == gcry_err_code(GPG_ERR_NO_ERROR)) {
+		return nil;
+	}
+
+	const char *gpg_error_string = gcry_strerror(gpg_error);
+	const char *gpg_error_source = gcry_strsource(gpg_error);
+
+	gpg_err_code_t gpg_error_code = gcry_err_code(gpg_error);
+
+	int errorCode = gcry_err_code_to_errno(gpg_error_code);
+
+	NSString *errorString = nil;
+
+	if (gpg_error_string) {
+		errorString = @(gpg_error_string);
+	}
+
+	NSString *errorSource = nil;
+
+	if (gpg_error_source) {
+		errorSource = @(gpg_error_source);
+	}
+
+	NSMutableString *errorDescription = [NSMutableString string];
+
+	if (errorString) {
+		[errorDescription appendString:errorString];
+	}
+
+	if (errorSource) {
+		[errorDescription appendString:@" - "];
+		[errorDescription appendString:errorSource];
+	}
+
+	NSError *error = [NSError errorWithDomain:OTRKitErrorDomain
+										 code:errorCode
+									 userInfo:@{NSLocalizedDescriptionKey : errorDescription}];
+
+	return error;
+}
+
+#pragma mark -
+#pragma mark TLV
+
+/* The chain is a single allocation to be released with free().
+ TLV data is not copied. Each element points at the data of its
+ OTRTLV which means tlvs must outlive the chain. */
+- (nullable OtrlTLV *)_tlvChainForTLVs:(NSArray<OTRTLV *> *)tlvs
+{
+	NSParameterAssert(tlvs != nil);
+
+	NSUInteger validTLVCount = 0;
+
+	for (OTRTLV *tlv in tlvs) {
+		if (tlv.validLength) {
+			validTLVCount++;
+		}
+	}
+
+	if (validTLVCount == 0) {
+		return NULL;
+	}
+
+	OtrlTLV *tlv_chain = calloc(validTLVCount, sizeof(OtrlTLV));
+
+	if (tlv_chain == NULL) {
+		return NULL;
+	}
+
+	NSUInteger tlvIndex = 0;
+
+	for (OTRTLV *tlv in tlvs) {
+		if (tlv.validLength == NO) {
+			continue;
+		}
+
+		OtrlTLV *current_tlv = &tlv_chain[tlvIndex];
+
+		current_tlv->type = tlv.type;
+		current_tlv->len = (unsigned short)tlv.data.length;
+		current_tlv->data = (unsigned char *)tlv.data.bytes;
+
+		if (tlvIndex > 0) {
+			tlv_chain[(tlvIndex - 1)].next = current_tlv;
+		}
+
+		tlvIndex++;
+	}
+
+	return tlv_chain;
+}
+
+/* Takes ownership of tlv_chain. The data of each OTRTLV returned
+ wraps the bytes of the chain instead of copying them. */
+- (NSArray<OTRTLV *> *)_tlvArrayForTLVChain:(OtrlTLV *)tlv_chain
+{
+	NSParameterAssert(tlv_chain != nil);
+
+	OTRKitTLVChain *chainOwner = [OTRKitTLVChain new];
+
+	chainOwner.tlv_chain = tlv_chain;
+
+	NSMutableArray *tlvArray = [NSMutableArray array];
+
+	OtrlTLV *current_tlv = tlv_chain;
+
+	while (current_tlv) {
+		NSData *tlvData = nil;
+
+		if (current_tlv->len > 0 && current_tlv->data) {
+			tlvData =
+			[[NSData alloc] initWithBytesNoCopy:current_tlv->data
+										 length:current_tlv->len
+									deallocator:^(void *bytes, NSUInteger length) {
+										(void)chainOwner;
+									}];
+		} else {
+			tlvData = [NSData data];
+		}
+
+		OTRTLVType type = current_tlv->type;
+
+		OTRTLV *tlv = [[OTRTLV alloc] initWithType:type data:tlvData];
+
+		[tlvArray addObject:tlv];
+
+		current_tlv = current_tlv->next;
+	}
+
+	return [tlvArray copy];
+}
+
+#pragma mark -
+#pragma mark Context
+
+- (nullable ConnContext *)_contextForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	return [self _contextForConversation:[self _conversationForUsername:username accountName:accountName protocol:protocol]];
+}
+
+- (nullable ConnContext *)_contextForConversation:(OTRKitConversation *)conversation
+{
+	NSParameterAssert(conversation != nil);
+
+	ConnContext *context = otrl_context_find(self.userState, conversation.usernameUTF8, conversation.accountNameUTF8, conversation.protocolUTF8, OTRL_INSTAG_BEST, YES, NULL, NULL, NULL);
+
+	if (context) {
+		OTRKitContextData *contextData = [self _contextDataForContext:context];
+
+		contextData.lastUsedTime = [NSDate timeIntervalSinceReferenceDate];
+
+		if (contextData.conversation == nil) {
+			contextData.conversation = conversation;
+		}
+
+		if (contextData.conversation == conversation) {
+			conversation.hasContext = YES;
+		}
+	}
+
+	self.currentConversation = conversation;
+
+	return context;
+}
+
+- (OTRKitContextData *)_contextDataForContext:(ConnContext *)context
+{
+	NSParameterAssert(context != NULL);
+
+	/* Instance children share the data of their master context. */
+	ConnContext *masterContext = context->m_context;
+
+	if (masterContext == NULL) {
+		masterContext = context;
+	}
+
+	if (masterContext->app_data == NULL) {
+		OTRKitContextData *contextData = [OTRKitContextData new];
+
+		masterContext->app_data = (void *)CFBridgingRetain(contextData);
+
+		masterContext->app_data_free = context_data_free_cb;
+	}
+
+	return (__bridge OTRKitContextData *)masterContext->app_data;
+}
+
+#pragma mark -
+#pragma mark Conversations
+
+- (OTRKitConversation *)_conversationForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	return [self _conversationForUsername:username accountName:accountName protocol:protocol create:YES];
+}
+
+/* Without create, nil is returned for a conversation not yet made. Nothing
+ is queued, reserved, or cached for it, so lookups needn't make one. */
+- (nullable OTRKitConversation *)_conversationForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol create:(BOOL)create
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	OTRKitConversation *conversation = nil;
+
+	pthread_mutex_lock(&self->_conversationsLock);
+
+	/* A remote user rarely talks to more than one account */
+	NSMutableArray<OTRKitConversation *> *conversations = self.conversations[username];
+
+	for (OTRKitConversation *existingConversation in conversations) {
+		if ([existingConversation.accountName isEqualToString:accountName] &&
+			[existingConversation.protocol isEqualToString:protocol])
+		{
+			conversation = existingConversation;
+
+			break;
+		}
+	}
+
+	if (conversation == nil && create) {
+		conversation = [[OTRKitConversation alloc] initWithUsername:username accountName:accountName protocol:protocol];
+
+		if (conversations == nil) {
+			conversations = [NSMutableArray arrayWithCapacity:1];
+
+			self.conversations[conversation.username] = conversations;
+		}
+
+		[conversations addObject:conversation];
+	}
+
+	pthread_mutex_unlock(&self->_conversationsLock);
+
+	return conversation;
+}
+
+/* For callbacks that libotr only gives names to. These are usually
+ for the conversation an operation is running for. */
+- (OTRKitConversation *)_conversationForUsernameUTF8:(const char *)username accountNameUTF8:(const char *)accountName protocolUTF8:(const char *)protocol
+{
+	NSParameterAssert(username != NULL);
+	NSParameterAssert(accountName != NULL);
+	NSParameterAssert(protocol != NULL);
+
+	OTRKitConversation *conversation = self.currentConversation;
+
+	if (conversation && [conversation isForUsernameUTF8:username accountNameUTF8:accountName protocolUTF8:protocol]) {
+		return conversation;
+	}
+
+	return [self _conversationForUsername:@(username) accountName:@(accountName) protocol:@(protocol)];
+}
+
+- (OTRKitConversation *)_conversationForContext:(ConnContext *)context
+{
+	NSParameterAssert(context != NULL);
+
+	OTRKitContextData *contextData = [self _contextDataForContext:context];
+
+	OTRKitConversation *conversation = contextData.conversation;
+
+	/* Contexts created by libotr itself, or read from storage,
+	 are given their conversation the first time it's needed. */
+	if (conversation == nil) {
+		conversation = [self _conversationForUsernameUTF8:context->username accountNameUTF8:context->accountname protocolUTF8:context->protocol];
+
+		conversation.hasContext = YES;
+
+		contextData.conversation = conversation;
+	}
+
+	return conversation;
+}
+
+- (void)_forgetConversation:(OTRKitConversation *)conversation
+{
+	NSParameterAssert(conversation != nil);
+
+	pthread_mutex_lock(&self->_conversationsLock);
+
+	NSMutableArray<OTRKitConversation *> *conversations = self.conversations[conversation.username];
+
+	[conversations removeObjectIdenticalTo:conversation];
+
+	if (conversations && conversations.count == 0) {
+		[self.conversations removeObjectForKey:conversation.username];
+	}
+
+	pthread_mutex_unlock(&self->_conversationsLock);
+
+	if (self.currentConversation == conversation) {
+		self.currentConversation = nil;
+	}
+}
+
+/* A conversation is made as soon as an operation names it. If the
+ operation is turned away, or never needs libotr to make a context,
+ nothing forgets the conversation along with a context later. */
+- (void)_forgetConversationIfUnused:(OTRKitConversation *)conversation
+{
+	NSParameterAssert(conversation != nil);
+
+	if (conversation.hasContext) {
+		return;
+	}
+
+	NSString *submissionKey = conversation.conversationKey;
+
+	if (self.smpReservations[submissionKey] ||
+		[self.submissionQueue depthForConversation:submissionKey] > 0)
+	{
+		return;
+	}
+
+	ConnContext *context = otrl_context_find(self.userState, conversation.usernameUTF8, conversation.accountNameUTF8, conversation.protocolUTF8, OTRL_INSTAG_BEST, NO, NULL, NULL, NULL);
+
+	if (context) {
+		OTRKitContextData *contextData = [self _contextDataForContext:context];
+
+		if (contextData.conversation == nil) {
+			contextData.conversation = conversation;
+		}
+
+		/* Otherwise it is looked at again once the context is gone */
+		if (contextData.conversation == conversation) {
+			conversation.hasContext = YES;
+		}
+
+		return;
+	}
+
+	[self _forgetConversation:conversation];
+}
+
+- (void)_forgetConversationsWithoutContexts
+{
+	NSMutableArray<OTRKitConversation *> *conversations = [NSMutableArray array];
+
+	pthread_mutex_lock(&self->_conversationsLock);
+
+	for (NSArray<OTRKitConversation *> *conversationsForUsername in self.conversations.allValues) {
+		for (OTRKitConversation *conversation in conversationsForUsername) {
+			if (conversation.hasContext == NO) {
+				[conversations addObject:conversation];
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&self->_conversationsLock);
+
+	for (OTRKitConversation *conversation in conversations) {
+		[self _forgetConversationIfUnused:conversation];
+	}
+}
+
+#pragma mark -
+#pragma mark Context Eviction
+
+- (void)setContextIdleInterval:(NSTimeInterval)contextIdleInterval
+{
+	NSParameterAssert(contextIdleInterval >= 0);
+
+	[self _performAsyncOperationOnInternalQueue:^{
+		self->_contextIdleInterval = contextIdleInterval;
+
+		[self _updateEvictionTimer];
+	}];
+}
+
+- (void)setMaximumContextCount:(NSUInteger)maximumContextCount
+{
+	[self _performAsyncOperationOnInternalQueue:^{
+		self->_maximumContextCount = maximumContextCount;
+
+		[self _updateEvictionTimer];
+	}];
+}
+
+- (void)_updateEvictionTimer
+{
+	BOOL evictionEnabled = (self->_contextIdleInterval > 0 || self->_maximumContextCount > 0);
+
+	if (evictionEnabled == NO) {
+		if (self.evictionTimer) {
+			dispatch_source_cancel(self.evictionTimer);
+
+			self.evictionTimer = nil;
+		}
+
+		return;
+	}
+
+	if (self.evictionTimer) {
+		return;
+	}
+
+	dispatch_source_t evictionTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.internalQueue);
+
+	uint64_t interval = (kOTRKitContextEvictionInterval * NSEC_PER_SEC);
+
+	dispatch_source_set_timer(evictionTimer, dispatch_time(DISPATCH_TIME_NOW, interval), interval, (interval / 10));
+
+	__weak OTRKit *weakSelf = self;
+
+	dispatch_source_set_event_handler(evictionTimer, ^{
+		[weakSelf _evictIdleContexts];
+	});
+
+	dispatch_resume(evictionTimer);
+
+	self.evictionTimer = evictionTimer;
+}
+
+- (void)evictIdleContexts
+{
+	[self _submitOperation:^{
+		[self _evictIdleContexts];
+	} priority:OTRKitPriorityBackground];
+}
+
+/* A context can only be forgotten if nothing would be lost by doing
+ so. Forgetting a context also forgets its fingerprints, which are
+ written to disk next time, so contexts that have any are kept. */
+- (BOOL)_contextCanBeEvicted:(ConnContext *)context
+{
+	NSParameterAssert(context != NULL);
+
+	if (context->msgstate != OTRL_MSGSTATE_PLAINTEXT) {
+		return NO;
+	}
+
+	if (context->auth.authstate != OTRL_AUTHSTATE_NONE) {
+		return NO;
+	}
+
+	if (context->smstate && context->smstate->nextExpected != OTRL_SMP_EXPECT1) {
+		return NO;
+	}
+
+	if (context->fingerprint_root.next != NULL) {
+		return NO;
+	}
+
+	/* The encode path relies on remembering that an offer was rejected */
+	if (context->otr_offer == OFFER_REJECTED) {
+		return NO;
+	}
+
+	return YES;
+}
+
+- (void)_evictIdleContexts
+{
+	NSTimeInterval idleInterval = self->_contextIdleInterval;
+
+	NSUInteger maximumContextCount = self->_maximumContextCount;
+
+	if (idleInterval <= 0 && maximumContextCount == 0) {
+		return;
+	}
+
+	if (self.userState == NULL) {
+		return;
+	}
+
+	NSTimeInterval currentTime = [NSDate timeIntervalSinceReferenceDate];
+
+	/* Instance children are forgotten with their master context.
+	 One that can't be forgotten keeps its master around as well. */
+	NSMutableSet<NSValue *> *retainedContexts = [NSMutableSet set];
+
+	NSMutableArray<NSValue *> *masterContexts = [NSMutableArray array];
+
+	ConnContext *otrContext = self.userState->context_root;
+
+	while (otrContext) {
+		ConnContext *masterContext = otrContext->m_context;
+
+		if (masterContext == NULL) {
+			masterContext = otrContext;
+		}
+
+		if (masterContext == otrContext) {
+			[masterContexts addObject:[NSValue valueWithPointer:otrContext]];
+		}
+
+		if ([self _contextCanBeEvicted:otrContext] == NO) {
+			[retainedContexts addObject:[NSValue valueWithPointer:masterContext]];
+		}
+
+		otrContext = otrContext->next;
+	}
+
+	NSMutableArray<NSValue *> *candidates = [NSMutableArray array];
+
+	for (NSValue *contextValue in masterContexts) {
+		if ([retainedContexts containsObject:contextValue]) {
+			continue;
+		}
+
+		ConnContext *masterContext = contextValue.pointerValue;
+
+		OTRKitContextData *contextData = [self _contextDataForContext:masterContext];
+
+		/* Contexts created by libotr itself have never been looked up */
+		if (contextData.lastUsedTime == 0) {
+			contextData.lastUsedTime = currentTime;
+		}
+
+		/* A context in use moments ago may be reassembling fragments */
+		if ((currentTime - contextData.lastUsedTime) < kOTRKitContextMinimumIdleInterval) {
+			continue;
+		}
+
+		/* Contexts that were never looked up aren't given a conversation here */
+		NSString *submissionKey = contextData.conversation.conversationKey;
+
+		if (submissionKey == nil) {
+			submissionKey = [NSString stringWithFormat:@"%s <-> %s <-> %s", masterContext->username, masterContext->accountname, masterContext->protocol];
+		}
+
+		if (self.smpReservations[submissionKey] ||
+			[self.submissionQueue depthForConversation:submissionKey] > 0)
+		{
+			continue;
+		}
+
+		[candidates addObject:contextValue];
+	}
+
+	/* Least recently used first */
+	[candidates sortUsingComparator:^NSComparisonResult(NSValue *value1, NSValue *value2) {
+		NSTimeInterval lastUsedTime1 = [self _contextDataForContext:value1.pointerValue].lastUsedTime;
+		NSTimeInterval lastUsedTime2 = [self _contextDataForContext:value2.pointerValue].lastUsedTime;
+
+		if (lastUsedTime1 < lastUsedTime2) {
+			return NSOrderedAscending;
+		} else if (lastUsedTime1 > lastUsedTime2) {
+			return NSOrderedDescending;
+		}
+
+		return NSOrderedSame;
+	}];
+
+	NSUInteger excessCount = 0;
+
+	if (maximumContextCount > 0 && masterContexts.count > maximumContextCount) {
+		excessCount = (masterContexts.count - maximumContextCount);
+	}
+
+	NSUInteger evictedCount = 0;
+
+	for (NSValue *contextValue in candidates) {
+		ConnContext *masterContext = contextValue.pointerValue;
+
+		BOOL isIdle = (idleInterval > 0 &&
+					   (currentTime - [self _contextDataForContext:masterContext].lastUsedTime) >= idleInterval);
+
+		/* Candidates are sorted so none of those that follow are idle either */
+		if (isIdle == NO && excessCount == 0) {
+			break;
+		}
+
+		OTRKitConversation *conversation = [self _contextDataForContext:masterContext].conversation;
+
+		if (conversation) {
+			[self _forgetConversation:conversation];
+		}
+
+		otrl_context_forget(masterContext);
+
+		evictedCount += 1;
+
+		if (excessCount > 0) {
+			excessCount -= 1;
+		}
+	}
+
+	if (evictedCount > 0) {
+		OTRKitMetricsAddToCounter(self.metrics, OTRKitMetricsCounterContextsEvicted, evictedCount);
+	}
+
+	/* Including those made for a context that was just evicted
+	 without ever being attached to it */
+	[self _forgetConversationsWithoutContexts];
+}
+
+- (BOOL)isGeneratingKeyForAccountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	__block BOOL generatingKey = NO;
+
+	[self _performSyncOperationOnInternalQueue:^{
+		void *otrKey;
+
+		gcry_error_t otrError = otrl_privkey_generate_start(self.userState, accountName.UTF8String, protocol.UTF8String, &otrKey);
+
+		if (otrError == 0) {
+			otrl_privkey_generate_cancelled(self.userState, otrKey);
+		}
+
+		generatingKey = (otrError == gcry_error(GPG_ERR_EEXIST));
+	}];
+
+	return generatingKey;
+}
+
+#pragma mark -
+#pragma mark Message State Management
+
+- (OTRKitMessageState)_messageStateForContext:(nullable ConnContext *)otrContext
+{
+	NSParameterAssert(otrContext != nil);
+
+	switch (otrContext->msgstate) {
+		case OTRL_MSGSTATE_ENCRYPTED:
+		{
+			return OTRKitMessageStateEncrypted;
+
+			break;
+		}
+		case OTRL_MSGSTATE_FINISHED:
+		{
+			return OTRKitMessageStateFinished;
+
+			break;
+		}
+		case OTRL_MSGSTATE_PLAINTEXT:
+		{
+			return OTRKitMessageStatePlaintext;
+
+			break;
+		}
+	}
+
+	return OTRKitMessageStatePlaintext;
+}
+
+- (OTRKitMessageState)messageStateForUsername:(NSString *)username
+								  accountName:(NSString *)accountName
+									 protocol:(NSString *)protocol
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	__block OTRKitMessageState messageState = OTRKitMessageStatePlaintext;
+
+	[self _performSyncOperationOnInternalQueue:^{
+		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+
+		if (otrContext == NULL) {
+			return;
+		}
+
+		messageState = [self _messageStateForContext:otrContext];
+	}];
+
+	return messageState;
+}
+
+- (OTRKitOfferState)_offerStateForContext:(ConnContext *)otrContext
+{
+	NSParameterAssert(otrContext != nil);
+
+	switch (otrContext->otr_offer) {
+		case OFFER_NOT:
+		{
+			return OTRKitOfferStateNone;
+
+			break;
+		}
+		case OFFER_ACCEPTED:
+		{
+			return OTRKitOfferStateAccepted;
+
+			break;
+		}
+		case OFFER_REJECTED:
+		{
+			return OTRKitOfferStateRejected;
+
+			break;
+		}
+		case OFFER_SENT:
+		{
+			return OTRKitOfferStateSent;
+
+			break;
+		}
+	}
+
+	return OTRKitOfferStateNone;
+}
+
+- (OTRKitOfferState)offerStateForUsername:(NSString *)username
+							  accountName:(NSString *)accountName
+								 protocol:(NSString *)protocol
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	__block OTRKitOfferState offerState = OTRKitOfferStateNone;
+
+	[self _performSyncOperationOnInternalQueue:^{
+		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+
+		if (otrContext == NULL) {
+			return;
+		}
+
+		offerState = [self _offerStateForContext:otrContext];
+	}];
+	
+	return offerState;
+}
+
+- (OTRKitMessageType)typeOfMessage:(NSString *)message
+{
+	NSParameterAssert(message != nil);
+
+	__block OTRKitMessageType messageType = OTRKitMessageTypeUnknown;
+
+	[self _performSyncOperationOnInternalQueue:^{
+		messageType = [self _typeOfMessage:message];
+	}];
+
+	return messageType;
+}
+
+- (BOOL)_typeOfMessageIsHandshake:(OTRKitMessageType)messageType
+{
+	switch (messageType) {
+		case OTRKitMessageTypeTaggedPlainText:
+		case OTRKitMessageTypeQuery:
+		case OTRKitMessageTypeDHCommit:
+		case OTRKitMessageTypeDHKey:
+		case OTRKitMessageTypeRevealSignature:
+		case OTRKitMessageTypeSignature:
+		case OTRKitMessageTypeV1KeyExchange:
+		{
+			return YES;
+		}
+		default:
+		{
+			return NO;
+		}
+	}
+}
+
+/* Each data message carries its own counter and MAC so the same text
+ only arrives twice when something delivered it twice. Remembering
+ it drops the copy before libotr spends time decrypting it and
+ reports an error for it. */
+/* Fragments are "?OTR|sender|receiver,k,n,piece," in version 3 and "?OTR,k,n,piece,"
+ in version 2. The first piece of a data message begins with its header in base64:
+ "?OTR:AAMD" in version 3 and "?OTR:AAID" in version 2. */
+static BOOL OTRKitFragmentBeginsDataMessage(const char *message)
+{
+	const char *fragmentFields = NULL;
+
+	if (strncmp(message, "?OTR|", 5) == 0) {
+		fragmentFields = strchr(message, ',');
+	} else if (strncmp(message, "?OTR,", 5) == 0) {
+		fragmentFields = (message + 4);
+	}
+
+	if (fragmentFields == NULL) {
+		return NO;
+	}
+
+	unsigned short fragmentIndex = 0;
+	unsigned short fragmentCount = 0;
+
+	int pieceOffset = 0;
+
+	if (sscanf(fragmentFields, ",%hu,%hu,%n", &fragmentIndex, &fragmentCount, &pieceOffset) != 2 || pieceOffset == 0) {
+		return NO;
+	}
+
+	if (fragmentIndex != 1) {
+		return NO;
+	}
+
+	const char *piece = (fragmentFields + pieceOffset);
+
+	return (strncmp(piece, "?OTR:AAMD", 9) == 0 ||
+			strncmp(piece, "?OTR:AAID", 9) == 0);
+}
+
+- (BOOL)_messageIsReplayed:(NSString *)message ofType:(OTRKitMessageType)messageType context:(ConnContext *)context
+{
+	NSParameterAssert(message != nil);
+	NSParameterAssert(context != NULL);
+
+	NSUInteger replayCacheSize = self->_replayCacheSize;
+
+	if (replayCacheSize == 0) {
+		return NO;
+	}
+
+	const char *messageBytes = message.UTF8String;
+
+	/* libotr answers an AKE message it receives again with the same reply,
+	 which is how a lost reply is recovered from, so only data messages are
+	 remembered. Of a fragmented one, only the first fragment is. The others
+	 are discarded by libotr without it. */
+	BOOL messageIsFragment = ([message hasPrefix:@"?OTR|"] || [message hasPrefix:@"?OTR,"]);
+
+	if (messageIsFragment) {
+		if (OTRKitFragmentBeginsDataMessage(messageBytes) == NO) {
+			return NO;
+		}
+	} else if (messageType != OTRKitMessageTypeData) {
+		return NO;
+	}
+
+	uint8_t messageDigestBytes[32];
+
+	gcry_md_hash_buffer(GCRY_MD_SHA256, messageDigestBytes, messageBytes, strlen(messageBytes));
+
+	NSData *messageDigest = [NSData dataWithBytes:messageDigestBytes length:kOTRKitReplayDigestLength];
+
+	OTRKitContextData *contextData = [self _contextDataForContext:context];
+
+	NSMutableOrderedSet *recentMessageDigests = contextData.recentMessageDigests;
+
+	if ([recentMessageDigests containsObject:messageDigest]) {
+		OTRKitMetricsIncrementCounter(self.metrics, OTRKitMetricsCounterReplayCacheHits);
+
+		return YES;
+	}
+
+	OTRKitMetricsIncrementCounter(self.metrics, OTRKitMetricsCounterReplayCacheMisses);
+
+	if (recentMessageDigests == nil) {
+		recentMessageDigests = [NSMutableOrderedSet orderedSet];
+
+		contextData.recentMessageDigests = recentMessageDigests;
+	}
+
+	[recentMessageDigests addObject:messageDigest];
+
+	while (recentMessageDigests.count > replayCacheSize) {
+		[recentMessageDigests removeObjectAtIndex:0];
+	}
+
+	return NO;
+}
+
+- (OTRKitMessageType)_typeOfMessage:(NSString *)message
+{
+	NSParameterAssert(message != nil);
+
+	OtrlMessageType otrMessageType = otrl_proto_message_type(message.UTF8String);
+
+	__block OTRKitMessageType messageType = OTRKitMessageTypeUnknown;
+
+	switch (otrMessageType) {
+		case OTRL_MSGTYPE_NOTOTR:
+		{
+			messageType = OTRKitMessageTypeNotOTR;
+
+			break;
+		}
+		case OTRL_MSGTYPE_TAGGEDPLAINTEXT:
+		{
+			messageType = OTRKitMessageTypeTaggedPlainText;
+
+			break;
+		}
+		case OTRL_MSGTYPE_QUERY:
+		{
+			messageType = OTRKitMessageTypeQuery;
+
+			break;
+		}
+		case OTRL_MSGTYPE_DH_COMMIT:
+		{
+			messageType = OTRKitMessageTypeDHCommit;
+
+			break;
+		}
+		case OTRL_MSGTYPE_DH_KEY:
+		{
+			messageType = OTRKitMessageTypeDHKey;
+
+			break;
+		}
+		case OTRL_MSGTYPE_REVEALSIG:
+		{
+			messageType = OTRKitMessageTypeRevealSignature;
+
+			break;
+		}
+		case OTRL_MSGTYPE_SIGNATURE:
+		{
+			messageType = OTRKitMessageTypeSignature;
+
+			break;
+		}
+		case OTRL_MSGTYPE_V1_KEYEXCH:
+		{
+			messageType = OTRKitMessageTypeV1KeyExchange;
+
+			break;
+		}
+		case OTRL_MSGTYPE_DATA:
+		{
+			messageType = OTRKitMessageTypeData;
+
+			break;
+		}
+		case OTRL_MSGTYPE_ERROR:
+		{
+			messageType = OTRKitMessageTypeError;
+
+			break;
+		}
+		case OTRL_MSGTYPE_UNKNOWN:
+		{
+			messageType = OTRKitMessageTypeUnknown;
+
+			break;
+		}
+	}
+
+	return messageType;
+}
+
+#pragma mark -
+#pragma mark Properties
+
+- (void)setOtrPolicy:(OTRKitPolicy)otrPolicy
+{
+	if (self->_otrPolicy != otrPolicy) {
+		self->_otrPolicy = otrPolicy;
+
+		if (otrPolicy == OTRKitPolicyNever) {
+			[self _disableEncryptionForAll];
+		}
+	}
+}
+
+- (OtrlPolicy)_otrlPolicy
+{
+	switch (self.otrPolicy) {
+		case OTRKitPolicyDefault:
+		{
+			return OTRL_POLICY_DEFAULT;
+		}
+		case OTRKitPolicyAlways:
+		{
+			return OTRL_POLICY_ALWAYS;
+		}
+		case OTRKitPolicyManual:
+		{
+			return OTRL_POLICY_MANUAL;
+		}
+		case OTRKitPolicyOpportunistic:
+		{
+			return OTRL_POLICY_OPPORTUNISTIC;
+		}
+		case OTRKitPolicyNever:
+		{
+			return OTRL_POLICY_NEVER;
+		}
+		default:
+		{
+			return OTRL_POLICY_DEFAULT;
+		}
+	}
+}
+
+- (NSString *)documentsDirectory
+{
+	NSArray *paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
+
+	NSString *cachedPath = [paths[0] stringByAppendingPathComponent:@"/com.codeux.frameworks.encryptionKit/OTRKit/"];
+
+	return cachedPath;
+}
+
+- (NSString *)dataPath
+{
+	if (self->_dataPath == nil) {
+		return [self documentsDirectory];
+	}
+
+	return self->_dataPath;
+}
+
+- (NSString *)privateKeyPath
+{
+	return [self.dataPath stringByAppendingPathComponent:kOTRKitPrivateKeyFileName];
+}
+
+- (NSString *)fingerprintsPath
+{
+	return [self.dataPath stringByAppendingPathComponent:kOTRKitFingerprintsFileName];
+}
+
+- (NSString *)instanceTagsPath
+{
+	return [self.dataPath stringByAppendingPathComponent:kOTRKitInstanceTagsFileName];
+}
+
+#pragma mark -
+#pragma mark Fingerprint Management
 
-- (void)initiateEncryptionWithUsername:(NSString *)username
-						   accountName:(NSString *)accountName
-							  protocol:(NSString *)protocol
-						asynchronously:(BOOL)asynchronously
+- (nullable Fingerprint *)_fingerprintForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
 {
 	NSParameterAssert(username != nil);
 	NSParameterAssert(accountName != nil);
@@ -1024,831 +3335,878 @@ static OtrlMessageAppOps ui_ops = {
 
 	ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
 
-	dispatch_block_t encodeBlock = ^{
-		[self _encodeMessage:@"?OTR?" tlvs:nil username:username accountName:accountName protocol:protocol tag:nil inContext:otrContext];
-	};
-
-	if (asynchronously) {
-		[self _performAsyncOperationOnInternalQueue:encodeBlock];
-	} else {
-		[self _performSyncOperationOnInternalQueue:encodeBlock];
+	if (otrContext == NULL) {
+		return NULL;
 	}
+
+	return otrContext->active_fingerprint;
 }
 
-- (void)disableEncryptionWithUsername:(NSString *)username
-						  accountName:(NSString *)accountName
-							 protocol:(NSString *)protocol
+- (nullable NSString *)_fingerprintStringFromFingerprint:(Fingerprint *)otrFingerprint
 {
-	NSParameterAssert(username != nil);
-	NSParameterAssert(accountName != nil);
-	NSParameterAssert(protocol != nil);
+	NSParameterAssert(otrFingerprint != NULL);
 
-	[self _performAsyncOperationOnInternalQueue:^{
-		otrl_message_disconnect_all_instances(self.userState, &ui_ops, NULL, accountName.UTF8String, protocol.UTF8String, username.UTF8String);
+	char fingerprintHash[OTRL_PRIVKEY_FPRINT_HUMAN_LEN];
 
-		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+	if (otrFingerprint->fingerprint) {
+		otrl_privkey_hash_to_human(fingerprintHash, otrFingerprint->fingerprint);
 
-		if (otrContext == NULL) {
-			return;
-		}
+		return @(fingerprintHash);
+	}
 
-		[self _updateEncryptionStatusWithContext:otrContext];
-	}];
+	return nil;
 }
 
-- (void)_disableEncryptionForAll
+- (NSArray *)requestAllFingerprints
 {
-	[self _performAsyncOperationOnInternalQueue:^{
+	__block NSArray *allFingerprints = nil;
+
+	[self _performSyncOperation:^{
+		NSMutableArray *fingerprintsArray = [NSMutableArray array];
+
 		ConnContext *otrContext = self.userState->context_root;
 
 		while (otrContext) {
-			OTRKitMessageState messageState = [self _messageStateForContext:otrContext];
+			Fingerprint *otrFingerprint = otrContext->fingerprint_root.next;
 
-			if (messageState == OTRKitMessageStateEncrypted) {
-				otrl_message_disconnect_all_instances(self.userState, &ui_ops, NULL, otrContext->accountname, otrContext->protocol, otrContext->username);
+			while (otrFingerprint) {
+				/* Gather information about the current fingerprint. */
+				NSString *fingerprintString = [self _fingerprintStringFromFingerprint:otrFingerprint];
 
-				[self _updateEncryptionStatusWithContext:otrContext];
-			}
+				NSString *username = @(otrContext->username);
+				NSString *accountName = @(otrContext->accountname);
 
-			otrContext = otrContext->next;
-		}
-	}];
-}
+				NSString *protocol = @(otrContext->protocol);
 
-#pragma mark -
-#pragma mark Helpers
+				BOOL isTrusted = (otrl_context_is_fingerprint_trusted(otrFingerprint) == true);
 
-- (nullable NSError *)_errorForGPGError:(gcry_error_t)gpg_error
-{
-	if (gpg_error == gcry_err_code(GPG_ERR_NO_ERROR)) {
-		return nil;
-	}
+				/* Build a concrete object around the information gathered */
+				OTRKitConcreteObject *resultObject = [OTRKitConcreteObject new];
 
-	const char *gpg_error_string = gcry_strerror(gpg_error);
-	const char *gpg_error_source = gcry_strsource(gpg_error);
+				resultObject.username = username;
+				resultObject.accountName = accountName;
 
-	gpg_err_code_t gpg_error_code = gcry_err_code(gpg_error);
+				resultObject.protocol = protocol;
 
-	int errorCode = gcry_err_code_to_errno(gpg_error_code);
+				resultObject.fingerprint = otrFingerprint;
+				resultObject.fingerprintString = fingerprintString;
 
-	NSString *errorString = nil;
+				resultObject.fingerprintIsTrusted = isTrusted;
 
-	if (gpg_error_string) {
-		errorString = @(gpg_error_string);
-	}
+				[fingerprintsArray addObject:resultObject];
 
-	NSString *errorSource = nil;
+				/* Move on to the next fingerprint in the chain */
+				otrFingerprint = otrFingerprint->next;
+			}
 
-	if (gpg_error_source) {
-		errorSource = @(gpg_error_source);
-	}
+			otrContext = otrContext->next;
+		}
 
-	NSMutableString *errorDescription = [NSMutableString string];
+		allFingerprints = [fingerprintsArray copy];
+	} priority:OTRKitPriorityBackground];
 
-	if (errorString) {
-		[errorDescription appendString:errorString];
-	}
+	return allFingerprints;
+}
 
-	if (errorSource) {
-		[errorDescription appendString:@" - "];
-		[errorDescription appendString:errorSource];
-	}
+- (void)deleteFingerprint:(NSString *)fingerprint
+				 username:(NSString *)username
+			  accountName:(NSString *)accountName
+				 protocol:(NSString *)protocol
+{
+	NSParameterAssert(fingerprint != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
 
-	NSError *error = [NSError errorWithDomain:kOTRKitErrorDomain
-										 code:errorCode
-									 userInfo:@{NSLocalizedDescriptionKey : errorDescription}];
+	[self _performAsyncOperationOnInternalQueue:^{
+		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
 
-	return error;
-}
+		if (otrContext == NULL) {
+			return;
+		}
 
-#pragma mark -
-#pragma mark TLV
+		Fingerprint *otrFingerprint = NULL;
 
-- (nullable OtrlTLV *)_tlvChainForTLVs:(NSArray<OTRTLV *> *)tlvs
-{
-	NSParameterAssert(tlvs != nil);
+		Fingerprint *otrFingerprintCurrent = otrContext->fingerprint_root.next;
 
-	OtrlTLV *root_tlv = NULL;
-	OtrlTLV *current_tlv = NULL;
+		while (otrFingerprintCurrent) {
+			char fingerprintHash[OTRL_PRIVKEY_FPRINT_HUMAN_LEN];
 
-	NSUInteger validTLVCount = 0;
+			otrl_privkey_hash_to_human(fingerprintHash, otrFingerprintCurrent->fingerprint);
 
-	for (OTRTLV *tlv in tlvs) {
-		if (tlv.validLength == NO) {
-			continue;
-		}
+			NSString *fingerprintCurrent = @(fingerprintHash);
 
-		OtrlTLV *new_tlv = otrl_tlv_new(tlv.type, tlv.data.length, tlv.data.bytes);
+			if ([fingerprintCurrent isEqualToString:fingerprint]) {
+				otrFingerprint = otrFingerprintCurrent;
 
-		if (validTLVCount == 0) {
-			root_tlv = new_tlv;
-		} else {
-			current_tlv->next = new_tlv;
+				break;
+			} else {
+				otrFingerprintCurrent = otrFingerprintCurrent->next;
+			}
 		}
 
-		current_tlv = new_tlv;
-
-		validTLVCount++;
-	}
+		if (otrFingerprint == NULL) {
+			return;
+		}
 
-	return root_tlv;
+		[self _deleteFingerprint:otrFingerprint username:username accountName:accountName protocol:protocol];
+	}];
 }
 
-- (NSArray<OTRTLV *> *)_tlvArrayForTLVChain:(OtrlTLV *)tlv_chain
+- (void)deleteFingerprintWithConcreteObject:(OTRKitConcreteObject *)fingerprint
 {
-	NSParameterAssert(tlv_chain != nil);
+	NSParameterAssert(fingerprint != NULL);
 
-	NSMutableArray *tlvArray = [NSMutableArray array];
+	[self _performAsyncOperationOnInternalQueue:^{
+		[self _deleteFingerprint:fingerprint.fingerprint username:fingerprint.username accountName:fingerprint.accountName protocol:fingerprint.protocol];
+	}];
+}
 
-	OtrlTLV *current_tlv = tlv_chain;
+- (void)_deleteFingerprint:(Fingerprint *)otrFingerprint username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(otrFingerprint != NULL);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
 
-	while (current_tlv) {
-		NSData *tlvData = [NSData dataWithBytes:current_tlv->data length:current_tlv->len];
+	Fingerprint *otrFingerprintActive = [self _fingerprintForUsername:username accountName:accountName protocol:protocol];
 
-		OTRTLVType type = current_tlv->type;
+	if (otrFingerprint == otrFingerprintActive) {
+		return;
+	}
 
-		OTRTLV *tlv = [[OTRTLV alloc] initWithType:type data:tlvData];
+	[self _deleteFingerprint:otrFingerprint];
+}
 
-		[tlvArray addObject:tlv];
+- (void)_deleteFingerprint:(Fingerprint *)otrFingerprint
+{
+	NSParameterAssert(otrFingerprint != NULL);
 
-		current_tlv = current_tlv->next;
-	}
+	/* Recorded first because forgetting it frees it */
+	[self _recordFingerprint:otrFingerprint removed:YES];
 
-	return [tlvArray copy];
-}
+	otrl_context_forget_fingerprint(otrFingerprint, 0);
 
-#pragma mark -
-#pragma mark Context
+	[self _scheduleStorageWrite];
+}
 
-- (nullable ConnContext *)_contextForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+- (nullable NSString *)fingerprintForAccountName:(NSString *)accountName
+										protocol:(NSString *)protocol
 {
-	NSParameterAssert(username != nil);
 	NSParameterAssert(accountName != nil);
 	NSParameterAssert(protocol != nil);
 
-	ConnContext *context = otrl_context_find(self.userState, username.UTF8String, accountName.UTF8String, protocol.UTF8String, OTRL_INSTAG_BEST, YES, NULL, NULL, NULL);
+	__block NSString *fingerprintString = nil;
 
-	return context;
+	[self _performSyncOperationOnInternalQueue:^{
+		char fingerprintHash[OTRL_PRIVKEY_FPRINT_HUMAN_LEN];
+
+		otrl_privkey_fingerprint(self.userState, fingerprintHash, accountName.UTF8String, protocol.UTF8String);
+
+		fingerprintString = @(fingerprintHash);
+	}];
+
+	return fingerprintString;
 }
 
-- (BOOL)isGeneratingKeyForAccountName:(NSString *)accountName protocol:(NSString *)protocol
+- (nullable NSString *)activeFingerprintForUsername:(NSString *)username
+										accountName:(NSString *)accountName
+										   protocol:(NSString *)protocol
 {
+	NSParameterAssert(username != nil);
 	NSParameterAssert(accountName != nil);
 	NSParameterAssert(protocol != nil);
 
-	__block BOOL generatingKey = NO;
+	__block NSString *fingerprintString = nil;
 
 	[self _performSyncOperationOnInternalQueue:^{
-		void *otrKey;
-
-		gcry_error_t otrError = otrl_privkey_generate_start(self.userState, accountName.UTF8String, protocol.UTF8String, &otrKey);
+		Fingerprint *otrFingerprint = [self _fingerprintForUsername:username accountName:accountName protocol:protocol];
 
-		if (otrError == 0) {
-			otrl_privkey_generate_cancelled(self.userState, otrKey);
+		if (otrFingerprint == NULL) {
+			return;
 		}
 
-		generatingKey = (otrError == gcry_error(GPG_ERR_EEXIST));
+		fingerprintString = [self _fingerprintStringFromFingerprint:otrFingerprint];
 	}];
 
-	return generatingKey;
+	return fingerprintString;
 }
 
-#pragma mark -
-#pragma mark Message State Management
-
-- (OTRKitMessageState)_messageStateForContext:(nullable ConnContext *)otrContext
+- (BOOL)activeFingerprintIsVerifiedForUsername:(NSString *)username
+								   accountName:(NSString *)accountName
+									  protocol:(NSString *)protocol
 {
-	NSParameterAssert(otrContext != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
 
-	switch (otrContext->msgstate) {
-		case OTRL_MSGSTATE_ENCRYPTED:
-		{
-			return OTRKitMessageStateEncrypted;
+	__block BOOL verified = NO;
 
-			break;
-		}
-		case OTRL_MSGSTATE_FINISHED:
-		{
-			return OTRKitMessageStateFinished;
+	[self _performSyncOperationOnInternalQueue:^{
+		Fingerprint *otrFingerprint = [self _fingerprintForUsername:username accountName:accountName protocol:protocol];
 
-			break;
+		if (otrFingerprint == NULL) {
+			return;
 		}
-		case OTRL_MSGSTATE_PLAINTEXT:
-		{
-			return OTRKitMessageStatePlaintext;
 
-			break;
+		if (otrFingerprint->trust) {
+			if (otrl_context_is_fingerprint_trusted(otrFingerprint) == true) {
+				verified = YES;
+			}
 		}
-	}
+	}];
 
-	return OTRKitMessageStatePlaintext;
+	return verified;
 }
 
-- (OTRKitMessageState)messageStateForUsername:(NSString *)username
-								  accountName:(NSString *)accountName
-									 protocol:(NSString *)protocol
+- (void)setActiveFingerprintVerificationForUsername:(NSString *)username
+										accountName:(NSString *)accountName
+										   protocol:(NSString *)protocol
+										   verified:(BOOL)verified
 {
 	NSParameterAssert(username != nil);
 	NSParameterAssert(accountName != nil);
 	NSParameterAssert(protocol != nil);
 
-	__block OTRKitMessageState messageState = OTRKitMessageStatePlaintext;
-
-	[self _performSyncOperationOnInternalQueue:^{
-		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+	[self _performAsyncOperationOnInternalQueue:^{
+		Fingerprint *otrFingerprint = [self _fingerprintForUsername:username accountName:accountName protocol:protocol];
 
-		if (otrContext == NULL) {
+		if (otrFingerprint == NULL) {
 			return;
 		}
 
-		messageState = [self _messageStateForContext:otrContext];
-	}];
+		[self _setVerificationForFingerprint:otrFingerprint verified:verified];
 
-	return messageState;
+		[self _postDelegateVerifiedStateChangedForUsername:username accountName:accountName protocol:protocol verified:verified];
+	}];
 }
 
-- (OTRKitOfferState)_offerStateForContext:(ConnContext *)otrContext
+- (void)setFingerprintVerificationForConcreteObject:(OTRKitConcreteObject *)fingerprint verified:(BOOL)verified
 {
-	NSParameterAssert(otrContext != nil);
+	NSParameterAssert(fingerprint != NULL);
 
-	switch (otrContext->otr_offer) {
-		case OFFER_NOT:
-		{
-			return OTRKitOfferStateNone;
+	[self _performAsyncOperationOnInternalQueue:^{
+		Fingerprint *otrFingerprint = fingerprint.fingerprint;
 
-			break;
+		if (otrFingerprint == NULL) {
+			return;
 		}
-		case OFFER_ACCEPTED:
-		{
-			return OTRKitOfferStateAccepted;
 
-			break;
-		}
-		case OFFER_REJECTED:
-		{
-			return OTRKitOfferStateRejected;
+		/* Set the fingerprint on our reference fingerprint */
+		[self _setVerificationForFingerprint:otrFingerprint verified:verified];
 
-			break;
-		}
-		case OFFER_SENT:
-		{
-			return OTRKitOfferStateSent;
+		/* Compare our reference fingerprint against that of the user */
+		Fingerprint *otrFingerprintActive = [self _fingerprintForUsername:fingerprint.username accountName:fingerprint.accountName protocol:fingerprint.protocol];
 
-			break;
+		if (otrFingerprint == otrFingerprintActive) {
+			[self _postDelegateVerifiedStateChangedForUsername:fingerprint.username accountName:fingerprint.accountName protocol:fingerprint.protocol verified:verified];
 		}
+	}];
+}
+
+- (void)_setVerificationForFingerprint:(Fingerprint *)otrFingerprint verified:(BOOL)verified
+{
+	NSParameterAssert(otrFingerprint != NULL);
+
+	const char *newTrust = NULL;
+
+	if (verified) {
+		newTrust = "verified";
 	}
 
-	return OTRKitOfferStateNone;
+	otrl_context_set_trust(otrFingerprint, newTrust);
+
+	[self _recordFingerprint:otrFingerprint removed:NO];
+
+	[self _scheduleStorageWrite];
 }
 
-- (OTRKitOfferState)offerStateForUsername:(NSString *)username
-							  accountName:(NSString *)accountName
-								 protocol:(NSString *)protocol
+#pragma mark -
+#pragma mark Read Data and Write Data
+
+- (id<OTRKitStorage>)_storageInUse
 {
-	NSParameterAssert(username != nil);
-	NSParameterAssert(accountName != nil);
-	NSParameterAssert(protocol != nil);
+	if (self.loadedStorage == nil) {
+		if (self->_storage) {
+			self.loadedStorage = self->_storage;
+		} else {
+			self.loadedStorage = [[OTRKitFileStorage alloc] initWithPrivateKeyPath:self.privateKeyPath
+																  fingerprintsPath:self.fingerprintsPath
+																  instanceTagsPath:self.instanceTagsPath];
+		}
+	}
 
-	__block OTRKitOfferState offerState = OTRKitOfferStateNone;
+	return self.loadedStorage;
+}
 
-	[self _performSyncOperationOnInternalQueue:^{
-		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+- (void)setStorage:(nullable id<OTRKitStorage>)storage
+{
+	[self _performAsyncOperationOnInternalQueue:^{
+		NSAssert((self.loadedStorage == nil),
+			@"Tried to change storage after it was loaded");
 
-		if (otrContext == NULL) {
+		self->_storage = storage;
+	}];
+}
+
+- (void)_loadStorage
+{
+	id<OTRKitStorage> storage = [self _storageInUse];
+
+	uint64_t readStartTime = OTRKitMetricsNow();
+
+	/* libotr only reads private keys and instance tags from a file
+	 so they are added to the user state here as they are loaded. */
+	[storage loadPrivateKeys:^(NSString *accountName, NSString *protocol, NSData *privateKey) {
+		[self _loadPrivateKey:privateKey accountName:accountName protocol:protocol];
+	} fingerprints:^(NSString *username, NSString *accountName, NSString *protocol, NSData *fingerprint, NSString * _Nullable trust) {
+		[self _loadFingerprint:fingerprint trust:trust username:username accountName:accountName protocol:protocol];
+	} instanceTags:^(NSString *accountName, NSString *protocol, uint32_t instanceTag) {
+		if (instanceTag < OTRL_MIN_VALID_INSTAG) {
 			return;
 		}
 
-		offerState = [self _offerStateForContext:otrContext];
+		[self _addInstanceTag:instanceTag accountName:accountName.UTF8String protocol:protocol.UTF8String];
 	}];
-	
-	return offerState;
+
+	OTRKitMetricsRecordDuration(self.metrics, OTRKitMetricsHistogramDiskRead, readStartTime);
 }
 
-- (OTRKitMessageType)typeOfMessage:(NSString *)message
+- (void)_loadPrivateKey:(NSData *)privateKeyData accountName:(NSString *)accountName protocol:(NSString *)protocol
 {
-	NSParameterAssert(message != nil);
+	NSParameterAssert(privateKeyData != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
 
-	__block OTRKitMessageType messageType = OTRKitMessageTypeUnknown;
+	/* Storage holds what -_storageDataForPrivateKey: made of the key */
+	gcry_sexp_t accountSexp = NULL;
 
-	[self _performSyncOperationOnInternalQueue:^{
-		messageType = [self _typeOfMessage:message];
-	}];
+	if (gcry_sexp_sscan(&accountSexp, NULL, privateKeyData.bytes, privateKeyData.length) != gcry_error(GPG_ERR_NO_ERROR)) {
+		return;
+	}
 
-	return messageType;
+	gcry_sexp_t privateKey = gcry_sexp_find_token(accountSexp, "private-key", 0);
+
+	gcry_sexp_release(accountSexp);
+
+	[self _addPrivateKey:privateKey accountName:accountName.UTF8String protocol:protocol.UTF8String];
 }
 
-- (OTRKitMessageType)_typeOfMessage:(NSString *)message
+/* The public key libotr sends is the DSA parameters p, q, g, and y,
+ each as an unsigned big endian number preceded by its length. */
+static gcry_error_t OTRKitMakePublicKey(unsigned char **publicKeyData, size_t *publicKeyDataLength, gcry_sexp_t privateKey)
 {
-	NSParameterAssert(message != nil);
-
-	OtrlMessageType otrMessageType = otrl_proto_message_type(message.UTF8String);
+	static const char * const parameterNames[] = {"p", "q", "g", "y"};
 
-	__block OTRKitMessageType messageType = OTRKitMessageTypeUnknown;
+	gcry_mpi_t parameters[4] = {NULL, NULL, NULL, NULL};
 
-	switch (otrMessageType) {
-		case OTRL_MSGTYPE_NOTOTR:
-		{
-			messageType = OTRKitMessageTypeNotOTR;
+	size_t parameterLengths[4] = {0, 0, 0, 0};
 
-			break;
-		}
-		case OTRL_MSGTYPE_TAGGEDPLAINTEXT:
-		{
-			messageType = OTRKitMessageTypeTaggedPlainText;
+	size_t bufferLength = 0;
 
-			break;
-		}
-		case OTRL_MSGTYPE_QUERY:
-		{
-			messageType = OTRKitMessageTypeQuery;
+	gcry_error_t makeError = gcry_error(GPG_ERR_NO_ERROR);
 
-			break;
-		}
-		case OTRL_MSGTYPE_DH_COMMIT:
-		{
-			messageType = OTRKitMessageTypeDHCommit;
+	gcry_sexp_t dsaSexp = gcry_sexp_find_token(privateKey, "dsa", 0);
 
-			break;
-		}
-		case OTRL_MSGTYPE_DH_KEY:
-		{
-			messageType = OTRKitMessageTypeDHKey;
+	if (dsaSexp == NULL) {
+		return gcry_error(GPG_ERR_UNUSABLE_SECKEY);
+	}
 
-			break;
-		}
-		case OTRL_MSGTYPE_REVEALSIG:
-		{
-			messageType = OTRKitMessageTypeRevealSignature;
+	for (int i = 0; i < 4; i++) {
+		gcry_sexp_t parameterSexp = gcry_sexp_find_token(dsaSexp, parameterNames[i], 0);
 
-			break;
-		}
-		case OTRL_MSGTYPE_SIGNATURE:
-		{
-			messageType = OTRKitMessageTypeSignature;
+		if (parameterSexp) {
+			parameters[i] = gcry_sexp_nth_mpi(parameterSexp, 1, GCRYMPI_FMT_USG);
 
-			break;
+			gcry_sexp_release(parameterSexp);
 		}
-		case OTRL_MSGTYPE_V1_KEYEXCH:
-		{
-			messageType = OTRKitMessageTypeV1KeyExchange;
 
-			break;
-		}
-		case OTRL_MSGTYPE_DATA:
-		{
-			messageType = OTRKitMessageTypeData;
+		if (parameters[i] == NULL) {
+			makeError = gcry_error(GPG_ERR_UNUSABLE_SECKEY);
 
 			break;
 		}
-		case OTRL_MSGTYPE_ERROR:
-		{
-			messageType = OTRKitMessageTypeError;
 
-			break;
-		}
-		case OTRL_MSGTYPE_UNKNOWN:
-		{
-			messageType = OTRKitMessageTypeUnknown;
+		gcry_mpi_print(GCRYMPI_FMT_USG, NULL, 0, &parameterLengths[i], parameters[i]);
 
-			break;
-		}
+		bufferLength += (4 + parameterLengths[i]);
 	}
 
-	return messageType;
-}
-
-#pragma mark -
-#pragma mark Properties
+	gcry_sexp_release(dsaSexp);
 
-- (void)setOtrPolicy:(OTRKitPolicy)otrPolicy
-{
-	if (self->_otrPolicy != otrPolicy) {
-		self->_otrPolicy = otrPolicy;
+	unsigned char *buffer = NULL;
 
-		if (otrPolicy == OTRKitPolicyNever) {
-			[self _disableEncryptionForAll];
-		}
-	}
-}
+	if (makeError == gcry_error(GPG_ERR_NO_ERROR)) {
+		buffer = malloc(bufferLength);
 
-- (OtrlPolicy)_otrlPolicy
-{
-	switch (self.otrPolicy) {
-		case OTRKitPolicyDefault:
-		{
-			return OTRL_POLICY_DEFAULT;
+		if (buffer == NULL) {
+			makeError = gcry_error(GPG_ERR_ENOMEM);
 		}
-		case OTRKitPolicyAlways:
-		{
-			return OTRL_POLICY_ALWAYS;
-		}
-		case OTRKitPolicyManual:
-		{
-			return OTRL_POLICY_MANUAL;
-		}
-		case OTRKitPolicyOpportunistic:
-		{
-			return OTRL_POLICY_OPPORTUNISTIC;
-		}
-		case OTRKitPolicyNever:
-		{
-			return OTRL_POLICY_NEVER;
-		}
-		default:
-		{
-			return OTRL_POLICY_DEFAULT;
-		}
-	}
-}
-
-- (NSString *)documentsDirectory
-{
-	NSArray *paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
-
-	NSString *cachedPath = [paths[0] stringByAppendingPathComponent:@"/com.codeux.frameworks.encryptionKit/OTRKit/"];
-
-	return cachedPath;
-}
-
-- (NSString *)dataPath
-{
-	if (self->_dataPath == nil) {
-		return [self documentsDirectory];
 	}
 
-	return self->_dataPath;
-}
-
-- (NSString *)privateKeyPath
-{
-	return [self.dataPath stringByAppendingPathComponent:kOTRKitPrivateKeyFileName];
-}
+	if (makeError == gcry_error(GPG_ERR_NO_ERROR)) {
+		unsigned char *bufferPointer = buffer;
 
-- (NSString *)fingerprintsPath
-{
-	return [self.dataPath stringByAppendingPathComponent:kOTRKitFingerprintsFileName];
-}
+		for (int i = 0; i < 4; i++) {
+			size_t parameterLength = parameterLengths[i];
 
-- (NSString *)instanceTagsPath
-{
-	return [self.dataPath stringByAppendingPathComponent:kOTRKitInstanceTagsFileName];
-}
+			bufferPointer[0] = (unsigned char)((parameterLength >> 24) & 0xff);
+			bufferPointer[1] = (unsigned char)((parameterLength >> 16) & 0xff);
+			bufferPointer[2] = (unsigned char)((parameterLength >> 8) & 0xff);
+			bufferPointer[3] = (unsigned char)(parameterLength & 0xff);
 
-#pragma mark -
-#pragma mark Fingerprint Management
+			gcry_mpi_print(GCRYMPI_FMT_USG, (bufferPointer + 4), parameterLength, NULL, parameters[i]);
 
-- (nullable Fingerprint *)_fingerprintForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
-{
-	NSParameterAssert(username != nil);
-	NSParameterAssert(accountName != nil);
-	NSParameterAssert(protocol != nil);
+			bufferPointer += (4 + parameterLength);
+		}
 
-	ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+		*publicKeyData = buffer;
+		*publicKeyDataLength = bufferLength;
+	}
 
-	if (otrContext == NULL) {
-		return NULL;
+	for (int i = 0; i < 4; i++) {
+		gcry_mpi_release(parameters[i]);
 	}
 
-	return otrContext->active_fingerprint;
+	return makeError;
 }
 
-- (nullable NSString *)_fingerprintStringFromFingerprint:(Fingerprint *)otrFingerprint
+/* Does what otrl_privkey_read_FILEp() does for each account it reads.
+ Takes ownership of privateKey and replaces any key the account had. */
+- (gcry_error_t)_addPrivateKey:(nullable gcry_sexp_t)privateKey accountName:(const char *)accountName protocol:(const char *)protocol
 {
-	NSParameterAssert(otrFingerprint != NULL);
+	NSParameterAssert(accountName != NULL);
+	NSParameterAssert(protocol != NULL);
 
-	char fingerprintHash[OTRL_PRIVKEY_FPRINT_HUMAN_LEN];
+	if (privateKey == NULL) {
+		return gcry_error(GPG_ERR_UNUSABLE_SECKEY);
+	}
 
-	if (otrFingerprint->fingerprint) {
-		otrl_privkey_hash_to_human(fingerprintHash, otrFingerprint->fingerprint);
+	unsigned char *publicKeyData = NULL;
 
-		return @(fingerprintHash);
-	}
+	size_t publicKeyDataLength = 0;
 
-	return nil;
-}
+	gcry_error_t addError = OTRKitMakePublicKey(&publicKeyData, &publicKeyDataLength, privateKey);
 
-- (NSArray *)requestAllFingerprints
-{
-	__block NSArray *allFingerprints = nil;
+	OtrlPrivKey *otrPrivateKey = NULL;
 
-	[self _performSyncOperationOnInternalQueue:^{
-		NSMutableArray *fingerprintsArray = [NSMutableArray array];
+	if (addError == gcry_error(GPG_ERR_NO_ERROR)) {
+		otrPrivateKey = calloc(1, sizeof(OtrlPrivKey));
 
-		ConnContext *otrContext = self.userState->context_root;
+		if (otrPrivateKey) {
+			otrPrivateKey->accountname = strdup(accountName);
+			otrPrivateKey->protocol = strdup(protocol);
+		}
 
-		while (otrContext) {
-			Fingerprint *otrFingerprint = otrContext->fingerprint_root.next;
+		if (otrPrivateKey == NULL ||
+			otrPrivateKey->accountname == NULL ||
+			otrPrivateKey->protocol == NULL)
+		{
+			addError = gcry_error(GPG_ERR_ENOMEM);
+		}
+	}
 
-			while (otrFingerprint) {
-				/* Gather information about the current fingerprint. */
-				NSString *fingerprintString = [self _fingerprintStringFromFingerprint:otrFingerprint];
+	if (addError != gcry_error(GPG_ERR_NO_ERROR)) {
+		if (otrPrivateKey) {
+			free(otrPrivateKey->accountname);
+			free(otrPrivateKey->protocol);
 
-				NSString *username = @(otrContext->username);
-				NSString *accountName = @(otrContext->accountname);
+			free(otrPrivateKey);
+		}
 
-				NSString *protocol = @(otrContext->protocol);
+		free(publicKeyData);
 
-				BOOL isTrusted = (otrl_context_is_fingerprint_trusted(otrFingerprint) == true);
+		gcry_sexp_release(privateKey);
 
-				/* Build a concrete object around the information gathered */
-				OTRKitConcreteObject *resultObject = [OTRKitConcreteObject new];
+		return addError;
+	}
 
-				resultObject.username = username;
-				resultObject.accountName = accountName;
+	OtrlPrivKey *existingPrivateKey = otrl_privkey_find(self.userState, accountName, protocol);
 
-				resultObject.protocol = protocol;
+	if (existingPrivateKey) {
+		otrl_privkey_forget(existingPrivateKey);
+	}
 
-				resultObject.fingerprint = otrFingerprint;
-				resultObject.fingerprintString = fingerprintString;
+	otrPrivateKey->pubkey_type = OTRL_PUBKEY_TYPE_DSA;
 
-				resultObject.fingerprintIsTrusted = isTrusted;
+	otrPrivateKey->privkey = privateKey;
 
-				[fingerprintsArray addObject:resultObject];
+	otrPrivateKey->pubkey_data = publicKeyData;
+	otrPrivateKey->pubkey_datalen = publicKeyDataLength;
 
-				/* Move on to the next fingerprint in the chain */
-				otrFingerprint = otrFingerprint->next;
-			}
+	OtrlUserState userState = self.userState;
 
-			otrContext = otrContext->next;
-		}
+	otrPrivateKey->next = userState->privkey_root;
 
-		allFingerprints = [fingerprintsArray copy];
-	}];
+	if (otrPrivateKey->next) {
+		otrPrivateKey->next->tous = &(otrPrivateKey->next);
+	}
 
-	return allFingerprints;
+	otrPrivateKey->tous = &(userState->privkey_root);
+
+	userState->privkey_root = otrPrivateKey;
+
+	return addError;
 }
 
-- (void)deleteFingerprint:(NSString *)fingerprint
-				 username:(NSString *)username
-			  accountName:(NSString *)accountName
-				 protocol:(NSString *)protocol
+/* Does what otrl_instag_read_FILEp() does for each line it reads */
+- (BOOL)_addInstanceTag:(otrl_instag_t)instanceTag accountName:(const char *)accountName protocol:(const char *)protocol
 {
-	NSParameterAssert(fingerprint != nil);
-	NSParameterAssert(username != nil);
-	NSParameterAssert(accountName != nil);
-	NSParameterAssert(protocol != nil);
+	NSParameterAssert(accountName != NULL);
+	NSParameterAssert(protocol != NULL);
 
-	[self _performAsyncOperationOnInternalQueue:^{
-		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+	OtrlInsTag *otrInstanceTag = calloc(1, sizeof(OtrlInsTag));
 
-		if (otrContext == NULL) {
-			return;
-		}
+	if (otrInstanceTag == NULL) {
+		return NO;
+	}
 
-		Fingerprint *otrFingerprint = NULL;
+	otrInstanceTag->accountname = strdup(accountName);
+	otrInstanceTag->protocol = strdup(protocol);
 
-		Fingerprint *otrFingerprintCurrent = otrContext->fingerprint_root.next;
+	if (otrInstanceTag->accountname == NULL || otrInstanceTag->protocol == NULL) {
+		free(otrInstanceTag->accountname);
+		free(otrInstanceTag->protocol);
 
-		while (otrFingerprintCurrent) {
-			char fingerprintHash[OTRL_PRIVKEY_FPRINT_HUMAN_LEN];
+		free(otrInstanceTag);
 
-			otrl_privkey_hash_to_human(fingerprintHash, otrFingerprintCurrent->fingerprint);
+		return NO;
+	}
 
-			NSString *fingerprintCurrent = @(fingerprintHash);
+	OtrlInsTag *existingInstanceTag = otrl_instag_find(self.userState, accountName, protocol);
 
-			if ([fingerprintCurrent isEqualToString:fingerprint]) {
-				otrFingerprint = otrFingerprintCurrent;
+	if (existingInstanceTag) {
+		otrl_instag_forget(existingInstanceTag);
+	}
 
-				break;
-			} else {
-				otrFingerprintCurrent = otrFingerprintCurrent->next;
-			}
-		}
+	otrInstanceTag->instag = instanceTag;
 
-		if (otrFingerprint == NULL) {
-			return;
-		}
+	OtrlUserState userState = self.userState;
 
-		[self _deleteFingerprint:otrFingerprint username:username accountName:accountName protocol:protocol];
-	}];
-}
+	otrInstanceTag->next = userState->instag_root;
 
-- (void)deleteFingerprintWithConcreteObject:(OTRKitConcreteObject *)fingerprint
-{
-	NSParameterAssert(fingerprint != NULL);
+	if (otrInstanceTag->next) {
+		otrInstanceTag->next->tous = &(otrInstanceTag->next);
+	}
 
-	[self _performAsyncOperationOnInternalQueue:^{
-		[self _deleteFingerprint:fingerprint.fingerprint username:fingerprint.username accountName:fingerprint.accountName protocol:fingerprint.protocol];
-	}];
+	otrInstanceTag->tous = &(userState->instag_root);
+
+	userState->instag_root = otrInstanceTag;
+
+	return YES;
 }
 
-- (void)_deleteFingerprint:(Fingerprint *)otrFingerprint username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+- (void)_loadFingerprint:(NSData *)fingerprint trust:(nullable NSString *)trust username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
 {
-	NSParameterAssert(otrFingerprint != NULL);
+	NSParameterAssert(fingerprint != nil);
 	NSParameterAssert(username != nil);
 	NSParameterAssert(accountName != nil);
 	NSParameterAssert(protocol != nil);
 
-	Fingerprint *otrFingerprintActive = [self _fingerprintForUsername:username accountName:accountName protocol:protocol];
+	if (fingerprint.length != 20) {
+		return;
+	}
 
-	if (otrFingerprint == otrFingerprintActive) {
+	ConnContext *otrContext = otrl_context_find(self.userState, username.UTF8String, accountName.UTF8String, protocol.UTF8String, OTRL_INSTAG_BEST, YES, NULL, NULL, NULL);
+
+	if (otrContext == NULL) {
 		return;
 	}
 
-	[self _deleteFingerprint:otrFingerprint];
+	Fingerprint *otrFingerprint = otrl_context_find_fingerprint(otrContext, (unsigned char *)fingerprint.bytes, YES, NULL);
+
+	if (otrFingerprint == NULL) {
+		return;
+	}
+
+	otrl_context_set_trust(otrFingerprint, trust.UTF8String);
 }
 
-- (void)_deleteFingerprint:(Fingerprint *)otrFingerprint
+- (nullable NSMutableData *)_storageDataForPrivateKey:(OtrlPrivKey *)privateKey
 {
-	NSParameterAssert(otrFingerprint != NULL);
+	NSParameterAssert(privateKey != NULL);
 
-	otrl_context_forget_fingerprint(otrFingerprint, 0);
+	/* The same S-expression libotr writes for each account in its private key file */
+	gcry_sexp_t accountSexp = NULL;
+
+	gcry_error_t buildError = gcry_sexp_build(&accountSexp, NULL, "(account (name %s) (protocol %s) %S)", privateKey->accountname, privateKey->protocol, privateKey->privkey);
+
+	if (buildError != gcry_error(GPG_ERR_NO_ERROR)) {
+		return nil;
+	}
+
+	size_t bufferLength = gcry_sexp_sprint(accountSexp, GCRYSEXP_FMT_ADVANCED, NULL, 0);
+
+	NSMutableData *privateKeyData = [NSMutableData dataWithLength:bufferLength];
+
+	gcry_sexp_sprint(accountSexp, GCRYSEXP_FMT_ADVANCED, privateKeyData.mutableBytes, bufferLength);
 
-	[self _writeFingerprintsPath];
+	gcry_sexp_release(accountSexp);
+
+	privateKeyData.length = strnlen(privateKeyData.bytes, bufferLength);
+
+	return privateKeyData;
 }
 
-- (nullable NSString *)fingerprintForAccountName:(NSString *)accountName
-										protocol:(NSString *)protocol
+- (BOOL)_commitTransactionInStorage:(id<OTRKitStorage>)storage error:(NSError **)error
 {
-	NSParameterAssert(accountName != nil);
-	NSParameterAssert(protocol != nil);
+	NSParameterAssert(storage != nil);
 
-	__block NSString *fingerprintString = nil;
+	BOOL countsBytesWritten = [storage respondsToSelector:@selector(bytesWritten)];
 
-	[self _performSyncOperationOnInternalQueue:^{
-		char fingerprintHash[OTRL_PRIVKEY_FPRINT_HUMAN_LEN];
+	uint64_t bytesWritten = 0;
 
-		otrl_privkey_fingerprint(self.userState, fingerprintHash, accountName.UTF8String, protocol.UTF8String);
+	if (countsBytesWritten) {
+		bytesWritten = storage.bytesWritten;
+	}
 
-		fingerprintString = @(fingerprintHash);
-	}];
+	BOOL commitResult = [storage commitTransaction:error];
 
-	return fingerprintString;
+	if (countsBytesWritten && storage.bytesWritten > bytesWritten) {
+		OTRKitMetricsAddToCounter(self.metrics, OTRKitMetricsCounterBytesWritten, (storage.bytesWritten - bytesWritten));
+	}
+
+	return commitResult;
 }
 
-- (nullable NSString *)activeFingerprintForUsername:(NSString *)username
-										accountName:(NSString *)accountName
-										   protocol:(NSString *)protocol
+/* A new private key is committed before the delegate is told it's ready,
+ along with any changes waiting for the next write, so that it is never
+ told of a key that quitting before that write would lose. A key that
+ can't be stored is forgotten and libotr asks for another when needed. */
+- (BOOL)_storeNewPrivateKeyForAccountName:(NSString *)accountName protocol:(NSString *)protocol error:(NSError **)error
 {
-	NSParameterAssert(username != nil);
 	NSParameterAssert(accountName != nil);
 	NSParameterAssert(protocol != nil);
 
-	__block NSString *fingerprintString = nil;
+	NSString *accountKey = [NSString stringWithFormat:@"%@ <-> %@", accountName, protocol];
 
-	[self _performSyncOperationOnInternalQueue:^{
-		Fingerprint *otrFingerprint = [self _fingerprintForUsername:username accountName:accountName protocol:protocol];
+	self.privateKeysToStore[accountKey] = @[accountName, protocol];
 
-		if (otrFingerprint == NULL) {
-			return;
-		}
+	if ([self _storeChanges:error]) {
+		return YES;
+	}
 
-		fingerprintString = [self _fingerprintStringFromFingerprint:otrFingerprint];
-	}];
+	[self.privateKeysToStore removeObjectForKey:accountKey];
 
-	return fingerprintString;
+	OtrlPrivKey *privateKey = otrl_privkey_find(self.userState, accountName.UTF8String, protocol.UTF8String);
+
+	if (privateKey) {
+		otrl_privkey_forget(privateKey);
+	}
+
+	return NO;
 }
 
-- (BOOL)activeFingerprintIsVerifiedForUsername:(NSString *)username
-								   accountName:(NSString *)accountName
-									  protocol:(NSString *)protocol
+/* New instance tags are kept in memory by libotr as soon as they are
+ made. Storing them waits with fingerprints so that provisioning many
+ accounts at once commits them together. */
+- (void)_scheduleInstanceTagWriteForAccountName:(NSString *)accountName protocol:(NSString *)protocol
 {
-	NSParameterAssert(username != nil);
 	NSParameterAssert(accountName != nil);
 	NSParameterAssert(protocol != nil);
 
-	__block BOOL verified = NO;
+	NSString *accountKey = [NSString stringWithFormat:@"%@ <-> %@", accountName, protocol];
 
-	[self _performSyncOperationOnInternalQueue:^{
-		Fingerprint *otrFingerprint = [self _fingerprintForUsername:username accountName:accountName protocol:protocol];
+	self.instanceTagsToStore[accountKey] = @[accountName, protocol];
 
-		if (otrFingerprint == NULL) {
-			return;
-		}
+	[self _scheduleStorageWrite];
+}
 
-		if (otrFingerprint->trust) {
-			if (otrl_context_is_fingerprint_trusted(otrFingerprint) == true) {
-				verified = YES;
-			}
-		}
-	}];
+/* Trust changes often come in bursts. Rather than committing each
+ to storage, the write waits in the background lane and covers
+ every change made before it runs. */
+- (void)_scheduleStorageWrite
+{
+	if (self.storageWriteScheduled) {
+		return;
+	}
 
-	return verified;
+	self.storageWriteScheduled = YES;
+
+	[self _submitOperation:^{
+		[self _writeScheduledChanges];
+	} priority:OTRKitPriorityBackground];
 }
 
-- (void)setActiveFingerprintVerificationForUsername:(NSString *)username
-										accountName:(NSString *)accountName
-										   protocol:(NSString *)protocol
-										   verified:(BOOL)verified
+- (void)_writeScheduledChanges
 {
-	NSParameterAssert(username != nil);
-	NSParameterAssert(accountName != nil);
-	NSParameterAssert(protocol != nil);
+	if (self.storageWriteScheduled == NO) {
+		return;
+	}
 
-	[self _performAsyncOperationOnInternalQueue:^{
-		Fingerprint *otrFingerprint = [self _fingerprintForUsername:username accountName:accountName protocol:protocol];
+	self.storageWriteScheduled = NO;
 
-		if (otrFingerprint == NULL) {
-			return;
-		}
+	[self _storeChanges:NULL];
+}
 
-		[self _setVerificationForFingerprint:otrFingerprint verified:verified];
+- (void)flushPendingWrites
+{
+	[self _performSyncOperationOnInternalQueue:^{
+		/* Also retries changes left over from a commit that failed */
+		self.storageWriteScheduled = NO;
 
-		[self _postDelegateVerifiedStateChangedForUsername:username accountName:accountName protocol:protocol verified:verified];
+		[self _storeChanges:NULL];
 	}];
 }
 
-- (void)setFingerprintVerificationForConcreteObject:(OTRKitConcreteObject *)fingerprint verified:(BOOL)verified
+- (BOOL)_storeChanges:(NSError **)error
 {
-	NSParameterAssert(fingerprint != NULL);
+	uint64_t writeStartTime = OTRKitMetricsNow();
 
-	[self _performAsyncOperationOnInternalQueue:^{
-		Fingerprint *otrFingerprint = fingerprint.fingerprint;
+	BOOL fingerprintsChanged = (self.fingerprintsToStore.count > 0 || self.fingerprintsToRemove.count > 0);
 
-		if (otrFingerprint == NULL) {
+	if (fingerprintsChanged == NO &&
+		self.privateKeysToStore.count == 0 &&
+		self.instanceTagsToStore.count == 0)
+	{
+		return YES;
+	}
+
+	id<OTRKitStorage> storage = [self _storageInUse];
+
+	[storage beginTransaction];
+
+	[self.privateKeysToStore enumerateKeysAndObjectsUsingBlock:^(NSString *accountKey, NSArray<NSString *> *account, BOOL *stop) {
+		OtrlPrivKey *privateKey = otrl_privkey_find(self.userState, account[0].UTF8String, account[1].UTF8String);
+
+		if (privateKey == NULL) {
 			return;
 		}
 
-		/* Set the fingerprint on our reference fingerprint */
-		[self _setVerificationForFingerprint:otrFingerprint verified:verified];
-
-		/* Compare our reference fingerprint against that of the user */
-		Fingerprint *otrFingerprintActive = [self _fingerprintForUsername:fingerprint.username accountName:fingerprint.accountName protocol:fingerprint.protocol];
+		NSMutableData *privateKeyData = [self _storageDataForPrivateKey:privateKey];
 
-		if (otrFingerprint == otrFingerprintActive) {
-			[self _postDelegateVerifiedStateChangedForUsername:fingerprint.username accountName:fingerprint.accountName protocol:fingerprint.protocol verified:verified];
+		if (privateKeyData == nil) {
+			return;
 		}
+
+		[storage storePrivateKey:privateKeyData accountName:account[0] protocol:account[1]];
+
+		[privateKeyData resetBytesInRange:NSMakeRange(0, privateKeyData.length)];
 	}];
-}
 
-- (void)_setVerificationForFingerprint:(Fingerprint *)otrFingerprint verified:(BOOL)verified
-{
-	NSParameterAssert(otrFingerprint != NULL);
+	[self.instanceTagsToStore enumerateKeysAndObjectsUsingBlock:^(NSString *accountKey, NSArray<NSString *> *account, BOOL *stop) {
+		OtrlInsTag *instanceTag = otrl_instag_find(self.userState, account[0].UTF8String, account[1].UTF8String);
 
-	const char *newTrust = NULL;
+		if (instanceTag == NULL) {
+			return;
+		}
 
-	if (verified) {
-		newTrust = "verified";
+		[storage storeInstanceTag:instanceTag->instag accountName:account[0] protocol:account[1]];
+	}];
+
+	for (OTRKitStoredFingerprint *fingerprint in self.fingerprintsToStore.objectEnumerator) {
+		[storage storeFingerprint:fingerprint.fingerprint trust:fingerprint.trust username:fingerprint.username accountName:fingerprint.accountName protocol:fingerprint.protocol];
 	}
 
-	otrl_context_set_trust(otrFingerprint, newTrust);
+	for (OTRKitStoredFingerprint *fingerprint in self.fingerprintsToRemove.objectEnumerator) {
+		[storage removeFingerprint:fingerprint.fingerprint username:fingerprint.username accountName:fingerprint.accountName protocol:fingerprint.protocol];
+	}
 
-	[self _writeFingerprintsPath];
-}
+	/* If the commit fails, everything is kept to be
+	 tried again the next time storage is written. */
+	NSError *commitError = nil;
 
-#pragma mark -
-#pragma mark Read Data and Write Data
+	BOOL commitResult = [self _commitTransactionInStorage:storage error:&commitError];
 
-- (void)_readPrivateKeyPath
-{
-	NSString *path = self.privateKeyPath;
+	if (commitResult) {
+		[self.privateKeysToStore removeAllObjects];
 
-	FILE *filePointer = fopen(path.UTF8String, "rb");
+		[self.instanceTagsToStore removeAllObjects];
 
-	if (filePointer == NULL) {
-		return;
+		[self.fingerprintsToStore removeAllObjects];
+
+		[self.fingerprintsToRemove removeAllObjects];
+	} else if (error) {
+		if (commitError == nil) {
+			commitError = [NSError errorWithDomain:OTRKitErrorDomain
+											  code:OTRKitErrorCodeFileWriteFailed
+										  userInfo:@{NSLocalizedDescriptionKey : @"Storage failed to commit changes"}];
+		}
+
+		*error = commitError;
 	}
 
-	otrl_privkey_read_FILEp(self.userState, filePointer);
+	if (fingerprintsChanged) {
+		OTRKitMetricsRecordDuration(self.metrics, OTRKitMetricsHistogramFingerprintWrite, writeStartTime);
 
-	fclose(filePointer);
+		OTRKitMetricsIncrementCounter(self.metrics, OTRKitMetricsCounterFingerprintWrites);
+
+		[self _postFingerprintsDidChangeNotification];
+	}
+
+	return commitResult;
 }
 
-- (void)_readFingerprintsPath
+- (void)_recordFingerprint:(Fingerprint *)otrFingerprint removed:(BOOL)removed
 {
-	NSString *path = self.fingerprintsPath;
+	NSParameterAssert(otrFingerprint != NULL);
 
-	FILE *filePointer = fopen(path.UTF8String, "rb");
+	/* Fingerprints belong to the master context */
+	OTRKitConversation *conversation = [self _conversationForContext:otrFingerprint->context];
 
-	if (filePointer == NULL) {
-		return;
+	char fingerprintHash[OTRL_PRIVKEY_FPRINT_HUMAN_LEN];
+
+	otrl_privkey_hash_to_human(fingerprintHash, otrFingerprint->fingerprint);
+
+	NSString *key = [NSString stringWithFormat:@"%@ <-> %s", conversation.conversationKey, fingerprintHash];
+
+	OTRKitStoredFingerprint *storedFingerprint = [OTRKitStoredFingerprint new];
+
+	storedFingerprint.username = conversation.username;
+	storedFingerprint.accountName = conversation.accountName;
+
+	storedFingerprint.protocol = conversation.protocol;
+
+	storedFingerprint.fingerprint = [NSData dataWithBytes:otrFingerprint->fingerprint length:20];
+
+	if (otrFingerprint->trust && otrFingerprint->trust[0] != '\0') {
+		storedFingerprint.trust = @(otrFingerprint->trust);
 	}
 
-	otrl_privkey_read_fingerprints_FILEp(self.userState, filePointer, NULL, NULL);
+	if (removed) {
+		[self.fingerprintsToStore removeObjectForKey:key];
+
+		self.fingerprintsToRemove[key] = storedFingerprint;
+	} else {
+		[self.fingerprintsToRemove removeObjectForKey:key];
 
-	fclose(filePointer);
+		self.fingerprintsToStore[key] = storedFingerprint;
+	}
 }
 
-- (void)_readInstanceTagsPath
+/* Storing a fingerprint that didn't change replaces it with itself.
+ A remote user has few, so each is recorded rather than comparing them. */
+- (void)_recordFingerprintsForConversation:(nullable OTRKitConversation *)conversation
 {
-	NSString *path = self.instanceTagsPath;
+	if (conversation) {
+		ConnContext *otrContext = otrl_context_find(self.userState, conversation.usernameUTF8, conversation.accountNameUTF8, conversation.protocolUTF8, OTRL_INSTAG_MASTER, NO, NULL, NULL, NULL);
 
-	FILE *filePointer = fopen(path.UTF8String, "rb");
+		if (otrContext) {
+			[self _recordFingerprintsForContext:otrContext];
 
-	if (filePointer == NULL) {
-		return;
+			return;
+		}
 	}
 
-	otrl_instag_read_FILEp(self.userState, filePointer);
+	/* Not expected, but without a conversation the
+	 fingerprints of every context are recorded instead. */
+	for (ConnContext *otrContext = self.userState->context_root; otrContext; otrContext = otrContext->next) {
+		/* Instance children share the fingerprints of their master context */
+		if (otrContext->m_context != otrContext) {
+			continue;
+		}
 
-	fclose(filePointer);
+		[self _recordFingerprintsForContext:otrContext];
+	}
 }
 
-- (void)_writeFingerprintsPath
+- (void)_recordFingerprintsForContext:(ConnContext *)otrContext
 {
-	NSString *path = self.fingerprintsPath;
-
-	FILE *filePointer = fopen(path.UTF8String, "wb");
+	NSParameterAssert(otrContext != NULL);
 
-	if (filePointer == NULL) {
-		return;
+	for (Fingerprint *otrFingerprint = otrContext->fingerprint_root.next; otrFingerprint; otrFingerprint = otrFingerprint->next) {
+		[self _recordFingerprint:otrFingerprint removed:NO];
 	}
-
-	otrl_privkey_write_fingerprints_FILEp(self.userState, filePointer);
-
-	fclose(filePointer);
-
-	[self _postFingerprintsDidChangeNotification];
 }
 
 #pragma mark -
@@ -1883,10 +4241,15 @@ static OtrlMessageAppOps ui_ops = {
 {
 	NSParameterAssert(context != NULL);
 
-	NSString *username = @(context->username);
-	NSString *accountName = @(context->accountname);
+	OTRKitConversation *conversation = [self _conversationForContext:context];
 
-	NSString *protocol = @(context->protocol);
+	NSString *username = conversation.username;
+	NSString *accountName = conversation.accountName;
+
+	NSString *protocol = conversation.protocol;
+
+	/* Keys handed out for a session that started or ended are stale */
+	[self.symmetricKeyCache removeKeysForConversation:conversation.conversationKey];
 
 	OTRKitMessageState messageState = [self messageStateForUsername:username accountName:accountName protocol:protocol];
 
@@ -1913,25 +4276,47 @@ static OtrlMessageAppOps ui_ops = {
 	NSParameterAssert(useData != nil);
 	NSParameterAssert(completion != nil);
 
+	/* A repeat request is answered without waiting on the internal queue */
+	NSData *cachedKey = [self cachedSymmetricKeyForUsername:username accountName:accountName protocol:protocol forUse:use useData:useData];
+
+	if (cachedKey) {
+		[self _performAsyncOperationOnDelegateQueue:^{
+			completion(cachedKey, nil);
+		}];
+
+		return;
+	}
+
 	[self _performAsyncOperationOnInternalQueue:^{
-		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+		OTRKitConversation *conversation = [self _conversationForUsername:username accountName:accountName protocol:protocol];
+
+		ConnContext *otrContext = [self _contextForConversation:conversation];
 
 		if (otrContext == NULL) {
 			return;
 		}
 
-		uint8_t *symmetricKeyBytes = malloc(OTRL_EXTRAKEY_BYTES * sizeof(uint8_t));
-
-		gcry_error_t otrError = otrl_message_symkey(self.userState, &ui_ops, NULL, otrContext, (unsigned int)use, useData.bytes, useData.length, symmetricKeyBytes);
+		NSString *submissionKey = conversation.conversationKey;
 
-		NSData *symmetricKey = nil;
+		/* Another request for the same use may have been answered while this one waited */
+		NSData *symmetricKey = [self.symmetricKeyCache keyForConversation:submissionKey use:use useData:useData];
 
 		NSError *errorString = nil;
 
-		if (otrError == gcry_err_code(GPG_ERR_NO_ERROR)) {
-			symmetricKey = [[NSData alloc] initWithBytes:symmetricKeyBytes length:OTRL_EXTRAKEY_BYTES];
-		} else {
-			errorString = [self _errorForGPGError:otrError];
+		if (symmetricKey == nil) {
+			NSMutableData *symmetricKeyMutable = [NSMutableData dataWithLength:OTRL_EXTRAKEY_BYTES];
+
+			gcry_error_t otrError = otrl_message_symkey(self.userState, &ui_ops, NULL, otrContext, (unsigned int)use, useData.bytes, useData.length, symmetricKeyMutable.mutableBytes);
+
+			if (otrError == gcry_err_code(GPG_ERR_NO_ERROR)) {
+				[self.symmetricKeyCache setKey:symmetricKeyMutable forConversation:submissionKey session:[self _symmetricKeySessionForContext:otrContext] use:use useData:useData];
+
+				symmetricKey = [symmetricKeyMutable copy];
+			} else {
+				errorString = [self _errorForGPGError:otrError];
+			}
+
+			[symmetricKeyMutable resetBytesInRange:NSMakeRange(0, symmetricKeyMutable.length)];
 		}
 
 		[self _performAsyncOperationOnDelegateQueue:^{
@@ -1940,6 +4325,53 @@ static OtrlMessageAppOps ui_ops = {
 	}];
 }
 
+- (nullable NSData *)cachedSymmetricKeyForUsername:(NSString *)username
+									   accountName:(NSString *)accountName
+										  protocol:(NSString *)protocol
+											forUse:(NSUInteger)use
+										   useData:(NSData *)useData
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+	NSParameterAssert(useData != nil);
+
+	OTRKitConversation *conversation = [self _conversationForUsername:username accountName:accountName protocol:protocol create:NO];
+
+	if (conversation == nil) {
+		return nil;
+	}
+
+	return [self.symmetricKeyCache keyForConversation:conversation.conversationKey use:use useData:useData];
+}
+
+- (OTRKitSymmetricKeySession)_symmetricKeySessionForContext:(ConnContext *)context
+{
+	NSParameterAssert(context != NULL);
+
+	OTRKitSymmetricKeySession session;
+
+	session.theirInstanceTag = context->their_instance;
+
+	/* otrl_message_symkey() derives the key from the
+	 session keys for these two key IDs. */
+	session.ourKeyID = context->context_priv->our_keyid;
+	session.theirKeyID = context->context_priv->their_keyid;
+
+	return session;
+}
+
+/* Session keys only change when a data message is received. Keys derived
+ from the old ones are wiped then, so the cache never serves them. */
+- (void)_removeSymmetricKeysOutdatedByContext:(ConnContext *)context
+{
+	NSParameterAssert(context != NULL);
+
+	NSString *submissionKey = [self _conversationForContext:context].conversationKey;
+
+	[self.symmetricKeyCache removeKeysForConversation:submissionKey unlessDerivedForSession:[self _symmetricKeySessionForContext:context]];
+}
+
 #pragma mark -
 #pragma mark Socialist Millionaire Problem
 
@@ -1953,17 +4385,7 @@ static OtrlMessageAppOps ui_ops = {
 	NSParameterAssert(protocol != nil);
 	NSParameterAssert(secret != nil);
 
-	[self _performAsyncOperationOnInternalQueue:^{
-		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
-
-		if (otrContext == NULL) {
-			return;
-		}
-
-		NSData *secretBytes = [secret dataUsingEncoding:NSUTF8StringEncoding];
-
-		otrl_message_initiate_smp(self.userState, &ui_ops, NULL, otrContext, secretBytes.bytes, secretBytes.length);
-	}];
+	[self _performSMPStepForUsername:username accountName:accountName protocol:protocol question:nil secret:secret initiating:YES];
 }
 
 - (void) initiateSMPForUsername:(NSString *)username
@@ -1978,17 +4400,7 @@ static OtrlMessageAppOps ui_ops = {
 	NSParameterAssert(question != nil);
 	NSParameterAssert(secret != nil);
 
-	[self _performAsyncOperationOnInternalQueue:^{
-		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
-
-		if (otrContext == NULL) {
-			return;
-		}
-
-		NSData *secretBytes = [secret dataUsingEncoding:NSUTF8StringEncoding];
-
-		otrl_message_initiate_smp_q(self.userState, &ui_ops, NULL, otrContext, question.UTF8String, secretBytes.bytes, secretBytes.length);
-	}];
+	[self _performSMPStepForUsername:username accountName:accountName protocol:protocol question:question secret:secret initiating:YES];
 }
 
 - (void)respondToSMPForUsername:(NSString *)username
@@ -2001,17 +4413,281 @@ static OtrlMessageAppOps ui_ops = {
 	NSParameterAssert(protocol != nil);
 	NSParameterAssert(secret != nil);
 
+	[self _performSMPStepForUsername:username accountName:accountName protocol:protocol question:nil secret:secret initiating:NO];
+}
+
+/* This does what otrl_message_initiate_smp_q() and otrl_message_respond_smp()
+ do except that the modular arithmetic of step 1 or 2b happens on the SMP queue.
+ The conversation is reserved meanwhile. Its operations waiting in the
+ submission queue are held back, and anything else on the internal queue that
+ touches its SMP state is performed once the step is finished. */
+- (void)_performSMPStepForUsername:(NSString *)username
+					   accountName:(NSString *)accountName
+						  protocol:(NSString *)protocol
+						  question:(nullable NSString *)question
+							secret:(NSString *)secret
+						initiating:(BOOL)initiating
+{
 	[self _performAsyncOperationOnInternalQueue:^{
-		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+		[self _performOperation:^{
+			[self _beginSMPStepForUsername:username accountName:accountName protocol:protocol question:question secret:secret initiating:initiating];
+		} afterSMPReservationForUsername:username accountName:accountName protocol:protocol];
+	}];
+}
 
-		if (otrContext == NULL) {
-			return;
+- (void)_beginSMPStepForUsername:(NSString *)username
+					 accountName:(NSString *)accountName
+						protocol:(NSString *)protocol
+						question:(nullable NSString *)question
+						  secret:(NSString *)secret
+					  initiating:(BOOL)initiating
+{
+	OTRKitConversation *conversation = [self _conversationForUsername:username accountName:accountName protocol:protocol];
+
+	NSString *submissionKey = conversation.conversationKey;
+
+	ConnContext *otrContext = [self _contextForConversation:conversation];
+
+	if (otrContext == NULL ||
+		otrContext->msgstate != OTRL_MSGSTATE_ENCRYPTED ||
+		otrContext->active_fingerprint == NULL)
+	{
+		return;
+	}
+
+	/* The combined secret is a SHA-256 hash of the version byte (0x01), the
+	 fingerprint of the initiator, that of the responder, the secure session id
+	 and the secret entered by the user. */
+	unsigned char ourFingerprint[20];
+
+	if (otrl_privkey_fingerprint_raw(self.userState, ourFingerprint, otrContext->accountname, otrContext->protocol) == NULL) {
+		return;
+	}
+
+	NSData *secretBytes = [secret dataUsingEncoding:NSUTF8StringEncoding];
+
+	NSMutableData *combinedBytes = [NSMutableData dataWithCapacity:(41 + otrContext->sessionid_len + secretBytes.length)];
+
+	const unsigned char versionByte = 0x01;
+
+	[combinedBytes appendBytes:&versionByte length:1];
+
+	if (initiating) {
+		[combinedBytes appendBytes:ourFingerprint length:20];
+		[combinedBytes appendBytes:otrContext->active_fingerprint->fingerprint length:20];
+	} else {
+		[combinedBytes appendBytes:otrContext->active_fingerprint->fingerprint length:20];
+		[combinedBytes appendBytes:ourFingerprint length:20];
+	}
+
+	[combinedBytes appendBytes:otrContext->sessionid length:otrContext->sessionid_len];
+
+	[combinedBytes appendData:secretBytes];
+
+	NSMutableData *combinedSecret = [NSMutableData dataWithLength:SM_DIGEST_SIZE];
+
+	gcry_md_hash_buffer(SM_HASH_ALGORITHM, combinedSecret.mutableBytes, combinedBytes.bytes, combinedBytes.length);
+
+	OTRKitSMPReservation *reservation = [OTRKitSMPReservation new];
+
+	reservation.context = otrContext;
+
+	reservation.submissionKey = submissionKey;
+
+	reservation.group = dispatch_group_create();
+
+	reservation.initiating = initiating;
+
+	reservation.question = question;
+
+	reservation.waitingBlocks = [NSMutableArray array];
+
+	self.smpReservations[submissionKey] = reservation;
+
+	[self.submissionQueue suspendConversation:submissionKey];
+
+	dispatch_group_async(reservation.group, self.smpQueue, ^{
+		unsigned char *smpMessage = NULL;
+
+		int smpMessageLength = 0;
+
+		if (initiating) {
+			reservation.stepError = otrl_sm_step1(otrContext->smstate, combinedSecret.bytes, SM_DIGEST_SIZE, &smpMessage, &smpMessageLength);
+		} else {
+			reservation.stepError = otrl_sm_step2b(otrContext->smstate, combinedSecret.bytes, SM_DIGEST_SIZE, &smpMessage, &smpMessageLength);
 		}
 
-		NSData *secretBytes = [secret dataUsingEncoding:NSUTF8StringEncoding];
+		reservation.smpMessage = smpMessage;
 
-		otrl_message_respond_smp(self.userState, &ui_ops, NULL, otrContext, secretBytes.bytes, secretBytes.length);
-	}];
+		reservation.smpMessageLength = smpMessageLength;
+	});
+
+	dispatch_group_notify(reservation.group, self.internalQueue, ^{
+		[self _finishSMPReservationWithKey:submissionKey];
+	});
+}
+
+/* Must be called on the internal queue to touch the SMP state of a context.
+ The block is performed right away unless a step is being computed for it. */
+- (void)_performOperation:(dispatch_block_t)block afterSMPReservationWithKey:(NSString *)submissionKey
+{
+	NSParameterAssert(block != nil);
+	NSParameterAssert(submissionKey != nil);
+
+	OTRKitSMPReservation *reservation = self.smpReservations[submissionKey];
+
+	if (reservation) {
+		[reservation.waitingBlocks addObject:block];
+
+		return;
+	}
+
+	block();
+}
+
+- (void)_performOperation:(dispatch_block_t)block afterSMPReservationForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	if (self.smpReservations.count == 0) {
+		block();
+
+		return;
+	}
+
+	OTRKitConversation *conversation = [self _conversationForUsername:username accountName:accountName protocol:protocol create:NO];
+
+	/* A reserved conversation isn't forgotten */
+	if (conversation == nil) {
+		block();
+
+		return;
+	}
+
+	[self _performOperation:block afterSMPReservationWithKey:conversation.conversationKey];
+}
+
+- (void)_performOperationAfterAllSMPReservations:(dispatch_block_t)block
+{
+	NSParameterAssert(block != nil);
+
+	NSString *submissionKey = self.smpReservations.allKeys.firstObject;
+
+	if (submissionKey == nil) {
+		block();
+
+		return;
+	}
+
+	/* Looked at again once this one is finished */
+	[self _performOperation:^{
+		[self _performOperationAfterAllSMPReservations:block];
+	} afterSMPReservationWithKey:submissionKey];
+}
+
+/* For callers that need the result of the block before returning. They wait
+ for a step being computed on their own thread, not on the internal queue. */
+- (void)_performSyncOperationOnInternalQueue:(dispatch_block_t)block afterSMPReservationWithKey:(NSString *)submissionKey
+{
+	NSParameterAssert(block != nil);
+	NSParameterAssert(submissionKey != nil);
+
+	__block dispatch_group_t reservationGroup = nil;
+
+	do {
+		if (reservationGroup) {
+			dispatch_group_wait(reservationGroup, DISPATCH_TIME_FOREVER);
+		}
+
+		reservationGroup = nil;
+
+		[self _performSyncOperationOnInternalQueue:^{
+			OTRKitSMPReservation *reservation = self.smpReservations[submissionKey];
+
+			/* The step may be computed without the reservation having been finished yet */
+			if (reservation && dispatch_group_wait(reservation.group, DISPATCH_TIME_NOW) == 0) {
+				[self _finishSMPReservationWithKey:submissionKey];
+
+				/* An operation that was waiting may have started another */
+				reservation = self.smpReservations[submissionKey];
+			}
+
+			if (reservation) {
+				reservationGroup = reservation.group;
+
+				return;
+			}
+
+			block();
+		}];
+	} while (reservationGroup);
+}
+
+- (void)_finishSMPReservationWithKey:(NSString *)submissionKey
+{
+	OTRKitSMPReservation *reservation = self.smpReservations[submissionKey];
+
+	/* Already finished by a synchronous operation that was waiting for it */
+	if (reservation == nil) {
+		return;
+	}
+
+	[self.smpReservations removeObjectForKey:submissionKey];
+
+	ConnContext *otrContext = reservation.context;
+
+	if (reservation.stepError || reservation.smpMessage == NULL) {
+		handle_smp_event_cb(NULL, OTRL_SMPEVENT_ERROR, otrContext, 0, NULL);
+	} else {
+		[self _sendSMPMessageForReservation:reservation];
+	}
+
+	[self.submissionQueue resumeConversation:submissionKey];
+
+	/* Each is performed after a step one before it may have started */
+	for (dispatch_block_t waitingBlock in reservation.waitingBlocks) {
+		[self _performOperation:waitingBlock afterSMPReservationWithKey:submissionKey];
+	}
+}
+
+- (void)_sendSMPMessageForReservation:(OTRKitSMPReservation *)reservation
+{
+	NSParameterAssert(reservation != nil);
+
+	ConnContext *otrContext = reservation.context;
+
+	NSMutableData *smpMessage = [NSMutableData data];
+
+	/* A question is sent in front of the message, terminated by NUL */
+	const char *question = reservation.question.UTF8String;
+
+	if (question) {
+		[smpMessage appendBytes:question length:(strlen(question) + 1)];
+	}
+
+	[smpMessage appendBytes:reservation.smpMessage length:reservation.smpMessageLength];
+
+	unsigned short type = OTRL_TLV_SMP2;
+
+	if (reservation.initiating) {
+		type = ((question) ? OTRL_TLV_SMP1Q : OTRL_TLV_SMP1);
+	}
+
+	OtrlTLV *sendTLV = otrl_tlv_new(type, smpMessage.length, smpMessage.bytes);
+
+	char *sendMessage = NULL;
+
+	gcry_error_t otrError = otrl_proto_create_data(&sendMessage, otrContext, "", sendTLV, OTRL_MSGFLAGS_IGNORE_UNREADABLE, NULL);
+
+	if (otrError == 0) {
+		otrl_message_fragment_and_send(&ui_ops, NULL, otrContext, sendMessage, OTRL_FRAGMENT_SEND_ALL, NULL);
+
+		otrContext->smstate->nextExpected = ((reservation.initiating) ? OTRL_SMP_EXPECT2 : OTRL_SMP_EXPECT3);
+	}
+
+	if (sendMessage) {
+		free(sendMessage);
+	}
+
+	otrl_tlv_free(sendTLV);
 }
 
 - (void)abortSMPForUsername:(NSString *)username
@@ -2023,13 +4699,15 @@ static OtrlMessageAppOps ui_ops = {
 	NSParameterAssert(protocol != nil);
 
 	[self _performAsyncOperationOnInternalQueue:^{
-		ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
+		[self _performOperation:^{
+			ConnContext *otrContext = [self _contextForUsername:username accountName:accountName protocol:protocol];
 
-		if (otrContext == NULL) {
-			return;
-		}
+			if (otrContext == NULL) {
+				return;
+			}
 
-		otrl_message_abort_smp(self.userState, &ui_ops, NULL, otrContext);
+			otrl_message_abort_smp(self.userState, &ui_ops, NULL, otrContext);
+		} afterSMPReservationForUsername:username accountName:accountName protocol:protocol];
 	}];
 }
 
@@ -2038,6 +4716,18 @@ static OtrlMessageAppOps ui_ops = {
 
 - (void)_performAsyncOperationOnDelegateQueue:(dispatch_block_t)block
 {
+	/* Results that are waiting in the batcher were produced before whatever
+	 the block reports, such as a change of message state or an SMP event,
+	 so they are handed to the delegate queue first. */
+	if (self.batchesDelegateResults && [self.resultBatcher flushSynchronously]) {
+		/* Invoking the block right away on the main thread would overtake them */
+		if (self.delegate && self.delegateQueue == NULL) {
+			dispatch_async([self _defaultCallbackQueue], block);
+
+			return;
+		}
+	}
+
 	[self _performBlockOnDelegateQueue:block asynchronously:YES];
 }
 
@@ -2059,13 +4749,13 @@ static OtrlMessageAppOps ui_ops = {
 	if (delegateQueue == NULL) {
 		/* The main queue is defaulted to if the delegate does not specify one.
 		 Check if this is the main thread (or queue) and may just invoke block. */
-		if ([NSThread isMainThread]) {
+		if (self.headless == NO && [NSThread isMainThread]) {
 			block();
 
 			return;
 		}
 
-		delegateQueue = dispatch_get_main_queue();
+		delegateQueue = [self _defaultCallbackQueue];
 	}
 
 	if (asynchronously) {
@@ -2075,6 +4765,62 @@ static OtrlMessageAppOps ui_ops = {
 	}
 }
 
+/* The queue callbacks go to when the caller hasn't picked one */
+- (dispatch_queue_t)_defaultCallbackQueue
+{
+	if (self.headless) {
+		return self.headlessDelegateQueue;
+	}
+
+	return dispatch_get_main_queue();
+}
+
+/* For delegate methods whose answer libotr is waiting on. Headless,
+ they are asked on the calling queue rather than waiting for another. */
+- (void)_performQueryOnDelegate:(dispatch_block_t)block
+{
+	NSParameterAssert(block != NULL);
+
+	if (self.headless) {
+		if (self.delegate) {
+			block();
+		}
+
+		return;
+	}
+
+	[self _performSyncOperationOnDelegateQueue:block];
+}
+
+/* Wraps an operation so that its time waiting for and running on the
+ internal queue is traced. Trace points within block find the operation
+ in traceOperation. name must be a string literal. */
+- (dispatch_block_t)_tracedBlock:(dispatch_block_t)block name:(const char *)name tag:(nullable id)tag
+{
+	NSParameterAssert(block != NULL);
+	NSParameterAssert(name != NULL);
+
+	uint64_t traceOperation = OTRKitTraceNewOperation();
+
+	uint64_t enqueueTime = OTRKitMetricsNow();
+
+	return ^{
+		uint64_t startTime = OTRKitMetricsNow();
+
+		OTRKitTraceRecordSpan("queue wait", traceOperation, enqueueTime, startTime, tag);
+
+		uint64_t previousTraceOperation = self.traceOperation;
+
+		self.traceOperation = traceOperation;
+
+		block();
+
+		self.traceOperation = previousTraceOperation;
+
+		OTRKitTraceRecordSpan(name, traceOperation, startTime, OTRKitMetricsNow(), tag);
+	};
+}
+
 - (void)_performAsyncOperationOnInternalQueue:(dispatch_block_t)block
 {
 	[self _performBlockOnInternalQueue:block asynchronously:YES];
@@ -2085,20 +4831,37 @@ static OtrlMessageAppOps ui_ops = {
 	[self _performBlockOnInternalQueue:block asynchronously:NO];
 }
 
+/* The queue names the instance it belongs to so that a block running
+ on the internal queue of another instance is not mistaken for ours. */
+- (BOOL)_isOnInternalQueue
+{
+	return (dispatch_get_specific(OTRKitInstanceQueueKey) == (__bridge void *)self);
+}
+
 - (void)_performBlockOnInternalQueue:(dispatch_block_t)block asynchronously:(BOOL)asynchronously
 {
 	NSParameterAssert(block != NULL);
 
-	if (dispatch_get_specific(IsOnInternalQueueKey)) {
+	if ([self _isOnInternalQueue]) {
 		block();
 
 		return;
 	}
 
+	OTRKitMetrics *metrics = self.metrics;
+
+	uint64_t enqueueTime = OTRKitMetricsNow();
+
+	dispatch_block_t measuredBlock = ^{
+		OTRKitMetricsRecordDuration(metrics, OTRKitMetricsHistogramQueueWait, enqueueTime);
+
+		block();
+	};
+
 	if (asynchronously) {
-		dispatch_async(self.internalQueue, block);
+		dispatch_async(self.internalQueue, measuredBlock);
 	} else {
-		dispatch_sync(self.internalQueue, block);
+		dispatch_sync(self.internalQueue, measuredBlock);
 	}
 }
 
@@ -0,0 +1,201 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#ifndef OTRKIT_C_H
+#define OTRKIT_C_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  A plain C interface to OTRKit for hosts that are not written in
+ *  Objective-C. It is backed by the same engine as OTRKit.
+ *
+ *  Ownership:
+ *
+ *  - A pointer returned by a function named Create or Copy is owned by
+ *    the caller. It is given back with the matching Release or Free function.
+ *  - Buffers passed to a function are copied before it returns.
+ *  - Buffers passed to a callback are only valid until the callback returns.
+ *
+ *  Callbacks are called on a private serial queue, except isLoggedIn which is
+ *  called on the internal queue of the engine. No callback is called once
+ *  OTRKitCRelease() has returned. A callback must not call OTRKitCRelease().
+ */
+
+typedef struct OTRKitC *OTRKitCRef;
+
+/*
+ *  A conversation between a local account and a remote user on a protocol.
+ *  Asking for the same conversation twice returns the same handle. A handle
+ *  is passed to each callback so that the host does not have to compare names.
+ */
+typedef struct OTRKitCConversation *OTRKitCConversationRef;
+
+/* These match OTRKitMessageState */
+typedef enum OTRKitCMessageState {
+	OTRKitCMessageStatePlaintext,
+	OTRKitCMessageStateEncrypted,
+	OTRKitCMessageStateFinished
+} OTRKitCMessageState;
+
+/* These match OTRKitPolicy */
+typedef enum OTRKitCPolicy {
+	OTRKitCPolicyDefault,
+	OTRKitCPolicyNever,
+	OTRKitCPolicyOpportunistic,
+	OTRKitCPolicyManual,
+	OTRKitCPolicyAlways
+} OTRKitCPolicy;
+
+/* These match OTRKitMessageEvent */
+typedef enum OTRKitCMessageEvent {
+	OTRKitCMessageEventNone,
+	OTRKitCMessageEventEncryptionRequired,
+	OTRKitCMessageEventEncryptionError,
+	OTRKitCMessageEventConnectionEnded,
+	OTRKitCMessageEventSetupError,
+	OTRKitCMessageEventMessageReflected,
+	OTRKitCMessageEventMessageResent,
+	OTRKitCMessageEventReceivedMessageNotInPrivate,
+	OTRKitCMessageEventReceivedMessageUnreadable,
+	OTRKitCMessageEventReceivedMessageMalformed,
+	OTRKitCMessageEventLogHeartbeatReceived,
+	OTRKitCMessageEventLogHeartbeatSent,
+	OTRKitCMessageEventReceivedMessageGeneralError,
+	OTRKitCMessageEventReceivedMessageUnencrypted,
+	OTRKitCMessageEventReceivedMessageUnrecognized,
+	OTRKitCMessageEventReceivedMessageForOtherInstance,
+	OTRKitCMessageEventReceivedMessageNotAdmitted,
+	OTRKitCMessageEventReceivedMessageCancelled
+} OTRKitCMessageEvent;
+
+/* A TLV attached to a decoded message. type is one of OTRTLVType. */
+typedef struct OTRKitCTLV {
+	uint16_t type;
+	const uint8_t *data;
+	size_t length;
+} OTRKitCTLV;
+
+/*
+ *  Each callback is given userData as its first argument and the tag that was
+ *  passed to OTRKitCEncode() or OTRKitCDecode(), or NULL for messages that
+ *  libotr sends by itself. Messages are UTF-8 and are not NUL-terminated.
+ *  errorCode is zero or one of OTRKitErrorCode.
+ *
+ *  injectMessage is required. Any other callback may be NULL.
+ *  If isLoggedIn is NULL then remote users are treated as logged in.
+ */
+typedef struct OTRKitCCallbacks {
+	void *userData;
+
+	void (*injectMessage)(void *userData, OTRKitCConversationRef conversation, const char *message, size_t length, void *tag);
+
+	void (*encodedMessage)(void *userData, OTRKitCConversationRef conversation, const char *message, size_t length, bool wasEncrypted, long errorCode, void *tag);
+
+	void (*decodedMessage)(void *userData, OTRKitCConversationRef conversation, const char *message, size_t length, bool wasEncrypted, const OTRKitCTLV *tlvs, size_t tlvCount, void *tag);
+
+	void (*messageStateChanged)(void *userData, OTRKitCConversationRef conversation, OTRKitCMessageState messageState);
+
+	void (*messageEvent)(void *userData, OTRKitCConversationRef conversation, OTRKitCMessageEvent event, const char *message, size_t length, long errorCode, void *tag);
+
+	bool (*isLoggedIn)(void *userData, OTRKitCConversationRef conversation);
+} OTRKitCCallbacks;
+
+/*
+ *  Creates an instance that keeps its private keys, fingerprints and
+ *  instance tags in dataPath. callbacks is copied.
+ */
+OTRKitCRef OTRKitCCreate(const char *dataPath, const OTRKitCCallbacks *callbacks);
+
+/*
+ *  Writes pending changes to disk and destroys the instance.
+ *  Conversations still held may be released afterwards but do nothing else.
+ */
+void OTRKitCRelease(OTRKitCRef otrKit);
+
+void OTRKitCSetPolicy(OTRKitCRef otrKit, OTRKitCPolicy policy);
+
+/*
+ *  Returns the conversation for a remote user, local account and protocol,
+ *  all given as NUL-terminated UTF-8. The caller owns the handle returned.
+ */
+OTRKitCConversationRef OTRKitCConversationCreate(OTRKitCRef otrKit, const char *username, const char *accountName, const char *protocol);
+
+/* Callbacks may keep the handle they are given by retaining it. */
+OTRKitCConversationRef OTRKitCConversationRetain(OTRKitCConversationRef conversation);
+
+void OTRKitCConversationRelease(OTRKitCConversationRef conversation);
+
+/* Valid for as long as the conversation is held */
+const char *OTRKitCConversationGetUsername(OTRKitCConversationRef conversation);
+const char *OTRKitCConversationGetAccountName(OTRKitCConversationRef conversation);
+const char *OTRKitCConversationGetProtocol(OTRKitCConversationRef conversation);
+
+/*
+ *  Encodes length bytes of UTF-8 asynchronously. The result is passed to the
+ *  encodedMessage callback and each fragment to the injectMessage callback.
+ *  Returns false if message is not valid UTF-8 or the instance is released.
+ */
+bool OTRKitCEncode(OTRKitCConversationRef conversation, const char *message, size_t length, void *tag);
+
+/*
+ *  Decodes length bytes of UTF-8 asynchronously. The result is passed to
+ *  the decodedMessage callback unless the message was only for libotr.
+ *  Returns false if message is not valid UTF-8 or the instance is released.
+ */
+bool OTRKitCDecode(OTRKitCConversationRef conversation, const char *message, size_t length, void *tag);
+
+void OTRKitCInitiateEncryption(OTRKitCConversationRef conversation);
+
+void OTRKitCDisableEncryption(OTRKitCConversationRef conversation);
+
+OTRKitCMessageState OTRKitCGetMessageState(OTRKitCConversationRef conversation);
+
+/*
+ *  Returns the fingerprint of the remote user in use, as a NUL-terminated
+ *  string, or NULL if there is none. Give it back with OTRKitCFree().
+ */
+char *OTRKitCCopyActiveFingerprint(OTRKitCConversationRef conversation);
+
+void OTRKitCFree(void *pointer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
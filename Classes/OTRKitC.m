@@ -0,0 +1,692 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKitC.h"
+#import "OTRKitPrivate.h"
+
+#include <pthread.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+_Static_assert((int)OTRKitCMessageStateFinished == (int)OTRKitMessageStateFinished, "OTRKitCMessageState does not match OTRKitMessageState");
+_Static_assert((int)OTRKitCPolicyAlways == (int)OTRKitPolicyAlways, "OTRKitCPolicy does not match OTRKitPolicy");
+_Static_assert((int)OTRKitCMessageEventReceivedMessageCancelled == (int)OTRKitMessageEventReceivedMessageCancelled, "OTRKitCMessageEvent does not match OTRKitMessageEvent");
+
+@class OTRKitCConversation;
+
+/* The delegate of the OTRKit behind an OTRKitCRef. It is the object the
+ handle points to and forwards each delegate method to the callbacks. */
+@interface OTRKitCInstance : NSObject <OTRKitDelegate>
+{
+	pthread_mutex_t _conversationsLock;
+}
+
+@property (nonatomic, strong) OTRKit *otrKit;
+@property (nonatomic, assign) OTRKitCCallbacks callbacks;
+
+/* Set by OTRKitCRelease(). Callbacks are no longer called once it is. */
+@property (atomic, assign) BOOL released;
+
+/* Conversations handed out and not yet deallocated, by conversation key */
+@property (nonatomic, strong) NSMapTable<NSString *, OTRKitCConversation *> *conversations;
+
+- (instancetype)initWithDataPath:(NSString *)dataPath callbacks:(const OTRKitCCallbacks *)callbacks;
+
+- (OTRKitCConversation *)conversationForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+- (void)invalidate;
+@end
+
+@interface OTRKitCConversation : NSObject
+@property (nonatomic, strong) OTRKitCInstance *instance;
+@property (nonatomic, strong) OTRKitConversation *identity;
+
+- (instancetype)initWithInstance:(OTRKitCInstance *)instance username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol;
+@end
+
+/* The tag given to OTRKit when the host passes one of its own. When the
+ host passes NULL the conversation is the tag so nothing is allocated. */
+@interface OTRKitCOperationTag : NSObject
+@property (nonatomic, strong) OTRKitCConversation *conversation;
+@property (nonatomic, assign) void *tag;
+@end
+
+#pragma mark -
+#pragma mark Conversation
+
+@implementation OTRKitCConversation
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+- (instancetype)init
+{
+	return nil;
+}
+#pragma clang diagnostic pop
+
+- (instancetype)initWithInstance:(OTRKitCInstance *)instance username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(instance != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	if ((self = [super init])) {
+		self.instance = instance;
+
+		self.identity = [[OTRKitConversation alloc] initWithUsername:username accountName:accountName protocol:protocol];
+
+		return self;
+	}
+
+	return nil;
+}
+
+@end
+
+@implementation OTRKitCOperationTag
+@end
+
+#pragma mark -
+#pragma mark Instance
+
+@implementation OTRKitCInstance
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+- (instancetype)init
+{
+	return nil;
+}
+#pragma clang diagnostic pop
+
+- (instancetype)initWithDataPath:(NSString *)dataPath callbacks:(const OTRKitCCallbacks *)callbacks
+{
+	NSParameterAssert(dataPath != nil);
+	NSParameterAssert(callbacks != NULL);
+	NSParameterAssert(callbacks->injectMessage != NULL);
+
+	if ((self = [super init])) {
+		pthread_mutex_init(&self->_conversationsLock, NULL);
+
+		self.callbacks = *callbacks;
+
+		self.conversations = [NSMapTable strongToWeakObjectsMapTable];
+
+		/* A C host has no main run loop to call back on */
+		OTRKit *otrKit = [OTRKit new];
+
+		otrKit.headless = YES;
+
+		otrKit.delegate = self;
+
+		[otrKit setupWithDataPath:dataPath];
+
+		self.otrKit = otrKit;
+
+		return self;
+	}
+
+	return nil;
+}
+
+- (void)dealloc
+{
+	pthread_mutex_destroy(&self->_conversationsLock);
+}
+
+- (void)invalidate
+{
+	self.released = YES;
+
+	OTRKit *otrKit = self.otrKit;
+
+	[otrKit flushPendingWrites];
+
+	/* Wait for callbacks that began before released was set.
+	 isLoggedIn is called on the internal queue and the rest
+	 on the headless delegate queue. */
+	[otrKit _performSyncOperationOnInternalQueue:^{ }];
+
+	dispatch_sync(otrKit.headlessDelegateQueue, ^{ });
+
+	otrKit.delegate = nil;
+}
+
+- (OTRKitCConversation *)conversationForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	NSString *conversationKey = [NSString stringWithFormat:@"%@ <-> %@ <-> %@", username, accountName, protocol];
+
+	pthread_mutex_lock(&self->_conversationsLock);
+
+	OTRKitCConversation *conversation = [self.conversations objectForKey:conversationKey];
+
+	if (conversation == nil) {
+		conversation = [[OTRKitCConversation alloc] initWithInstance:self username:username accountName:accountName protocol:protocol];
+
+		[self.conversations setObject:conversation forKey:conversation.identity.conversationKey];
+	}
+
+	pthread_mutex_unlock(&self->_conversationsLock);
+
+	return conversation;
+}
+
+/* Resolves the tag passed to OTRKit back to the conversation and the tag of the host.
+ Messages libotr sends by itself have no tag so the conversation is looked up. */
+- (OTRKitCConversation *)_conversationForTag:(nullable id)tag hostTag:(void * _Nullable * _Nonnull)hostTag username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(hostTag != NULL);
+
+	*hostTag = NULL;
+
+	if ([tag isKindOfClass:[OTRKitCConversation class]]) {
+		return tag;
+	} else if ([tag isKindOfClass:[OTRKitCOperationTag class]]) {
+		*hostTag = ((OTRKitCOperationTag *)tag).tag;
+
+		return ((OTRKitCOperationTag *)tag).conversation;
+	}
+
+	return [self conversationForUsername:username accountName:accountName protocol:protocol];
+}
+
+- (void) otrKit:(OTRKit *)otrKit
+  injectMessage:(NSString *)message
+	   username:(NSString *)username
+	accountName:(NSString *)accountName
+	   protocol:(NSString *)protocol
+			tag:(nullable id)tag
+{
+	if (self.released) {
+		return;
+	}
+
+	@autoreleasepool {
+		void *hostTag = NULL;
+
+		OTRKitCConversation *conversation = [self _conversationForTag:tag hostTag:&hostTag username:username accountName:accountName protocol:protocol];
+
+		self->_callbacks.injectMessage(self->_callbacks.userData,
+									   (__bridge OTRKitCConversationRef)conversation,
+									   message.UTF8String,
+									   [message lengthOfBytesUsingEncoding:NSUTF8StringEncoding],
+									   hostTag);
+	}
+}
+
+- (void) otrKit:(OTRKit *)otrKit
+ encodedMessage:(nullable NSString *)encodedMessage
+   wasEncrypted:(BOOL)wasEncrypted
+	   username:(NSString *)username
+	accountName:(NSString *)accountName
+	   protocol:(NSString *)protocol
+			tag:(nullable id)tag
+		  error:(nullable NSError *)error
+{
+	if (self.released || self->_callbacks.encodedMessage == NULL) {
+		return;
+	}
+
+	@autoreleasepool {
+		void *hostTag = NULL;
+
+		OTRKitCConversation *conversation = [self _conversationForTag:tag hostTag:&hostTag username:username accountName:accountName protocol:protocol];
+
+		self->_callbacks.encodedMessage(self->_callbacks.userData,
+										(__bridge OTRKitCConversationRef)conversation,
+										encodedMessage.UTF8String,
+										[encodedMessage lengthOfBytesUsingEncoding:NSUTF8StringEncoding],
+										wasEncrypted,
+										(long)error.code,
+										hostTag);
+	}
+}
+
+- (void) otrKit:(OTRKit *)otrKit
+ decodedMessage:(nullable NSString *)decodedMessage
+   wasEncrypted:(BOOL)wasEncrypted
+		   tlvs:(NSArray<OTRTLV *> *)tlvs
+	   username:(NSString *)username
+	accountName:(NSString *)accountName
+	   protocol:(NSString *)protocol
+			tag:(nullable id)tag
+{
+	if (self.released || self->_callbacks.decodedMessage == NULL) {
+		return;
+	}
+
+	@autoreleasepool {
+		void *hostTag = NULL;
+
+		OTRKitCConversation *conversation = [self _conversationForTag:tag hostTag:&hostTag username:username accountName:accountName protocol:protocol];
+
+		NSUInteger tlvCount = tlvs.count;
+
+		OTRKitCTLV *tlvsC = NULL;
+
+		if (tlvCount > 0) {
+			tlvsC = calloc(tlvCount, sizeof(OTRKitCTLV));
+
+			for (NSUInteger i = 0; i < tlvCount; i++) {
+				OTRTLV *tlv = tlvs[i];
+
+				tlvsC[i].type = tlv.type;
+				tlvsC[i].data = tlv.data.bytes;
+				tlvsC[i].length = tlv.data.length;
+			}
+		}
+
+		self->_callbacks.decodedMessage(self->_callbacks.userData,
+										(__bridge OTRKitCConversationRef)conversation,
+										decodedMessage.UTF8String,
+										[decodedMessage lengthOfBytesUsingEncoding:NSUTF8StringEncoding],
+										wasEncrypted,
+										tlvsC,
+										tlvCount,
+										hostTag);
+
+		free(tlvsC);
+	}
+}
+
+- (void)    otrKit:(OTRKit *)otrKit
+updateMessageState:(OTRKitMessageState)messageState
+		  username:(NSString *)username
+	   accountName:(NSString *)accountName
+		  protocol:(NSString *)protocol
+{
+	if (self.released || self->_callbacks.messageStateChanged == NULL) {
+		return;
+	}
+
+	OTRKitCConversation *conversation = [self conversationForUsername:username accountName:accountName protocol:protocol];
+
+	self->_callbacks.messageStateChanged(self->_callbacks.userData,
+										 (__bridge OTRKitCConversationRef)conversation,
+										 (OTRKitCMessageState)messageState);
+}
+
+- (BOOL)       otrKit:(OTRKit *)otrKit
+   isUsernameLoggedIn:(NSString *)username
+		  accountName:(NSString *)accountName
+			 protocol:(NSString *)protocol
+{
+	if (self.released || self->_callbacks.isLoggedIn == NULL) {
+		return YES;
+	}
+
+	OTRKitCConversation *conversation = [self conversationForUsername:username accountName:accountName protocol:protocol];
+
+	return self->_callbacks.isLoggedIn(self->_callbacks.userData, (__bridge OTRKitCConversationRef)conversation);
+}
+
+- (void)    otrKit:(OTRKit *)otrKit
+handleMessageEvent:(OTRKitMessageEvent)event
+		   message:(NSString *)message
+		  username:(NSString *)username
+	   accountName:(NSString *)accountName
+		  protocol:(NSString *)protocol
+			   tag:(nullable id)tag
+			 error:(nullable NSError *)error
+{
+	if (self.released || self->_callbacks.messageEvent == NULL) {
+		return;
+	}
+
+	@autoreleasepool {
+		void *hostTag = NULL;
+
+		OTRKitCConversation *conversation = [self _conversationForTag:tag hostTag:&hostTag username:username accountName:accountName protocol:protocol];
+
+		self->_callbacks.messageEvent(self->_callbacks.userData,
+									  (__bridge OTRKitCConversationRef)conversation,
+									  (OTRKitCMessageEvent)event,
+									  message.UTF8String,
+									  [message lengthOfBytesUsingEncoding:NSUTF8StringEncoding],
+									  (long)error.code,
+									  hostTag);
+	}
+}
+
+/* The C interface does not offer fingerprint confirmation,
+ SMP, or symmetric keys yet. These are left unanswered. */
+- (void)                           otrKit:(OTRKit *)otrKit
+  showFingerprintConfirmationForTheirHash:(NSString *)theirHash
+								  ourHash:(NSString *)ourHash
+								 username:(NSString *)username
+							  accountName:(NSString *)accountName
+								 protocol:(NSString *)protocol
+{
+
+}
+
+- (void)							  otrKit:(OTRKit *)otrKit
+fingerprintIsVerifiedStateChangedForUsername:(NSString *)username
+								 accountName:(NSString *)accountName
+									protocol:(NSString *)protocol
+									verified:(BOOL)verified
+{
+
+}
+
+- (void) otrKit:(OTRKit *)otrKit
+ handleSMPEvent:(OTRKitSMPEvent)event
+	   progress:(double)progress
+	   question:(nullable NSString *)question
+	   username:(NSString *)username
+	accountName:(NSString *)accountName
+	   protocol:(NSString *)protocol
+		  error:(nullable NSError *)error
+{
+
+}
+
+- (void)        otrKit:(OTRKit *)otrKit
+  receivedSymmetricKey:(NSData *)symmetricKey
+				forUse:(NSUInteger)use
+			   useData:(NSData *)useData
+			  username:(NSString *)username
+		   accountName:(NSString *)accountName
+			  protocol:(NSString *)protocol
+{
+
+}
+
+@end
+
+#pragma mark -
+#pragma mark C Interface
+
+static inline OTRKitCInstance *OTRKitCInstanceForRef(OTRKitCRef otrKit)
+{
+	return (__bridge OTRKitCInstance *)(void *)otrKit;
+}
+
+static inline OTRKitCConversation *OTRKitCConversationForRef(OTRKitCConversationRef conversation)
+{
+	return (__bridge OTRKitCConversation *)(void *)conversation;
+}
+
+/* The tag handed to OTRKit for a tag of the host */
+static id OTRKitCTagForHostTag(OTRKitCConversation *conversation, void * _Nullable tag)
+{
+	if (tag == NULL) {
+		return conversation;
+	}
+
+	OTRKitCOperationTag *operationTag = [OTRKitCOperationTag new];
+
+	operationTag.conversation = conversation;
+
+	operationTag.tag = tag;
+
+	return operationTag;
+}
+
+OTRKitCRef OTRKitCCreate(const char *dataPath, const OTRKitCCallbacks *callbacks)
+{
+	NSCParameterAssert(dataPath != NULL);
+	NSCParameterAssert(callbacks != NULL);
+
+	@autoreleasepool {
+		NSString *dataPathString = [NSString stringWithUTF8String:dataPath];
+
+		if (dataPathString == nil) {
+			return NULL;
+		}
+
+		OTRKitCInstance *instance = [[OTRKitCInstance alloc] initWithDataPath:dataPathString callbacks:callbacks];
+
+		return (OTRKitCRef)CFBridgingRetain(instance);
+	}
+}
+
+void OTRKitCRelease(OTRKitCRef otrKit)
+{
+	NSCParameterAssert(otrKit != NULL);
+
+	@autoreleasepool {
+		OTRKitCInstance *instance = CFBridgingRelease((void *)otrKit);
+
+		[instance invalidate];
+	}
+}
+
+void OTRKitCSetPolicy(OTRKitCRef otrKit, OTRKitCPolicy policy)
+{
+	NSCParameterAssert(otrKit != NULL);
+
+	OTRKitCInstanceForRef(otrKit).otrKit.otrPolicy = (OTRKitPolicy)policy;
+}
+
+OTRKitCConversationRef OTRKitCConversationCreate(OTRKitCRef otrKit, const char *username, const char *accountName, const char *protocol)
+{
+	NSCParameterAssert(otrKit != NULL);
+	NSCParameterAssert(username != NULL);
+	NSCParameterAssert(accountName != NULL);
+	NSCParameterAssert(protocol != NULL);
+
+	@autoreleasepool {
+		NSString *usernameString = [NSString stringWithUTF8String:username];
+		NSString *accountNameString = [NSString stringWithUTF8String:accountName];
+		NSString *protocolString = [NSString stringWithUTF8String:protocol];
+
+		if (usernameString == nil || accountNameString == nil || protocolString == nil) {
+			return NULL;
+		}
+
+		OTRKitCConversation *conversation = [OTRKitCInstanceForRef(otrKit) conversationForUsername:usernameString accountName:accountNameString protocol:protocolString];
+
+		return (OTRKitCConversationRef)CFBridgingRetain(conversation);
+	}
+}
+
+OTRKitCConversationRef OTRKitCConversationRetain(OTRKitCConversationRef conversation)
+{
+	NSCParameterAssert(conversation != NULL);
+
+	CFRetain((CFTypeRef)conversation);
+
+	return conversation;
+}
+
+void OTRKitCConversationRelease(OTRKitCConversationRef conversation)
+{
+	NSCParameterAssert(conversation != NULL);
+
+	CFRelease((CFTypeRef)conversation);
+}
+
+const char *OTRKitCConversationGetUsername(OTRKitCConversationRef conversation)
+{
+	NSCParameterAssert(conversation != NULL);
+
+	return OTRKitCConversationForRef(conversation).identity.usernameUTF8;
+}
+
+const char *OTRKitCConversationGetAccountName(OTRKitCConversationRef conversation)
+{
+	NSCParameterAssert(conversation != NULL);
+
+	return OTRKitCConversationForRef(conversation).identity.accountNameUTF8;
+}
+
+const char *OTRKitCConversationGetProtocol(OTRKitCConversationRef conversation)
+{
+	NSCParameterAssert(conversation != NULL);
+
+	return OTRKitCConversationForRef(conversation).identity.protocolUTF8;
+}
+
+bool OTRKitCEncode(OTRKitCConversationRef conversation, const char *message, size_t length, void *tag)
+{
+	NSCParameterAssert(conversation != NULL);
+	NSCParameterAssert(message != NULL || length == 0);
+
+	OTRKitCConversation *conversationObject = OTRKitCConversationForRef(conversation);
+
+	if (conversationObject.instance.released) {
+		return false;
+	}
+
+	@autoreleasepool {
+		NSString *messageString = [[NSString alloc] initWithBytes:message length:length encoding:NSUTF8StringEncoding];
+
+		if (messageString == nil) {
+			return false;
+		}
+
+		[conversationObject.instance.otrKit encodeMessage:messageString
+													 tlvs:nil
+												 username:conversationObject.identity.username
+											  accountName:conversationObject.identity.accountName
+												 protocol:conversationObject.identity.protocol
+										   asynchronously:YES
+													  tag:OTRKitCTagForHostTag(conversationObject, tag)];
+	}
+
+	return true;
+}
+
+bool OTRKitCDecode(OTRKitCConversationRef conversation, const char *message, size_t length, void *tag)
+{
+	NSCParameterAssert(conversation != NULL);
+	NSCParameterAssert(message != NULL || length == 0);
+
+	OTRKitCConversation *conversationObject = OTRKitCConversationForRef(conversation);
+
+	if (conversationObject.instance.released) {
+		return false;
+	}
+
+	@autoreleasepool {
+		NSString *messageString = [[NSString alloc] initWithBytes:message length:length encoding:NSUTF8StringEncoding];
+
+		if (messageString == nil) {
+			return false;
+		}
+
+		[conversationObject.instance.otrKit decodeMessage:messageString
+												 username:conversationObject.identity.username
+											  accountName:conversationObject.identity.accountName
+												 protocol:conversationObject.identity.protocol
+										   asynchronously:YES
+													  tag:OTRKitCTagForHostTag(conversationObject, tag)];
+	}
+
+	return true;
+}
+
+void OTRKitCInitiateEncryption(OTRKitCConversationRef conversation)
+{
+	NSCParameterAssert(conversation != NULL);
+
+	OTRKitCConversation *conversationObject = OTRKitCConversationForRef(conversation);
+
+	if (conversationObject.instance.released) {
+		return;
+	}
+
+	[conversationObject.instance.otrKit initiateEncryptionWithUsername:conversationObject.identity.username
+														   accountName:conversationObject.identity.accountName
+															  protocol:conversationObject.identity.protocol
+														asynchronously:YES];
+}
+
+void OTRKitCDisableEncryption(OTRKitCConversationRef conversation)
+{
+	NSCParameterAssert(conversation != NULL);
+
+	OTRKitCConversation *conversationObject = OTRKitCConversationForRef(conversation);
+
+	if (conversationObject.instance.released) {
+		return;
+	}
+
+	[conversationObject.instance.otrKit disableEncryptionWithUsername:conversationObject.identity.username
+														  accountName:conversationObject.identity.accountName
+															 protocol:conversationObject.identity.protocol];
+}
+
+OTRKitCMessageState OTRKitCGetMessageState(OTRKitCConversationRef conversation)
+{
+	NSCParameterAssert(conversation != NULL);
+
+	OTRKitCConversation *conversationObject = OTRKitCConversationForRef(conversation);
+
+	if (conversationObject.instance.released) {
+		return OTRKitCMessageStatePlaintext;
+	}
+
+	OTRKitMessageState messageState =
+	[conversationObject.instance.otrKit messageStateForUsername:conversationObject.identity.username
+													accountName:conversationObject.identity.accountName
+													   protocol:conversationObject.identity.protocol];
+
+	return (OTRKitCMessageState)messageState;
+}
+
+char *OTRKitCCopyActiveFingerprint(OTRKitCConversationRef conversation)
+{
+	NSCParameterAssert(conversation != NULL);
+
+	OTRKitCConversation *conversationObject = OTRKitCConversationForRef(conversation);
+
+	if (conversationObject.instance.released) {
+		return NULL;
+	}
+
+	@autoreleasepool {
+		NSString *fingerprint =
+		[conversationObject.instance.otrKit activeFingerprintForUsername:conversationObject.identity.username
+															 accountName:conversationObject.identity.accountName
+																protocol:conversationObject.identity.protocol];
+
+		if (fingerprint == nil) {
+			return NULL;
+		}
+
+		return strdup(fingerprint.UTF8String);
+	}
+}
+
+void OTRKitCFree(void *pointer)
+{
+	free(pointer);
+}
+
+NS_ASSUME_NONNULL_END
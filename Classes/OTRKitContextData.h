@@ -0,0 +1,64 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class OTRKitConversation;
+
+/* OTRKitContextData is attached to the app_data of a master ConnContext
+ the first time OTRKit needs to remember something about a conversation.
+ libotr releases it together with the context. */
+@interface OTRKitContextData : NSObject
+/* The conversation the context belongs to */
+@property (nonatomic, strong, nullable) OTRKitConversation *conversation;
+
+/* Resolved value of max_message_size_cb. It is recalculated when
+ maximumMessageSizeGeneration no longer matches that of OTRKit. */
+@property (nonatomic, assign) int maximumMessageSize;
+@property (nonatomic, assign) NSUInteger maximumMessageSizeGeneration;
+@property (nonatomic, assign) BOOL maximumMessageSizeIsContactOverride;
+
+/* Adaptive message size learned from transport feedback. */
+@property (nonatomic, assign) int learnedMessageSize;
+@property (nonatomic, assign) int truncatedMessageSize;
+@property (nonatomic, assign) NSUInteger deliveriesAtLearnedMessageSize;
+
+/* Time the conversation was last looked up. Used to decide
+ which contexts are forgotten once they have been idle. */
+@property (nonatomic, assign) NSTimeInterval lastUsedTime;
+
+/* Truncated digests of the data messages and fragments received most
+ recently, oldest first. Used to drop messages delivered twice. */
+@property (nonatomic, strong, nullable) NSMutableOrderedSet<NSData *> *recentMessageDigests;
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,62 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+NS_ASSUME_NONNULL_BEGIN
+
+/* OTRKitConversation is the identity of a conversation: the remote user, the
+ local account and the protocol. OTRKit keeps one for each conversation it
+ knows of so that the strings naming it, their UTF-8 forms, and its key are
+ made once rather than each time a message passes through libotr. */
+@interface OTRKitConversation : NSObject
+@property (nonatomic, copy, readonly) NSString *username;
+@property (nonatomic, copy, readonly) NSString *accountName;
+@property (nonatomic, copy, readonly) NSString *protocol;
+
+/* "username <-> accountName <-> protocol" which is also the submission key */
+@property (nonatomic, copy, readonly) NSString *conversationKey;
+
+/* Valid for as long as the conversation is */
+@property (nonatomic, assign, readonly) const char *usernameUTF8;
+@property (nonatomic, assign, readonly) const char *accountNameUTF8;
+@property (nonatomic, assign, readonly) const char *protocolUTF8;
+
+/* Whether the conversation is the one attached to a context of libotr.
+ It is then forgotten along with that context. Only accessed on the
+ internal queue of OTRKit. */
+@property (nonatomic, assign) BOOL hasContext;
+
+- (instancetype)initWithUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol NS_DESIGNATED_INITIALIZER;
+
+- (BOOL)isForUsernameUTF8:(const char *)username accountNameUTF8:(const char *)accountName protocolUTF8:(const char *)protocol;
+@end
+
+NS_ASSUME_NONNULL_END
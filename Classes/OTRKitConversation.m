@@ -0,0 +1,123 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKitConversation.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface OTRKitConversation ()
+{
+	char *_usernameUTF8;
+	char *_accountNameUTF8;
+	char *_protocolUTF8;
+}
+
+@property (nonatomic, copy, readwrite) NSString *username;
+@property (nonatomic, copy, readwrite) NSString *accountName;
+@property (nonatomic, copy, readwrite) NSString *protocol;
+@property (nonatomic, copy, readwrite) NSString *conversationKey;
+@end
+
+@implementation OTRKitConversation
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+- (instancetype)init
+{
+	return nil;
+}
+#pragma clang diagnostic pop
+
+- (instancetype)initWithUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	if ((self = [super init])) {
+		self.username = username;
+		self.accountName = accountName;
+		self.protocol = protocol;
+
+		self.conversationKey = [NSString stringWithFormat:@"%@ <-> %@ <-> %@", username, accountName, protocol];
+
+		self->_usernameUTF8 = strdup(username.UTF8String);
+		self->_accountNameUTF8 = strdup(accountName.UTF8String);
+		self->_protocolUTF8 = strdup(protocol.UTF8String);
+
+		return self;
+	}
+
+	return nil;
+}
+
+- (void)dealloc
+{
+	free(self->_usernameUTF8);
+	free(self->_accountNameUTF8);
+	free(self->_protocolUTF8);
+}
+
+- (const char *)usernameUTF8
+{
+	return self->_usernameUTF8;
+}
+
+- (const char *)accountNameUTF8
+{
+	return self->_accountNameUTF8;
+}
+
+- (const char *)protocolUTF8
+{
+	return self->_protocolUTF8;
+}
+
+- (BOOL)isForUsernameUTF8:(const char *)username accountNameUTF8:(const char *)accountName protocolUTF8:(const char *)protocol
+{
+	NSParameterAssert(username != NULL);
+	NSParameterAssert(accountName != NULL);
+	NSParameterAssert(protocol != NULL);
+
+	return (strcmp(self->_usernameUTF8, username) == 0 &&
+			strcmp(self->_accountNameUTF8, accountName) == 0 &&
+			strcmp(self->_protocolUTF8, protocol) == 0);
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<%@: %@>", NSStringFromClass([self class]), self.conversationKey];
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,206 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class OTRKitDataTransferManager;
+
+typedef NS_ENUM(NSUInteger, OTRKitDataTransferDirection) {
+	OTRKitDataTransferDirectionIncoming,
+	OTRKitDataTransferDirectionOutgoing
+};
+
+typedef NS_ENUM(NSUInteger, OTRKitDataTransferState) {
+	OTRKitDataTransferStateOffered,
+	OTRKitDataTransferStateTransferring,
+	OTRKitDataTransferStateCompleted,
+	OTRKitDataTransferStateFailed,
+	OTRKitDataTransferStateCancelled
+};
+
+/**
+ *  A snapshot of a transfer at the time it was handed out.
+ *  A new snapshot is created each time the delegate is informed of a change.
+ */
+@interface OTRKitDataTransfer : NSObject
+@property (nonatomic, copy, readonly) NSString *identifier;
+@property (nonatomic, copy, readonly) NSString *username;
+@property (nonatomic, copy, readonly) NSString *accountName;
+@property (nonatomic, copy, readonly) NSString *protocol;
+@property (nonatomic, assign, readonly) OTRKitDataTransferDirection direction;
+@property (nonatomic, assign, readonly) OTRKitDataTransferState state;
+
+/**
+ *  Name and MIME type suggested by the sender
+ */
+@property (nonatomic, copy, readonly, nullable) NSString *fileName;
+@property (nonatomic, copy, readonly, nullable) NSString *mimeType;
+
+/**
+ *  Path of the file being sent, or of the file being written once an offer is accepted
+ */
+@property (nonatomic, copy, readonly, nullable) NSString *filePath;
+
+@property (nonatomic, assign, readonly) uint64_t fileLength;
+@property (nonatomic, assign, readonly) uint64_t bytesTransferred;
+
+/**
+ *  Value between 0.0 and 1.0
+ */
+@property (nonatomic, assign, readonly) double progress;
+
+/**
+ *  Average number of bytes transferred per second since the transfer began
+ */
+@property (nonatomic, assign, readonly) double throughput;
+
+@property (nonatomic, strong, readonly, nullable) NSError *error;
+@end
+
+@protocol OTRKitDataTransferManagerDelegate <NSObject>
+@required
+
+/**
+ *  The remote user offered a file. Call -acceptTransfer:destinationPath:
+ *  or -rejectTransfer: to respond.
+ *
+ *  @param manager		Reference to the manager of the OTRKit instance
+ *  @param transfer		The transfer offered
+ */
+- (void)dataTransferManager:(OTRKitDataTransferManager *)manager didReceiveOffer:(OTRKitDataTransfer *)transfer;
+
+@optional
+
+/**
+ *  Called at most once per progress interval while data is moving.
+ */
+- (void)dataTransferManager:(OTRKitDataTransferManager *)manager transferDidUpdateProgress:(OTRKitDataTransfer *)transfer;
+
+/**
+ *  Called when a transfer completes. An incoming transfer completes once every
+ *  byte is written. An outgoing transfer completes once every byte was sent and
+ *  the remote user has stopped asking for any of it again, which takes
+ *  requestTimeout multiplied by one more than maximumRetransmits.
+ */
+- (void)dataTransferManager:(OTRKitDataTransferManager *)manager transferDidComplete:(OTRKitDataTransfer *)transfer;
+
+/**
+ *  Called when a transfer fails. The error property of transfer describes the problem.
+ */
+- (void)dataTransferManager:(OTRKitDataTransferManager *)manager transferDidFail:(OTRKitDataTransfer *)transfer;
+@end
+
+/**
+ *  OTRKitDataTransferManager transfers files over an encrypted conversation using
+ *  OTRDATA requests and responses carried in OTRTLVTypeDataRequest and
+ *  OTRTLVTypeDataResponse TLVs.
+ *
+ *  The sender offers a file. The receiver then requests it in chunks, keeping
+ *  several requests outstanding at once. The number of outstanding requests
+ *  shrinks when requests time out and grows again as responses arrive.
+ *  Requests that time out are sent again.
+ *
+ *  Data TLVs are handled by the manager and no longer passed to the
+ *  decodedMessage: delegate method once a delegate is set.
+ *  Delegate methods are called on the delegate queue of OTRKit.
+ */
+@interface OTRKitDataTransferManager : NSObject
+@property (nonatomic, weak, nullable) id<OTRKitDataTransferManagerDelegate> delegate;
+
+/**
+ *  Number of bytes requested at a time. Defaults to 16 KiB.
+ *  Values above 60 KiB are reduced so a chunk fits in a single TLV.
+ */
+@property (nonatomic, assign) NSUInteger chunkSize;
+
+/**
+ *  Number of requests that may be outstanding for each conversation. Defaults to 4.
+ */
+@property (nonatomic, assign) NSUInteger maximumOutstandingRequests;
+
+/**
+ *  Number of seconds to wait for a response before a request is sent again. Defaults to 30.
+ */
+@property (nonatomic, assign) NSTimeInterval requestTimeout;
+
+/**
+ *  Number of times a request is sent again before the transfer fails. Defaults to 3.
+ */
+@property (nonatomic, assign) NSUInteger maximumRetransmits;
+
+/**
+ *  Number of seconds between progress updates. Defaults to 1.
+ */
+@property (nonatomic, assign) NSTimeInterval progressInterval;
+
+/**
+ *  Offer a file to a remote user. The conversation must be encrypted.
+ *
+ *  The transfer remains offered until the remote user requests the file
+ *  or the transfer is cancelled.
+ *
+ *  @param filePath		Path of the file to send
+ *  @param fileName		Name suggested to the remote user. Defaults to the last path component.
+ *  @param mimeType		MIME type suggested to the remote user
+ *  @param username		The account name of the remote user
+ *  @param accountName	The account name of the local user
+ *  @param protocol		The protocol of the exchange
+ *  @param error		Describes the problem if nil is returned
+ */
+- (nullable OTRKitDataTransfer *)offerFileAtPath:(NSString *)filePath
+										fileName:(nullable NSString *)fileName
+										mimeType:(nullable NSString *)mimeType
+										username:(NSString *)username
+									 accountName:(NSString *)accountName
+										protocol:(NSString *)protocol
+										   error:(NSError **)error;
+
+/**
+ *  Accept an offer and begin requesting the file.
+ *
+ *  @param transfer			The transfer given to -dataTransferManager:didReceiveOffer:
+ *  @param destinationPath	Path to write the file to. Replaced if it exists.
+ */
+- (void)acceptTransfer:(OTRKitDataTransfer *)transfer destinationPath:(NSString *)destinationPath;
+
+/**
+ *  Forget an offer. The remote user is not told, which is what OTRDATA expects.
+ */
+- (void)rejectTransfer:(OTRKitDataTransfer *)transfer;
+
+/**
+ *  Stop a transfer in either direction. The delegate is not informed.
+ */
+- (void)cancelTransfer:(OTRKitDataTransfer *)transfer;
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,1284 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKitPrivate.h"
+#import "OTRKitDataTransferManagerPrivate.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/* Leaves room for the request line and headers within UINT16_MAX. */
+static NSUInteger const kOTRKitDataTransferMaximumChunkSize		= (60 * 1024);
+
+static NSUInteger const kOTRKitDataTransferDefaultChunkSize		= (16 * 1024);
+
+static NSTimeInterval const kOTRKitDataTransferTimerInterval	= 0.5;
+
+static NSString * const kOTRKitDataTransferURLPrefix			= @"otr-in-band:/storage/";
+static NSString * const kOTRKitDataTransferVersion				= @"HTTP/1.1";
+
+#pragma mark -
+#pragma mark Private Interfaces
+
+@interface OTRKitDataTransfer ()
+@property (nonatomic, copy, readwrite) NSString *identifier;
+@property (nonatomic, copy, readwrite) NSString *username;
+@property (nonatomic, copy, readwrite) NSString *accountName;
+@property (nonatomic, copy, readwrite) NSString *protocol;
+@property (nonatomic, assign, readwrite) OTRKitDataTransferDirection direction;
+@property (nonatomic, assign, readwrite) OTRKitDataTransferState state;
+@property (nonatomic, copy, readwrite, nullable) NSString *fileName;
+@property (nonatomic, copy, readwrite, nullable) NSString *mimeType;
+@property (nonatomic, copy, readwrite, nullable) NSString *filePath;
+@property (nonatomic, assign, readwrite) uint64_t fileLength;
+@property (nonatomic, assign, readwrite) uint64_t bytesTransferred;
+@property (nonatomic, assign, readwrite) double progress;
+@property (nonatomic, assign, readwrite) double throughput;
+@property (nonatomic, strong, readwrite, nullable) NSError *error;
+@end
+
+/* An OTRDATA request or response. The format is that of HTTP/1.1:
+ a start line, headers, an empty line, then the body as raw bytes. */
+@interface OTRKitDataTransferMessage : NSObject
+@property (nonatomic, assign) BOOL isResponse;
+@property (nonatomic, copy, nullable) NSString *method;
+@property (nonatomic, copy, nullable) NSString *url;
+@property (nonatomic, assign) NSInteger statusCode;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSString *> *headers;
+@property (nonatomic, copy, nullable) NSData *body;
+
++ (instancetype)requestWithMethod:(NSString *)method url:(NSString *)url;
++ (instancetype)responseWithStatusCode:(NSInteger)statusCode;
+
++ (nullable instancetype)messageWithData:(NSData *)data;
+
+- (nullable NSString *)valueForHeader:(NSString *)name;
+
+@property (readonly, copy) NSData *data;
+@end
+
+@interface OTRKitDataTransferRequest : NSObject
+@property (nonatomic, copy) NSString *requestIdentifier;
+@property (nonatomic, strong) OTRKitDataTransferMessage *message;
+@property (nonatomic, assign) uint64_t offset;
+@property (nonatomic, assign) uint64_t length;
+@property (nonatomic, assign) NSTimeInterval sentTime;
+@property (nonatomic, assign) NSUInteger retransmitCount;
+@end
+
+@interface OTRKitDataTransferSession : NSObject
+@property (nonatomic, copy) NSString *identifier;
+@property (nonatomic, copy) NSString *username;
+@property (nonatomic, copy) NSString *accountName;
+@property (nonatomic, copy) NSString *protocol;
+@property (nonatomic, assign) OTRKitDataTransferDirection direction;
+@property (nonatomic, assign) OTRKitDataTransferState state;
+@property (nonatomic, copy, nullable) NSString *fileName;
+@property (nonatomic, copy, nullable) NSString *mimeType;
+@property (nonatomic, copy, nullable) NSString *filePath;
+@property (nonatomic, assign) int fileDescriptor;
+@property (nonatomic, assign) uint64_t fileLength;
+@property (nonatomic, assign) uint64_t bytesTransferred;
+@property (nonatomic, assign) uint64_t bytesReported;
+@property (nonatomic, assign) NSTimeInterval startTime;
+@property (nonatomic, assign) NSTimeInterval lastProgressTime;
+@property (nonatomic, strong, nullable) NSError *error;
+
+/* Outgoing: the offer until it is acknowledged, and the byte ranges
+ requested so far. A range requested twice is only counted once.
+ The time of the last request decides when the receiver is done. */
+@property (nonatomic, strong, nullable) OTRKitDataTransferRequest *offerRequest;
+@property (nonatomic, strong) NSMutableIndexSet *servedRanges;
+@property (nonatomic, assign) NSTimeInterval lastRequestTime;
+
+/* Incoming: the next byte to request, the number of requests allowed
+ to be outstanding for this transfer, and those that are outstanding. */
+@property (nonatomic, assign) uint64_t nextOffset;
+@property (nonatomic, assign) NSUInteger window;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, OTRKitDataTransferRequest *> *outstandingRequests;
+
+- (OTRKitDataTransfer *)snapshot;
+@end
+
+@interface OTRKitDataTransferManager ()
+@property (nonatomic, weak) OTRKit *otrKit;
+@property (nonatomic, strong) dispatch_queue_t transferQueue;
+@property (nonatomic, strong, nullable) dispatch_source_t timer;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, OTRKitDataTransferSession *> *sessions;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, OTRKitDataTransferSession *> *requests;
+@end
+
+#pragma mark -
+#pragma mark Transfer Manager
+
+@implementation OTRKitDataTransferManager
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+- (instancetype)init
+{
+	return nil;
+}
+#pragma clang diagnostic pop
+
+- (instancetype)initWithOTRKit:(OTRKit *)otrKit
+{
+	NSParameterAssert(otrKit != nil);
+
+	if ((self = [super init])) {
+		self.otrKit = otrKit;
+
+		self.transferQueue = dispatch_queue_create("OTRKit Data Transfer Queue", DISPATCH_QUEUE_SERIAL);
+
+		self.sessions = [NSMutableDictionary dictionary];
+
+		self.requests = [NSMutableDictionary dictionary];
+
+		self.chunkSize = kOTRKitDataTransferDefaultChunkSize;
+
+		self.maximumOutstandingRequests = 4;
+
+		self.requestTimeout = 30.0;
+
+		self.maximumRetransmits = 3;
+
+		self.progressInterval = 1.0;
+
+		return self;
+	}
+
+	return nil;
+}
+
+- (void)dealloc
+{
+	if ( self.timer) {
+		dispatch_source_cancel(self.timer);
+	}
+
+	for (OTRKitDataTransferSession *session in self.sessions.allValues) {
+		if (session.fileDescriptor >= 0) {
+			close(session.fileDescriptor);
+		}
+	}
+}
+
+- (BOOL)handlesDataTLVs
+{
+	return (self.delegate != nil);
+}
+
+#pragma mark -
+#pragma mark Public Interface
+
+- (nullable OTRKitDataTransfer *)offerFileAtPath:(NSString *)filePath
+										fileName:(nullable NSString *)fileName
+										mimeType:(nullable NSString *)mimeType
+										username:(NSString *)username
+									 accountName:(NSString *)accountName
+										protocol:(NSString *)protocol
+										   error:(NSError **)error
+{
+	NSParameterAssert(filePath != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	if ([self.otrKit messageStateForUsername:username accountName:accountName protocol:protocol] != OTRKitMessageStateEncrypted) {
+		[self _setError:error code:OTRKitErrorCodeConversationNotEncrypted description:@"Files can only be sent over an encrypted conversation"];
+
+		return nil;
+	}
+
+	int fileDescriptor = open(filePath.fileSystemRepresentation, O_RDONLY);
+
+	struct stat fileStat;
+
+	if (fileDescriptor < 0 || fstat(fileDescriptor, &fileStat) != 0 || S_ISREG(fileStat.st_mode) == NO) {
+		if (fileDescriptor >= 0) {
+			close(fileDescriptor);
+		}
+
+		[self _setError:error code:OTRKitErrorCodeFileReadFailed description:@"Unable to open the file to send"];
+
+		return nil;
+	}
+
+	OTRKitDataTransferSession *session = [OTRKitDataTransferSession new];
+
+	session.identifier = [NSUUID UUID].UUIDString;
+
+	session.username = username;
+	session.accountName = accountName;
+	session.protocol = protocol;
+
+	session.direction = OTRKitDataTransferDirectionOutgoing;
+
+	session.fileName = ((fileName) ?: filePath.lastPathComponent);
+
+	session.mimeType = mimeType;
+
+	session.filePath = filePath;
+
+	session.fileDescriptor = fileDescriptor;
+
+	session.fileLength = (uint64_t)fileStat.st_size;
+
+	__block OTRKitDataTransfer *transfer = nil;
+
+	dispatch_sync(self.transferQueue, ^{
+		self.sessions[[self _keyForSession:session]] = session;
+
+		OTRKitDataTransferMessage *message =
+		[OTRKitDataTransferMessage requestWithMethod:@"OFFER" url:[self _urlForIdentifier:session.identifier]];
+
+		message.headers[@"File-Length"] = [NSString stringWithFormat:@"%llu", session.fileLength];
+
+		if (session.fileName) {
+			message.headers[@"File-Name"] = session.fileName;
+		}
+
+		if (session.mimeType) {
+			message.headers[@"Mime-Type"] = session.mimeType;
+		}
+
+		session.offerRequest = [self _sendRequest:message forSession:session];
+
+		[self _startTimer];
+
+		transfer = [session snapshot];
+	});
+
+	return transfer;
+}
+
+- (void)acceptTransfer:(OTRKitDataTransfer *)transfer destinationPath:(NSString *)destinationPath
+{
+	NSParameterAssert(transfer != nil);
+	NSParameterAssert(destinationPath != nil);
+
+	dispatch_async(self.transferQueue, ^{
+		OTRKitDataTransferSession *session = [self _sessionForTransfer:transfer];
+
+		if (session == nil ||
+			session.direction != OTRKitDataTransferDirectionIncoming ||
+			session.state != OTRKitDataTransferStateOffered)
+		{
+			return;
+		}
+
+		session.filePath = destinationPath;
+
+		session.fileDescriptor = open(destinationPath.fileSystemRepresentation, (O_WRONLY | O_CREAT | O_TRUNC), 0600);
+
+		if (session.fileDescriptor < 0) {
+			[self _failSession:session code:OTRKitErrorCodeFileWriteFailed description:@"Unable to create the file to receive"];
+
+			return;
+		}
+
+		session.state = OTRKitDataTransferStateTransferring;
+
+		session.startTime = [NSProcessInfo processInfo].systemUptime;
+
+		session.window = MAX(self.maximumOutstandingRequests, (NSUInteger)1);
+
+		if (session.fileLength == 0) {
+			[self _completeSession:session];
+
+			return;
+		}
+
+		[self _requestChunksForUsername:session.username accountName:session.accountName protocol:session.protocol];
+	});
+}
+
+- (void)rejectTransfer:(OTRKitDataTransfer *)transfer
+{
+	[self cancelTransfer:transfer];
+}
+
+- (void)cancelTransfer:(OTRKitDataTransfer *)transfer
+{
+	NSParameterAssert(transfer != nil);
+
+	dispatch_async(self.transferQueue, ^{
+		OTRKitDataTransferSession *session = [self _sessionForTransfer:transfer];
+
+		if (session == nil) {
+			return;
+		}
+
+		session.state = OTRKitDataTransferStateCancelled;
+
+		[self _removeSession:session];
+	});
+}
+
+#pragma mark -
+#pragma mark Incoming Messages
+
+- (void)handleTLV:(OTRTLV *)tlv username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(tlv != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	NSData *tlvData = tlv.data;
+
+	dispatch_async(self.transferQueue, ^{
+		OTRKitDataTransferMessage *message = [OTRKitDataTransferMessage messageWithData:tlvData];
+
+		if (message == nil) {
+			return;
+		}
+
+		if (message.isResponse) {
+			[self _handleResponse:message username:username accountName:accountName protocol:protocol];
+		} else if ([message.method isEqualToString:@"OFFER"]) {
+			[self _handleOffer:message username:username accountName:accountName protocol:protocol];
+		} else if ([message.method isEqualToString:@"GET"]) {
+			[self _handleGet:message username:username accountName:accountName protocol:protocol];
+		} else {
+			[self _respondToRequest:message withStatusCode:501 body:nil username:username accountName:accountName protocol:protocol];
+		}
+	});
+}
+
+- (void)_handleOffer:(OTRKitDataTransferMessage *)message username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSString *identifier = [self _identifierForURL:message.url];
+
+	uint64_t fileLength = 0;
+
+	NSString *fileLengthString = [message valueForHeader:@"File-Length"];
+
+	if (identifier == nil || fileLengthString == nil ||
+		[[NSScanner scannerWithString:fileLengthString] scanUnsignedLongLong:&fileLength] == NO)
+	{
+		[self _respondToRequest:message withStatusCode:400 body:nil username:username accountName:accountName protocol:protocol];
+
+		return;
+	}
+
+	[self _respondToRequest:message withStatusCode:200 body:nil username:username accountName:accountName protocol:protocol];
+
+	/* The offer is sent again when our acknowledgement is lost. */
+	NSString *sessionKey = [self _keyForIdentifier:identifier username:username accountName:accountName protocol:protocol];
+
+	if (self.sessions[sessionKey]) {
+		return;
+	}
+
+	OTRKitDataTransferSession *session = [OTRKitDataTransferSession new];
+
+	session.identifier = identifier;
+
+	session.username = username;
+	session.accountName = accountName;
+	session.protocol = protocol;
+
+	session.direction = OTRKitDataTransferDirectionIncoming;
+
+	session.fileName = (([message valueForHeader:@"File-Name"]) ?: identifier);
+
+	session.mimeType = [message valueForHeader:@"Mime-Type"];
+
+	session.fileLength = fileLength;
+
+	self.sessions[sessionKey] = session;
+
+	[self _startTimer];
+
+	OTRKitDataTransfer *transfer = [session snapshot];
+
+	[self _notifyDelegate:^(id<OTRKitDataTransferManagerDelegate> delegate) {
+		[delegate dataTransferManager:self didReceiveOffer:transfer];
+	}];
+}
+
+- (void)_handleGet:(OTRKitDataTransferMessage *)message username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSString *identifier = [self _identifierForURL:message.url];
+
+	OTRKitDataTransferSession *session = nil;
+
+	if (identifier) {
+		session = self.sessions[[self _keyForIdentifier:identifier username:username accountName:accountName protocol:protocol]];
+	}
+
+	if (session == nil || session.direction != OTRKitDataTransferDirectionOutgoing) {
+		[self _respondToRequest:message withStatusCode:404 body:nil username:username accountName:accountName protocol:protocol];
+
+		return;
+	}
+
+	uint64_t rangeStart = 0;
+	uint64_t rangeEnd = 0;
+
+	NSString *rangeString = [message valueForHeader:@"Range"];
+
+	if (rangeString) {
+		NSScanner *rangeScanner = [NSScanner scannerWithString:rangeString];
+
+		if ([rangeScanner scanString:@"bytes=" intoString:NULL] == NO ||
+			[rangeScanner scanUnsignedLongLong:&rangeStart] == NO ||
+			[rangeScanner scanString:@"-" intoString:NULL] == NO ||
+			[rangeScanner scanUnsignedLongLong:&rangeEnd] == NO ||
+			rangeScanner.isAtEnd == NO)
+		{
+			rangeString = nil;
+		}
+	}
+
+	if (rangeString == nil ||
+		rangeStart > rangeEnd ||
+		rangeEnd >= session.fileLength ||
+		(rangeEnd - rangeStart) >= kOTRKitDataTransferMaximumChunkSize)
+	{
+		[self _respondToRequest:message withStatusCode:416 body:nil username:username accountName:accountName protocol:protocol];
+
+		return;
+	}
+
+	/* A request for data means the offer arrived. */
+	[self _forgetOfferOfSession:session];
+
+	NSTimeInterval now = [NSProcessInfo processInfo].systemUptime;
+
+	if (session.state == OTRKitDataTransferStateOffered) {
+		session.state = OTRKitDataTransferStateTransferring;
+
+		session.startTime = now;
+	}
+
+	session.lastRequestTime = now;
+
+	size_t chunkLength = (size_t)(rangeEnd - rangeStart + 1);
+
+	NSMutableData *chunkData = [NSMutableData dataWithLength:chunkLength];
+
+	if (pread(session.fileDescriptor, chunkData.mutableBytes, chunkLength, (off_t)rangeStart) != (ssize_t)chunkLength) {
+		[self _respondToRequest:message withStatusCode:500 body:nil username:username accountName:accountName protocol:protocol];
+
+		[self _failSession:session code:OTRKitErrorCodeFileReadFailed description:@"Unable to read from the file being sent"];
+
+		return;
+	}
+
+	[self _respondToRequest:message withStatusCode:200 body:chunkData username:username accountName:accountName protocol:protocol];
+
+	[session.servedRanges addIndexesInRange:NSMakeRange((NSUInteger)rangeStart, chunkLength)];
+
+	/* The session is kept once every byte was served because a response
+	 may have been lost. It completes once the receiver stops asking. */
+	session.bytesTransferred = session.servedRanges.count;
+}
+
+- (void)_handleResponse:(OTRKitDataTransferMessage *)message username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSString *requestIdentifier = [message valueForHeader:@"Request-Id"];
+
+	if (requestIdentifier == nil) {
+		return;
+	}
+
+	NSString *requestKey = [self _keyForIdentifier:requestIdentifier username:username accountName:accountName protocol:protocol];
+
+	OTRKitDataTransferSession *session = self.requests[requestKey];
+
+	/* Late responses to requests that were sent again end up here. */
+	if (session == nil) {
+		return;
+	}
+
+	[self.requests removeObjectForKey:requestKey];
+
+	if (session.direction == OTRKitDataTransferDirectionOutgoing) {
+		session.offerRequest = nil;
+
+		if (message.statusCode != 200) {
+			[self _failSession:session code:OTRKitErrorCodeDataTransferRemoteError description:@"The remote user refused the offer"];
+		} else if (session.fileLength == 0) {
+			[self _completeSession:session];
+		}
+
+		return;
+	}
+
+	OTRKitDataTransferRequest *request = session.outstandingRequests[requestIdentifier];
+
+	[session.outstandingRequests removeObjectForKey:requestIdentifier];
+
+	if (request == nil) {
+		return;
+	}
+
+	if (message.statusCode != 200 || message.body.length != request.length) {
+		[self _failSession:session code:OTRKitErrorCodeDataTransferRemoteError description:@"The remote user did not send the data requested"];
+
+		return;
+	}
+
+	if (pwrite(session.fileDescriptor, message.body.bytes, (size_t)request.length, (off_t)request.offset) != (ssize_t)request.length) {
+		[self _failSession:session code:OTRKitErrorCodeFileWriteFailed description:@"Unable to write to the file being received"];
+
+		return;
+	}
+
+	session.bytesTransferred += request.length;
+
+	if (session.window < self.maximumOutstandingRequests) {
+		session.window += 1;
+	}
+
+	if (session.bytesTransferred == session.fileLength) {
+		[self _completeSession:session];
+	} else {
+		[self _requestChunksForUsername:username accountName:accountName protocol:protocol];
+	}
+}
+
+#pragma mark -
+#pragma mark Flow Control
+
+- (void)_requestChunksForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	/* The window of the conversation is shared by all of its transfers
+	 which take turns so that one large file does not hold up the rest. */
+	NSMutableArray<OTRKitDataTransferSession *> *sessions = [NSMutableArray array];
+
+	NSUInteger outstandingRequests = 0;
+
+	for (OTRKitDataTransferSession *session in self.sessions.allValues) {
+		if (session.direction != OTRKitDataTransferDirectionIncoming ||
+			session.state != OTRKitDataTransferStateTransferring ||
+			[session.username isEqualToString:username] == NO ||
+			[session.accountName isEqualToString:accountName] == NO ||
+			[session.protocol isEqualToString:protocol] == NO)
+		{
+			continue;
+		}
+
+		[sessions addObject:session];
+
+		outstandingRequests += session.outstandingRequests.count;
+	}
+
+	NSUInteger maximumOutstandingRequests = MAX(self.maximumOutstandingRequests, (NSUInteger)1);
+
+	BOOL requestSent = YES;
+
+	while (requestSent && outstandingRequests < maximumOutstandingRequests) {
+		requestSent = NO;
+
+		for (OTRKitDataTransferSession *session in sessions) {
+			if (outstandingRequests >= maximumOutstandingRequests) {
+				break;
+			}
+
+			if (session.nextOffset >= session.fileLength ||
+				session.outstandingRequests.count >= session.window)
+			{
+				continue;
+			}
+
+			[self _requestNextChunkForSession:session];
+
+			outstandingRequests += 1;
+
+			requestSent = YES;
+		}
+	}
+}
+
+- (void)_requestNextChunkForSession:(OTRKitDataTransferSession *)session
+{
+	NSParameterAssert(session != nil);
+
+	NSUInteger chunkSize = MIN(MAX(self.chunkSize, (NSUInteger)1), kOTRKitDataTransferMaximumChunkSize);
+
+	uint64_t offset = session.nextOffset;
+
+	uint64_t length = MIN((uint64_t)chunkSize, (session.fileLength - offset));
+
+	OTRKitDataTransferMessage *message =
+	[OTRKitDataTransferMessage requestWithMethod:@"GET" url:[self _urlForIdentifier:session.identifier]];
+
+	message.headers[@"Range"] = [NSString stringWithFormat:@"bytes=%llu-%llu", offset, (offset + length - 1)];
+
+	OTRKitDataTransferRequest *request = [self _sendRequest:message forSession:session];
+
+	request.offset = offset;
+
+	request.length = length;
+
+	session.outstandingRequests[request.requestIdentifier] = request;
+
+	session.nextOffset = (offset + length);
+}
+
+#pragma mark -
+#pragma mark Timer
+
+- (void)_startTimer
+{
+	if (self.timer) {
+		return;
+	}
+
+	dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.transferQueue);
+
+	uint64_t interval = (uint64_t)(kOTRKitDataTransferTimerInterval * NSEC_PER_SEC);
+
+	dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, (interval / 10));
+
+	__weak OTRKitDataTransferManager *weakSelf = self;
+
+	dispatch_source_set_event_handler(timer, ^{
+		[weakSelf _timerFired];
+	});
+
+	dispatch_resume(timer);
+
+	self.timer = timer;
+}
+
+- (void)_stopTimer
+{
+	if (self.timer == nil) {
+		return;
+	}
+
+	dispatch_source_cancel(self.timer);
+
+	self.timer = nil;
+}
+
+- (void)_timerFired
+{
+	NSTimeInterval now = [NSProcessInfo processInfo].systemUptime;
+
+	for (OTRKitDataTransferSession *session in self.sessions.allValues) {
+		if (session.offerRequest) {
+			if ([self _retransmitRequest:session.offerRequest forSession:session now:now] == NO) {
+				continue;
+			}
+		}
+
+		if ([self _sessionIsServed:session now:now]) {
+			[self _completeSession:session];
+
+			continue;
+		}
+
+		for (OTRKitDataTransferRequest *request in session.outstandingRequests.allValues) {
+			if ((now - request.sentTime) < self.requestTimeout) {
+				continue;
+			}
+
+			if ([self _retransmitRequest:request forSession:session now:now] == NO) {
+				break;
+			}
+
+			/* Back off. The window grows again as responses arrive. */
+			session.window = MAX((session.window / 2), (NSUInteger)1);
+		}
+
+		if (session.state == OTRKitDataTransferStateTransferring &&
+			session.bytesTransferred != session.bytesReported &&
+			(now - session.lastProgressTime) >= self.progressInterval)
+		{
+			[self _reportProgressOfSession:session now:now];
+		}
+	}
+}
+
+/* An outgoing transfer is complete once every byte was served and the
+ receiver has gone long enough without asking that it would have given
+ up on any response that was lost. */
+- (BOOL)_sessionIsServed:(OTRKitDataTransferSession *)session now:(NSTimeInterval)now
+{
+	NSParameterAssert(session != nil);
+
+	if (session.direction != OTRKitDataTransferDirectionOutgoing ||
+		session.state != OTRKitDataTransferStateTransferring ||
+		session.bytesTransferred != session.fileLength)
+	{
+		return NO;
+	}
+
+	NSTimeInterval idleInterval = (self.requestTimeout * (self.maximumRetransmits + 1));
+
+	return ((now - session.lastRequestTime) >= idleInterval);
+}
+
+- (BOOL)_retransmitRequest:(OTRKitDataTransferRequest *)request forSession:(OTRKitDataTransferSession *)session now:(NSTimeInterval)now
+{
+	NSParameterAssert(request != nil);
+	NSParameterAssert(session != nil);
+
+	if ((now - request.sentTime) < self.requestTimeout) {
+		return YES;
+	}
+
+	if (request.retransmitCount >= self.maximumRetransmits) {
+		[self _failSession:session code:OTRKitErrorCodeDataTransferTimedOut description:@"The remote user stopped responding"];
+
+		return NO;
+	}
+
+	request.retransmitCount += 1;
+
+	request.sentTime = now;
+
+	/* The request identifier is kept so that a late response is still accepted. */
+	[self _sendMessage:request.message username:session.username accountName:session.accountName protocol:session.protocol];
+
+	return YES;
+}
+
+#pragma mark -
+#pragma mark Session Management
+
+- (void)_reportProgressOfSession:(OTRKitDataTransferSession *)session now:(NSTimeInterval)now
+{
+	NSParameterAssert(session != nil);
+
+	session.bytesReported = session.bytesTransferred;
+
+	session.lastProgressTime = now;
+
+	OTRKitDataTransfer *transfer = [session snapshot];
+
+	[self _notifyDelegate:^(id<OTRKitDataTransferManagerDelegate> delegate) {
+		if ([delegate respondsToSelector:@selector(dataTransferManager:transferDidUpdateProgress:)]) {
+			[delegate dataTransferManager:self transferDidUpdateProgress:transfer];
+		}
+	}];
+}
+
+- (void)_completeSession:(OTRKitDataTransferSession *)session
+{
+	NSParameterAssert(session != nil);
+
+	if (session.bytesTransferred != session.bytesReported) {
+		[self _reportProgressOfSession:session now:[NSProcessInfo processInfo].systemUptime];
+	}
+
+	session.state = OTRKitDataTransferStateCompleted;
+
+	[self _removeSession:session];
+
+	OTRKitDataTransfer *transfer = [session snapshot];
+
+	[self _notifyDelegate:^(id<OTRKitDataTransferManagerDelegate> delegate) {
+		if ([delegate respondsToSelector:@selector(dataTransferManager:transferDidComplete:)]) {
+			[delegate dataTransferManager:self transferDidComplete:transfer];
+		}
+	}];
+}
+
+- (void)_failSession:(OTRKitDataTransferSession *)session code:(OTRKitErrorCode)code description:(NSString *)description
+{
+	NSParameterAssert(session != nil);
+	NSParameterAssert(description != nil);
+
+	session.state = OTRKitDataTransferStateFailed;
+
+	session.error = [NSError errorWithDomain:OTRKitErrorDomain
+										code:code
+									userInfo:@{NSLocalizedDescriptionKey : description}];
+
+	NSString *username = session.username;
+	NSString *accountName = session.accountName;
+	NSString *protocol = session.protocol;
+
+	BOOL wasIncoming = (session.direction == OTRKitDataTransferDirectionIncoming);
+
+	[self _removeSession:session];
+
+	OTRKitDataTransfer *transfer = [session snapshot];
+
+	[self _notifyDelegate:^(id<OTRKitDataTransferManagerDelegate> delegate) {
+		if ([delegate respondsToSelector:@selector(dataTransferManager:transferDidFail:)]) {
+			[delegate dataTransferManager:self transferDidFail:transfer];
+		}
+	}];
+
+	/* Give the window of the failed transfer to the others. */
+	if (wasIncoming) {
+		[self _requestChunksForUsername:username accountName:accountName protocol:protocol];
+	}
+}
+
+- (void)_removeSession:(OTRKitDataTransferSession *)session
+{
+	NSParameterAssert(session != nil);
+
+	[self _forgetOfferOfSession:session];
+
+	for (NSString *requestIdentifier in session.outstandingRequests) {
+		[self.requests removeObjectForKey:[self _keyForIdentifier:requestIdentifier username:session.username accountName:session.accountName protocol:session.protocol]];
+	}
+
+	[session.outstandingRequests removeAllObjects];
+
+	if (session.fileDescriptor >= 0) {
+		close(session.fileDescriptor);
+
+		session.fileDescriptor = -1;
+	}
+
+	[self.sessions removeObjectForKey:[self _keyForSession:session]];
+
+	if (self.sessions.count == 0) {
+		[self _stopTimer];
+	}
+}
+
+- (void)_forgetOfferOfSession:(OTRKitDataTransferSession *)session
+{
+	NSParameterAssert(session != nil);
+
+	if (session.offerRequest == nil) {
+		return;
+	}
+
+	[self.requests removeObjectForKey:[self _keyForIdentifier:session.offerRequest.requestIdentifier username:session.username accountName:session.accountName protocol:session.protocol]];
+
+	session.offerRequest = nil;
+}
+
+- (nullable OTRKitDataTransferSession *)_sessionForTransfer:(OTRKitDataTransfer *)transfer
+{
+	NSParameterAssert(transfer != nil);
+
+	return self.sessions[[self _keyForIdentifier:transfer.identifier username:transfer.username accountName:transfer.accountName protocol:transfer.protocol]];
+}
+
+#pragma mark -
+#pragma mark Outgoing Messages
+
+- (OTRKitDataTransferRequest *)_sendRequest:(OTRKitDataTransferMessage *)message forSession:(OTRKitDataTransferSession *)session
+{
+	NSParameterAssert(message != nil);
+	NSParameterAssert(session != nil);
+
+	OTRKitDataTransferRequest *request = [OTRKitDataTransferRequest new];
+
+	request.requestIdentifier = [NSUUID UUID].UUIDString;
+
+	request.message = message;
+
+	request.sentTime = [NSProcessInfo processInfo].systemUptime;
+
+	message.headers[@"Request-Id"] = request.requestIdentifier;
+
+	self.requests[[self _keyForIdentifier:request.requestIdentifier username:session.username accountName:session.accountName protocol:session.protocol]] = session;
+
+	[self _sendMessage:message username:session.username accountName:session.accountName protocol:session.protocol];
+
+	return request;
+}
+
+- (void)_respondToRequest:(OTRKitDataTransferMessage *)request withStatusCode:(NSInteger)statusCode body:(nullable NSData *)body username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(request != nil);
+
+	NSString *requestIdentifier = [request valueForHeader:@"Request-Id"];
+
+	/* Without a request identifier the response can't be matched. */
+	if (requestIdentifier == nil) {
+		return;
+	}
+
+	OTRKitDataTransferMessage *response = [OTRKitDataTransferMessage responseWithStatusCode:statusCode];
+
+	response.headers[@"Request-Id"] = requestIdentifier;
+
+	if (body) {
+		response.headers[@"Content-Length"] = [NSString stringWithFormat:@"%lu", (unsigned long)body.length];
+
+		response.body = body;
+	}
+
+	[self _sendMessage:response username:username accountName:accountName protocol:protocol];
+}
+
+- (void)_sendMessage:(OTRKitDataTransferMessage *)message username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(message != nil);
+
+	OTRTLVType tlvType = ((message.isResponse) ? OTRTLVTypeDataResponse : OTRTLVTypeDataRequest);
+
+	OTRTLV *tlv = [[OTRTLV alloc] initWithType:tlvType data:message.data];
+
+	if (tlv == nil) {
+		return;
+	}
+
+	[self.otrKit _sendDataTransferTLV:tlv username:username accountName:accountName protocol:protocol];
+}
+
+#pragma mark -
+#pragma mark Helpers
+
+- (void)_notifyDelegate:(void (^)(id<OTRKitDataTransferManagerDelegate> delegate))block
+{
+	NSParameterAssert(block != nil);
+
+	[self.otrKit _performAsyncOperationOnDelegateQueue:^{
+		id<OTRKitDataTransferManagerDelegate> delegate = self.delegate;
+
+		if (delegate) {
+			block(delegate);
+		}
+	}];
+}
+
+- (NSString *)_urlForIdentifier:(NSString *)identifier
+{
+	NSParameterAssert(identifier != nil);
+
+	return [kOTRKitDataTransferURLPrefix stringByAppendingString:identifier];
+}
+
+- (nullable NSString *)_identifierForURL:(nullable NSString *)url
+{
+	if ([url hasPrefix:kOTRKitDataTransferURLPrefix] == NO) {
+		return nil;
+	}
+
+	NSString *identifier = [url substringFromIndex:kOTRKitDataTransferURLPrefix.length];
+
+	if (identifier.length == 0) {
+		return nil;
+	}
+
+	return identifier;
+}
+
+- (NSString *)_keyForSession:(OTRKitDataTransferSession *)session
+{
+	NSParameterAssert(session != nil);
+
+	return [self _keyForIdentifier:session.identifier username:session.username accountName:session.accountName protocol:session.protocol];
+}
+
+- (NSString *)_keyForIdentifier:(NSString *)identifier username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(identifier != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	return [NSString stringWithFormat:@"%@ <-> %@ <-> %@ <-> %@", identifier, username, accountName, protocol];
+}
+
+- (void)_setError:(NSError **)error code:(OTRKitErrorCode)code description:(NSString *)description
+{
+	NSParameterAssert(description != nil);
+
+	if (error == NULL) {
+		return;
+	}
+
+	*error = [NSError errorWithDomain:OTRKitErrorDomain
+								 code:code
+							 userInfo:@{NSLocalizedDescriptionKey : description}];
+}
+
+@end
+
+#pragma mark -
+#pragma mark Transfer Session
+
+@implementation OTRKitDataTransferSession
+
+- (instancetype)init
+{
+	if ((self = [super init])) {
+		self.fileDescriptor = -1;
+
+		self.servedRanges = [NSMutableIndexSet indexSet];
+
+		self.outstandingRequests = [NSMutableDictionary dictionary];
+
+		return self;
+	}
+
+	return nil;
+}
+
+- (OTRKitDataTransfer *)snapshot
+{
+	OTRKitDataTransfer *transfer = [OTRKitDataTransfer new];
+
+	transfer.identifier = self.identifier;
+
+	transfer.username = self.username;
+	transfer.accountName = self.accountName;
+	transfer.protocol = self.protocol;
+
+	transfer.direction = self.direction;
+
+	transfer.state = self.state;
+
+	transfer.fileName = self.fileName;
+	transfer.mimeType = self.mimeType;
+	transfer.filePath = self.filePath;
+
+	transfer.fileLength = self.fileLength;
+
+	transfer.bytesTransferred = self.bytesTransferred;
+
+	if (self.fileLength > 0) {
+		transfer.progress = ((double)self.bytesTransferred / (double)self.fileLength);
+	} else if (self.state == OTRKitDataTransferStateCompleted) {
+		transfer.progress = 1.0;
+	}
+
+	if (self.startTime > 0) {
+		NSTimeInterval elapsedTime = ([NSProcessInfo processInfo].systemUptime - self.startTime);
+
+		if (elapsedTime > 0) {
+			transfer.throughput = ((double)self.bytesTransferred / elapsedTime);
+		}
+	}
+
+	transfer.error = self.error;
+
+	return transfer;
+}
+
+@end
+
+@implementation OTRKitDataTransfer
+@end
+
+@implementation OTRKitDataTransferRequest
+@end
+
+#pragma mark -
+#pragma mark Transfer Message
+
+@implementation OTRKitDataTransferMessage
+
+- (instancetype)init
+{
+	if ((self = [super init])) {
+		self.headers = [NSMutableDictionary dictionary];
+
+		return self;
+	}
+
+	return nil;
+}
+
++ (instancetype)requestWithMethod:(NSString *)method url:(NSString *)url
+{
+	NSParameterAssert(method != nil);
+	NSParameterAssert(url != nil);
+
+	OTRKitDataTransferMessage *message = [self new];
+
+	message.method = method;
+
+	message.url = url;
+
+	return message;
+}
+
++ (instancetype)responseWithStatusCode:(NSInteger)statusCode
+{
+	OTRKitDataTransferMessage *message = [self new];
+
+	message.isResponse = YES;
+
+	message.statusCode = statusCode;
+
+	return message;
+}
+
++ (nullable instancetype)messageWithData:(NSData *)data
+{
+	NSParameterAssert(data != nil);
+
+	NSData *separator = [NSData dataWithBytes:"\r\n\r\n" length:4];
+
+	NSRange separatorRange = [data rangeOfData:separator options:0 range:NSMakeRange(0, data.length)];
+
+	if (separatorRange.location == NSNotFound) {
+		return nil;
+	}
+
+	NSString *head = [[NSString alloc] initWithData:[data subdataWithRange:NSMakeRange(0, separatorRange.location)] encoding:NSUTF8StringEncoding];
+
+	if (head == nil) {
+		return nil;
+	}
+
+	NSArray<NSString *> *lines = [head componentsSeparatedByString:@"\r\n"];
+
+	NSArray<NSString *> *startLine = [lines.firstObject componentsSeparatedByString:@" "];
+
+	if (startLine.count < 3) {
+		return nil;
+	}
+
+	OTRKitDataTransferMessage *message = [self new];
+
+	if ([startLine[0] hasPrefix:@"HTTP/"]) {
+		message.isResponse = YES;
+
+		message.statusCode = startLine[1].integerValue;
+	} else {
+		message.method = startLine[0];
+
+		message.url = startLine[1];
+	}
+
+	for (NSUInteger i = 1; i < lines.count; i++) {
+		NSString *line = lines[i];
+
+		NSRange colonRange = [line rangeOfString:@":"];
+
+		if (colonRange.location == NSNotFound) {
+			continue;
+		}
+
+		NSString *name = [line substringToIndex:colonRange.location];
+
+		NSString *value = [[line substringFromIndex:NSMaxRange(colonRange)] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+
+		message.headers[name] = value;
+	}
+
+	NSUInteger bodyStart = NSMaxRange(separatorRange);
+
+	/* The body is a view into data rather than a copy of it. */
+	if (bodyStart < data.length) {
+		message.body =
+		[[NSData alloc] initWithBytesNoCopy:(void *)((const uint8_t *)data.bytes + bodyStart)
+									 length:(data.length - bodyStart)
+								deallocator:^(void *bytes, NSUInteger length) {
+									(void)data;
+								}];
+	}
+
+	return message;
+}
+
+- (nullable NSString *)valueForHeader:(NSString *)name
+{
+	NSParameterAssert(name != nil);
+
+	for (NSString *headerName in self.headers) {
+		if ([headerName caseInsensitiveCompare:name] == NSOrderedSame) {
+			return self.headers[headerName];
+		}
+	}
+
+	return nil;
+}
+
+- (NSData *)data
+{
+	NSMutableString *head = [NSMutableString string];
+
+	if (self.isResponse) {
+		[head appendFormat:@"%@ %ld %@\r\n", kOTRKitDataTransferVersion, (long)self.statusCode, [self _reasonPhrase]];
+	} else {
+		[head appendFormat:@"%@ %@ %@\r\n", self.method, self.url, kOTRKitDataTransferVersion];
+	}
+
+	[self.headers enumerateKeysAndObjectsUsingBlock:^(NSString *name, NSString *value, BOOL *stop) {
+		[head appendFormat:@"%@: %@\r\n", name, value];
+	}];
+
+	[head appendString:@"\r\n"];
+
+	NSMutableData *data = [[head dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+
+	if (self.body) {
+		[data appendData:self.body];
+	}
+
+	return [data copy];
+}
+
+- (NSString *)_reasonPhrase
+{
+	switch (self.statusCode) {
+		case 200:
+		{
+			return @"OK";
+		}
+		case 400:
+		{
+			return @"Bad Request";
+		}
+		case 404:
+		{
+			return @"Not Found";
+		}
+		case 416:
+		{
+			return @"Requested Range Not Satisfiable";
+		}
+		case 500:
+		{
+			return @"Internal Server Error";
+		}
+		case 501:
+		{
+			return @"Not Implemented";
+		}
+		default:
+		{
+			return @"Unknown";
+		}
+	}
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,129 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  Length of the header written at the start of each encrypted file.
+ */
+extern NSUInteger const OTRKitFileCryptorHeaderLength;
+
+/**
+ *  Number of bytes each encrypted chunk is larger than its plain text.
+ */
+extern NSUInteger const OTRKitFileCryptorChunkOverhead;
+
+/**
+ *  OTRKitFileCryptor encrypts and decrypts files with a key obtained from
+ *  -requestSymmetricKeyForUsername:accountName:protocol:forUse:useData:completion:
+ *  or the receivedSymmetricKey: delegate method.
+ *
+ *  Files are processed in chunks of chunkSize bytes. Each chunk is sealed with
+ *  AES-256-GCM under a key derived from the symmetric key and a random salt
+ *  stored in the file header. A chunk's position in the file and whether it
+ *  is the last chunk are authenticated, so chunks can't be reordered and the
+ *  file can't be truncated without decryption failing.
+ *
+ *  Chunks are encrypted and decrypted in parallel. At most
+ *  maximumConcurrentChunks chunks are held in memory at any time regardless
+ *  of the size of the file.
+ */
+@interface OTRKitFileCryptor : NSObject
+/**
+ *  @param symmetricKey		The 32 byte symmetric key shared with the remote user
+ */
+- (nullable instancetype)initWithSymmetricKey:(NSData *)symmetricKey NS_DESIGNATED_INITIALIZER;
+
+/**
+ *  Size of each chunk of plain text in bytes. Defaults to 64 KiB.
+ *  Only used when encrypting. Decryption uses the size stored in the file.
+ */
+@property (nonatomic, assign) NSUInteger chunkSize;
+
+/**
+ *  Number of chunks processed at the same time. Defaults to the number of active processors.
+ */
+@property (nonatomic, assign) NSUInteger maximumConcurrentChunks;
+
+/**
+ *  Encrypt a file.
+ *
+ *  @param inputPath	Path of the plain text file
+ *  @param outputPath	Path to write the encrypted file to. Replaced if it exists.
+ *  @param error		Describes the problem if NO is returned
+ */
+- (BOOL)encryptFileAtPath:(NSString *)inputPath toPath:(NSString *)outputPath error:(NSError **)error;
+
+/**
+ *  Continue encrypting a file that was interrupted. The length and modification
+ *  time of the plain text file are recorded in the header when encryption
+ *  begins. NO is returned if either has changed since, because resuming would
+ *  seal different plain text with the same key and nonce. Start over instead.
+ *
+ *  @param inputPath	Path of the plain text file
+ *  @param outputPath	Path of the partially encrypted file. Anything past chunkIndex is discarded.
+ *  @param chunkIndex	Index of the first chunk to encrypt. Chunks before it are kept as they are.
+ *  @param error		Describes the problem if NO is returned
+ */
+- (BOOL)encryptFileAtPath:(NSString *)inputPath toPath:(NSString *)outputPath resumingAtChunk:(uint64_t)chunkIndex error:(NSError **)error;
+
+/**
+ *  Decrypt a file.
+ *
+ *  @param inputPath	Path of the encrypted file
+ *  @param outputPath	Path to write the plain text to. Replaced if it exists.
+ *  @param error		Describes the problem if NO is returned
+ */
+- (BOOL)decryptFileAtPath:(NSString *)inputPath toPath:(NSString *)outputPath error:(NSError **)error;
+
+/**
+ *  Continue decrypting a file that was interrupted.
+ *
+ *  @param inputPath	Path of the encrypted file
+ *  @param outputPath	Path of the partially decrypted file. Anything past chunkIndex is discarded.
+ *  @param chunkIndex	Index of the first chunk to decrypt
+ *  @param error		Describes the problem if NO is returned
+ */
+- (BOOL)decryptFileAtPath:(NSString *)inputPath toPath:(NSString *)outputPath resumingAtChunk:(uint64_t)chunkIndex error:(NSError **)error;
+
+/**
+ *  Decrypt a single chunk without decrypting the rest of the file.
+ *  The plain text of chunk N starts at offset N * chunk size.
+ *
+ *  @param chunkIndex	Index of the chunk to decrypt
+ *  @param inputPath	Path of the encrypted file
+ *  @param error		Describes the problem if nil is returned
+ */
+- (nullable NSData *)decryptChunkAtIndex:(uint64_t)chunkIndex ofFileAtPath:(NSString *)inputPath error:(NSError **)error;
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,831 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKit.h"
+#import "OTRKitFileCryptor.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <gcrypt.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+NSUInteger const OTRKitFileCryptorHeaderLength		= 64;
+NSUInteger const OTRKitFileCryptorChunkOverhead		= 16;
+
+#define OTRKitFileCryptorKeyLength				32
+#define OTRKitFileCryptorSaltLength				32
+#define OTRKitFileCryptorIVLength				12
+#define OTRKitFileCryptorTagLength				16
+
+/* Additional data: header, chunk index, and final chunk flag */
+#define OTRKitFileCryptorAdditionalDataLength	(64 + 8 + 1)
+
+static NSUInteger const kOTRKitFileCryptorDefaultChunkSize	= (64 * 1024);
+static NSUInteger const kOTRKitFileCryptorMaximumChunkSize	= (16 * 1024 * 1024);
+
+/* Header: magic (8 bytes), chunk size (4 bytes, big endian), reserved (4 bytes), salt (32 bytes),
+ length of the plain text (8 bytes, big endian), and its modification time in nanoseconds (8 bytes, big endian) */
+static const uint8_t kOTRKitFileCryptorMagic[8] = {'O', 'T', 'R', 'K', 'i', 't', 'F', '2'};
+
+static const char kOTRKitFileCryptorKeyLabel[] = "OTRKit File Encryption";
+
+static gcry_error_t OTRKitFileCryptorTransformChunk(const uint8_t *fileKey, const uint8_t *header, uint64_t chunkIndex, BOOL finalChunk, uint8_t *bytes, size_t length, BOOL encrypting);
+
+static void OTRKitFileCryptorWriteUInt32(uint8_t *bytes, uint32_t value);
+static uint32_t OTRKitFileCryptorReadUInt32(const uint8_t *bytes);
+static void OTRKitFileCryptorWriteUInt64(uint8_t *bytes, uint64_t value);
+static uint64_t OTRKitFileCryptorReadUInt64(const uint8_t *bytes);
+static uint64_t OTRKitFileCryptorModificationTime(const struct stat *fileStat);
+
+@interface OTRKitFileCryptor ()
+@property (nonatomic, strong) NSMutableData *symmetricKey;
+@end
+
+@implementation OTRKitFileCryptor
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+- (instancetype)init
+{
+	return nil;
+}
+#pragma clang diagnostic pop
+
+- (nullable instancetype)initWithSymmetricKey:(NSData *)symmetricKey
+{
+	if (symmetricKey == nil || symmetricKey.length != OTRKitFileCryptorKeyLength) {
+		return nil;
+	}
+
+	if ((self = [super init])) {
+		self.symmetricKey = [symmetricKey mutableCopy];
+
+		self.chunkSize = kOTRKitFileCryptorDefaultChunkSize;
+
+		self.maximumConcurrentChunks = [NSProcessInfo processInfo].activeProcessorCount;
+
+		return self;
+	}
+
+	return nil;
+}
+
+- (void)dealloc
+{
+	[self.symmetricKey resetBytesInRange:NSMakeRange(0, self.symmetricKey.length)];
+}
+
+#pragma mark -
+#pragma mark Encryption
+
+- (BOOL)encryptFileAtPath:(NSString *)inputPath toPath:(NSString *)outputPath error:(NSError **)error
+{
+	return [self _encryptFileAtPath:inputPath toPath:outputPath startingAtChunk:0 resuming:NO error:error];
+}
+
+- (BOOL)encryptFileAtPath:(NSString *)inputPath toPath:(NSString *)outputPath resumingAtChunk:(uint64_t)chunkIndex error:(NSError **)error
+{
+	return [self _encryptFileAtPath:inputPath toPath:outputPath startingAtChunk:chunkIndex resuming:YES error:error];
+}
+
+- (BOOL)_encryptFileAtPath:(NSString *)inputPath toPath:(NSString *)outputPath startingAtChunk:(uint64_t)chunkIndex resuming:(BOOL)resuming error:(NSError **)error
+{
+	NSParameterAssert(inputPath != nil);
+	NSParameterAssert(outputPath != nil);
+
+	int inputFile = open(inputPath.fileSystemRepresentation, O_RDONLY);
+
+	if (inputFile < 0) {
+		[self _setError:error code:OTRKitErrorCodeFileReadFailed description:@"Unable to open the file to encrypt"];
+
+		return NO;
+	}
+
+	struct stat inputStat;
+
+	if (fstat(inputFile, &inputStat) != 0) {
+		close(inputFile);
+
+		[self _setError:error code:OTRKitErrorCodeFileReadFailed description:@"Unable to determine the length of the file to encrypt"];
+
+		return NO;
+	}
+
+	uint64_t inputLength = (uint64_t)inputStat.st_size;
+
+	uint64_t inputModificationTime = OTRKitFileCryptorModificationTime(&inputStat);
+
+	int outputFile = -1;
+
+	uint8_t header[OTRKitFileCryptorHeaderLength];
+
+	NSUInteger chunkSize = 0;
+
+	if (resuming) {
+		outputFile = open(outputPath.fileSystemRepresentation, O_RDWR);
+
+		if (outputFile < 0 || [self _readHeader:header fromFile:outputFile chunkSize:&chunkSize error:error] == NO) {
+			if (outputFile >= 0) {
+				close(outputFile);
+			} else {
+				[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"Unable to open the partially encrypted file"];
+			}
+
+			close(inputFile);
+
+			return NO;
+		}
+
+		/* The salt of the existing header is kept which means chunks are sealed
+		 with the same key and nonce as before. Sealing different plain text that
+		 way would give both away, so the input must be the one the header names. */
+		if (OTRKitFileCryptorReadUInt64(&header[48]) != inputLength ||
+			OTRKitFileCryptorReadUInt64(&header[56]) != inputModificationTime)
+		{
+			close(outputFile);
+			close(inputFile);
+
+			[self _setError:error code:OTRKitErrorCodeFileFormatInvalid description:@"The file to encrypt changed since encryption began"];
+
+			return NO;
+		}
+
+		if (chunkIndex > [self _chunkCountForLength:inputLength chunkSize:chunkSize]) {
+			close(outputFile);
+			close(inputFile);
+
+			[self _setError:error code:OTRKitErrorCodeFileFormatInvalid description:@"The chunk to resume at is past the end of the file"];
+
+			return NO;
+		}
+
+		/* Discard anything past the chunk we resume at. It may be incomplete. */
+		off_t resumeOffset = (off_t)(OTRKitFileCryptorHeaderLength + (chunkIndex * (chunkSize + OTRKitFileCryptorChunkOverhead)));
+
+		struct stat outputStat;
+
+		if (fstat(outputFile, &outputStat) != 0 || outputStat.st_size < resumeOffset || ftruncate(outputFile, resumeOffset) != 0) {
+			close(outputFile);
+			close(inputFile);
+
+			[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"The partially encrypted file is shorter than the chunk to resume at"];
+
+			return NO;
+		}
+	} else {
+		chunkSize = MIN(MAX(self.chunkSize, (NSUInteger)1), kOTRKitFileCryptorMaximumChunkSize);
+
+		outputFile = open(outputPath.fileSystemRepresentation, (O_RDWR | O_CREAT | O_TRUNC), 0600);
+
+		if (outputFile < 0) {
+			close(inputFile);
+
+			[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"Unable to create the encrypted file"];
+
+			return NO;
+		}
+
+		memcpy(header, kOTRKitFileCryptorMagic, sizeof(kOTRKitFileCryptorMagic));
+
+		OTRKitFileCryptorWriteUInt32(&header[8], (uint32_t)chunkSize);
+		OTRKitFileCryptorWriteUInt32(&header[12], 0);
+
+		gcry_randomize(&header[16], OTRKitFileCryptorSaltLength, GCRY_STRONG_RANDOM);
+
+		OTRKitFileCryptorWriteUInt64(&header[48], inputLength);
+		OTRKitFileCryptorWriteUInt64(&header[56], inputModificationTime);
+
+		if (pwrite(outputFile, header, OTRKitFileCryptorHeaderLength, 0) != (ssize_t)OTRKitFileCryptorHeaderLength) {
+			close(outputFile);
+			close(inputFile);
+
+			[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"Unable to write the header of the encrypted file"];
+
+			return NO;
+		}
+	}
+
+	uint64_t chunkCount = [self _chunkCountForLength:inputLength chunkSize:chunkSize];
+
+	BOOL result = YES;
+
+	if (chunkIndex < chunkCount) {
+		result = [self _transformFile:inputFile
+							   toFile:outputFile
+							   header:header
+							chunkSize:chunkSize
+						  inputLength:inputLength
+						   chunkCount:chunkCount
+					  startingAtChunk:chunkIndex
+						   encrypting:YES
+								error:error];
+	}
+
+	close(outputFile);
+	close(inputFile);
+
+	return result;
+}
+
+#pragma mark -
+#pragma mark Decryption
+
+- (BOOL)decryptFileAtPath:(NSString *)inputPath toPath:(NSString *)outputPath error:(NSError **)error
+{
+	return [self _decryptFileAtPath:inputPath toPath:outputPath startingAtChunk:0 resuming:NO error:error];
+}
+
+- (BOOL)decryptFileAtPath:(NSString *)inputPath toPath:(NSString *)outputPath resumingAtChunk:(uint64_t)chunkIndex error:(NSError **)error
+{
+	return [self _decryptFileAtPath:inputPath toPath:outputPath startingAtChunk:chunkIndex resuming:YES error:error];
+}
+
+- (BOOL)_decryptFileAtPath:(NSString *)inputPath toPath:(NSString *)outputPath startingAtChunk:(uint64_t)chunkIndex resuming:(BOOL)resuming error:(NSError **)error
+{
+	NSParameterAssert(inputPath != nil);
+	NSParameterAssert(outputPath != nil);
+
+	uint8_t header[OTRKitFileCryptorHeaderLength];
+
+	NSUInteger chunkSize = 0;
+
+	uint64_t inputLength = 0;
+
+	uint64_t chunkCount = 0;
+
+	int inputFile = [self _openEncryptedFileAtPath:inputPath header:header chunkSize:&chunkSize inputLength:&inputLength chunkCount:&chunkCount error:error];
+
+	if (inputFile < 0) {
+		return NO;
+	}
+
+	/* Checked before the output is opened so that it isn't truncated for nothing */
+	if (resuming && chunkIndex > chunkCount) {
+		close(inputFile);
+
+		[self _setError:error code:OTRKitErrorCodeFileFormatInvalid description:@"The chunk to resume at is past the end of the file"];
+
+		return NO;
+	}
+
+	int outputFlags = (O_RDWR | O_CREAT);
+
+	if (resuming == NO) {
+		outputFlags |= O_TRUNC;
+	}
+
+	int outputFile = open(outputPath.fileSystemRepresentation, outputFlags, 0600);
+
+	if (outputFile < 0) {
+		close(inputFile);
+
+		[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"Unable to create the decrypted file"];
+
+		return NO;
+	}
+
+	if (resuming) {
+		off_t resumeOffset = (off_t)(chunkIndex * chunkSize);
+
+		struct stat outputStat;
+
+		if (fstat(outputFile, &outputStat) != 0 || outputStat.st_size < resumeOffset || ftruncate(outputFile, resumeOffset) != 0) {
+			close(outputFile);
+			close(inputFile);
+
+			[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"The partially decrypted file is shorter than the chunk to resume at"];
+
+			return NO;
+		}
+	}
+
+	BOOL result = YES;
+
+	if (chunkIndex < chunkCount) {
+		result = [self _transformFile:inputFile
+							   toFile:outputFile
+							   header:header
+							chunkSize:chunkSize
+						  inputLength:inputLength
+						   chunkCount:chunkCount
+					  startingAtChunk:chunkIndex
+						   encrypting:NO
+								error:error];
+	}
+
+	close(outputFile);
+	close(inputFile);
+
+	return result;
+}
+
+- (nullable NSData *)decryptChunkAtIndex:(uint64_t)chunkIndex ofFileAtPath:(NSString *)inputPath error:(NSError **)error
+{
+	NSParameterAssert(inputPath != nil);
+
+	uint8_t header[OTRKitFileCryptorHeaderLength];
+
+	NSUInteger chunkSize = 0;
+
+	uint64_t inputLength = 0;
+
+	uint64_t chunkCount = 0;
+
+	int inputFile = [self _openEncryptedFileAtPath:inputPath header:header chunkSize:&chunkSize inputLength:&inputLength chunkCount:&chunkCount error:error];
+
+	if (inputFile < 0) {
+		return nil;
+	}
+
+	if (chunkIndex >= chunkCount) {
+		close(inputFile);
+
+		[self _setError:error code:OTRKitErrorCodeFileFormatInvalid description:@"The chunk requested is past the end of the file"];
+
+		return nil;
+	}
+
+	uint8_t fileKey[OTRKitFileCryptorKeyLength];
+
+	if ([self _deriveFileKey:fileKey header:header error:error] == NO) {
+		close(inputFile);
+
+		return nil;
+	}
+
+	uint64_t encryptedChunkSize = (chunkSize + OTRKitFileCryptorChunkOverhead);
+
+	off_t chunkOffset = (off_t)(OTRKitFileCryptorHeaderLength + (chunkIndex * encryptedChunkSize));
+
+	size_t chunkLength = (size_t)MIN(encryptedChunkSize, (inputLength - (chunkIndex * encryptedChunkSize)));
+
+	NSMutableData *chunkData = [NSMutableData dataWithLength:chunkLength];
+
+	NSData *result = nil;
+
+	if (pread(inputFile, chunkData.mutableBytes, chunkLength, chunkOffset) != (ssize_t)chunkLength) {
+		[self _setError:error code:OTRKitErrorCodeFileReadFailed description:@"Unable to read the encrypted chunk"];
+	} else {
+		BOOL finalChunk = (chunkIndex == (chunkCount - 1));
+
+		gcry_error_t chunkError = OTRKitFileCryptorTransformChunk(fileKey, header, chunkIndex, finalChunk, chunkData.mutableBytes, chunkLength, NO);
+
+		if (chunkError == GPG_ERR_NO_ERROR) {
+			chunkData.length = (chunkLength - OTRKitFileCryptorTagLength);
+
+			result = [chunkData copy];
+		} else {
+			[self _setError:error forChunkError:chunkError];
+		}
+	}
+
+	memset(fileKey, 0, sizeof(fileKey));
+
+	[chunkData resetBytesInRange:NSMakeRange(0, chunkData.length)];
+
+	close(inputFile);
+
+	return result;
+}
+
+- (int)_openEncryptedFileAtPath:(NSString *)inputPath header:(uint8_t *)header chunkSize:(NSUInteger *)chunkSize inputLength:(uint64_t *)inputLength chunkCount:(uint64_t *)chunkCount error:(NSError **)error
+{
+	NSParameterAssert(inputPath != nil);
+	NSParameterAssert(header != NULL);
+	NSParameterAssert(chunkSize != NULL);
+	NSParameterAssert(inputLength != NULL);
+	NSParameterAssert(chunkCount != NULL);
+
+	int inputFile = open(inputPath.fileSystemRepresentation, O_RDONLY);
+
+	if (inputFile < 0) {
+		[self _setError:error code:OTRKitErrorCodeFileReadFailed description:@"Unable to open the file to decrypt"];
+
+		return -1;
+	}
+
+	if ([self _readHeader:header fromFile:inputFile chunkSize:chunkSize error:error] == NO) {
+		close(inputFile);
+
+		return -1;
+	}
+
+	struct stat inputStat;
+
+	if (fstat(inputFile, &inputStat) != 0) {
+		close(inputFile);
+
+		[self _setError:error code:OTRKitErrorCodeFileReadFailed description:@"Unable to determine the length of the file to decrypt"];
+
+		return -1;
+	}
+
+	/* The length passed on is that of the chunks, without the header. */
+	uint64_t encryptedLength = ((uint64_t)inputStat.st_size - OTRKitFileCryptorHeaderLength);
+
+	uint64_t encryptedChunkSize = (*chunkSize + OTRKitFileCryptorChunkOverhead);
+
+	uint64_t lastChunkLength = (encryptedLength % encryptedChunkSize);
+
+	/* Every chunk, including an empty final chunk, carries a tag. */
+	if (encryptedLength == 0 || (lastChunkLength > 0 && lastChunkLength < OTRKitFileCryptorTagLength)) {
+		close(inputFile);
+
+		[self _setError:error code:OTRKitErrorCodeFileFormatInvalid description:@"The encrypted file is truncated"];
+
+		return -1;
+	}
+
+	*inputLength = encryptedLength;
+
+	*chunkCount = ((encryptedLength + encryptedChunkSize - 1) / encryptedChunkSize);
+
+	return inputFile;
+}
+
+- (BOOL)_readHeader:(uint8_t *)header fromFile:(int)file chunkSize:(NSUInteger *)chunkSize error:(NSError **)error
+{
+	NSParameterAssert(header != NULL);
+	NSParameterAssert(chunkSize != NULL);
+
+	if (pread(file, header, OTRKitFileCryptorHeaderLength, 0) != (ssize_t)OTRKitFileCryptorHeaderLength ||
+		memcmp(header, kOTRKitFileCryptorMagic, sizeof(kOTRKitFileCryptorMagic)) != 0)
+	{
+		[self _setError:error code:OTRKitErrorCodeFileFormatInvalid description:@"The file is not an encrypted file"];
+
+		return NO;
+	}
+
+	uint32_t headerChunkSize = OTRKitFileCryptorReadUInt32(&header[8]);
+
+	if (headerChunkSize == 0 || headerChunkSize > kOTRKitFileCryptorMaximumChunkSize) {
+		[self _setError:error code:OTRKitErrorCodeFileFormatInvalid description:@"The chunk size of the encrypted file is invalid"];
+
+		return NO;
+	}
+
+	*chunkSize = headerChunkSize;
+
+	return YES;
+}
+
+#pragma mark -
+#pragma mark Chunk Processing
+
+- (uint64_t)_chunkCountForLength:(uint64_t)length chunkSize:(NSUInteger)chunkSize
+{
+	NSParameterAssert(chunkSize > 0);
+
+	/* An empty file is still written as one (empty) final chunk so
+	 that truncating an encrypted file to its header is detected. */
+	if (length == 0) {
+		return 1;
+	}
+
+	return ((length + chunkSize - 1) / chunkSize);
+}
+
+- (BOOL)_transformFile:(int)inputFile
+				toFile:(int)outputFile
+				header:(const uint8_t *)header
+			 chunkSize:(NSUInteger)chunkSize
+		   inputLength:(uint64_t)inputLength
+			chunkCount:(uint64_t)chunkCount
+	   startingAtChunk:(uint64_t)firstChunkIndex
+			encrypting:(BOOL)encrypting
+				 error:(NSError **)error
+{
+	NSParameterAssert(header != NULL);
+	NSParameterAssert(chunkSize > 0);
+	NSParameterAssert(firstChunkIndex < chunkCount);
+
+	uint8_t fileKey[OTRKitFileCryptorKeyLength];
+
+	if ([self _deriveFileKey:fileKey header:header error:error] == NO) {
+		return NO;
+	}
+
+	/* Blocks can't capture an array */
+	const uint8_t *fileKeyBytes = fileKey;
+
+	uint64_t encryptedChunkSize = (chunkSize + OTRKitFileCryptorChunkOverhead);
+
+	uint64_t inputChunkSize = ((encrypting) ? chunkSize : encryptedChunkSize);
+	uint64_t outputChunkSize = ((encrypting) ? encryptedChunkSize : chunkSize);
+
+	off_t inputBaseOffset = (off_t)((encrypting) ? 0 : OTRKitFileCryptorHeaderLength);
+	off_t outputBaseOffset = (off_t)((encrypting) ? OTRKitFileCryptorHeaderLength : 0);
+
+	/* Buffers are allocated once and reused for every batch
+	 which is what keeps memory use independent of file size. */
+	NSUInteger batchSize = MAX(self.maximumConcurrentChunks, (NSUInteger)1);
+
+	NSMutableArray<NSMutableData *> *buffers = [NSMutableArray arrayWithCapacity:batchSize];
+
+	for (NSUInteger i = 0; i < batchSize; i++) {
+		[buffers addObject:[NSMutableData dataWithLength:(NSUInteger)encryptedChunkSize]];
+	}
+
+	size_t *bufferLengths = calloc(batchSize, sizeof(size_t));
+
+	gcry_error_t *bufferErrors = calloc(batchSize, sizeof(gcry_error_t));
+
+	dispatch_queue_t workQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+
+	BOOL result = YES;
+
+	for (uint64_t batchStart = firstChunkIndex; batchStart < chunkCount && result; batchStart += batchSize) {
+		NSUInteger batchCount = (NSUInteger)MIN((uint64_t)batchSize, (chunkCount - batchStart));
+
+		/* Read */
+		for (NSUInteger i = 0; i < batchCount; i++) {
+			uint64_t chunkIndex = (batchStart + i);
+
+			uint64_t chunkStart = (chunkIndex * inputChunkSize);
+
+			size_t chunkLength = 0;
+
+			if (chunkStart < inputLength) {
+				chunkLength = (size_t)MIN(inputChunkSize, (inputLength - chunkStart));
+			}
+
+			if (chunkLength > 0 &&
+				pread(inputFile, buffers[i].mutableBytes, chunkLength, (inputBaseOffset + (off_t)chunkStart)) != (ssize_t)chunkLength)
+			{
+				[self _setError:error code:OTRKitErrorCodeFileReadFailed description:@"Unable to read from the file"];
+
+				result = NO;
+
+				break;
+			}
+
+			bufferLengths[i] = chunkLength;
+		}
+
+		if (result == NO) {
+			break;
+		}
+
+		/* Transform */
+		dispatch_apply(batchCount, workQueue, ^(size_t i) {
+			uint64_t chunkIndex = (batchStart + i);
+
+			BOOL finalChunk = (chunkIndex == (chunkCount - 1));
+
+			bufferErrors[i] = OTRKitFileCryptorTransformChunk(fileKeyBytes, header, chunkIndex, finalChunk, buffers[i].mutableBytes, bufferLengths[i], encrypting);
+		});
+
+		/* Write */
+		for (NSUInteger i = 0; i < batchCount; i++) {
+			if (bufferErrors[i] != GPG_ERR_NO_ERROR) {
+				[self _setError:error forChunkError:bufferErrors[i]];
+
+				result = NO;
+
+				break;
+			}
+
+			size_t chunkLength = bufferLengths[i];
+
+			if (encrypting) {
+				chunkLength += OTRKitFileCryptorTagLength;
+			} else {
+				chunkLength -= OTRKitFileCryptorTagLength;
+			}
+
+			off_t chunkOffset = (outputBaseOffset + (off_t)((batchStart + i) * outputChunkSize));
+
+			if (chunkLength > 0 &&
+				pwrite(outputFile, buffers[i].bytes, chunkLength, chunkOffset) != (ssize_t)chunkLength)
+			{
+				[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"Unable to write to the file"];
+
+				result = NO;
+
+				break;
+			}
+		}
+	}
+
+	for (NSMutableData *buffer in buffers) {
+		[buffer resetBytesInRange:NSMakeRange(0, buffer.length)];
+	}
+
+	free(bufferLengths);
+	free(bufferErrors);
+
+	memset(fileKey, 0, sizeof(fileKey));
+
+	return result;
+}
+
+static gcry_error_t OTRKitFileCryptorTransformChunk(const uint8_t *fileKey, const uint8_t *header, uint64_t chunkIndex, BOOL finalChunk, uint8_t *bytes, size_t length, BOOL encrypting)
+{
+	size_t dataLength = length;
+
+	if (encrypting == NO) {
+		if (length < OTRKitFileCryptorTagLength) {
+			return gcry_error(GPG_ERR_TOO_SHORT);
+		}
+
+		dataLength -= OTRKitFileCryptorTagLength;
+	}
+
+	uint8_t iv[OTRKitFileCryptorIVLength] = {0};
+
+	OTRKitFileCryptorWriteUInt64(&iv[4], chunkIndex);
+
+	uint8_t additionalData[OTRKitFileCryptorAdditionalDataLength];
+
+	memcpy(additionalData, header, OTRKitFileCryptorHeaderLength);
+
+	OTRKitFileCryptorWriteUInt64(&additionalData[OTRKitFileCryptorHeaderLength], chunkIndex);
+
+	additionalData[OTRKitFileCryptorHeaderLength + 8] = ((finalChunk) ? 1 : 0);
+
+	gcry_cipher_hd_t cipher = NULL;
+
+	gcry_error_t cipherError = gcry_cipher_open(&cipher, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_GCM, GCRY_CIPHER_SECURE);
+
+	if (cipherError == GPG_ERR_NO_ERROR) {
+		cipherError = gcry_cipher_setkey(cipher, fileKey, OTRKitFileCryptorKeyLength);
+	}
+
+	if (cipherError == GPG_ERR_NO_ERROR) {
+		cipherError = gcry_cipher_setiv(cipher, iv, OTRKitFileCryptorIVLength);
+	}
+
+	if (cipherError == GPG_ERR_NO_ERROR) {
+		cipherError = gcry_cipher_authenticate(cipher, additionalData, OTRKitFileCryptorAdditionalDataLength);
+	}
+
+	if (cipherError == GPG_ERR_NO_ERROR && dataLength > 0) {
+		if (encrypting) {
+			cipherError = gcry_cipher_encrypt(cipher, bytes, dataLength, NULL, 0);
+		} else {
+			cipherError = gcry_cipher_decrypt(cipher, bytes, dataLength, NULL, 0);
+		}
+	}
+
+	if (cipherError == GPG_ERR_NO_ERROR) {
+		if (encrypting) {
+			cipherError = gcry_cipher_gettag(cipher, &bytes[dataLength], OTRKitFileCryptorTagLength);
+		} else {
+			cipherError = gcry_cipher_checktag(cipher, &bytes[dataLength], OTRKitFileCryptorTagLength);
+		}
+	}
+
+	if (cipher) {
+		gcry_cipher_close(cipher);
+	}
+
+	return cipherError;
+}
+
+#pragma mark -
+#pragma mark Key Derivation
+
+- (BOOL)_deriveFileKey:(uint8_t *)fileKey header:(const uint8_t *)header error:(NSError **)error
+{
+	NSParameterAssert(fileKey != NULL);
+	NSParameterAssert(header != NULL);
+
+	/* fileKey = HMAC-SHA256(symmetricKey, label || salt) */
+	gcry_md_hd_t digest = NULL;
+
+	gcry_error_t digestError = gcry_md_open(&digest, GCRY_MD_SHA256, (GCRY_MD_FLAG_HMAC | GCRY_MD_FLAG_SECURE));
+
+	if (digestError == GPG_ERR_NO_ERROR) {
+		digestError = gcry_md_setkey(digest, self.symmetricKey.bytes, self.symmetricKey.length);
+	}
+
+	if (digestError == GPG_ERR_NO_ERROR) {
+		gcry_md_write(digest, kOTRKitFileCryptorKeyLabel, strlen(kOTRKitFileCryptorKeyLabel));
+
+		gcry_md_write(digest, &header[16], OTRKitFileCryptorSaltLength);
+
+		memcpy(fileKey, gcry_md_read(digest, GCRY_MD_SHA256), OTRKitFileCryptorKeyLength);
+	}
+
+	if (digest) {
+		gcry_md_close(digest);
+	}
+
+	if (digestError != GPG_ERR_NO_ERROR) {
+		[self _setError:error forChunkError:digestError];
+
+		return NO;
+	}
+
+	return YES;
+}
+
+#pragma mark -
+#pragma mark Helpers
+
+static void OTRKitFileCryptorWriteUInt32(uint8_t *bytes, uint32_t value)
+{
+	bytes[0] = (uint8_t)(value >> 24);
+	bytes[1] = (uint8_t)(value >> 16);
+	bytes[2] = (uint8_t)(value >> 8);
+	bytes[3] = (uint8_t)(value);
+}
+
+static uint32_t OTRKitFileCryptorReadUInt32(const uint8_t *bytes)
+{
+	return (((uint32_t)bytes[0] << 24) |
+			((uint32_t)bytes[1] << 16) |
+			((uint32_t)bytes[2] << 8) |
+			((uint32_t)bytes[3]));
+}
+
+static void OTRKitFileCryptorWriteUInt64(uint8_t *bytes, uint64_t value)
+{
+	OTRKitFileCryptorWriteUInt32(bytes, (uint32_t)(value >> 32));
+	OTRKitFileCryptorWriteUInt32(&bytes[4], (uint32_t)(value));
+}
+
+static uint64_t OTRKitFileCryptorReadUInt64(const uint8_t *bytes)
+{
+	return (((uint64_t)OTRKitFileCryptorReadUInt32(bytes) << 32) |
+			((uint64_t)OTRKitFileCryptorReadUInt32(&bytes[4])));
+}
+
+static uint64_t OTRKitFileCryptorModificationTime(const struct stat *fileStat)
+{
+#ifdef __APPLE__
+	struct timespec modificationTime = fileStat->st_mtimespec;
+#else
+	struct timespec modificationTime = fileStat->st_mtim;
+#endif
+
+	return (((uint64_t)modificationTime.tv_sec * NSEC_PER_SEC) + (uint64_t)modificationTime.tv_nsec);
+}
+
+- (void)_setError:(NSError **)error forChunkError:(gcry_error_t)chunkError
+{
+	if (gcry_err_code(chunkError) == GPG_ERR_CHECKSUM) {
+		[self _setError:error code:OTRKitErrorCodeFileAuthenticationFailed description:@"The encrypted file was modified or the key is wrong"];
+
+		return;
+	}
+
+	NSString *errorDescription = @"Unknown error";
+
+	const char *gpg_error_string = gcry_strerror(chunkError);
+
+	if (gpg_error_string) {
+		errorDescription = @(gpg_error_string);
+	}
+
+	[self _setError:error code:OTRKitErrorCodeFileFormatInvalid description:errorDescription];
+}
+
+- (void)_setError:(NSError **)error code:(OTRKitErrorCode)code description:(NSString *)description
+{
+	NSParameterAssert(description != nil);
+
+	if (error == NULL) {
+		return;
+	}
+
+	*error = [NSError errorWithDomain:OTRKitErrorDomain
+								 code:code
+							 userInfo:@{NSLocalizedDescriptionKey : description}];
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,614 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKit.h"
+#import "OTRKitFileStorage.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <gcrypt.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface OTRKitFileStorage ()
+@property (nonatomic, copy) NSString *privateKeyPath;
+@property (nonatomic, copy) NSString *fingerprintsPath;
+@property (nonatomic, copy) NSString *instanceTagsPath;
+@property (nonatomic, assign) BOOL filesRead;
+
+/* Keys are the tab separated fields of each record that identify it,
+ the same way they appear in the fingerprints and instance tags files. */
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSData *> *privateKeys;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSString *> *fingerprints;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSNumber *> *instanceTags;
+@property (nonatomic, assign) BOOL privateKeysChanged;
+@property (nonatomic, assign) BOOL fingerprintsChanged;
+@property (nonatomic, assign) BOOL instanceTagsChanged;
+@property (nonatomic, assign) NSUInteger transactionDepth;
+@property (readwrite) uint64_t bytesWritten;
+@end
+
+@implementation OTRKitFileStorage
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+- (instancetype)init
+{
+	return nil;
+}
+#pragma clang diagnostic pop
+
+- (instancetype)initWithPrivateKeyPath:(NSString *)privateKeyPath fingerprintsPath:(NSString *)fingerprintsPath instanceTagsPath:(NSString *)instanceTagsPath
+{
+	NSParameterAssert(privateKeyPath != nil);
+	NSParameterAssert(fingerprintsPath != nil);
+	NSParameterAssert(instanceTagsPath != nil);
+
+	if ((self = [super init])) {
+		self.privateKeyPath = privateKeyPath;
+		self.fingerprintsPath = fingerprintsPath;
+		self.instanceTagsPath = instanceTagsPath;
+
+		self.privateKeys = [NSMutableDictionary dictionary];
+		self.fingerprints = [NSMutableDictionary dictionary];
+		self.instanceTags = [NSMutableDictionary dictionary];
+
+		return self;
+	}
+
+	return nil;
+}
+
+#pragma mark -
+#pragma mark Loading
+
+- (void)loadPrivateKeys:(void (NS_NOESCAPE ^)(NSString *accountName, NSString *protocol, NSData *privateKey))privateKeyBlock
+		   fingerprints:(void (NS_NOESCAPE ^)(NSString *username, NSString *accountName, NSString *protocol, NSData *fingerprint, NSString * _Nullable trust))fingerprintBlock
+		   instanceTags:(void (NS_NOESCAPE ^)(NSString *accountName, NSString *protocol, uint32_t instanceTag))instanceTagBlock
+{
+	NSParameterAssert(privateKeyBlock != nil);
+	NSParameterAssert(fingerprintBlock != nil);
+	NSParameterAssert(instanceTagBlock != nil);
+
+	[self _readFiles];
+
+	[self.privateKeys enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSData *privateKey, BOOL *stop) {
+		NSArray *keyComponents = [key componentsSeparatedByString:@"\t"];
+
+		privateKeyBlock(keyComponents[0], keyComponents[1], privateKey);
+	}];
+
+	[self.fingerprints enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSString *trust, BOOL *stop) {
+		NSArray *keyComponents = [key componentsSeparatedByString:@"\t"];
+
+		NSData *fingerprint = [self _fingerprintFromHexString:keyComponents[3]];
+
+		fingerprintBlock(keyComponents[0], keyComponents[1], keyComponents[2], fingerprint, ((trust.length > 0) ? trust : nil));
+	}];
+
+	[self.instanceTags enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSNumber *instanceTag, BOOL *stop) {
+		NSArray *keyComponents = [key componentsSeparatedByString:@"\t"];
+
+		instanceTagBlock(keyComponents[0], keyComponents[1], instanceTag.unsignedIntValue);
+	}];
+}
+
+- (void)_readFiles
+{
+	if (self.filesRead) {
+		return;
+	}
+
+	self.filesRead = YES;
+
+	[self _readPrivateKeyPath];
+
+	[self _readFingerprintsPath];
+
+	[self _readInstanceTagsPath];
+}
+
+- (void)_readPrivateKeyPath
+{
+	NSData *privateKeyData = [NSData dataWithContentsOfFile:self.privateKeyPath];
+
+	if (privateKeyData.length == 0) {
+		return;
+	}
+
+	gcry_sexp_t allKeys = NULL;
+
+	if (gcry_sexp_sscan(&allKeys, NULL, privateKeyData.bytes, privateKeyData.length) != gcry_error(GPG_ERR_NO_ERROR)) {
+		return;
+	}
+
+	if ([self _sexp:allKeys hasToken:"privkeys"] == NO) {
+		gcry_sexp_release(allKeys);
+
+		return;
+	}
+
+	int accountCount = gcry_sexp_length(allKeys);
+
+	for (int i = 1; i < accountCount; i++) {
+		gcry_sexp_t account = gcry_sexp_nth(allKeys, i);
+
+		if (account == NULL) {
+			continue;
+		}
+
+		NSString *accountName = [self _stringOfSexp:account token:"name"];
+		NSString *protocol = [self _stringOfSexp:account token:"protocol"];
+
+		NSData *privateKey = [self _dataForSexp:account];
+
+		if ([self _sexp:account hasToken:"account"] && accountName && protocol && privateKey) {
+			NSString *key = [@[accountName, protocol] componentsJoinedByString:@"\t"];
+
+			self.privateKeys[key] = privateKey;
+		}
+
+		gcry_sexp_release(account);
+	}
+
+	gcry_sexp_release(allKeys);
+}
+
+- (BOOL)_sexp:(gcry_sexp_t)sexp hasToken:(const char *)token
+{
+	NSParameterAssert(sexp != NULL);
+	NSParameterAssert(token != NULL);
+
+	size_t tokenLength = 0;
+
+	const char *tokenData = gcry_sexp_nth_data(sexp, 0, &tokenLength);
+
+	return (tokenData && tokenLength == strlen(token) && strncmp(tokenData, token, tokenLength) == 0);
+}
+
+- (nullable NSString *)_stringOfSexp:(gcry_sexp_t)sexp token:(const char *)token
+{
+	NSParameterAssert(sexp != NULL);
+	NSParameterAssert(token != NULL);
+
+	gcry_sexp_t tokenSexp = gcry_sexp_find_token(sexp, token, 0);
+
+	if (tokenSexp == NULL) {
+		return nil;
+	}
+
+	size_t valueLength = 0;
+
+	const char *valueData = gcry_sexp_nth_data(tokenSexp, 1, &valueLength);
+
+	NSString *value = nil;
+
+	if (valueData) {
+		value = [[NSString alloc] initWithBytes:valueData length:valueLength encoding:NSUTF8StringEncoding];
+	}
+
+	gcry_sexp_release(tokenSexp);
+
+	return value;
+}
+
+- (nullable NSData *)_dataForSexp:(gcry_sexp_t)sexp
+{
+	NSParameterAssert(sexp != NULL);
+
+	size_t bufferLength = gcry_sexp_sprint(sexp, GCRYSEXP_FMT_ADVANCED, NULL, 0);
+
+	if (bufferLength == 0) {
+		return nil;
+	}
+
+	NSMutableData *sexpData = [NSMutableData dataWithLength:bufferLength];
+
+	if (gcry_sexp_sprint(sexp, GCRYSEXP_FMT_ADVANCED, sexpData.mutableBytes, bufferLength) == 0) {
+		return nil;
+	}
+
+	sexpData.length = strnlen(sexpData.bytes, bufferLength);
+
+	return sexpData;
+}
+
+- (void)_readFingerprintsPath
+{
+	NSString *fingerprintsFile = [NSString stringWithContentsOfFile:self.fingerprintsPath encoding:NSUTF8StringEncoding error:NULL];
+
+	/* username, account name, protocol, fingerprint, and optionally trust */
+	[fingerprintsFile enumerateLinesUsingBlock:^(NSString *line, BOOL *stop) {
+		NSArray *lineComponents = [line componentsSeparatedByString:@"\t"];
+
+		if (lineComponents.count < 4 || [lineComponents[3] length] != 40) {
+			return;
+		}
+
+		NSString *key = [[lineComponents subarrayWithRange:NSMakeRange(0, 4)] componentsJoinedByString:@"\t"];
+
+		NSString *trust = @"";
+
+		if (lineComponents.count > 4) {
+			trust = lineComponents[4];
+		}
+
+		self.fingerprints[key] = trust;
+	}];
+}
+
+- (void)_readInstanceTagsPath
+{
+	NSString *instanceTagsFile = [NSString stringWithContentsOfFile:self.instanceTagsPath encoding:NSUTF8StringEncoding error:NULL];
+
+	/* account name, protocol, and instance tag in hex */
+	[instanceTagsFile enumerateLinesUsingBlock:^(NSString *line, BOOL *stop) {
+		NSArray *lineComponents = [line componentsSeparatedByString:@"\t"];
+
+		if (lineComponents.count != 3) {
+			return;
+		}
+
+		unsigned int instanceTag = 0;
+
+		if ([[NSScanner scannerWithString:lineComponents[2]] scanHexInt:&instanceTag] == NO) {
+			return;
+		}
+
+		NSString *key = [[lineComponents subarrayWithRange:NSMakeRange(0, 2)] componentsJoinedByString:@"\t"];
+
+		self.instanceTags[key] = @(instanceTag);
+	}];
+}
+
+#pragma mark -
+#pragma mark Transactions
+
+- (void)beginTransaction
+{
+	[self _readFiles];
+
+	self.transactionDepth += 1;
+}
+
+- (BOOL)commitTransaction:(NSError **)error
+{
+	NSAssert((self.transactionDepth > 0),
+		@"Tried to commit a transaction that wasn't started");
+
+	self.transactionDepth -= 1;
+
+	if (self.transactionDepth > 0) {
+		return YES;
+	}
+
+	/* Every file is written before any of them replaces the one before it
+	 so that a failed write leaves all of them as they were. */
+	NSMutableArray<NSString *> *pathsWritten = [NSMutableArray arrayWithCapacity:3];
+
+	BOOL writeResult = YES;
+
+	if (self.privateKeysChanged) {
+		NSMutableData *privateKeysFile = [NSMutableData data];
+
+		[privateKeysFile appendBytes:"(privkeys\n" length:10];
+
+		for (NSData *privateKey in self.privateKeys.allValues) {
+			[privateKeysFile appendBytes:" " length:1];
+			[privateKeysFile appendData:privateKey];
+			[privateKeysFile appendBytes:"\n" length:1];
+		}
+
+		[privateKeysFile appendBytes:")\n" length:2];
+
+		writeResult = [self _writeData:privateKeysFile toTemporaryFileForPath:self.privateKeyPath error:error];
+
+		if (writeResult) {
+			[pathsWritten addObject:self.privateKeyPath];
+		}
+	}
+
+	if (writeResult && self.fingerprintsChanged) {
+		NSMutableString *fingerprintsFile = [NSMutableString string];
+
+		[self.fingerprints enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSString *trust, BOOL *stop) {
+			[fingerprintsFile appendFormat:@"%@\t%@\n", key, trust];
+		}];
+
+		writeResult = [self _writeData:[fingerprintsFile dataUsingEncoding:NSUTF8StringEncoding] toTemporaryFileForPath:self.fingerprintsPath error:error];
+
+		if (writeResult) {
+			[pathsWritten addObject:self.fingerprintsPath];
+		}
+	}
+
+	if (writeResult && self.instanceTagsChanged) {
+		NSMutableString *instanceTagsFile = [NSMutableString string];
+
+		[self.instanceTags enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSNumber *instanceTag, BOOL *stop) {
+			[instanceTagsFile appendFormat:@"%@\t%08x\n", key, instanceTag.unsignedIntValue];
+		}];
+
+		writeResult = [self _writeData:[instanceTagsFile dataUsingEncoding:NSUTF8StringEncoding] toTemporaryFileForPath:self.instanceTagsPath error:error];
+
+		if (writeResult) {
+			[pathsWritten addObject:self.instanceTagsPath];
+		}
+	}
+
+	if (writeResult == NO) {
+		for (NSString *path in pathsWritten) {
+			unlink([self _temporaryPathForPath:path].fileSystemRepresentation);
+		}
+
+		return NO;
+	}
+
+	if ([self _replaceFilesAtPaths:pathsWritten error:error] == NO) {
+		return NO;
+	}
+
+	self.privateKeysChanged = NO;
+	self.fingerprintsChanged = NO;
+	self.instanceTagsChanged = NO;
+
+	return YES;
+}
+
+- (NSString *)_temporaryPathForPath:(NSString *)path
+{
+	NSParameterAssert(path != nil);
+
+	return [path stringByAppendingString:@".new"];
+}
+
+/* The new contents are written next to the file and
+ only replace it once they are on disk. A crash while
+ writing leaves either the old files or the new ones. */
+- (BOOL)_writeData:(NSData *)data toTemporaryFileForPath:(NSString *)path error:(NSError **)error
+{
+	NSParameterAssert(data != nil);
+	NSParameterAssert(path != nil);
+
+	NSString *temporaryPath = [self _temporaryPathForPath:path];
+
+	int temporaryFile = open(temporaryPath.fileSystemRepresentation, (O_WRONLY | O_CREAT | O_TRUNC), 0600);
+
+	if (temporaryFile < 0) {
+		[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"Unable to open the file to write"];
+
+		return NO;
+	}
+
+	const uint8_t *bytes = data.bytes;
+
+	size_t bytesRemaining = data.length;
+
+	BOOL writeResult = YES;
+
+	while (bytesRemaining > 0) {
+		ssize_t bytesWritten = write(temporaryFile, bytes, bytesRemaining);
+
+		if (bytesWritten < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			writeResult = NO;
+
+			break;
+		}
+
+		self.bytesWritten += (uint64_t)bytesWritten;
+
+		bytes += bytesWritten;
+
+		bytesRemaining -= (size_t)bytesWritten;
+	}
+
+	if (writeResult) {
+		writeResult = (fsync(temporaryFile) == 0);
+	}
+
+	if (close(temporaryFile) != 0) {
+		writeResult = NO;
+	}
+
+	if (writeResult == NO) {
+		unlink(temporaryPath.fileSystemRepresentation);
+
+		[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"Unable to write the file"];
+
+		return NO;
+	}
+
+	return YES;
+}
+
+/* A rename within the same directory only fails if the directory itself
+ can't be changed, which would already have kept the files from being written. */
+- (BOOL)_replaceFilesAtPaths:(NSArray<NSString *> *)paths error:(NSError **)error
+{
+	NSParameterAssert(paths != nil);
+
+	BOOL replaceResult = YES;
+
+	for (NSString *path in paths) {
+		const char *temporaryPath = [self _temporaryPathForPath:path].fileSystemRepresentation;
+
+		if (replaceResult) {
+			replaceResult = (rename(temporaryPath, path.fileSystemRepresentation) == 0);
+
+			if (replaceResult) {
+				continue;
+			}
+		}
+
+		unlink(temporaryPath);
+	}
+
+	if (replaceResult == NO) {
+		[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"Unable to replace the file"];
+
+		return NO;
+	}
+
+	/* Make the renames themselves durable */
+	for (NSString *path in paths) {
+		int directoryFile = open(path.stringByDeletingLastPathComponent.fileSystemRepresentation, O_RDONLY);
+
+		if (directoryFile >= 0) {
+			(void)fsync(directoryFile);
+
+			close(directoryFile);
+		}
+	}
+
+	return YES;
+}
+
+#pragma mark -
+#pragma mark Changes
+
+- (void)storePrivateKey:(NSData *)privateKey accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(privateKey != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	NSString *key = [@[accountName, protocol] componentsJoinedByString:@"\t"];
+
+	self.privateKeys[key] = [privateKey copy];
+
+	self.privateKeysChanged = YES;
+}
+
+- (void)storeFingerprint:(NSData *)fingerprint trust:(nullable NSString *)trust username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(fingerprint != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	NSString *key = [self _keyForFingerprint:fingerprint username:username accountName:accountName protocol:protocol];
+
+	self.fingerprints[key] = ((trust) ?: @"");
+
+	self.fingerprintsChanged = YES;
+}
+
+- (void)removeFingerprint:(NSData *)fingerprint username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(fingerprint != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	NSString *key = [self _keyForFingerprint:fingerprint username:username accountName:accountName protocol:protocol];
+
+	if (self.fingerprints[key] == nil) {
+		return;
+	}
+
+	[self.fingerprints removeObjectForKey:key];
+
+	self.fingerprintsChanged = YES;
+}
+
+- (void)storeInstanceTag:(uint32_t)instanceTag accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	NSString *key = [@[accountName, protocol] componentsJoinedByString:@"\t"];
+
+	self.instanceTags[key] = @(instanceTag);
+
+	self.instanceTagsChanged = YES;
+}
+
+- (NSString *)_keyForFingerprint:(NSData *)fingerprint username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(fingerprint != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	NSMutableString *fingerprintString = [NSMutableString stringWithCapacity:(fingerprint.length * 2)];
+
+	const uint8_t *fingerprintBytes = fingerprint.bytes;
+
+	for (NSUInteger i = 0; i < fingerprint.length; i++) {
+		[fingerprintString appendFormat:@"%02x", fingerprintBytes[i]];
+	}
+
+	return [@[username, accountName, protocol, fingerprintString] componentsJoinedByString:@"\t"];
+}
+
+- (NSData *)_fingerprintFromHexString:(NSString *)hexString
+{
+	NSParameterAssert(hexString != nil);
+
+	const char *hexCharacters = hexString.UTF8String;
+
+	NSMutableData *fingerprint = [NSMutableData dataWithLength:(strlen(hexCharacters) / 2)];
+
+	uint8_t *fingerprintBytes = fingerprint.mutableBytes;
+
+	for (NSUInteger i = 0; i < fingerprint.length; i++) {
+		unsigned int byte = 0;
+
+		sscanf(&hexCharacters[(i * 2)], "%2x", &byte);
+
+		fingerprintBytes[i] = (uint8_t)byte;
+	}
+
+	return fingerprint;
+}
+
+- (void)_setError:(NSError **)error code:(OTRKitErrorCode)code description:(NSString *)description
+{
+	NSParameterAssert(description != nil);
+
+	if (error == NULL) {
+		return;
+	}
+
+	*error = [NSError errorWithDomain:OTRKitErrorDomain
+								 code:code
+							 userInfo:@{NSLocalizedDescriptionKey : description}];
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
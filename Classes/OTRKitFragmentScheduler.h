@@ -0,0 +1,72 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef void (^OTRKitFragmentSchedulerDeliveryBlock)(NSString *message, NSString *username, NSString *accountName, NSString *protocol, id __nullable tag, uint64_t traceOperation);
+
+/* OTRKitFragmentScheduler sits between inject_message_cb and the delegate.
+ Each local account is given a token bucket. Messages are released as long
+ as the bucket has tokens. Once it runs dry, messages are held back and
+ released at the configured rate, one conversation at a time in round robin
+ order, so that one long message does not starve every other conversation. */
+/* Accounts without a configured rate are passed straight through. */
+@interface OTRKitFragmentScheduler : NSObject
+- (instancetype)initWithDeliveryBlock:(OTRKitFragmentSchedulerDeliveryBlock)deliveryBlock NS_DESIGNATED_INITIALIZER;
+
+/* A nil accountName applies the rate to every account of the protocol
+ that does not have a rate of its own. Each account still receives its own
+ bucket because flood protection is enforced per connection. */
+- (void)setRate:(double)messagesPerSecond burst:(NSUInteger)burst forAccountName:(nullable NSString *)accountName protocol:(NSString *)protocol;
+- (void)removeRateForAccountName:(nullable NSString *)accountName protocol:(NSString *)protocol;
+
+/* traceOperation is handed back to the delivery block as is */
+- (void)enqueueMessage:(NSString *)message
+			  username:(NSString *)username
+		   accountName:(NSString *)accountName
+			  protocol:(NSString *)protocol
+				   tag:(nullable id)tag
+		traceOperation:(uint64_t)traceOperation;
+
+/* Drop messages that are being held back for a conversation. */
+- (void)discardMessagesForUsername:(NSString *)username
+					   accountName:(NSString *)accountName
+						  protocol:(NSString *)protocol;
+
+/* Drop messages that are being held back for every conversation of an account. */
+- (void)discardMessagesForAccountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+/* Drop messages that are being held back which carry a tag equal to tag. */
+- (void)discardMessagesWithTag:(id)tag;
+@end
+
+NS_ASSUME_NONNULL_END
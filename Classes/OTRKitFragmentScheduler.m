@@ -0,0 +1,419 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKitFragmentScheduler.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface OTRKitFragmentSchedulerRate : NSObject
+@property (nonatomic, assign) double messagesPerSecond;
+@property (nonatomic, assign) NSUInteger burst;
+@end
+
+@interface OTRKitFragmentSchedulerMessage : NSObject
+@property (nonatomic, copy) NSString *message;
+@property (nonatomic, copy) NSString *username;
+@property (nonatomic, copy) NSString *accountName;
+@property (nonatomic, copy) NSString *protocol;
+@property (nonatomic, strong, nullable) id tag;
+@property (nonatomic, assign) uint64_t traceOperation;
+@end
+
+@interface OTRKitFragmentSchedulerConversation : NSObject
+@property (nonatomic, copy) NSString *username;
+@property (nonatomic, strong) NSMutableArray<OTRKitFragmentSchedulerMessage *> *messages;
+@end
+
+@interface OTRKitFragmentSchedulerBucket : NSObject
+@property (nonatomic, copy) NSString *accountName;
+@property (nonatomic, copy) NSString *protocol;
+@property (nonatomic, strong, nullable) OTRKitFragmentSchedulerRate *rate;
+@property (nonatomic, assign) double tokens;
+@property (nonatomic, assign) NSTimeInterval lastRefillTime;
+@property (nonatomic, assign) BOOL wakeupScheduled;
+@property (nonatomic, strong) NSMutableArray<OTRKitFragmentSchedulerConversation *> *activeConversations;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, OTRKitFragmentSchedulerConversation *> *conversations;
+@end
+
+@interface OTRKitFragmentScheduler ()
+@property (nonatomic, copy) OTRKitFragmentSchedulerDeliveryBlock deliveryBlock;
+@property (nonatomic, strong) dispatch_queue_t schedulerQueue;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, OTRKitFragmentSchedulerRate *> *rates;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, OTRKitFragmentSchedulerBucket *> *buckets;
+@end
+
+@implementation OTRKitFragmentScheduler
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+- (instancetype)init
+{
+	return nil;
+}
+#pragma clang diagnostic pop
+
+- (instancetype)initWithDeliveryBlock:(OTRKitFragmentSchedulerDeliveryBlock)deliveryBlock
+{
+	NSParameterAssert(deliveryBlock != nil);
+
+	if ((self = [super init])) {
+		self.deliveryBlock = deliveryBlock;
+
+		self.schedulerQueue = dispatch_queue_create("OTRKit Fragment Scheduler Queue", DISPATCH_QUEUE_SERIAL);
+
+		self.rates = [NSMutableDictionary dictionary];
+
+		self.buckets = [NSMutableDictionary dictionary];
+
+		return self;
+	}
+
+	return nil;
+}
+
+#pragma mark -
+#pragma mark Configuration
+
+- (void)setRate:(double)messagesPerSecond burst:(NSUInteger)burst forAccountName:(nullable NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(messagesPerSecond > 0);
+	NSParameterAssert(burst > 0);
+	NSParameterAssert(protocol != nil);
+
+	dispatch_async(self.schedulerQueue, ^{
+		OTRKitFragmentSchedulerRate *rate = [OTRKitFragmentSchedulerRate new];
+
+		rate.messagesPerSecond = messagesPerSecond;
+
+		rate.burst = burst;
+
+		self.rates[[self _rateKeyForAccountName:accountName protocol:protocol]] = rate;
+
+		[self _reloadRates];
+	});
+}
+
+- (void)removeRateForAccountName:(nullable NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(protocol != nil);
+
+	dispatch_async(self.schedulerQueue, ^{
+		[self.rates removeObjectForKey:[self _rateKeyForAccountName:accountName protocol:protocol]];
+
+		[self _reloadRates];
+	});
+}
+
+- (void)_reloadRates
+{
+	/* Buckets keep a reference to the rate they were created with.
+	 Point each of them at whatever applies now and drain them so that
+	 messages held back by a rate that was removed are released. */
+	for (OTRKitFragmentSchedulerBucket *bucket in self.buckets.allValues) {
+		OTRKitFragmentSchedulerRate *rate = [self _rateForAccountName:bucket.accountName protocol:bucket.protocol];
+
+		bucket.rate = rate;
+
+		if (rate && bucket.tokens > rate.burst) {
+			bucket.tokens = rate.burst;
+		}
+
+		[self _drainBucket:bucket];
+	}
+}
+
+- (nullable OTRKitFragmentSchedulerRate *)_rateForAccountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	OTRKitFragmentSchedulerRate *rate = self.rates[[self _rateKeyForAccountName:accountName protocol:protocol]];
+
+	if (rate == nil) {
+		rate = self.rates[[self _rateKeyForAccountName:nil protocol:protocol]];
+	}
+
+	return rate;
+}
+
+- (NSString *)_rateKeyForAccountName:(nullable NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(protocol != nil);
+
+	if (accountName == nil) {
+		return [NSString stringWithFormat:@"* <-> %@", protocol];
+	}
+
+	return [NSString stringWithFormat:@"%@ <-> %@", accountName, protocol];
+}
+
+#pragma mark -
+#pragma mark Scheduling
+
+- (void)enqueueMessage:(NSString *)message
+			  username:(NSString *)username
+		   accountName:(NSString *)accountName
+			  protocol:(NSString *)protocol
+				   tag:(nullable id)tag
+		traceOperation:(uint64_t)traceOperation
+{
+	NSParameterAssert(message != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	dispatch_async(self.schedulerQueue, ^{
+		NSString *bucketKey = [self _rateKeyForAccountName:accountName protocol:protocol];
+
+		OTRKitFragmentSchedulerBucket *bucket = self.buckets[bucketKey];
+
+		if (bucket == nil) {
+			OTRKitFragmentSchedulerRate *rate = [self _rateForAccountName:accountName protocol:protocol];
+
+			/* Nothing to pace and nothing held back that this message could overtake. */
+			if (rate == nil) {
+				self.deliveryBlock(message, username, accountName, protocol, tag, traceOperation);
+
+				return;
+			}
+
+			bucket = [OTRKitFragmentSchedulerBucket new];
+
+			bucket.accountName = accountName;
+			bucket.protocol = protocol;
+
+			bucket.rate = rate;
+
+			bucket.tokens = rate.burst;
+
+			bucket.lastRefillTime = [self _currentTime];
+
+			bucket.activeConversations = [NSMutableArray array];
+
+			bucket.conversations = [NSMutableDictionary dictionary];
+
+			self.buckets[bucketKey] = bucket;
+		}
+
+		OTRKitFragmentSchedulerMessage *object = [OTRKitFragmentSchedulerMessage new];
+
+		object.message = message;
+		object.username = username;
+		object.accountName = accountName;
+		object.protocol = protocol;
+		object.tag = tag;
+		object.traceOperation = traceOperation;
+
+		OTRKitFragmentSchedulerConversation *conversation = bucket.conversations[username];
+
+		if (conversation == nil) {
+			conversation = [OTRKitFragmentSchedulerConversation new];
+
+			conversation.username = username;
+
+			conversation.messages = [NSMutableArray array];
+
+			bucket.conversations[username] = conversation;
+		}
+
+		/* A conversation with nothing held back is not in the rotation. */
+		if (conversation.messages.count == 0) {
+			[bucket.activeConversations addObject:conversation];
+		}
+
+		[conversation.messages addObject:object];
+
+		[self _drainBucket:bucket];
+	});
+}
+
+- (void)discardMessagesForUsername:(NSString *)username
+					   accountName:(NSString *)accountName
+						  protocol:(NSString *)protocol
+{
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	dispatch_async(self.schedulerQueue, ^{
+		OTRKitFragmentSchedulerBucket *bucket = self.buckets[[self _rateKeyForAccountName:accountName protocol:protocol]];
+
+		if (bucket == nil) {
+			return;
+		}
+
+		OTRKitFragmentSchedulerConversation *conversation = bucket.conversations[username];
+
+		if (conversation == nil) {
+			return;
+		}
+
+		[conversation.messages removeAllObjects];
+
+		[bucket.activeConversations removeObjectIdenticalTo:conversation];
+
+		[bucket.conversations removeObjectForKey:username];
+	});
+}
+
+- (void)discardMessagesForAccountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	dispatch_async(self.schedulerQueue, ^{
+		OTRKitFragmentSchedulerBucket *bucket = self.buckets[[self _rateKeyForAccountName:accountName protocol:protocol]];
+
+		if (bucket == nil) {
+			return;
+		}
+
+		[bucket.activeConversations removeAllObjects];
+
+		[bucket.conversations removeAllObjects];
+	});
+}
+
+- (void)discardMessagesWithTag:(id)tag
+{
+	NSParameterAssert(tag != nil);
+
+	dispatch_async(self.schedulerQueue, ^{
+		[self.buckets enumerateKeysAndObjectsUsingBlock:^(NSString *key, OTRKitFragmentSchedulerBucket *bucket, BOOL *stop) {
+			for (OTRKitFragmentSchedulerConversation *conversation in bucket.activeConversations.copy) {
+				NSIndexSet *indexes = [conversation.messages indexesOfObjectsPassingTest:^BOOL(OTRKitFragmentSchedulerMessage *object, NSUInteger index, BOOL *stopTest) {
+					return [object.tag isEqual:tag];
+				}];
+
+				[conversation.messages removeObjectsAtIndexes:indexes];
+
+				/* A conversation with nothing held back is not in the rotation. */
+				if (conversation.messages.count == 0) {
+					[bucket.activeConversations removeObjectIdenticalTo:conversation];
+				}
+			}
+		}];
+	});
+}
+
+- (void)_drainBucket:(OTRKitFragmentSchedulerBucket *)bucket
+{
+	NSParameterAssert(bucket != nil);
+
+	OTRKitFragmentSchedulerRate *rate = bucket.rate;
+
+	NSTimeInterval currentTime = [self _currentTime];
+
+	if (rate) {
+		double tokens = bucket.tokens + ((currentTime - bucket.lastRefillTime) * rate.messagesPerSecond);
+
+		bucket.tokens = MIN(tokens, (double)rate.burst);
+	}
+
+	bucket.lastRefillTime = currentTime;
+
+	while (bucket.activeConversations.count > 0) {
+		if (rate && bucket.tokens < 1.0) {
+			break;
+		}
+
+		OTRKitFragmentSchedulerConversation *conversation = bucket.activeConversations[0];
+
+		[bucket.activeConversations removeObjectAtIndex:0];
+
+		OTRKitFragmentSchedulerMessage *object = conversation.messages[0];
+
+		[conversation.messages removeObjectAtIndex:0];
+
+		/* Move the conversation to the back of the line if it has more to send. */
+		if (conversation.messages.count > 0) {
+			[bucket.activeConversations addObject:conversation];
+		} else {
+			[bucket.conversations removeObjectForKey:conversation.username];
+		}
+
+		if (rate) {
+			bucket.tokens -= 1.0;
+		}
+
+		self.deliveryBlock(object.message, object.username, object.accountName, object.protocol, object.tag, object.traceOperation);
+	}
+
+	if (bucket.activeConversations.count == 0) {
+		/* Forget the bucket once it is full again. It holds no information
+		 that can't be recreated and there may be many accounts. */
+		NSString *bucketKey = [self _rateKeyForAccountName:bucket.accountName protocol:bucket.protocol];
+
+		if ((rate == nil || bucket.tokens >= rate.burst) && self.buckets[bucketKey] == bucket) {
+			[self.buckets removeObjectForKey:bucketKey];
+		}
+
+		return;
+	}
+
+	if (bucket.wakeupScheduled) {
+		return;
+	}
+
+	bucket.wakeupScheduled = YES;
+
+	NSTimeInterval wakeupDelay = ((1.0 - bucket.tokens) / rate.messagesPerSecond);
+
+	dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(wakeupDelay * NSEC_PER_SEC)), self.schedulerQueue, ^{
+		bucket.wakeupScheduled = NO;
+
+		[self _drainBucket:bucket];
+	});
+}
+
+- (NSTimeInterval)_currentTime
+{
+	return [NSProcessInfo processInfo].systemUptime;
+}
+
+@end
+
+#pragma mark -
+
+@implementation OTRKitFragmentSchedulerRate
+@end
+
+@implementation OTRKitFragmentSchedulerMessage
+@end
+
+@implementation OTRKitFragmentSchedulerConversation
+@end
+
+@implementation OTRKitFragmentSchedulerBucket
+@end
+
+NS_ASSUME_NONNULL_END
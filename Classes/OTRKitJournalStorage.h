@@ -0,0 +1,72 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKitStorage.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  OTRKitJournalStorage keeps private keys, fingerprints, and instance tags
+ *  in a single journal file. Each transaction is appended to the end of the
+ *  journal and synchronized to disk once, however many changes it holds,
+ *  instead of rewriting every record.
+ *
+ *  A transaction that was only partly written, such as when the process
+ *  was killed, is discarded the next time the journal is read.
+ *
+ *  Once the journal grows to compactionRatio times the size of the records
+ *  still in use, it is replaced by a copy holding only those records.
+ *
+ *  Not thread safe. An instance should only be used by one OTRKit.
+ */
+@interface OTRKitJournalStorage : NSObject <OTRKitStorage>
+/**
+ *  @param path		Path of the journal file. Created when the first transaction is committed.
+ */
+- (instancetype)initWithPath:(NSString *)path NS_DESIGNATED_INITIALIZER;
+
+@property (readonly, copy) NSString *path;
+
+/**
+ *  Defaults to 2. Journals smaller than 64 KiB are never compacted.
+ */
+@property (nonatomic, assign) double compactionRatio;
+
+/**
+ *  Replace the journal with a copy holding only the records in use.
+ *
+ *  @param error		Describes the problem if NO is returned
+ */
+- (BOOL)compact:(NSError **)error;
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,719 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKit.h"
+#import "OTRKitJournalStorage.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <gcrypt.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+/* Journal: magic (8 bytes) followed by records.
+ Record: type (1 byte), key length (4 bytes, big endian), value length
+ (4 bytes, big endian), key (UTF-8), value. A transaction is any number of
+ put and remove records followed by a commit record whose value is the
+ CRC-32 of the records before it in the same transaction. */
+static const uint8_t kOTRKitJournalMagic[8] = {'O', 'T', 'R', 'K', 'i', 't', 'J', '1'};
+
+#define OTRKitJournalRecordHeaderLength		9
+
+typedef NS_ENUM(uint8_t, OTRKitJournalRecordType) {
+	OTRKitJournalRecordTypePut = 1,
+	OTRKitJournalRecordTypeRemove = 2,
+	OTRKitJournalRecordTypeCommit = 3
+};
+
+static NSUInteger const kOTRKitJournalMinimumCompactionLength	= (64 * 1024);
+
+static NSString * const kOTRKitJournalPrivateKeyPrefix		= @"privkey";
+static NSString * const kOTRKitJournalFingerprintPrefix		= @"fingerprint";
+static NSString * const kOTRKitJournalInstanceTagPrefix		= @"instag";
+
+static void OTRKitJournalWriteUInt32(uint8_t *bytes, uint32_t value);
+static uint32_t OTRKitJournalReadUInt32(const uint8_t *bytes);
+
+static BOOL OTRKitJournalWrite(int fileDescriptor, const void *bytes, size_t length);
+static BOOL OTRKitJournalSynchronize(int fileDescriptor);
+
+@interface OTRKitJournalStorage ()
+@property (readwrite, copy) NSString *path;
+@property (nonatomic, assign) BOOL journalRead;
+@property (nonatomic, assign) BOOL journalInvalid;
+
+/* Length of the journal up to the end of the last complete transaction */
+@property (nonatomic, assign) uint64_t journalLength;
+
+/* Length the records in use would take up in the journal */
+@property (nonatomic, assign) uint64_t recordsLength;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSData *> *records;
+
+/* Values are NSNull for removed records */
+@property (nonatomic, strong) NSMutableDictionary<NSString *, id> *pendingChanges;
+@property (nonatomic, assign) NSUInteger transactionDepth;
+@property (readwrite) uint64_t bytesWritten;
+@end
+
+@implementation OTRKitJournalStorage
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+- (instancetype)init
+{
+	return nil;
+}
+#pragma clang diagnostic pop
+
+- (instancetype)initWithPath:(NSString *)path
+{
+	NSParameterAssert(path != nil);
+
+	if ((self = [super init])) {
+		self.path = path;
+
+		self.compactionRatio = 2.0;
+
+		self.records = [NSMutableDictionary dictionary];
+
+		self.pendingChanges = [NSMutableDictionary dictionary];
+
+		return self;
+	}
+
+	return nil;
+}
+
+#pragma mark -
+#pragma mark Loading
+
+- (void)loadPrivateKeys:(void (NS_NOESCAPE ^)(NSString *accountName, NSString *protocol, NSData *privateKey))privateKeyBlock
+		   fingerprints:(void (NS_NOESCAPE ^)(NSString *username, NSString *accountName, NSString *protocol, NSData *fingerprint, NSString * _Nullable trust))fingerprintBlock
+		   instanceTags:(void (NS_NOESCAPE ^)(NSString *accountName, NSString *protocol, uint32_t instanceTag))instanceTagBlock
+{
+	NSParameterAssert(privateKeyBlock != nil);
+	NSParameterAssert(fingerprintBlock != nil);
+	NSParameterAssert(instanceTagBlock != nil);
+
+	[self _readJournal];
+
+	[self.records enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSData *value, BOOL *stop) {
+		NSArray *keyComponents = [key componentsSeparatedByString:@"\t"];
+
+		NSString *keyPrefix = keyComponents.firstObject;
+
+		if ([keyPrefix isEqualToString:kOTRKitJournalPrivateKeyPrefix] && keyComponents.count == 3)
+		{
+			privateKeyBlock(keyComponents[1], keyComponents[2], value);
+		}
+		else if ([keyPrefix isEqualToString:kOTRKitJournalFingerprintPrefix] && keyComponents.count == 5)
+		{
+			NSData *fingerprint = [self _fingerprintFromHexString:keyComponents[4]];
+
+			if (fingerprint == nil) {
+				return;
+			}
+
+			NSString *trust = nil;
+
+			if (value.length > 0) {
+				trust = [[NSString alloc] initWithData:value encoding:NSUTF8StringEncoding];
+			}
+
+			fingerprintBlock(keyComponents[1], keyComponents[2], keyComponents[3], fingerprint, trust);
+		}
+		else if ([keyPrefix isEqualToString:kOTRKitJournalInstanceTagPrefix] && keyComponents.count == 3)
+		{
+			if (value.length != sizeof(uint32_t)) {
+				return;
+			}
+
+			instanceTagBlock(keyComponents[1], keyComponents[2], OTRKitJournalReadUInt32(value.bytes));
+		}
+	}];
+}
+
+- (void)_readJournal
+{
+	if (self.journalRead) {
+		return;
+	}
+
+	self.journalRead = YES;
+
+	NSData *journal = [NSData dataWithContentsOfFile:self.path options:NSDataReadingMappedIfSafe error:NULL];
+
+	if (journal == nil || journal.length == 0) {
+		return;
+	}
+
+	const uint8_t *bytes = journal.bytes;
+
+	NSUInteger length = journal.length;
+
+	if (length < sizeof(kOTRKitJournalMagic) ||
+		memcmp(bytes, kOTRKitJournalMagic, sizeof(kOTRKitJournalMagic)) != 0)
+	{
+		/* Refuse to append to something that isn't a journal */
+		self.journalInvalid = YES;
+
+		return;
+	}
+
+	NSUInteger offset = sizeof(kOTRKitJournalMagic);
+
+	NSUInteger transactionStart = offset;
+
+	NSMutableDictionary<NSString *, id> *transaction = [NSMutableDictionary dictionary];
+
+	self.journalLength = offset;
+
+	while ((length - offset) >= OTRKitJournalRecordHeaderLength) {
+		uint8_t recordType = bytes[offset];
+
+		uint32_t keyLength = OTRKitJournalReadUInt32(&bytes[(offset + 1)]);
+		uint32_t valueLength = OTRKitJournalReadUInt32(&bytes[(offset + 5)]);
+
+		NSUInteger recordLength = (OTRKitJournalRecordHeaderLength + (NSUInteger)keyLength + (NSUInteger)valueLength);
+
+		if ((length - offset) < recordLength) {
+			break;
+		}
+
+		const uint8_t *keyBytes = &bytes[(offset + OTRKitJournalRecordHeaderLength)];
+
+		const uint8_t *valueBytes = (keyBytes + keyLength);
+
+		if (recordType == OTRKitJournalRecordTypeCommit) {
+			if (keyLength != 0 || valueLength != sizeof(uint32_t)) {
+				break;
+			}
+
+			uint8_t checksum[4];
+
+			gcry_md_hash_buffer(GCRY_MD_CRC32, checksum, &bytes[transactionStart], (offset - transactionStart));
+
+			if (memcmp(checksum, valueBytes, sizeof(checksum)) != 0) {
+				break;
+			}
+
+			[self _applyChanges:transaction];
+
+			[transaction removeAllObjects];
+
+			offset += recordLength;
+
+			transactionStart = offset;
+
+			self.journalLength = offset;
+
+			continue;
+		}
+
+		if (recordType != OTRKitJournalRecordTypePut &&
+			recordType != OTRKitJournalRecordTypeRemove)
+		{
+			break;
+		}
+
+		NSString *key = [[NSString alloc] initWithBytes:keyBytes length:keyLength encoding:NSUTF8StringEncoding];
+
+		if (key == nil) {
+			break;
+		}
+
+		if (recordType == OTRKitJournalRecordTypePut) {
+			transaction[key] = [NSData dataWithBytes:valueBytes length:valueLength];
+		} else {
+			transaction[key] = [NSNull null];
+		}
+
+		offset += recordLength;
+	}
+
+	/* Anything past journalLength belongs to a transaction that wasn't
+	 completely written. It is cut off when the next one is appended. */
+}
+
+- (void)_applyChanges:(NSDictionary<NSString *, id> *)changes
+{
+	NSParameterAssert(changes != nil);
+
+	[changes enumerateKeysAndObjectsUsingBlock:^(NSString *key, id value, BOOL *stop) {
+		NSData *oldValue = self.records[key];
+
+		if (oldValue) {
+			self.recordsLength -= [self _lengthOfRecordWithKey:key value:oldValue];
+		}
+
+		if (value == [NSNull null]) {
+			[self.records removeObjectForKey:key];
+
+			return;
+		}
+
+		self.records[key] = value;
+
+		self.recordsLength += [self _lengthOfRecordWithKey:key value:value];
+	}];
+}
+
+- (uint64_t)_lengthOfRecordWithKey:(NSString *)key value:(NSData *)value
+{
+	NSParameterAssert(key != nil);
+	NSParameterAssert(value != nil);
+
+	return (OTRKitJournalRecordHeaderLength + [key lengthOfBytesUsingEncoding:NSUTF8StringEncoding] + value.length);
+}
+
+#pragma mark -
+#pragma mark Transactions
+
+- (void)beginTransaction
+{
+	self.transactionDepth += 1;
+}
+
+- (BOOL)commitTransaction:(NSError **)error
+{
+	NSAssert((self.transactionDepth > 0),
+		@"Tried to commit a transaction that wasn't started");
+
+	self.transactionDepth -= 1;
+
+	if (self.transactionDepth > 0) {
+		return YES;
+	}
+
+	NSDictionary *changes = self.pendingChanges;
+
+	self.pendingChanges = [NSMutableDictionary dictionary];
+
+	if (changes.count == 0) {
+		return YES;
+	}
+
+	[self _readJournal];
+
+	if (self.journalInvalid) {
+		[self _setError:error code:OTRKitErrorCodeFileFormatInvalid description:@"The file at the journal path isn't a journal"];
+
+		return NO;
+	}
+
+	NSMutableData *transaction = [NSMutableData data];
+
+	[changes enumerateKeysAndObjectsUsingBlock:^(NSString *key, id value, BOOL *stop) {
+		if (value == [NSNull null]) {
+			[self _appendRecordOfType:OTRKitJournalRecordTypeRemove key:key value:nil toData:transaction];
+		} else {
+			[self _appendRecordOfType:OTRKitJournalRecordTypePut key:key value:value toData:transaction];
+		}
+	}];
+
+	[self _appendCommitRecordToData:transaction];
+
+	if ([self _appendTransaction:transaction error:error] == NO) {
+		return NO;
+	}
+
+	[self _applyChanges:changes];
+
+	if (self.journalLength >= kOTRKitJournalMinimumCompactionLength &&
+		self.journalLength > (self.recordsLength * self.compactionRatio))
+	{
+		/* The transaction is already safe. If compacting fails,
+		 the journal is left as it was and tried again later. */
+		[self compact:NULL];
+	}
+
+	return YES;
+}
+
+- (void)_appendRecordOfType:(OTRKitJournalRecordType)recordType key:(NSString *)key value:(nullable NSData *)value toData:(NSMutableData *)data
+{
+	NSParameterAssert(key != nil);
+	NSParameterAssert(data != nil);
+
+	NSData *keyData = [key dataUsingEncoding:NSUTF8StringEncoding];
+
+	uint8_t recordHeader[OTRKitJournalRecordHeaderLength];
+
+	recordHeader[0] = recordType;
+
+	OTRKitJournalWriteUInt32(&recordHeader[1], (uint32_t)keyData.length);
+	OTRKitJournalWriteUInt32(&recordHeader[5], (uint32_t)value.length);
+
+	[data appendBytes:recordHeader length:sizeof(recordHeader)];
+
+	[data appendData:keyData];
+
+	if (value) {
+		[data appendData:value];
+	}
+}
+
+- (void)_appendCommitRecordToData:(NSMutableData *)data
+{
+	NSParameterAssert(data != nil);
+
+	uint8_t commitRecord[(OTRKitJournalRecordHeaderLength + 4)];
+
+	commitRecord[0] = OTRKitJournalRecordTypeCommit;
+
+	OTRKitJournalWriteUInt32(&commitRecord[1], 0);
+	OTRKitJournalWriteUInt32(&commitRecord[5], 4);
+
+	gcry_md_hash_buffer(GCRY_MD_CRC32, &commitRecord[OTRKitJournalRecordHeaderLength], data.bytes, data.length);
+
+	[data appendBytes:commitRecord length:sizeof(commitRecord)];
+}
+
+- (BOOL)_appendTransaction:(NSData *)transaction error:(NSError **)error
+{
+	NSParameterAssert(transaction != nil);
+
+	int journalFile = open(self.path.fileSystemRepresentation, (O_WRONLY | O_CREAT), 0600);
+
+	if (journalFile < 0) {
+		[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"Unable to open the journal"];
+
+		return NO;
+	}
+
+	uint64_t journalLength = self.journalLength;
+
+	BOOL writeResult = YES;
+
+	/* Cut off any transaction that wasn't completely written */
+	if (ftruncate(journalFile, (off_t)journalLength) != 0 ||
+		lseek(journalFile, (off_t)journalLength, SEEK_SET) < 0)
+	{
+		writeResult = NO;
+	}
+
+	if (writeResult && journalLength == 0) {
+		writeResult = OTRKitJournalWrite(journalFile, kOTRKitJournalMagic, sizeof(kOTRKitJournalMagic));
+
+		journalLength = sizeof(kOTRKitJournalMagic);
+	}
+
+	if (writeResult) {
+		writeResult = OTRKitJournalWrite(journalFile, transaction.bytes, transaction.length);
+	}
+
+	if (writeResult) {
+		writeResult = OTRKitJournalSynchronize(journalFile);
+	}
+
+	if (writeResult == NO) {
+		(void)ftruncate(journalFile, (off_t)self.journalLength);
+
+		close(journalFile);
+
+		[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"Unable to write to the journal"];
+
+		return NO;
+	}
+
+	close(journalFile);
+
+	self.bytesWritten += ((journalLength - self.journalLength) + transaction.length);
+
+	self.journalLength = (journalLength + transaction.length);
+
+	return YES;
+}
+
+#pragma mark -
+#pragma mark Compaction
+
+- (BOOL)compact:(NSError **)error
+{
+	[self _readJournal];
+
+	if (self.journalInvalid) {
+		[self _setError:error code:OTRKitErrorCodeFileFormatInvalid description:@"The file at the journal path isn't a journal"];
+
+		return NO;
+	}
+
+	NSMutableData *journal = [NSMutableData dataWithBytes:kOTRKitJournalMagic length:sizeof(kOTRKitJournalMagic)];
+
+	NSMutableData *transaction = [NSMutableData data];
+
+	[self.records enumerateKeysAndObjectsUsingBlock:^(NSString *key, NSData *value, BOOL *stop) {
+		[self _appendRecordOfType:OTRKitJournalRecordTypePut key:key value:value toData:transaction];
+	}];
+
+	if (transaction.length > 0) {
+		[self _appendCommitRecordToData:transaction];
+
+		[journal appendData:transaction];
+	}
+
+	NSString *temporaryPath = [self.path stringByAppendingString:@".compact"];
+
+	int journalFile = open(temporaryPath.fileSystemRepresentation, (O_WRONLY | O_CREAT | O_TRUNC), 0600);
+
+	if (journalFile < 0) {
+		[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"Unable to create the compacted journal"];
+
+		return NO;
+	}
+
+	BOOL writeResult = OTRKitJournalWrite(journalFile, journal.bytes, journal.length);
+
+	if (writeResult) {
+		writeResult = OTRKitJournalSynchronize(journalFile);
+	}
+
+	close(journalFile);
+
+	if (writeResult) {
+		writeResult = (rename(temporaryPath.fileSystemRepresentation, self.path.fileSystemRepresentation) == 0);
+	}
+
+	if (writeResult == NO) {
+		unlink(temporaryPath.fileSystemRepresentation);
+
+		[self _setError:error code:OTRKitErrorCodeFileWriteFailed description:@"Unable to write the compacted journal"];
+
+		return NO;
+	}
+
+	/* Make the rename itself durable */
+	int directoryFile = open(self.path.stringByDeletingLastPathComponent.fileSystemRepresentation, O_RDONLY);
+
+	if (directoryFile >= 0) {
+		(void)fsync(directoryFile);
+
+		close(directoryFile);
+	}
+
+	self.bytesWritten += journal.length;
+
+	self.journalLength = journal.length;
+
+	return YES;
+}
+
+#pragma mark -
+#pragma mark Changes
+
+- (void)storePrivateKey:(NSData *)privateKey accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(privateKey != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	NSString *key = [@[kOTRKitJournalPrivateKeyPrefix, accountName, protocol] componentsJoinedByString:@"\t"];
+
+	[self _setValue:[privateKey copy] forKey:key];
+}
+
+- (void)storeFingerprint:(NSData *)fingerprint trust:(nullable NSString *)trust username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(fingerprint != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	NSString *key = [self _keyForFingerprint:fingerprint username:username accountName:accountName protocol:protocol];
+
+	NSData *value = [NSData data];
+
+	if (trust) {
+		value = [trust dataUsingEncoding:NSUTF8StringEncoding];
+	}
+
+	[self _setValue:value forKey:key];
+}
+
+- (void)removeFingerprint:(NSData *)fingerprint username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(fingerprint != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	NSString *key = [self _keyForFingerprint:fingerprint username:username accountName:accountName protocol:protocol];
+
+	[self _setValue:nil forKey:key];
+}
+
+- (void)storeInstanceTag:(uint32_t)instanceTag accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	NSString *key = [@[kOTRKitJournalInstanceTagPrefix, accountName, protocol] componentsJoinedByString:@"\t"];
+
+	uint8_t value[4];
+
+	OTRKitJournalWriteUInt32(value, instanceTag);
+
+	[self _setValue:[NSData dataWithBytes:value length:sizeof(value)] forKey:key];
+}
+
+- (void)_setValue:(nullable NSData *)value forKey:(NSString *)key
+{
+	NSParameterAssert(key != nil);
+
+	NSAssert((self.transactionDepth > 0),
+		@"Tried to make a change outside of a transaction");
+
+	if (value) {
+		self.pendingChanges[key] = value;
+	} else {
+		self.pendingChanges[key] = [NSNull null];
+	}
+}
+
+- (NSString *)_keyForFingerprint:(NSData *)fingerprint username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	NSParameterAssert(fingerprint != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+	NSParameterAssert(protocol != nil);
+
+	NSMutableString *fingerprintString = [NSMutableString stringWithCapacity:(fingerprint.length * 2)];
+
+	const uint8_t *fingerprintBytes = fingerprint.bytes;
+
+	for (NSUInteger i = 0; i < fingerprint.length; i++) {
+		[fingerprintString appendFormat:@"%02x", fingerprintBytes[i]];
+	}
+
+	return [@[kOTRKitJournalFingerprintPrefix, username, accountName, protocol, fingerprintString] componentsJoinedByString:@"\t"];
+}
+
+- (nullable NSData *)_fingerprintFromHexString:(NSString *)hexString
+{
+	NSParameterAssert(hexString != nil);
+
+	const char *hexCharacters = hexString.UTF8String;
+
+	size_t hexLength = strlen(hexCharacters);
+
+	if ((hexLength % 2) != 0) {
+		return nil;
+	}
+
+	NSMutableData *fingerprint = [NSMutableData dataWithLength:(hexLength / 2)];
+
+	uint8_t *fingerprintBytes = fingerprint.mutableBytes;
+
+	for (size_t i = 0; i < (hexLength / 2); i++) {
+		unsigned int byte = 0;
+
+		if (sscanf(&hexCharacters[(i * 2)], "%2x", &byte) != 1) {
+			return nil;
+		}
+
+		fingerprintBytes[i] = (uint8_t)byte;
+	}
+
+	return fingerprint;
+}
+
+#pragma mark -
+#pragma mark Utilities
+
+static void OTRKitJournalWriteUInt32(uint8_t *bytes, uint32_t value)
+{
+	bytes[0] = (uint8_t)(value >> 24);
+	bytes[1] = (uint8_t)(value >> 16);
+	bytes[2] = (uint8_t)(value >> 8);
+	bytes[3] = (uint8_t)(value);
+}
+
+static uint32_t OTRKitJournalReadUInt32(const uint8_t *bytes)
+{
+	return (((uint32_t)bytes[0] << 24) |
+			((uint32_t)bytes[1] << 16) |
+			((uint32_t)bytes[2] << 8) |
+			((uint32_t)bytes[3]));
+}
+
+static BOOL OTRKitJournalWrite(int fileDescriptor, const void *bytes, size_t length)
+{
+	const uint8_t *remainingBytes = bytes;
+
+	while (length > 0) {
+		ssize_t bytesWritten = write(fileDescriptor, remainingBytes, length);
+
+		if (bytesWritten < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return NO;
+		}
+
+		remainingBytes += bytesWritten;
+
+		length -= (size_t)bytesWritten;
+	}
+
+	return YES;
+}
+
+static BOOL OTRKitJournalSynchronize(int fileDescriptor)
+{
+#if defined(F_FULLFSYNC)
+	/* fsync() on macOS doesn't ask the drive to flush its cache */
+	if (fcntl(fileDescriptor, F_FULLFSYNC) == 0) {
+		return YES;
+	}
+#endif
+
+	return (fsync(fileDescriptor) == 0);
+}
+
+- (void)_setError:(NSError **)error code:(OTRKitErrorCode)code description:(NSString *)description
+{
+	NSParameterAssert(description != nil);
+
+	if (error == NULL) {
+		return;
+	}
+
+	*error = [NSError errorWithDomain:OTRKitErrorDomain
+								 code:code
+							 userInfo:@{NSLocalizedDescriptionKey : description}];
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
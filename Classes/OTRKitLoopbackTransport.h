@@ -0,0 +1,239 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class OTRKit;
+
+typedef NS_ENUM(NSUInteger, OTRKitLoopbackTransportStepType) {
+	OTRKitLoopbackTransportStepTypeStartEncryption,
+	OTRKitLoopbackTransportStepTypeSendMessages,
+	OTRKitLoopbackTransportStepTypeEndEncryption,
+	OTRKitLoopbackTransportStepTypePause
+};
+
+/**
+ *  Describes the network between the local accounts and the simulated peers.
+ */
+@interface OTRKitLoopbackTransportConfiguration : NSObject <NSCopying>
+/**
+ *  Number of local accounts. Defaults to 1.
+ */
+@property (nonatomic, assign) NSUInteger accountCount;
+
+/**
+ *  Number of simulated peers. Each local account has a conversation
+ *  with each peer. Defaults to 1.
+ */
+@property (nonatomic, assign) NSUInteger peerCount;
+
+/**
+ *  Protocol used for each conversation. Defaults to "prpl-loopback".
+ */
+@property (nonatomic, copy) NSString *protocol;
+
+/**
+ *  Time in seconds each message takes to arrive. Defaults to 0.01.
+ */
+@property (nonatomic, assign) NSTimeInterval latency;
+
+/**
+ *  Up to this many seconds are added at random to the latency of each message. Defaults to zero.
+ */
+@property (nonatomic, assign) NSTimeInterval latencyJitter;
+
+/**
+ *  Chance between 0 and 1 that a message is lost. Defaults to zero.
+ */
+@property (nonatomic, assign) double lossRate;
+
+/**
+ *  Chance between 0 and 1 that a message is held back long enough
+ *  for the message sent after it to arrive first. Defaults to zero.
+ */
+@property (nonatomic, assign) double reorderRate;
+
+/**
+ *  Messages longer than this many bytes are cut short the way an IRC
+ *  server would. OTRKit is told to fragment at this size and is told
+ *  of each truncation. Defaults to zero which means no limit.
+ */
+@property (nonatomic, assign) NSUInteger maximumLineLength;
+
+/**
+ *  Seed for loss, reordering, and jitter so a run can be repeated. Defaults to 1.
+ */
+@property (nonatomic, assign) uint64_t randomSeed;
+@end
+
+/**
+ *  One step of the traffic driven by -runScript:timeout:completionHandler:
+ *  Each step runs for every conversation then waits until the transport
+ *  is idle before the next step begins.
+ */
+@interface OTRKitLoopbackTransportStep : NSObject
+@property (nonatomic, assign, readonly) OTRKitLoopbackTransportStepType type;
+@property (nonatomic, assign, readonly) NSUInteger messageCount;
+@property (nonatomic, assign, readonly) NSUInteger messageSize;
+@property (nonatomic, assign, readonly) BOOL bidirectional;
+@property (nonatomic, assign, readonly) NSTimeInterval interval;
+
+/**
+ *  Each local account starts an encrypted conversation with each peer.
+ */
++ (instancetype)startEncryptionStep;
+
+/**
+ *  Each local account sends messageCount messages of messageSize bytes to each peer.
+ *
+ *  @param messageCount		Number of messages sent in each conversation
+ *  @param messageSize		Length of each message in bytes
+ *  @param bidirectional	Whether each peer sends the same number of messages back
+ */
++ (instancetype)sendStepWithMessageCount:(NSUInteger)messageCount messageSize:(NSUInteger)messageSize bidirectional:(BOOL)bidirectional;
+
+/**
+ *  Each local account ends the encrypted conversation with each peer.
+ */
++ (instancetype)endEncryptionStep;
+
+/**
+ *  Nothing is sent for interval seconds.
+ */
++ (instancetype)pauseStepWithInterval:(NSTimeInterval)interval;
+@end
+
+/**
+ *  A snapshot of the counters of a transport.
+ */
+@interface OTRKitLoopbackTransportStatistics : NSObject
+/**
+ *  Number of conversations. This is accountCount multiplied by peerCount.
+ */
+@property (nonatomic, assign, readonly) NSUInteger conversationCount;
+
+/**
+ *  Number of conversations that are encrypted on both sides.
+ */
+@property (nonatomic, assign, readonly) NSUInteger encryptedConversationCount;
+
+/**
+ *  Messages handed to -encodeMessage:tlvs:username:accountName:protocol:asynchronously:tag:
+ */
+@property (nonatomic, assign, readonly) NSUInteger messagesSent;
+
+/**
+ *  Messages that the other side decoded intact.
+ */
+@property (nonatomic, assign, readonly) NSUInteger messagesReceived;
+
+/**
+ *  Lines passed to the injectMessage: delegate method, and their length in bytes.
+ *  This includes protocol messages and each fragment.
+ */
+@property (nonatomic, assign, readonly) NSUInteger linesInjected;
+@property (nonatomic, assign, readonly) uint64_t bytesInjected;
+
+/**
+ *  Lines that were delivered, lost, delivered out of order, or cut short.
+ */
+@property (nonatomic, assign, readonly) NSUInteger linesDelivered;
+@property (nonatomic, assign, readonly) NSUInteger linesLost;
+@property (nonatomic, assign, readonly) NSUInteger linesReordered;
+@property (nonatomic, assign, readonly) NSUInteger linesTruncated;
+
+/**
+ *  Number of message events with an error reported by either side.
+ */
+@property (nonatomic, assign, readonly) NSUInteger errorCount;
+
+/**
+ *  Time in seconds from encoding a message to receiving it.
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval averageLatency;
+@property (nonatomic, assign, readonly) NSTimeInterval maximumLatency;
+
+/**
+ *  Time in seconds the script ran for, or has been running for.
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval elapsedTime;
+@end
+
+/**
+ *  OTRKitLoopbackTransport connects simulated peers to local accounts without
+ *  a network so that many conversations can be load tested offline.
+ *
+ *  The local accounts are hosted by localOTRKit and the peers by remoteOTRKit.
+ *  The transport is the delegate of both. Lines injected by one side are
+ *  delivered to the other side according to the configuration.
+ *
+ *  Private keys are created for each account and peer the first time they
+ *  are needed and kept in dataPath. Reusing dataPath skips that work.
+ */
+@interface OTRKitLoopbackTransport : NSObject
+/**
+ *  @param configuration	Describes the accounts, peers, and network. It is copied.
+ *  @param dataPath			Directory to keep private keys, fingerprints, and instance tags in
+ */
+- (instancetype)initWithConfiguration:(OTRKitLoopbackTransportConfiguration *)configuration dataPath:(NSString *)dataPath NS_DESIGNATED_INITIALIZER;
+
+@property (nonatomic, copy, readonly) OTRKitLoopbackTransportConfiguration *configuration;
+
+@property (nonatomic, strong, readonly) OTRKit *localOTRKit;
+@property (nonatomic, strong, readonly) OTRKit *remoteOTRKit;
+
+@property (nonatomic, copy, readonly) NSArray<NSString *> *accountNames;
+@property (nonatomic, copy, readonly) NSArray<NSString *> *peerNames;
+
+/**
+ *  Runs each step in turn.
+ *
+ *  @param script				Steps to run
+ *  @param timeout				Most seconds to wait for each step. Anything
+ *								still outstanding is left behind.
+ *  @param completionHandler	Called with the statistics once the last step is done. It is called on a
+ *								global queue because the main thread is often blocked by load tests.
+ */
+- (void)runScript:(NSArray<OTRKitLoopbackTransportStep *> *)script timeout:(NSTimeInterval)timeout completionHandler:(void (^)(OTRKitLoopbackTransportStatistics *statistics))completionHandler;
+
+/**
+ *  A snapshot of the counters as they are now.
+ */
+@property (nonatomic, strong, readonly) OTRKitLoopbackTransportStatistics *statistics;
+
+/**
+ *  Set each counter back to zero.
+ */
+- (void)resetStatistics;
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,879 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKit.h"
+#import "OTRKitLoopbackTransport.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+static NSTimeInterval const kOTRKitLoopbackTransportTimerInterval = 0.05;
+
+#pragma mark -
+#pragma mark Private Interfaces
+
+@interface OTRKitLoopbackTransportStep ()
+@property (nonatomic, assign, readwrite) OTRKitLoopbackTransportStepType type;
+@property (nonatomic, assign, readwrite) NSUInteger messageCount;
+@property (nonatomic, assign, readwrite) NSUInteger messageSize;
+@property (nonatomic, assign, readwrite) BOOL bidirectional;
+@property (nonatomic, assign, readwrite) NSTimeInterval interval;
+@end
+
+@interface OTRKitLoopbackTransportStatistics ()
+@property (nonatomic, assign, readwrite) NSUInteger conversationCount;
+@property (nonatomic, assign, readwrite) NSUInteger encryptedConversationCount;
+@property (nonatomic, assign, readwrite) NSUInteger messagesSent;
+@property (nonatomic, assign, readwrite) NSUInteger messagesReceived;
+@property (nonatomic, assign, readwrite) NSUInteger linesInjected;
+@property (nonatomic, assign, readwrite) uint64_t bytesInjected;
+@property (nonatomic, assign, readwrite) NSUInteger linesDelivered;
+@property (nonatomic, assign, readwrite) NSUInteger linesLost;
+@property (nonatomic, assign, readwrite) NSUInteger linesReordered;
+@property (nonatomic, assign, readwrite) NSUInteger linesTruncated;
+@property (nonatomic, assign, readwrite) NSUInteger errorCount;
+@property (nonatomic, assign, readwrite) NSTimeInterval averageLatency;
+@property (nonatomic, assign, readwrite) NSTimeInterval maximumLatency;
+@property (nonatomic, assign, readwrite) NSTimeInterval elapsedTime;
+
+- (OTRKitLoopbackTransportStatistics *)snapshot;
+@end
+
+@interface OTRKitLoopbackTransport () <OTRKitDelegate>
+@property (nonatomic, copy, readwrite) OTRKitLoopbackTransportConfiguration *configuration;
+@property (nonatomic, strong, readwrite) OTRKit *localOTRKit;
+@property (nonatomic, strong, readwrite) OTRKit *remoteOTRKit;
+@property (nonatomic, copy, readwrite) NSArray<NSString *> *accountNames;
+@property (nonatomic, copy, readwrite) NSArray<NSString *> *peerNames;
+
+/* Everything below is only accessed on transportQueue which is
+ also the delegate queue of both instances of OTRKit. */
+@property (nonatomic, strong) dispatch_queue_t transportQueue;
+@property (nonatomic, assign) uint64_t randomState;
+
+/* Counters */
+@property (nonatomic, strong) OTRKitLoopbackTransportStatistics *counters;
+@property (nonatomic, assign) NSTimeInterval totalLatency;
+@property (nonatomic, strong) NSMutableSet<NSString *> *localEncryptedConversations;
+@property (nonatomic, strong) NSMutableSet<NSString *> *remoteEncryptedConversations;
+
+/* Messages that are being encoded and lines that are in the air.
+ A line is pending until the other side has finished decoding it. */
+@property (nonatomic, assign) uint64_t lastSequenceNumber;
+@property (nonatomic, strong) NSMutableDictionary<NSNumber *, NSNumber *> *sendTimes;
+@property (nonatomic, assign) NSUInteger pendingEncodeCount;
+@property (nonatomic, assign) NSUInteger pendingLineCount;
+
+/* Instances that did something during the current step */
+@property (nonatomic, strong) NSMutableSet<OTRKit *> *activeOTRKits;
+
+/* Increased each time either side does something. A step is
+ done once this stops changing and nothing is pending. */
+@property (nonatomic, assign) uint64_t activityCount;
+@property (nonatomic, assign) NSTimeInterval lastActivityTime;
+
+/* Script */
+@property (nonatomic, assign) BOOL scriptRunning;
+@property (nonatomic, copy, nullable) NSArray<OTRKitLoopbackTransportStep *> *script;
+@property (nonatomic, assign) NSUInteger scriptStepIndex;
+@property (nonatomic, assign) NSTimeInterval scriptTimeout;
+@property (nonatomic, assign) NSTimeInterval scriptStartTime;
+@property (nonatomic, assign) NSTimeInterval scriptEndTime;
+@property (nonatomic, assign) NSTimeInterval stepStartTime;
+@property (nonatomic, assign) BOOL stepDraining;
+@property (nonatomic, copy, nullable) void (^scriptCompletionHandler)(OTRKitLoopbackTransportStatistics *statistics);
+@property (nonatomic, strong, nullable) dispatch_source_t scriptTimer;
+@end
+
+#pragma mark -
+#pragma mark Configuration
+
+@implementation OTRKitLoopbackTransportConfiguration
+
+- (instancetype)init
+{
+	if ((self = [super init])) {
+		self.accountCount = 1;
+
+		self.peerCount = 1;
+
+		self.protocol = @"prpl-loopback";
+
+		self.latency = 0.01;
+
+		self.randomSeed = 1;
+
+		return self;
+	}
+
+	return nil;
+}
+
+- (id)copyWithZone:(nullable NSZone *)zone
+{
+	OTRKitLoopbackTransportConfiguration *object = [[[self class] allocWithZone:zone] init];
+
+	object.accountCount = self.accountCount;
+	object.peerCount = self.peerCount;
+	object.protocol = self.protocol;
+	object.latency = self.latency;
+	object.latencyJitter = self.latencyJitter;
+	object.lossRate = self.lossRate;
+	object.reorderRate = self.reorderRate;
+	object.maximumLineLength = self.maximumLineLength;
+	object.randomSeed = self.randomSeed;
+
+	return object;
+}
+
+@end
+
+#pragma mark -
+#pragma mark Step
+
+@implementation OTRKitLoopbackTransportStep
+
++ (instancetype)startEncryptionStep
+{
+	OTRKitLoopbackTransportStep *step = [self new];
+
+	step.type = OTRKitLoopbackTransportStepTypeStartEncryption;
+
+	return step;
+}
+
++ (instancetype)sendStepWithMessageCount:(NSUInteger)messageCount messageSize:(NSUInteger)messageSize bidirectional:(BOOL)bidirectional
+{
+	OTRKitLoopbackTransportStep *step = [self new];
+
+	step.type = OTRKitLoopbackTransportStepTypeSendMessages;
+
+	step.messageCount = messageCount;
+	step.messageSize = messageSize;
+
+	step.bidirectional = bidirectional;
+
+	return step;
+}
+
++ (instancetype)endEncryptionStep
+{
+	OTRKitLoopbackTransportStep *step = [self new];
+
+	step.type = OTRKitLoopbackTransportStepTypeEndEncryption;
+
+	return step;
+}
+
++ (instancetype)pauseStepWithInterval:(NSTimeInterval)interval
+{
+	OTRKitLoopbackTransportStep *step = [self new];
+
+	step.type = OTRKitLoopbackTransportStepTypePause;
+
+	step.interval = interval;
+
+	return step;
+}
+
+@end
+
+#pragma mark -
+#pragma mark Statistics
+
+@implementation OTRKitLoopbackTransportStatistics
+
+- (OTRKitLoopbackTransportStatistics *)snapshot
+{
+	OTRKitLoopbackTransportStatistics *object = [OTRKitLoopbackTransportStatistics new];
+
+	object.conversationCount = self.conversationCount;
+	object.encryptedConversationCount = self.encryptedConversationCount;
+	object.messagesSent = self.messagesSent;
+	object.messagesReceived = self.messagesReceived;
+	object.linesInjected = self.linesInjected;
+	object.bytesInjected = self.bytesInjected;
+	object.linesDelivered = self.linesDelivered;
+	object.linesLost = self.linesLost;
+	object.linesReordered = self.linesReordered;
+	object.linesTruncated = self.linesTruncated;
+	object.errorCount = self.errorCount;
+	object.averageLatency = self.averageLatency;
+	object.maximumLatency = self.maximumLatency;
+	object.elapsedTime = self.elapsedTime;
+
+	return object;
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:@"<%@: conversations: %lu (%lu encrypted), messages: %lu sent %lu received, lines: %lu injected %lu delivered %lu lost %lu reordered %lu truncated, errors: %lu, latency: %.3fs average %.3fs maximum, elapsed: %.3fs>",
+			NSStringFromClass([self class]),
+			(unsigned long)self.conversationCount,
+			(unsigned long)self.encryptedConversationCount,
+			(unsigned long)self.messagesSent,
+			(unsigned long)self.messagesReceived,
+			(unsigned long)self.linesInjected,
+			(unsigned long)self.linesDelivered,
+			(unsigned long)self.linesLost,
+			(unsigned long)self.linesReordered,
+			(unsigned long)self.linesTruncated,
+			(unsigned long)self.errorCount,
+			self.averageLatency,
+			self.maximumLatency,
+			self.elapsedTime];
+}
+
+@end
+
+#pragma mark -
+#pragma mark Transport
+
+@implementation OTRKitLoopbackTransport
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+- (instancetype)init
+{
+	return nil;
+}
+#pragma clang diagnostic pop
+
+- (instancetype)initWithConfiguration:(OTRKitLoopbackTransportConfiguration *)configuration dataPath:(NSString *)dataPath
+{
+	NSParameterAssert(configuration != nil);
+	NSParameterAssert(dataPath != nil);
+
+	if ((self = [super init])) {
+		self.configuration = configuration;
+
+		self.transportQueue = dispatch_queue_create("OTRKit Loopback Transport Queue", DISPATCH_QUEUE_SERIAL);
+
+		self.randomState = ((configuration.randomSeed) ?: 1);
+
+		self.counters = [OTRKitLoopbackTransportStatistics new];
+
+		self.counters.conversationCount = (configuration.accountCount * configuration.peerCount);
+
+		self.localEncryptedConversations = [NSMutableSet set];
+		self.remoteEncryptedConversations = [NSMutableSet set];
+
+		self.sendTimes = [NSMutableDictionary dictionary];
+
+		self.activeOTRKits = [NSMutableSet set];
+
+		NSMutableArray<NSString *> *accountNames = [NSMutableArray arrayWithCapacity:configuration.accountCount];
+
+		for (NSUInteger i = 0; i < configuration.accountCount; i++) {
+			[accountNames addObject:[NSString stringWithFormat:@"account-%lu@loopback", (unsigned long)i]];
+		}
+
+		self.accountNames = accountNames;
+
+		NSMutableArray<NSString *> *peerNames = [NSMutableArray arrayWithCapacity:configuration.peerCount];
+
+		for (NSUInteger i = 0; i < configuration.peerCount; i++) {
+			[peerNames addObject:[NSString stringWithFormat:@"peer-%lu@loopback", (unsigned long)i]];
+		}
+
+		self.peerNames = peerNames;
+
+		self.localOTRKit = [self _otrKitWithDataPath:[dataPath stringByAppendingPathComponent:@"Local"]];
+		self.remoteOTRKit = [self _otrKitWithDataPath:[dataPath stringByAppendingPathComponent:@"Remote"]];
+
+		return self;
+	}
+
+	return nil;
+}
+
+- (OTRKit *)_otrKitWithDataPath:(NSString *)dataPath
+{
+	NSParameterAssert(dataPath != nil);
+
+	[[NSFileManager defaultManager] createDirectoryAtPath:dataPath withIntermediateDirectories:YES attributes:nil error:NULL];
+
+	OTRKit *otrKit = [OTRKit new];
+
+	otrKit.delegate = self;
+
+	otrKit.delegateQueue = self.transportQueue;
+
+	[otrKit setupWithDataPath:dataPath];
+
+	NSUInteger maximumLineLength = self.configuration.maximumLineLength;
+
+	if (maximumLineLength > 0) {
+		[otrKit setMaximumProtocolSize:(int)MIN(maximumLineLength, (NSUInteger)INT_MAX) forProtocol:self.configuration.protocol];
+	}
+
+	return otrKit;
+}
+
+#pragma mark -
+#pragma mark Statistics
+
+- (OTRKitLoopbackTransportStatistics *)statistics
+{
+	__block OTRKitLoopbackTransportStatistics *statistics = nil;
+
+	dispatch_sync(self.transportQueue, ^{
+		statistics = [self _statistics];
+	});
+
+	return statistics;
+}
+
+- (OTRKitLoopbackTransportStatistics *)_statistics
+{
+	OTRKitLoopbackTransportStatistics *counters = self.counters;
+
+	NSMutableSet<NSString *> *encryptedConversations = [self.localEncryptedConversations mutableCopy];
+
+	[encryptedConversations intersectSet:self.remoteEncryptedConversations];
+
+	counters.encryptedConversationCount = encryptedConversations.count;
+
+	if (counters.messagesReceived > 0) {
+		counters.averageLatency = (self.totalLatency / counters.messagesReceived);
+	}
+
+	if (self.scriptRunning) {
+		counters.elapsedTime = ([NSProcessInfo processInfo].systemUptime - self.scriptStartTime);
+	} else {
+		counters.elapsedTime = (self.scriptEndTime - self.scriptStartTime);
+	}
+
+	return [counters snapshot];
+}
+
+- (void)resetStatistics
+{
+	dispatch_async(self.transportQueue, ^{
+		NSUInteger conversationCount = self.counters.conversationCount;
+
+		self.counters = [OTRKitLoopbackTransportStatistics new];
+
+		self.counters.conversationCount = conversationCount;
+
+		self.totalLatency = 0;
+
+		/* Which conversations are encrypted is state, not a counter */
+	});
+}
+
+#pragma mark -
+#pragma mark Script
+
+- (void)runScript:(NSArray<OTRKitLoopbackTransportStep *> *)script timeout:(NSTimeInterval)timeout completionHandler:(void (^)(OTRKitLoopbackTransportStatistics *statistics))completionHandler
+{
+	NSParameterAssert(script != nil);
+	NSParameterAssert(completionHandler != nil);
+
+	dispatch_async(self.transportQueue, ^{
+		NSAssert((self.scriptRunning == NO), @"A script is already running");
+
+		self.scriptRunning = YES;
+
+		self.script = script;
+
+		self.scriptStepIndex = 0;
+
+		self.scriptTimeout = timeout;
+
+		self.scriptCompletionHandler = completionHandler;
+
+		self.scriptStartTime = [NSProcessInfo processInfo].systemUptime;
+
+		dispatch_source_t scriptTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.transportQueue);
+
+		dispatch_source_set_timer(scriptTimer,
+								  dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kOTRKitLoopbackTransportTimerInterval * NSEC_PER_SEC)),
+								  (uint64_t)(kOTRKitLoopbackTransportTimerInterval * NSEC_PER_SEC),
+								  (uint64_t)(kOTRKitLoopbackTransportTimerInterval * NSEC_PER_SEC / 10));
+
+		__weak OTRKitLoopbackTransport *weakSelf = self;
+
+		dispatch_source_set_event_handler(scriptTimer, ^{
+			[weakSelf _scriptTimerFired];
+		});
+
+		self.scriptTimer = scriptTimer;
+
+		dispatch_resume(scriptTimer);
+
+		[self _startStep];
+	});
+}
+
+- (void)_startStep
+{
+	if (self.scriptStepIndex >= self.script.count) {
+		[self _finishScript];
+
+		return;
+	}
+
+	OTRKitLoopbackTransportStep *step = self.script[self.scriptStepIndex];
+
+	self.stepStartTime = [NSProcessInfo processInfo].systemUptime;
+
+	self.stepDraining = NO;
+
+	[self.activeOTRKits removeAllObjects];
+
+	[self _noteActivity];
+
+	NSString *protocol = self.configuration.protocol;
+
+	switch (step.type) {
+		case OTRKitLoopbackTransportStepTypeStartEncryption:
+		{
+			[self.activeOTRKits addObject:self.localOTRKit];
+
+			for (NSString *accountName in self.accountNames) {
+				for (NSString *peerName in self.peerNames) {
+					[self.localOTRKit initiateEncryptionWithUsername:peerName accountName:accountName protocol:protocol asynchronously:YES];
+				}
+			}
+
+			break;
+		}
+		case OTRKitLoopbackTransportStepTypeSendMessages:
+		{
+			for (NSString *accountName in self.accountNames) {
+				for (NSString *peerName in self.peerNames) {
+					for (NSUInteger i = 0; i < step.messageCount; i++) {
+						[self _sendMessageOfSize:step.messageSize withOTRKit:self.localOTRKit username:peerName accountName:accountName];
+
+						if (step.bidirectional) {
+							[self _sendMessageOfSize:step.messageSize withOTRKit:self.remoteOTRKit username:accountName accountName:peerName];
+						}
+					}
+				}
+			}
+
+			break;
+		}
+		case OTRKitLoopbackTransportStepTypeEndEncryption:
+		{
+			[self.activeOTRKits addObject:self.localOTRKit];
+
+			for (NSString *accountName in self.accountNames) {
+				for (NSString *peerName in self.peerNames) {
+					[self.localOTRKit disableEncryptionWithUsername:peerName accountName:accountName protocol:protocol];
+				}
+			}
+
+			break;
+		}
+		case OTRKitLoopbackTransportStepTypePause:
+		{
+			/* The timer moves on once the interval has passed */
+
+			break;
+		}
+	}
+}
+
+- (void)_scriptTimerFired
+{
+	if (self.scriptRunning == NO || self.stepDraining) {
+		return;
+	}
+
+	OTRKitLoopbackTransportStep *step = self.script[self.scriptStepIndex];
+
+	NSTimeInterval currentTime = [NSProcessInfo processInfo].systemUptime;
+
+	if ((currentTime - self.stepStartTime) >= self.scriptTimeout) {
+		[self _finishStep];
+
+		return;
+	}
+
+	if (step.type == OTRKitLoopbackTransportStepTypePause) {
+		if ((currentTime - self.stepStartTime) >= step.interval) {
+			[self _finishStep];
+		}
+
+		return;
+	}
+
+	if (self.pendingEncodeCount > 0 || self.pendingLineCount > 0) {
+		return;
+	}
+
+	/* Work that isn't counted, such as starting or ending encryption or
+	 aborting SMP, may still be queued. Wait for a quiet period and then
+	 for the internal queue of each instance that took part to catch up. */
+	NSTimeInterval quietInterval = MAX((self.configuration.latency + self.configuration.latencyJitter), kOTRKitLoopbackTransportTimerInterval);
+
+	if ((currentTime - self.lastActivityTime) < quietInterval) {
+		return;
+	}
+
+	self.stepDraining = YES;
+
+	uint64_t activityCount = self.activityCount;
+
+	NSString *accountName = self.accountNames.firstObject;
+	NSString *peerName = self.peerNames.firstObject;
+
+	NSString *protocol = self.configuration.protocol;
+
+	OTRKit *localOTRKit = self.localOTRKit;
+
+	NSArray<OTRKit *> *activeOTRKits = self.activeOTRKits.allObjects;
+
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		/* A synchronous call returns once the internal queue of an instance has
+		 run everything queued before it, whichever conversation it was for. */
+		for (OTRKit *otrKit in activeOTRKits) {
+			if (otrKit == localOTRKit) {
+				(void)[otrKit messageStateForUsername:peerName accountName:accountName protocol:protocol];
+			} else {
+				(void)[otrKit messageStateForUsername:accountName accountName:peerName protocol:protocol];
+			}
+		}
+
+		dispatch_async(self.transportQueue, ^{
+			self.stepDraining = NO;
+
+			if (self.scriptRunning == NO) {
+				return;
+			}
+
+			if (self.activityCount != activityCount ||
+				self.pendingEncodeCount > 0 ||
+				self.pendingLineCount > 0)
+			{
+				return;
+			}
+
+			[self _finishStep];
+		});
+	});
+}
+
+- (void)_finishStep
+{
+	self.scriptStepIndex += 1;
+
+	[self _startStep];
+}
+
+- (void)_finishScript
+{
+	dispatch_source_cancel(self.scriptTimer);
+
+	self.scriptTimer = nil;
+
+	self.scriptEndTime = [NSProcessInfo processInfo].systemUptime;
+
+	self.scriptRunning = NO;
+
+	self.script = nil;
+
+	OTRKitLoopbackTransportStatistics *statistics = [self _statistics];
+
+	void (^completionHandler)(OTRKitLoopbackTransportStatistics *) = self.scriptCompletionHandler;
+
+	self.scriptCompletionHandler = nil;
+
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		completionHandler(statistics);
+	});
+}
+
+#pragma mark -
+#pragma mark Traffic
+
+- (void)_sendMessageOfSize:(NSUInteger)messageSize withOTRKit:(OTRKit *)otrKit username:(NSString *)username accountName:(NSString *)accountName
+{
+	NSParameterAssert(otrKit != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+
+	uint64_t sequenceNumber = (self.lastSequenceNumber + 1);
+
+	self.lastSequenceNumber = sequenceNumber;
+
+	/* The sequence number leads the message so the
+	 receiving side can work out how long it took. */
+	NSMutableString *message = [NSMutableString stringWithFormat:@"%llu:", sequenceNumber];
+
+	while (message.length < messageSize) {
+		[message appendString:@"x"];
+	}
+
+	self.sendTimes[@(sequenceNumber)] = @([NSProcessInfo processInfo].systemUptime);
+
+	self.counters.messagesSent += 1;
+
+	self.pendingEncodeCount += 1;
+
+	[self.activeOTRKits addObject:otrKit];
+
+	[otrKit encodeMessage:message tlvs:nil username:username accountName:accountName protocol:self.configuration.protocol asynchronously:YES tag:@(sequenceNumber)];
+}
+
+- (double)_random
+{
+	/* xorshift64* */
+	uint64_t x = self.randomState;
+
+	x ^= (x >> 12);
+	x ^= (x << 25);
+	x ^= (x >> 27);
+
+	self.randomState = x;
+
+	return ((double)((x * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53));
+}
+
+- (void)_noteActivity
+{
+	self.activityCount += 1;
+
+	self.lastActivityTime = [NSProcessInfo processInfo].systemUptime;
+}
+
+- (void)_noteActivityOfOTRKit:(OTRKit *)otrKit
+{
+	NSParameterAssert(otrKit != nil);
+
+	[self.activeOTRKits addObject:otrKit];
+
+	[self _noteActivity];
+}
+
+- (NSString *)_conversationKeyForOTRKit:(OTRKit *)otrKit username:(NSString *)username accountName:(NSString *)accountName
+{
+	NSParameterAssert(otrKit != nil);
+	NSParameterAssert(username != nil);
+	NSParameterAssert(accountName != nil);
+
+	/* Both sides use the local account first */
+	if (otrKit == self.localOTRKit) {
+		return [NSString stringWithFormat:@"%@ <-> %@", accountName, username];
+	} else {
+		return [NSString stringWithFormat:@"%@ <-> %@", username, accountName];
+	}
+}
+
+#pragma mark -
+#pragma mark OTRKit Delegate
+
+- (void)otrKit:(OTRKit *)otrKit injectMessage:(NSString *)message username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol tag:(nullable id)tag
+{
+	[self _noteActivityOfOTRKit:otrKit];
+
+	OTRKitLoopbackTransportConfiguration *configuration = self.configuration;
+
+	NSUInteger messageLength = [message lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+
+	self.counters.linesInjected += 1;
+
+	self.counters.bytesInjected += messageLength;
+
+	if ([self _random] < configuration.lossRate) {
+		self.counters.linesLost += 1;
+
+		return;
+	}
+
+	NSUInteger maximumLineLength = configuration.maximumLineLength;
+
+	/* OTR messages are ASCII so characters and bytes are the same */
+	if (maximumLineLength > 0 && messageLength > maximumLineLength) {
+		message = [message substringToIndex:MIN(maximumLineLength, message.length)];
+
+		self.counters.linesTruncated += 1;
+
+		[otrKit transportDidTruncateMessageOfLength:messageLength toLength:maximumLineLength username:username accountName:accountName protocol:protocol];
+	} else {
+		[otrKit transportDidDeliverMessageOfLength:messageLength username:username accountName:accountName protocol:protocol];
+	}
+
+	NSTimeInterval delay = (configuration.latency + (configuration.latencyJitter * [self _random]));
+
+	if ([self _random] < configuration.reorderRate) {
+		delay += MAX((configuration.latency + configuration.latencyJitter), kOTRKitLoopbackTransportTimerInterval);
+
+		self.counters.linesReordered += 1;
+	}
+
+	OTRKit *remoteOTRKit = ((otrKit == self.localOTRKit) ? self.remoteOTRKit : self.localOTRKit);
+
+	self.pendingLineCount += 1;
+
+	dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), self.transportQueue, ^{
+		self.counters.linesDelivered += 1;
+
+		[self _noteActivityOfOTRKit:remoteOTRKit];
+
+		/* What is sent to username by accountName arrives at accountName of the other side from username.
+		 The completion handler is called once even when the decode is rejected, and the lines injected
+		 while decoding reach the transport queue ahead of it, so nothing in flight goes uncounted. */
+		[remoteOTRKit decodeMessage:message
+						   username:accountName
+						accountName:username
+						   protocol:protocol
+						   priority:OTRKitPriorityInteractive
+								tag:nil
+					completionQueue:self.transportQueue
+						 completion:^(NSString *decodedMessage, BOOL wasEncrypted, NSArray<OTRTLV *> *tlvs, NSError *error) {
+							 self.pendingLineCount -= 1;
+
+							 [self _noteActivityOfOTRKit:remoteOTRKit];
+
+							 if (error) {
+								 self.counters.errorCount += 1;
+							 }
+
+							 if (decodedMessage) {
+								 [self _receivedMessage:decodedMessage];
+							 }
+						 }];
+	});
+}
+
+- (void)otrKit:(OTRKit *)otrKit encodedMessage:(nullable NSString *)encodedMessage wasEncrypted:(BOOL)wasEncrypted username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol tag:(nullable id)tag error:(nullable NSError *)error
+{
+	[self _noteActivityOfOTRKit:otrKit];
+
+	if ([tag isKindOfClass:[NSNumber class]] == NO) {
+		return;
+	}
+
+	self.pendingEncodeCount -= 1;
+
+	if (encodedMessage == nil || error) {
+		self.counters.errorCount += 1;
+
+		[self.sendTimes removeObjectForKey:tag];
+	}
+}
+
+- (void)otrKit:(OTRKit *)otrKit decodedMessage:(nullable NSString *)decodedMessage wasEncrypted:(BOOL)wasEncrypted tlvs:(NSArray<OTRTLV *> *)tlvs username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol tag:(nullable id)tag
+{
+	/* Lines are decoded with a completion handler which is called in place of this */
+}
+
+- (void)_receivedMessage:(NSString *)decodedMessage
+{
+	NSParameterAssert(decodedMessage != nil);
+
+	NSRange separatorRange = [decodedMessage rangeOfString:@":"];
+
+	if (separatorRange.location == NSNotFound) {
+		return;
+	}
+
+	NSNumber *sequenceNumber = @(strtoull([decodedMessage substringToIndex:separatorRange.location].UTF8String, NULL, 10));
+
+	NSNumber *sendTime = self.sendTimes[sequenceNumber];
+
+	if (sendTime == nil) {
+		return;
+	}
+
+	[self.sendTimes removeObjectForKey:sequenceNumber];
+
+	NSTimeInterval latency = ([NSProcessInfo processInfo].systemUptime - sendTime.doubleValue);
+
+	self.counters.messagesReceived += 1;
+
+	self.totalLatency += latency;
+
+	if (self.counters.maximumLatency < latency) {
+		self.counters.maximumLatency = latency;
+	}
+}
+
+- (void)otrKit:(OTRKit *)otrKit updateMessageState:(OTRKitMessageState)messageState username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	[self _noteActivityOfOTRKit:otrKit];
+
+	NSString *conversationKey = [self _conversationKeyForOTRKit:otrKit username:username accountName:accountName];
+
+	NSMutableSet<NSString *> *encryptedConversations = ((otrKit == self.localOTRKit) ? self.localEncryptedConversations : self.remoteEncryptedConversations);
+
+	if (messageState == OTRKitMessageStateEncrypted) {
+		[encryptedConversations addObject:conversationKey];
+	} else {
+		[encryptedConversations removeObject:conversationKey];
+	}
+}
+
+- (BOOL)otrKit:(OTRKit *)otrKit isUsernameLoggedIn:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+	return YES;
+}
+
+- (void)otrKit:(OTRKit *)otrKit showFingerprintConfirmationForTheirHash:(NSString *)theirHash ourHash:(NSString *)ourHash username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+
+}
+
+- (void)otrKit:(OTRKit *)otrKit fingerprintIsVerifiedStateChangedForUsername:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol verified:(BOOL)verified
+{
+
+}
+
+- (void)otrKit:(OTRKit *)otrKit handleSMPEvent:(OTRKitSMPEvent)event progress:(double)progress question:(nullable NSString *)question username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol error:(nullable NSError *)error
+{
+	[self _noteActivityOfOTRKit:otrKit];
+
+	/* Scripts don't authenticate peers */
+	if (event == OTRKitSMPEventAskForSecret || event == OTRKitSMPEventAskForAnswer) {
+		[otrKit abortSMPForUsername:username accountName:accountName protocol:protocol];
+	}
+}
+
+- (void)otrKit:(OTRKit *)otrKit handleMessageEvent:(OTRKitMessageEvent)event message:(NSString *)message username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol tag:(nullable id)tag error:(nullable NSError *)error
+{
+	[self _noteActivityOfOTRKit:otrKit];
+
+	if (error) {
+		self.counters.errorCount += 1;
+	}
+}
+
+- (void)otrKit:(OTRKit *)otrKit receivedSymmetricKey:(NSData *)symmetricKey forUse:(NSUInteger)use useData:(NSData *)useData username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol
+{
+
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,65 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKit.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef NS_ENUM(NSUInteger, OTRKitMessageResultType) {
+	/* Would have been passed to the encodedMessage: delegate method */
+	OTRKitMessageResultTypeEncoded,
+
+	/* Would have been passed to the decodedMessage: delegate method */
+	OTRKitMessageResultTypeDecoded,
+
+	/* Would have been passed to the injectMessage: delegate method */
+	OTRKitMessageResultTypeInjected
+};
+
+/**
+ *  One result in a batch passed to the didProduceMessageResults: delegate method.
+ *  The properties hold the arguments the matching delegate method would have received.
+ */
+@interface OTRKitMessageResult : NSObject
+@property (readonly) OTRKitMessageResultType type;
+@property (readonly, copy, nullable) NSString *message;
+/* Always NO for injected results */
+@property (readonly) BOOL wasEncrypted;
+@property (readonly, copy, nullable) NSArray<OTRTLV *> *tlvs;
+@property (readonly, copy) NSString *username;
+@property (readonly, copy) NSString *accountName;
+@property (readonly, copy) NSString *protocol;
+@property (readonly, strong, nullable) id tag;
+@property (readonly, strong, nullable) NSError *error;
+@end
+
+NS_ASSUME_NONNULL_END
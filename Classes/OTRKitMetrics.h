@@ -0,0 +1,153 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef NS_ENUM(NSUInteger, OTRKitMetricsCounter) {
+	OTRKitMetricsCounterMessagesEncoded,
+	OTRKitMetricsCounterMessagesDecoded,
+	OTRKitMetricsCounterEncodeErrors,
+	OTRKitMetricsCounterMessagesInjected,
+	OTRKitMetricsCounterMessageEvents,
+	OTRKitMetricsCounterMessageEventErrors,
+	OTRKitMetricsCounterConversationsSecured,
+	OTRKitMetricsCounterConversationsRefreshed,
+	OTRKitMetricsCounterSMPSucceeded,
+	OTRKitMetricsCounterSMPFailed,
+	OTRKitMetricsCounterKeysGenerated,
+	OTRKitMetricsCounterInstanceTagsGenerated,
+	OTRKitMetricsCounterFingerprintWrites,
+	OTRKitMetricsCounterBytesWritten,
+	OTRKitMetricsCounterOperationsRejected,
+	OTRKitMetricsCounterOperationsDropped,
+	OTRKitMetricsCounterOperationsCancelled,
+	OTRKitMetricsCounterContextsEvicted,
+	OTRKitMetricsCounterReplayCacheHits,
+	OTRKitMetricsCounterReplayCacheMisses,
+
+	OTRKitMetricsCounterCount
+};
+
+/**
+ *  Durations are recorded in microseconds.
+ *  OTRKitMetricsHistogramFragmentsPerMessage records the number of
+ *  messages passed to the injectMessage: delegate method for each encode.
+ */
+typedef NS_ENUM(NSUInteger, OTRKitMetricsHistogram) {
+	OTRKitMetricsHistogramQueueWait,
+	OTRKitMetricsHistogramEncode,
+	OTRKitMetricsHistogramDecode,
+	OTRKitMetricsHistogramFragmentsPerMessage,
+	OTRKitMetricsHistogramKeyGeneration,
+	OTRKitMetricsHistogramFingerprintWrite,
+	OTRKitMetricsHistogramDiskRead,
+
+	OTRKitMetricsHistogramCount
+};
+
+/**
+ *  Number of buckets in each histogram. Bucket zero holds values of zero.
+ *  Bucket N holds values from 2^(N-1) up to but not including 2^N.
+ *  The last bucket also holds anything larger.
+ */
+extern NSUInteger const OTRKitMetricsHistogramBucketCount;
+
+@interface OTRKitMetricsHistogramSnapshot : NSObject
+@property (nonatomic, assign, readonly) uint64_t count;
+@property (nonatomic, assign, readonly) uint64_t sum;
+@property (nonatomic, assign, readonly) uint64_t minimum;
+@property (nonatomic, assign, readonly) uint64_t maximum;
+@property (nonatomic, assign, readonly) double mean;
+
+/**
+ *  Number of values in each bucket.
+ */
+@property (nonatomic, copy, readonly) NSArray<NSNumber *> *buckets;
+
+/**
+ *  The upper bound of the bucket that holds the given percentile.
+ *
+ *  @param percentile	Between 0 and 100
+ */
+- (uint64_t)valueAtPercentile:(double)percentile;
+
+/**
+ *  Count, sum, minimum, maximum, mean, a few percentiles, and buckets by name.
+ */
+@property (nonatomic, copy, readonly) NSDictionary<NSString *, id> *dictionaryRepresentation;
+@end
+
+@interface OTRKitMetricsSnapshot : NSObject
+/**
+ *  Seconds between the last reset, or creation of OTRKit, and the snapshot.
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval interval;
+
+- (uint64_t)valueForCounter:(OTRKitMetricsCounter)counter;
+
+- (OTRKitMetricsHistogramSnapshot *)histogram:(OTRKitMetricsHistogram)histogram;
+
+/**
+ *  Each counter and histogram by name. Suitable for serializing to JSON.
+ */
+@property (nonatomic, copy, readonly) NSDictionary<NSString *, id> *dictionaryRepresentation;
+@end
+
+/**
+ *  Counters and latency histograms for an instance of OTRKit.
+ *
+ *  Values are updated with atomic operations and never take a lock.
+ *  A snapshot taken while OTRKit is busy may include a value in a
+ *  counter that isn't yet included in a related histogram.
+ */
+@interface OTRKitMetrics : NSObject
+/**
+ *  Copy each value as it is now.
+ */
+- (OTRKitMetricsSnapshot *)snapshot;
+
+/**
+ *  Copy each value as it is now and set it back to zero.
+ *  No value is counted twice or lost between two calls.
+ */
+- (OTRKitMetricsSnapshot *)snapshotAndReset;
+
+/**
+ *  Set each value back to zero.
+ */
+- (void)reset;
+
++ (NSString *)nameForCounter:(OTRKitMetricsCounter)counter;
++ (NSString *)nameForHistogram:(OTRKitMetricsHistogram)histogram;
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,426 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKitMetricsPrivate.h"
+
+#include <stdatomic.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+NS_ASSUME_NONNULL_BEGIN
+
+#define OTRKitMetricsBucketCount	64
+
+NSUInteger const OTRKitMetricsHistogramBucketCount = OTRKitMetricsBucketCount;
+
+typedef struct {
+	_Atomic(uint64_t) count;
+	_Atomic(uint64_t) sum;
+	_Atomic(uint64_t) minimum;
+	_Atomic(uint64_t) maximum;
+	_Atomic(uint64_t) buckets[OTRKitMetricsBucketCount];
+} OTRKitMetricsHistogramStorage;
+
+static NSString * const OTRKitMetricsCounterNames[OTRKitMetricsCounterCount] = {
+	@"messages_encoded",
+	@"messages_decoded",
+	@"encode_errors",
+	@"messages_injected",
+	@"message_events",
+	@"message_event_errors",
+	@"conversations_secured",
+	@"conversations_refreshed",
+	@"smp_succeeded",
+	@"smp_failed",
+	@"keys_generated",
+	@"instance_tags_generated",
+	@"fingerprint_writes",
+	@"bytes_written",
+	@"operations_rejected",
+	@"operations_dropped",
+	@"operations_cancelled",
+	@"contexts_evicted",
+	@"replay_cache_hits",
+	@"replay_cache_misses"
+};
+
+static NSString * const OTRKitMetricsHistogramNames[OTRKitMetricsHistogramCount] = {
+	@"queue_wait_us",
+	@"encode_us",
+	@"decode_us",
+	@"fragments_per_message",
+	@"key_generation_us",
+	@"fingerprint_write_us",
+	@"disk_read_us"
+};
+
+#pragma mark -
+#pragma mark Private Interfaces
+
+@interface OTRKitMetricsHistogramSnapshot ()
+@property (nonatomic, assign, readwrite) uint64_t count;
+@property (nonatomic, assign, readwrite) uint64_t sum;
+@property (nonatomic, assign, readwrite) uint64_t minimum;
+@property (nonatomic, assign, readwrite) uint64_t maximum;
+@property (nonatomic, copy, readwrite) NSArray<NSNumber *> *buckets;
+@end
+
+@interface OTRKitMetricsSnapshot ()
+@property (nonatomic, assign, readwrite) NSTimeInterval interval;
+@property (nonatomic, copy) NSArray<NSNumber *> *counters;
+@property (nonatomic, copy) NSArray<OTRKitMetricsHistogramSnapshot *> *histograms;
+@end
+
+#pragma mark -
+#pragma mark Histogram Snapshot
+
+@implementation OTRKitMetricsHistogramSnapshot
+
+- (double)mean
+{
+	if (self.count == 0) {
+		return 0;
+	}
+
+	return ((double)self.sum / (double)self.count);
+}
+
+- (uint64_t)valueAtPercentile:(double)percentile
+{
+	uint64_t count = self.count;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	uint64_t target = (uint64_t)ceil((double)count * (MIN(MAX(percentile, 0.0), 100.0) / 100.0));
+
+	if (target == 0) {
+		target = 1;
+	}
+
+	uint64_t runningCount = 0;
+
+	NSUInteger bucketIndex = 0;
+
+	for (NSNumber *bucket in self.buckets) {
+		runningCount += bucket.unsignedLongLongValue;
+
+		if (runningCount >= target) {
+			break;
+		}
+
+		bucketIndex += 1;
+	}
+
+	if (bucketIndex == 0) {
+		return 0;
+	}
+
+	if (bucketIndex >= (OTRKitMetricsBucketCount - 1)) {
+		return self.maximum;
+	}
+
+	return MIN((((uint64_t)1 << bucketIndex) - 1), self.maximum);
+}
+
+- (NSDictionary<NSString *, id> *)dictionaryRepresentation
+{
+	return @{
+		@"count"	: @(self.count),
+		@"sum"		: @(self.sum),
+		@"min"		: @(self.minimum),
+		@"max"		: @(self.maximum),
+		@"mean"		: @(self.mean),
+		@"p50"		: @([self valueAtPercentile:50]),
+		@"p90"		: @([self valueAtPercentile:90]),
+		@"p99"		: @([self valueAtPercentile:99]),
+		@"buckets"	: self.buckets
+	};
+}
+
+@end
+
+#pragma mark -
+#pragma mark Snapshot
+
+@implementation OTRKitMetricsSnapshot
+
+- (uint64_t)valueForCounter:(OTRKitMetricsCounter)counter
+{
+	NSParameterAssert(counter < OTRKitMetricsCounterCount);
+
+	return self.counters[counter].unsignedLongLongValue;
+}
+
+- (OTRKitMetricsHistogramSnapshot *)histogram:(OTRKitMetricsHistogram)histogram
+{
+	NSParameterAssert(histogram < OTRKitMetricsHistogramCount);
+
+	return self.histograms[histogram];
+}
+
+- (NSDictionary<NSString *, id> *)dictionaryRepresentation
+{
+	NSMutableDictionary<NSString *, NSNumber *> *counters = [NSMutableDictionary dictionaryWithCapacity:OTRKitMetricsCounterCount];
+
+	for (NSUInteger i = 0; i < OTRKitMetricsCounterCount; i++) {
+		counters[OTRKitMetricsCounterNames[i]] = self.counters[i];
+	}
+
+	NSMutableDictionary<NSString *, NSDictionary *> *histograms = [NSMutableDictionary dictionaryWithCapacity:OTRKitMetricsHistogramCount];
+
+	for (NSUInteger i = 0; i < OTRKitMetricsHistogramCount; i++) {
+		histograms[OTRKitMetricsHistogramNames[i]] = [self.histograms[i] dictionaryRepresentation];
+	}
+
+	return @{
+		@"interval_s"	: @(self.interval),
+		@"counters"		: counters,
+		@"histograms"	: histograms
+	};
+}
+
+@end
+
+#pragma mark -
+#pragma mark Metrics
+
+@implementation OTRKitMetrics
+{
+	_Atomic(uint64_t) _counters[OTRKitMetricsCounterCount];
+
+	OTRKitMetricsHistogramStorage _histograms[OTRKitMetricsHistogramCount];
+
+	_Atomic(uint64_t) _resetTime;
+}
+
+- (instancetype)init
+{
+	if ((self = [super init])) {
+		[self reset];
+
+		return self;
+	}
+
+	return nil;
+}
+
+uint64_t OTRKitMetricsNow(void)
+{
+#ifdef __APPLE__
+	static mach_timebase_info_data_t timebase;
+
+	static dispatch_once_t onceToken;
+
+	dispatch_once(&onceToken, ^{
+		mach_timebase_info(&timebase);
+	});
+
+	return ((mach_absolute_time() * timebase.numer) / timebase.denom);
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (((uint64_t)now.tv_sec * NSEC_PER_SEC) + (uint64_t)now.tv_nsec);
+#endif
+}
+
+void OTRKitMetricsAddToCounter(OTRKitMetrics * _Nullable metrics, OTRKitMetricsCounter counter, uint64_t value)
+{
+	if (metrics == nil) {
+		return;
+	}
+
+	atomic_fetch_add_explicit(&metrics->_counters[counter], value, memory_order_relaxed);
+}
+
+void OTRKitMetricsIncrementCounter(OTRKitMetrics * _Nullable metrics, OTRKitMetricsCounter counter)
+{
+	OTRKitMetricsAddToCounter(metrics, counter, 1);
+}
+
+uint64_t OTRKitMetricsCounterValue(OTRKitMetrics * _Nullable metrics, OTRKitMetricsCounter counter)
+{
+	if (metrics == nil) {
+		return 0;
+	}
+
+	return atomic_load_explicit(&metrics->_counters[counter], memory_order_relaxed);
+}
+
+void OTRKitMetricsRecordValue(OTRKitMetrics * _Nullable metrics, OTRKitMetricsHistogram histogram, uint64_t value)
+{
+	if (metrics == nil) {
+		return;
+	}
+
+	OTRKitMetricsHistogramStorage *storage = &metrics->_histograms[histogram];
+
+	NSUInteger bucketIndex = 0;
+
+	if (value > 0) {
+		bucketIndex = MIN((NSUInteger)(64 - __builtin_clzll(value)), (NSUInteger)(OTRKitMetricsBucketCount - 1));
+	}
+
+	atomic_fetch_add_explicit(&storage->buckets[bucketIndex], 1, memory_order_relaxed);
+
+	atomic_fetch_add_explicit(&storage->count, 1, memory_order_relaxed);
+
+	atomic_fetch_add_explicit(&storage->sum, value, memory_order_relaxed);
+
+	uint64_t minimum = atomic_load_explicit(&storage->minimum, memory_order_relaxed);
+
+	while (value < minimum &&
+		   atomic_compare_exchange_weak_explicit(&storage->minimum, &minimum, value, memory_order_relaxed, memory_order_relaxed) == false);
+
+	uint64_t maximum = atomic_load_explicit(&storage->maximum, memory_order_relaxed);
+
+	while (value > maximum &&
+		   atomic_compare_exchange_weak_explicit(&storage->maximum, &maximum, value, memory_order_relaxed, memory_order_relaxed) == false);
+}
+
+void OTRKitMetricsRecordDuration(OTRKitMetrics * _Nullable metrics, OTRKitMetricsHistogram histogram, uint64_t startTime)
+{
+	if (metrics == nil) {
+		return;
+	}
+
+	uint64_t currentTime = OTRKitMetricsNow();
+
+	uint64_t duration = 0;
+
+	if (currentTime > startTime) {
+		duration = ((currentTime - startTime) / NSEC_PER_USEC);
+	}
+
+	OTRKitMetricsRecordValue(metrics, histogram, duration);
+}
+
+- (OTRKitMetricsSnapshot *)snapshot
+{
+	return [self _snapshotResettingValues:NO];
+}
+
+- (OTRKitMetricsSnapshot *)snapshotAndReset
+{
+	return [self _snapshotResettingValues:YES];
+}
+
+- (void)reset
+{
+	(void)[self _snapshotResettingValues:YES];
+}
+
+/* Reads a value, or swaps it for resetValue when resetting */
+static uint64_t OTRKitMetricsTakeValue(_Atomic(uint64_t) *value, BOOL resetting, uint64_t resetValue)
+{
+	if (resetting) {
+		return atomic_exchange_explicit(value, resetValue, memory_order_relaxed);
+	} else {
+		return atomic_load_explicit(value, memory_order_relaxed);
+	}
+}
+
+- (OTRKitMetricsSnapshot *)_snapshotResettingValues:(BOOL)resetValues
+{
+	uint64_t currentTime = OTRKitMetricsNow();
+
+	OTRKitMetricsSnapshot *snapshot = [OTRKitMetricsSnapshot new];
+
+	snapshot.interval = ((double)(currentTime - OTRKitMetricsTakeValue(&self->_resetTime, resetValues, currentTime)) / NSEC_PER_SEC);
+
+	NSMutableArray<NSNumber *> *counters = [NSMutableArray arrayWithCapacity:OTRKitMetricsCounterCount];
+
+	for (NSUInteger i = 0; i < OTRKitMetricsCounterCount; i++) {
+		[counters addObject:@(OTRKitMetricsTakeValue(&self->_counters[i], resetValues, 0))];
+	}
+
+	snapshot.counters = counters;
+
+	NSMutableArray<OTRKitMetricsHistogramSnapshot *> *histograms = [NSMutableArray arrayWithCapacity:OTRKitMetricsHistogramCount];
+
+	for (NSUInteger i = 0; i < OTRKitMetricsHistogramCount; i++) {
+		OTRKitMetricsHistogramStorage *storage = &self->_histograms[i];
+
+		OTRKitMetricsHistogramSnapshot *histogram = [OTRKitMetricsHistogramSnapshot new];
+
+		histogram.count = OTRKitMetricsTakeValue(&storage->count, resetValues, 0);
+
+		histogram.sum = OTRKitMetricsTakeValue(&storage->sum, resetValues, 0);
+
+		histogram.minimum = OTRKitMetricsTakeValue(&storage->minimum, resetValues, UINT64_MAX);
+
+		histogram.maximum = OTRKitMetricsTakeValue(&storage->maximum, resetValues, 0);
+
+		if (histogram.count == 0) {
+			histogram.minimum = 0;
+		}
+
+		NSMutableArray<NSNumber *> *buckets = [NSMutableArray arrayWithCapacity:OTRKitMetricsBucketCount];
+
+		for (NSUInteger j = 0; j < OTRKitMetricsBucketCount; j++) {
+			[buckets addObject:@(OTRKitMetricsTakeValue(&storage->buckets[j], resetValues, 0))];
+		}
+
+		histogram.buckets = buckets;
+
+		[histograms addObject:histogram];
+	}
+
+	snapshot.histograms = histograms;
+
+	return snapshot;
+}
+
++ (NSString *)nameForCounter:(OTRKitMetricsCounter)counter
+{
+	NSParameterAssert(counter < OTRKitMetricsCounterCount);
+
+	return OTRKitMetricsCounterNames[counter];
+}
+
++ (NSString *)nameForHistogram:(OTRKitMetricsHistogram)histogram
+{
+	NSParameterAssert(histogram < OTRKitMetricsHistogramCount);
+
+	return OTRKitMetricsHistogramNames[histogram];
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,55 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKitMetrics.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/* These are C functions rather than methods because they are called
+ for each message on the internal queue. Each one does nothing when
+ metrics is nil. */
+
+/* Monotonic time in nanoseconds */
+extern uint64_t OTRKitMetricsNow(void);
+
+extern void OTRKitMetricsAddToCounter(OTRKitMetrics * _Nullable metrics, OTRKitMetricsCounter counter, uint64_t value);
+
+extern void OTRKitMetricsIncrementCounter(OTRKitMetrics * _Nullable metrics, OTRKitMetricsCounter counter);
+
+extern uint64_t OTRKitMetricsCounterValue(OTRKitMetrics * _Nullable metrics, OTRKitMetricsCounter counter);
+
+extern void OTRKitMetricsRecordValue(OTRKitMetrics * _Nullable metrics, OTRKitMetricsHistogram histogram, uint64_t value);
+
+/* Records the microseconds between startTime and now */
+extern void OTRKitMetricsRecordDuration(OTRKitMetrics * _Nullable metrics, OTRKitMetricsHistogram histogram, uint64_t startTime);
+
+NS_ASSUME_NONNULL_END
@@ -68,6 +68,17 @@
 
 #import "OTRKit.h"
 #import "OTRKitConcreteObjectPrivate.h"
+#import "OTRKitContextData.h"
+#import "OTRKitConversation.h"
+#import "OTRKitDataTransferManagerPrivate.h"
+#import "OTRKitFileStorage.h"
+#import "OTRKitFragmentScheduler.h"
+#import "OTRKitMessageResultPrivate.h"
+#import "OTRKitMetricsPrivate.h"
+#import "OTRKitResultBatcher.h"
+#import "OTRKitSubmissionQueue.h"
+#import "OTRKitSymmetricKeyCache.h"
+#import "OTRKitTracerPrivate.h"
 
 #import "OTRTLV.h"
 
@@ -75,17 +86,72 @@
 #import "libotr/message.h"
 #import "libotr/privkey.h"
 
+#include <pthread.h>
+
 NS_ASSUME_NONNULL_BEGIN
 
+@class OTRKitSMPReservation;
+@class OTRKitStoredFingerprint;
+
 @interface OTRKit () {
-	void *IsOnInternalQueueKey;
+	pthread_mutex_t _conversationsLock;
 }
 
 @property (nonatomic, strong) dispatch_queue_t internalQueue;
-@property (nonatomic, strong) NSTimer *pollTimer;
+@property (nonatomic, strong, nullable) dispatch_source_t pollTimer;
+@property (nonatomic, strong) dispatch_queue_t headlessDelegateQueue;
 @property (nonatomic) OtrlUserState userState;
 @property (nonatomic, strong) NSDictionary *protocolMaxSize;
+@property (nonatomic, strong) NSDictionary *accountMaxSize;
+@property (nonatomic, strong) NSDictionary *contactMaxSize;
+@property (nonatomic, assign) NSUInteger maxSizeGeneration;
+@property (nonatomic, strong) OTRKitFragmentScheduler *fragmentScheduler;
+@property (nonatomic, strong) OTRKitSubmissionQueue *submissionQueue;
+@property (nonatomic, strong) OTRKitResultBatcher *resultBatcher;
+@property (nonatomic, assign) BOOL storageWriteScheduled;
+
+/* The storage read when set up. */
+@property (nonatomic, strong, nullable) id<OTRKitStorage> loadedStorage;
+
+/* Fingerprints added, given a different trust, or removed since the last storage write.
+ Keys are "username <-> account <-> protocol <-> fingerprint". A fingerprint is only in one of them. */
+@property (nonatomic, strong) NSMutableDictionary<NSString *, OTRKitStoredFingerprint *> *fingerprintsToStore;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, OTRKitStoredFingerprint *> *fingerprintsToRemove;
+
+/* Accounts whose new private key or instance tag waits for the next storage write.
+ Keys are "account <-> protocol". Values are the account name and protocol. */
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSArray<NSString *> *> *privateKeysToStore;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSArray<NSString *> *> *instanceTagsToStore;
+
+@property (nonatomic, strong, nullable) dispatch_source_t evictionTimer;
+@property (nonatomic, strong) OTRKitSymmetricKeyCache *symmetricKeyCache;
+
+/* One conversation for each remote user, account and protocol, by username.
+ Conversations are looked up from any thread while holding _conversationsLock.
+ They are forgotten along with their context, or if they never got one, once an
+ operation for them is turned away or contexts are next evicted. */
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSMutableArray<OTRKitConversation *> *> *conversations;
+
+/* The conversation last looked up on the internal queue. Callbacks that
+ libotr only gives names to compare them with this one first. */
+@property (nonatomic, strong, nullable) OTRKitConversation *currentConversation;
+
+/* SMP steps started locally are computed on smpQueue. Accessed on the internal queue. */
+@property (nonatomic, strong) dispatch_queue_t smpQueue;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, OTRKitSMPReservation *> *smpReservations;
+@property (nonatomic, strong, readwrite) OTRKitDataTransferManager *dataTransferManager;
+@property (nonatomic, strong, readwrite) OTRKitMetrics *metrics;
+
+/* The operation being traced on the internal queue, or zero */
+@property (nonatomic, assign) uint64_t traceOperation;
 @property (nonatomic, copy, readwrite) NSString *dataPath;
+
+/* Encrypts a TLV without informing the encodedMessage: delegate method.
+ Nothing is sent unless the conversation is encrypted. */
+- (void)_sendDataTransferTLV:(OTRTLV *)tlv username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+- (void)_performAsyncOperationOnDelegateQueue:(dispatch_block_t)block;
+- (void)_performSyncOperationOnInternalQueue:(dispatch_block_t)block;
 @end
 
 NS_ASSUME_NONNULL_END
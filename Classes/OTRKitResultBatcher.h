@@ -0,0 +1,60 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+NS_ASSUME_NONNULL_BEGIN
+
+@class OTRKitMessageResult;
+
+typedef void (^OTRKitResultBatcherDeliveryBlock)(NSArray<OTRKitMessageResult *> *results);
+
+/* OTRKitResultBatcher collects results headed for the delegate so that they
+ can be delivered together. A batch is delivered once it is full, once its
+ first result has waited for the maximum delay, or when asked to flush.
+ Results are delivered in the order they were added. Every method may be
+ called on any thread. The delivery block is called on a private queue. */
+@interface OTRKitResultBatcher : NSObject
+- (instancetype)initWithDeliveryBlock:(OTRKitResultBatcherDeliveryBlock)deliveryBlock NS_DESIGNATED_INITIALIZER;
+
+@property (nonatomic, assign) NSUInteger maximumBatchSize;
+@property (nonatomic, assign) NSTimeInterval maximumDelay;
+
+- (void)addResult:(OTRKitMessageResult *)result;
+
+- (void)flush;
+
+/* Like -flush but returns once the results collected so far were handed
+ to the delivery block, and whether there were any. It must not be called
+ from the delivery block. */
+- (BOOL)flushSynchronously;
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,146 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKitResultBatcher.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface OTRKitResultBatcher ()
+@property (nonatomic, copy) OTRKitResultBatcherDeliveryBlock deliveryBlock;
+@property (nonatomic, strong) dispatch_queue_t batcherQueue;
+@property (nonatomic, strong) NSMutableArray<OTRKitMessageResult *> *results;
+
+/* Incremented for each batch so that a timer set
+ for one that was delivered early does nothing. */
+@property (nonatomic, assign) NSUInteger batchGeneration;
+@end
+
+@implementation OTRKitResultBatcher
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+- (instancetype)init
+{
+	return nil;
+}
+#pragma clang diagnostic pop
+
+- (instancetype)initWithDeliveryBlock:(OTRKitResultBatcherDeliveryBlock)deliveryBlock
+{
+	NSParameterAssert(deliveryBlock != nil);
+
+	if ((self = [super init])) {
+		self.deliveryBlock = deliveryBlock;
+
+		self.batcherQueue = dispatch_queue_create("OTRKit Result Batcher Queue", DISPATCH_QUEUE_SERIAL);
+
+		self.results = [NSMutableArray array];
+
+		self.maximumBatchSize = 64;
+
+		self.maximumDelay = 0.01;
+
+		return self;
+	}
+
+	return nil;
+}
+
+- (void)addResult:(OTRKitMessageResult *)result
+{
+	NSParameterAssert(result != nil);
+
+	dispatch_async(self.batcherQueue, ^{
+		[self.results addObject:result];
+
+		NSUInteger maximumBatchSize = self.maximumBatchSize;
+
+		if (maximumBatchSize > 0 && self.results.count >= maximumBatchSize) {
+			[self _deliverBatch];
+
+			return;
+		}
+
+		if (self.results.count > 1) {
+			return;
+		}
+
+		NSUInteger batchGeneration = self.batchGeneration;
+
+		dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.maximumDelay * NSEC_PER_SEC)), self.batcherQueue, ^{
+			if (self.batchGeneration != batchGeneration) {
+				return;
+			}
+
+			[self _deliverBatch];
+		});
+	});
+}
+
+- (void)flush
+{
+	dispatch_async(self.batcherQueue, ^{
+		[self _deliverBatch];
+	});
+}
+
+- (BOOL)flushSynchronously
+{
+	__block BOOL resultsDelivered = NO;
+
+	dispatch_sync(self.batcherQueue, ^{
+		resultsDelivered = (self.results.count > 0);
+
+		[self _deliverBatch];
+	});
+
+	return resultsDelivered;
+}
+
+- (void)_deliverBatch
+{
+	if (self.results.count == 0) {
+		return;
+	}
+
+	NSArray *results = [self.results copy];
+
+	[self.results removeAllObjects];
+
+	self.batchGeneration += 1;
+
+	self.deliveryBlock(results);
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,102 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  OTRKitStorage is where OTRKit keeps private keys, fingerprints, and
+ *  instance tags. Assign an object conforming to it to the storage property
+ *  of OTRKit before calling -setupWithDataPath: to replace the files kept
+ *  in the data path.
+ *
+ *  Everything is read once when OTRKit is set up. After that, OTRKit only
+ *  tells the storage what changed. Changes are always made between
+ *  -beginTransaction and -commitTransaction: so that a storage can write
+ *  all of them at once.
+ *
+ *  Every method is called on the internal queue of OTRKit, one at a time.
+ */
+@protocol OTRKitStorage <NSObject>
+/**
+ *  Read everything stored. Each block is called once for each record.
+ *
+ *  @param privateKeyBlock		Called with the private key of an account as the
+ *								`account` S-expression libotr writes to its private key file
+ *  @param fingerprintBlock		Called with a 20 byte fingerprint of a remote user
+ *								and its trust, or nil if it isn't trusted
+ *  @param instanceTagBlock		Called with the instance tag of an account
+ */
+- (void)loadPrivateKeys:(void (NS_NOESCAPE ^)(NSString *accountName, NSString *protocol, NSData *privateKey))privateKeyBlock
+		   fingerprints:(void (NS_NOESCAPE ^)(NSString *username, NSString *accountName, NSString *protocol, NSData *fingerprint, NSString * _Nullable trust))fingerprintBlock
+		   instanceTags:(void (NS_NOESCAPE ^)(NSString *accountName, NSString *protocol, uint32_t instanceTag))instanceTagBlock;
+
+/**
+ *  Start collecting changes.
+ */
+- (void)beginTransaction;
+
+/**
+ *  Write every change made since -beginTransaction.
+ *  If NO is returned, none of them should have been written.
+ *
+ *  @param error		Describes the problem if NO is returned
+ */
+- (BOOL)commitTransaction:(NSError **)error;
+
+/**
+ *  Add or replace the private key of an account.
+ */
+- (void)storePrivateKey:(NSData *)privateKey accountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+/**
+ *  Add a fingerprint or change its trust.
+ */
+- (void)storeFingerprint:(NSData *)fingerprint trust:(nullable NSString *)trust username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+/**
+ *  Remove a fingerprint. Does nothing if it isn't stored.
+ */
+- (void)removeFingerprint:(NSData *)fingerprint username:(NSString *)username accountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+/**
+ *  Add or replace the instance tag of an account.
+ */
+- (void)storeInstanceTag:(uint32_t)instanceTag accountName:(NSString *)accountName protocol:(NSString *)protocol;
+
+@optional
+/**
+ *  Number of bytes written so far. Added to OTRKitMetricsCounterBytesWritten.
+ */
+@property (readonly) uint64_t bytesWritten;
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,103 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKit.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+typedef void (^OTRKitSubmissionQueueScheduleBlock)(dispatch_block_t block);
+
+typedef void (^OTRKitSubmissionQueueRejectionBlock)(NSError *error);
+
+typedef BOOL (^OTRKitSubmissionQueueCancellationTest)(NSString * __nullable conversation, id __nullable tag);
+
+/* OTRKitSubmissionQueue holds operations waiting for the internal queue of
+ OTRKit so that they can be run by priority, counted, and if need be dropped.
+
+ For each operation that is submitted, the schedule block is asked to run
+ -performNextOperation on the internal queue. That runs the operation that
+ has waited longest in the most urgent lane that isn't empty. An operation
+ that was dropped leaves one extra call behind which does nothing.
+
+ Operations of a conversation always share one lane so that they run in the
+ order they were submitted. When a more urgent operation is submitted for a
+ conversation, those waiting ahead of it move up to its lane. Operations that
+ belong to no conversation, such as fingerprint writes, are neither limited
+ nor dropped.
+
+ An operation that has waited longer than a second in a less urgent lane is
+ run next so that bulk and background work is never starved.
+
+ Handshake operations wait in a lane of their own, together with whatever
+ their conversation submits after them, and get a limited share of the
+ internal queue while other operations are waiting. */
+@interface OTRKitSubmissionQueue : NSObject
+- (instancetype)initWithScheduleBlock:(OTRKitSubmissionQueueScheduleBlock)scheduleBlock NS_DESIGNATED_INITIALIZER;
+
+/* Zero means no limit */
+@property (nonatomic, assign) OTRKitAdmissionPolicy policy;
+@property (nonatomic, assign) NSUInteger maximumDepth;
+@property (nonatomic, assign) NSUInteger maximumDepthPerConversation;
+
+/* Number of other operations run between two handshake operations
+ while both are waiting. Zero puts handshakes in the ordinary lanes. */
+@property (nonatomic, assign) NSUInteger operationsPerHandshake;
+
+@property (readonly) NSUInteger depth;
+- (NSUInteger)depthForConversation:(NSString *)conversation;
+- (NSUInteger)depthForPriority:(OTRKitPriority)priority;
+
+/* The rejection block of an operation is called, at most once, on the thread
+ that submitted whichever operation caused it to be turned away or dropped. */
+- (void)submitOperation:(dispatch_block_t)operation
+		forConversation:(nullable NSString *)conversation
+			   priority:(OTRKitPriority)priority
+			  handshake:(BOOL)handshake
+					tag:(nullable id)tag
+		 rejectionBlock:(nullable OTRKitSubmissionQueueRejectionBlock)rejectionBlock;
+
+/* Removes the operations still waiting that pass the test and calls their
+ rejection blocks with OTRKitErrorCodeOperationCancelled on this thread.
+ Returns the number of operations that were removed. */
+- (NSUInteger)cancelOperationsPassingTest:(OTRKitSubmissionQueueCancellationTest)test;
+
+/* Operations of a suspended conversation are passed over, and keep their
+ place, until it is resumed. Calls are not counted: one resume undoes any
+ number of suspends. */
+- (void)suspendConversation:(NSString *)conversation;
+- (void)resumeConversation:(NSString *)conversation;
+
+/* Must be called on the internal queue */
+- (void)performNextOperation;
+@end
+
+NS_ASSUME_NONNULL_END
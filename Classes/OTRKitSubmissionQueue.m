@@ -0,0 +1,595 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKitSubmissionQueue.h"
+
+NS_ASSUME_NONNULL_BEGIN
+
+/* One lane for each OTRKitPriority followed by the handshake lane */
+#define OTRKitSubmissionQueuePriorityLaneCount		3
+#define OTRKitSubmissionQueueHandshakeLane			3
+#define OTRKitSubmissionQueueLaneCount				4
+
+static NSTimeInterval const kOTRKitSubmissionQueueStarvationInterval = 1.0;
+
+@interface OTRKitSubmissionQueueOperation : NSObject
+@property (nonatomic, copy, nullable) NSString *conversation;
+@property (nonatomic, copy) dispatch_block_t block;
+@property (nonatomic, strong, nullable) id tag;
+@property (nonatomic, copy, nullable) OTRKitSubmissionQueueRejectionBlock rejectionBlock;
+@property (nonatomic, assign) NSTimeInterval submitTime;
+@end
+
+@interface OTRKitSubmissionQueue ()
+@property (nonatomic, copy) OTRKitSubmissionQueueScheduleBlock scheduleBlock;
+@property (nonatomic, strong) NSCondition *condition;
+@property (nonatomic, copy) NSArray<NSMutableArray<OTRKitSubmissionQueueOperation *> *> *lanes;
+@property (nonatomic, assign) NSUInteger operationCount;
+@property (nonatomic, strong) NSCountedSet<NSString *> *conversationDepths;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSNumber *> *conversationLanes;
+@property (nonatomic, strong) NSMutableSet<NSString *> *suspendedConversations;
+@property (nonatomic, assign) NSUInteger operationsSinceHandshake;
+@end
+
+@implementation OTRKitSubmissionQueueOperation
+@end
+
+@implementation OTRKitSubmissionQueue
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+- (instancetype)init
+{
+	return nil;
+}
+#pragma clang diagnostic pop
+
+- (instancetype)initWithScheduleBlock:(OTRKitSubmissionQueueScheduleBlock)scheduleBlock
+{
+	NSParameterAssert(scheduleBlock != nil);
+
+	if ((self = [super init])) {
+		self.scheduleBlock = scheduleBlock;
+
+		self.condition = [NSCondition new];
+
+		NSMutableArray *lanes = [NSMutableArray arrayWithCapacity:OTRKitSubmissionQueueLaneCount];
+
+		for (NSUInteger i = 0; i < OTRKitSubmissionQueueLaneCount; i++) {
+			[lanes addObject:[NSMutableArray array]];
+		}
+
+		self.lanes = lanes;
+
+		self.conversationDepths = [NSCountedSet set];
+
+		self.conversationLanes = [NSMutableDictionary dictionary];
+
+		self.suspendedConversations = [NSMutableSet set];
+
+		return self;
+	}
+
+	return nil;
+}
+
+#pragma mark -
+#pragma mark Configuration
+
+/* Limits are read with the condition locked. Changing them
+ wakes anyone who is blocked so they can check again. */
+
+- (void)setPolicy:(OTRKitAdmissionPolicy)policy
+{
+	[self.condition lock];
+
+	self->_policy = policy;
+
+	[self.condition broadcast];
+
+	[self.condition unlock];
+}
+
+- (void)setMaximumDepth:(NSUInteger)maximumDepth
+{
+	[self.condition lock];
+
+	self->_maximumDepth = maximumDepth;
+
+	[self.condition broadcast];
+
+	[self.condition unlock];
+}
+
+- (void)setMaximumDepthPerConversation:(NSUInteger)maximumDepthPerConversation
+{
+	[self.condition lock];
+
+	self->_maximumDepthPerConversation = maximumDepthPerConversation;
+
+	[self.condition broadcast];
+
+	[self.condition unlock];
+}
+
+- (void)setOperationsPerHandshake:(NSUInteger)operationsPerHandshake
+{
+	[self.condition lock];
+
+	self->_operationsPerHandshake = operationsPerHandshake;
+
+	[self.condition unlock];
+}
+
+- (NSUInteger)operationsPerHandshake
+{
+	[self.condition lock];
+
+	NSUInteger operationsPerHandshake = self->_operationsPerHandshake;
+
+	[self.condition unlock];
+
+	return operationsPerHandshake;
+}
+
+- (NSUInteger)depth
+{
+	[self.condition lock];
+
+	NSUInteger depth = self.operationCount;
+
+	[self.condition unlock];
+
+	return depth;
+}
+
+- (NSUInteger)depthForConversation:(NSString *)conversation
+{
+	NSParameterAssert(conversation != nil);
+
+	[self.condition lock];
+
+	NSUInteger depth = [self.conversationDepths countForObject:conversation];
+
+	[self.condition unlock];
+
+	return depth;
+}
+
+- (NSUInteger)depthForPriority:(OTRKitPriority)priority
+{
+	NSParameterAssert(priority < OTRKitSubmissionQueuePriorityLaneCount);
+
+	[self.condition lock];
+
+	NSUInteger depth = self.lanes[priority].count;
+
+	[self.condition unlock];
+
+	return depth;
+}
+
+#pragma mark -
+#pragma mark Submission
+
+/* Called with the condition locked */
+- (BOOL)_isFullForConversation:(NSString *)conversation conversationIsFull:(BOOL *)conversationIsFull
+{
+	BOOL conversationFull = (self->_maximumDepthPerConversation > 0 &&
+							 [self.conversationDepths countForObject:conversation] >= self->_maximumDepthPerConversation);
+
+	BOOL globalFull = (self->_maximumDepth > 0 &&
+					   self.operationCount >= self->_maximumDepth);
+
+	if (conversationIsFull) {
+		*conversationIsFull = conversationFull;
+	}
+
+	return (conversationFull || globalFull);
+}
+
+/* Called with the condition locked. Returns the operation that should make
+ room: the oldest of the conversation when it is full, otherwise the oldest
+ in the least urgent lane that has an operation which may be dropped. */
+- (nullable OTRKitSubmissionQueueOperation *)_operationToDropForConversation:(NSString *)conversation conversationIsFull:(BOOL)conversationIsFull
+{
+	if (conversationIsFull) {
+		NSNumber *laneIndex = self.conversationLanes[conversation];
+
+		for (OTRKitSubmissionQueueOperation *operation in self.lanes[laneIndex.unsignedIntegerValue]) {
+			if ([operation.conversation isEqualToString:conversation]) {
+				return operation;
+			}
+		}
+
+		return nil;
+	}
+
+	/* Handshakes are dropped after bulk and background work but before interactive */
+	static NSUInteger const laneOrder[OTRKitSubmissionQueueLaneCount] = {
+		OTRKitPriorityBackground,
+		OTRKitPriorityBulk,
+		OTRKitSubmissionQueueHandshakeLane,
+		OTRKitPriorityInteractive
+	};
+
+	for (NSUInteger i = 0; i < OTRKitSubmissionQueueLaneCount; i++) {
+		for (OTRKitSubmissionQueueOperation *operation in self.lanes[laneOrder[i]]) {
+			if (operation.conversation) {
+				return operation;
+			}
+		}
+	}
+
+	return nil;
+}
+
+/* Called with the condition locked */
+- (void)_removeOperation:(OTRKitSubmissionQueueOperation *)operation fromLane:(NSMutableArray<OTRKitSubmissionQueueOperation *> *)lane
+{
+	NSString *conversation = operation.conversation;
+
+	if (conversation) {
+		[self.conversationDepths removeObject:conversation];
+
+		if ([self.conversationDepths countForObject:conversation] == 0) {
+			[self.conversationLanes removeObjectForKey:conversation];
+		}
+	}
+
+	[lane removeObjectIdenticalTo:operation];
+
+	self.operationCount -= 1;
+
+	[self.condition broadcast];
+}
+
+/* Called with the condition locked. Moves the operations of a conversation
+ to a more urgent lane, or to the handshake lane, keeping them in order, and
+ returns the lane to use. A conversation stays in the handshake lane until
+ it has nothing left waiting. */
+- (NSUInteger)_laneForConversation:(nullable NSString *)conversation priority:(OTRKitPriority)priority handshake:(BOOL)handshake
+{
+	NSUInteger targetLaneIndex = priority;
+
+	if (handshake && self->_operationsPerHandshake > 0) {
+		targetLaneIndex = OTRKitSubmissionQueueHandshakeLane;
+	}
+
+	if (conversation == nil) {
+		return targetLaneIndex;
+	}
+
+	NSNumber *currentLaneIndex = self.conversationLanes[conversation];
+
+	if (currentLaneIndex == nil) {
+		return targetLaneIndex;
+	}
+
+	NSUInteger laneIndex = currentLaneIndex.unsignedIntegerValue;
+
+	if (laneIndex == targetLaneIndex || laneIndex == OTRKitSubmissionQueueHandshakeLane) {
+		return laneIndex;
+	}
+
+	if (targetLaneIndex != OTRKitSubmissionQueueHandshakeLane && laneIndex <= targetLaneIndex) {
+		return laneIndex;
+	}
+
+	NSMutableArray<OTRKitSubmissionQueueOperation *> *currentLane = self.lanes[laneIndex];
+
+	NSIndexSet *indexes = [currentLane indexesOfObjectsPassingTest:^BOOL(OTRKitSubmissionQueueOperation *object, NSUInteger index, BOOL *stop) {
+		return [object.conversation isEqualToString:conversation];
+	}];
+
+	[self.lanes[targetLaneIndex] addObjectsFromArray:[currentLane objectsAtIndexes:indexes]];
+
+	[currentLane removeObjectsAtIndexes:indexes];
+
+	return targetLaneIndex;
+}
+
+- (void)submitOperation:(dispatch_block_t)operation
+		forConversation:(nullable NSString *)conversation
+			   priority:(OTRKitPriority)priority
+			  handshake:(BOOL)handshake
+					tag:(nullable id)tag
+		 rejectionBlock:(nullable OTRKitSubmissionQueueRejectionBlock)rejectionBlock
+{
+	NSParameterAssert(operation != nil);
+	NSParameterAssert(priority < OTRKitSubmissionQueuePriorityLaneCount);
+
+	OTRKitSubmissionQueueOperation *droppedOperation = nil;
+
+	[self.condition lock];
+
+	BOOL conversationIsFull = NO;
+
+	if (conversation && [self _isFullForConversation:conversation conversationIsFull:&conversationIsFull]) {
+		switch (self->_policy) {
+			case OTRKitAdmissionPolicyUnbounded:
+			{
+				break;
+			}
+			case OTRKitAdmissionPolicyBlock:
+			{
+				while (self->_policy == OTRKitAdmissionPolicyBlock &&
+					   [self _isFullForConversation:conversation conversationIsFull:NULL])
+				{
+					[self.condition wait];
+				}
+
+				break;
+			}
+			case OTRKitAdmissionPolicyFailFast:
+			{
+				[self.condition unlock];
+
+				if (rejectionBlock) {
+					rejectionBlock([NSError errorWithDomain:OTRKitErrorDomain
+													   code:OTRKitErrorCodeOperationRejected
+												   userInfo:@{NSLocalizedDescriptionKey : @"Too many operations are waiting"}]);
+				}
+
+				return;
+			}
+			case OTRKitAdmissionPolicyDropOldest:
+			{
+				droppedOperation = [self _operationToDropForConversation:conversation conversationIsFull:conversationIsFull];
+
+				if (droppedOperation) {
+					NSUInteger droppedLaneIndex = self.conversationLanes[droppedOperation.conversation].unsignedIntegerValue;
+
+					[self _removeOperation:droppedOperation fromLane:self.lanes[droppedLaneIndex]];
+				}
+
+				break;
+			}
+		}
+	}
+
+	OTRKitSubmissionQueueOperation *object = [OTRKitSubmissionQueueOperation new];
+
+	object.conversation = conversation;
+
+	object.block = operation;
+
+	object.tag = tag;
+
+	object.rejectionBlock = rejectionBlock;
+
+	object.submitTime = [NSDate timeIntervalSinceReferenceDate];
+
+	NSUInteger laneIndex = [self _laneForConversation:conversation priority:priority handshake:handshake];
+
+	[self.lanes[laneIndex] addObject:object];
+
+	self.operationCount += 1;
+
+	if (conversation) {
+		[self.conversationDepths addObject:conversation];
+
+		self.conversationLanes[conversation] = @(laneIndex);
+	}
+
+	[self.condition unlock];
+
+	if (droppedOperation.rejectionBlock) {
+		droppedOperation.rejectionBlock([NSError errorWithDomain:OTRKitErrorDomain
+															code:OTRKitErrorCodeOperationDropped
+														userInfo:@{NSLocalizedDescriptionKey : @"Dropped to make room for a newer operation"}]);
+	}
+
+	self.scheduleBlock(^{
+		[self performNextOperation];
+	});
+}
+
+- (NSUInteger)cancelOperationsPassingTest:(OTRKitSubmissionQueueCancellationTest)test
+{
+	NSParameterAssert(test != nil);
+
+	NSMutableArray<OTRKitSubmissionQueueOperation *> *cancelledOperations = [NSMutableArray array];
+
+	[self.condition lock];
+
+	for (NSMutableArray<OTRKitSubmissionQueueOperation *> *lane in self.lanes) {
+		for (OTRKitSubmissionQueueOperation *operation in lane.copy) {
+			if (test(operation.conversation, operation.tag) == NO) {
+				continue;
+			}
+
+			[self _removeOperation:operation fromLane:lane];
+
+			[cancelledOperations addObject:operation];
+		}
+	}
+
+	[self.condition unlock];
+
+	/* The calls to -performNextOperation scheduled for these
+	 operations will run whatever is next, or do nothing. */
+	if (cancelledOperations.count == 0) {
+		return 0;
+	}
+
+	NSError *error = [NSError errorWithDomain:OTRKitErrorDomain
+										 code:OTRKitErrorCodeOperationCancelled
+									 userInfo:@{NSLocalizedDescriptionKey : @"The operation was cancelled"}];
+
+	for (OTRKitSubmissionQueueOperation *operation in cancelledOperations) {
+		if (operation.rejectionBlock) {
+			operation.rejectionBlock(error);
+		}
+	}
+
+	return cancelledOperations.count;
+}
+
+#pragma mark -
+#pragma mark Suspension
+
+- (void)suspendConversation:(NSString *)conversation
+{
+	NSParameterAssert(conversation != nil);
+
+	[self.condition lock];
+
+	[self.suspendedConversations addObject:conversation];
+
+	[self.condition unlock];
+}
+
+- (void)resumeConversation:(NSString *)conversation
+{
+	NSParameterAssert(conversation != nil);
+
+	[self.condition lock];
+
+	[self.suspendedConversations removeObject:conversation];
+
+	/* The calls scheduled for these operations while the conversation was
+	 suspended found nothing to run. Make up for them. */
+	NSUInteger depth = [self.conversationDepths countForObject:conversation];
+
+	[self.condition unlock];
+
+	for (NSUInteger i = 0; i < depth; i++) {
+		self.scheduleBlock(^{
+			[self performNextOperation];
+		});
+	}
+}
+
+#pragma mark -
+#pragma mark Execution
+
+/* Called with the condition locked */
+- (nullable OTRKitSubmissionQueueOperation *)_firstOperationInLane:(NSMutableArray<OTRKitSubmissionQueueOperation *> *)lane
+{
+	if (self.suspendedConversations.count == 0) {
+		return lane.firstObject;
+	}
+
+	for (OTRKitSubmissionQueueOperation *operation in lane) {
+		if (operation.conversation == nil ||
+			[self.suspendedConversations containsObject:operation.conversation] == NO)
+		{
+			return operation;
+		}
+	}
+
+	return nil;
+}
+
+/* Called with the condition locked */
+- (nullable OTRKitSubmissionQueueOperation *)_nextOperationInPriorityLane:(NSMutableArray<OTRKitSubmissionQueueOperation *> * _Nullable * _Nonnull)laneOut
+{
+	NSTimeInterval currentTime = [NSDate timeIntervalSinceReferenceDate];
+
+	/* Least urgent first so that the longest starved lane wins */
+	for (NSUInteger laneIndex = (OTRKitSubmissionQueuePriorityLaneCount - 1); laneIndex > 0; laneIndex--) {
+		OTRKitSubmissionQueueOperation *operation = [self _firstOperationInLane:self.lanes[laneIndex]];
+
+		if (operation && (currentTime - operation.submitTime) >= kOTRKitSubmissionQueueStarvationInterval) {
+			*laneOut = self.lanes[laneIndex];
+
+			return operation;
+		}
+	}
+
+	for (NSUInteger laneIndex = 0; laneIndex < OTRKitSubmissionQueuePriorityLaneCount; laneIndex++) {
+		OTRKitSubmissionQueueOperation *operation = [self _firstOperationInLane:self.lanes[laneIndex]];
+
+		if (operation) {
+			*laneOut = self.lanes[laneIndex];
+
+			return operation;
+		}
+	}
+
+	return nil;
+}
+
+/* Called with the condition locked */
+- (nullable OTRKitSubmissionQueueOperation *)_nextOperationInLane:(NSMutableArray<OTRKitSubmissionQueueOperation *> * _Nullable * _Nonnull)laneOut
+{
+	NSMutableArray<OTRKitSubmissionQueueOperation *> *handshakeLane = self.lanes[OTRKitSubmissionQueueHandshakeLane];
+
+	OTRKitSubmissionQueueOperation *handshakeOperation = [self _firstOperationInLane:handshakeLane];
+
+	OTRKitSubmissionQueueOperation *operation = [self _nextOperationInPriorityLane:laneOut];
+
+	if (handshakeOperation == nil) {
+		return operation;
+	}
+
+	/* Not subject to the starvation rule. During a storm of handshakes
+	 every one of them is old and the share alone guarantees progress. */
+	BOOL handshakeIsDue = (operation == nil ||
+						   self.operationsSinceHandshake >= self->_operationsPerHandshake);
+
+	if (handshakeIsDue == NO) {
+		self.operationsSinceHandshake += 1;
+
+		return operation;
+	}
+
+	self.operationsSinceHandshake = 0;
+
+	*laneOut = handshakeLane;
+
+	return handshakeOperation;
+}
+
+- (void)performNextOperation
+{
+	[self.condition lock];
+
+	NSMutableArray<OTRKitSubmissionQueueOperation *> *lane = nil;
+
+	OTRKitSubmissionQueueOperation *operation = [self _nextOperationInLane:&lane];
+
+	if (operation) {
+		[self _removeOperation:operation fromLane:lane];
+	}
+
+	[self.condition unlock];
+
+	if (operation) {
+		operation.block();
+	}
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,64 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+NS_ASSUME_NONNULL_BEGIN
+
+/* Identifies the session keys an extra symmetric key was derived from */
+typedef struct {
+	uint32_t theirInstanceTag;
+	uint32_t ourKeyID;
+	uint32_t theirKeyID;
+} OTRKitSymmetricKeySession;
+
+/* OTRKitSymmetricKeyCache keeps the extra symmetric keys handed out for each
+ conversation. libotr derives the same key for every use until the session
+ keys change, but the remote user only learns of a use and its use data when
+ it's first requested. A key is therefore only served for uses that were
+ requested before under the same session keys.
+ Keys are wiped from memory when removed. Every method may be called on any thread. */
+@interface OTRKitSymmetricKeyCache : NSObject
+- (nullable NSData *)keyForConversation:(NSString *)conversation use:(NSUInteger)use useData:(NSData *)useData;
+
+/* Keys for a different session of the conversation are removed first */
+- (void)setKey:(NSData *)key forConversation:(NSString *)conversation session:(OTRKitSymmetricKeySession)session use:(NSUInteger)use useData:(NSData *)useData;
+
+/* Removes the keys of the conversation if they were derived for the same
+ instance as session under different session keys. Keys for another
+ instance are left alone because nothing is known about it. */
+- (void)removeKeysForConversation:(NSString *)conversation unlessDerivedForSession:(OTRKitSymmetricKeySession)session;
+
+- (void)removeKeysForConversation:(NSString *)conversation;
+
+- (void)removeAllKeys;
+@end
+
+NS_ASSUME_NONNULL_END
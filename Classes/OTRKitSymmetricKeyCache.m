@@ -0,0 +1,195 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKitSymmetricKeyCache.h"
+
+#include <pthread.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+@interface OTRKitSymmetricKeyCacheEntry : NSObject
+@property (nonatomic, assign) OTRKitSymmetricKeySession session;
+@property (nonatomic, strong) NSMutableData *key;
+
+/* The use followed by the use data of each use requested */
+@property (nonatomic, strong) NSMutableSet<NSData *> *uses;
+@end
+
+@implementation OTRKitSymmetricKeyCacheEntry
+
+- (void)dealloc
+{
+	[self.key resetBytesInRange:NSMakeRange(0, self.key.length)];
+}
+
+@end
+
+@interface OTRKitSymmetricKeyCache ()
+{
+	pthread_mutex_t _lock;
+}
+
+@property (nonatomic, strong) NSMutableDictionary<NSString *, OTRKitSymmetricKeyCacheEntry *> *entries;
+@end
+
+@implementation OTRKitSymmetricKeyCache
+
+- (instancetype)init
+{
+	if ((self = [super init])) {
+		pthread_mutex_init(&self->_lock, NULL);
+
+		self.entries = [NSMutableDictionary dictionary];
+
+		return self;
+	}
+
+	return nil;
+}
+
+- (void)dealloc
+{
+	pthread_mutex_destroy(&self->_lock);
+}
+
+- (nullable NSData *)keyForConversation:(NSString *)conversation use:(NSUInteger)use useData:(NSData *)useData
+{
+	NSParameterAssert(conversation != nil);
+	NSParameterAssert(useData != nil);
+
+	NSData *useKey = [self _keyForUse:use useData:useData];
+
+	NSData *key = nil;
+
+	pthread_mutex_lock(&self->_lock);
+
+	OTRKitSymmetricKeyCacheEntry *entry = self.entries[conversation];
+
+	if ([entry.uses containsObject:useKey]) {
+		key = [entry.key copy];
+	}
+
+	pthread_mutex_unlock(&self->_lock);
+
+	return key;
+}
+
+- (void)setKey:(NSData *)key forConversation:(NSString *)conversation session:(OTRKitSymmetricKeySession)session use:(NSUInteger)use useData:(NSData *)useData
+{
+	NSParameterAssert(key != nil);
+	NSParameterAssert(conversation != nil);
+	NSParameterAssert(useData != nil);
+
+	NSData *useKey = [self _keyForUse:use useData:useData];
+
+	pthread_mutex_lock(&self->_lock);
+
+	OTRKitSymmetricKeyCacheEntry *entry = self.entries[conversation];
+
+	if (entry == nil || [self _session:entry.session isEqualToSession:session] == NO) {
+		entry = [OTRKitSymmetricKeyCacheEntry new];
+
+		entry.session = session;
+
+		entry.key = [key mutableCopy];
+
+		entry.uses = [NSMutableSet set];
+
+		self.entries[conversation] = entry;
+	}
+
+	[entry.uses addObject:useKey];
+
+	pthread_mutex_unlock(&self->_lock);
+}
+
+- (void)removeKeysForConversation:(NSString *)conversation unlessDerivedForSession:(OTRKitSymmetricKeySession)session
+{
+	NSParameterAssert(conversation != nil);
+
+	pthread_mutex_lock(&self->_lock);
+
+	OTRKitSymmetricKeyCacheEntry *entry = self.entries[conversation];
+
+	if (entry &&
+		entry.session.theirInstanceTag == session.theirInstanceTag &&
+		[self _session:entry.session isEqualToSession:session] == NO)
+	{
+		[self.entries removeObjectForKey:conversation];
+	}
+
+	pthread_mutex_unlock(&self->_lock);
+}
+
+- (void)removeKeysForConversation:(NSString *)conversation
+{
+	NSParameterAssert(conversation != nil);
+
+	pthread_mutex_lock(&self->_lock);
+
+	[self.entries removeObjectForKey:conversation];
+
+	pthread_mutex_unlock(&self->_lock);
+}
+
+- (void)removeAllKeys
+{
+	pthread_mutex_lock(&self->_lock);
+
+	[self.entries removeAllObjects];
+
+	pthread_mutex_unlock(&self->_lock);
+}
+
+- (BOOL)_session:(OTRKitSymmetricKeySession)session isEqualToSession:(OTRKitSymmetricKeySession)otherSession
+{
+	return (session.theirInstanceTag == otherSession.theirInstanceTag &&
+			session.ourKeyID == otherSession.ourKeyID &&
+			session.theirKeyID == otherSession.theirKeyID);
+}
+
+- (NSData *)_keyForUse:(NSUInteger)use useData:(NSData *)useData
+{
+	NSParameterAssert(useData != nil);
+
+	uint64_t useValue = (uint64_t)use;
+
+	NSMutableData *useKey = [NSMutableData dataWithBytes:&useValue length:sizeof(useValue)];
+
+	[useKey appendData:useData];
+
+	return useKey;
+}
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,83 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ *  OTRKitTracer records what happens to each message between the call to
+ *  -encodeMessage:... or -decodeMessage:... and the delegate method it ends
+ *  in. Each operation is given an identifier. Spans are recorded for time
+ *  spent waiting for the internal queue, time spent in libotr, each injected
+ *  fragment, and delivery to the delegate. Spans carry the identifier and a
+ *  description of the tag given by the caller.
+ *
+ *  Spans are kept in a ring buffer shared by every instance of OTRKit.
+ *  Once it is full the oldest spans are overwritten.
+ *
+ *  Tracing is disabled by default. While disabled, each trace point is a
+ *  single branch.
+ */
+@interface OTRKitTracer : NSObject
+/**
+ *  Operations that start while enabled are traced until they finish.
+ */
++ (BOOL)isEnabled;
++ (void)setEnabled:(BOOL)enabled;
+
+/**
+ *  Number of spans the ring buffer holds. Defaults to 16384.
+ *  Changing it discards the spans recorded so far.
+ */
++ (NSUInteger)capacity;
++ (void)setCapacity:(NSUInteger)capacity;
+
+/**
+ *  Discard the spans recorded so far.
+ */
++ (void)clear;
+
+/**
+ *  The spans recorded so far in the Chrome trace event format. Open it
+ *  with chrome://tracing or ui.perfetto.dev. Time is relative to boot.
+ */
++ (NSData *)chromeTraceData;
+
+/**
+ *  Write -chromeTraceData to a file.
+ *
+ *  @param path		Path to write to. Replaced if it exists.
+ *  @param error	Describes the problem if NO is returned
+ */
++ (BOOL)writeChromeTraceToPath:(NSString *)path error:(NSError **)error;
+@end
+
+NS_ASSUME_NONNULL_END
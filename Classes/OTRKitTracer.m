@@ -0,0 +1,266 @@
+/* *********************************************************************
+ *
+ *        Copyright (c) 2015 - 2018 Codeux Software, LLC
+ *     Please see ACKNOWLEDGEMENT for additional information.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of "Codeux Software, LLC", nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *********************************************************************** */
+
+#import "OTRKitMetricsPrivate.h"
+#import "OTRKitTracerPrivate.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+NS_ASSUME_NONNULL_BEGIN
+
+#define OTRKitTraceTagLength	48
+
+static NSUInteger const kOTRKitTracerDefaultCapacity = 16384;
+
+typedef struct {
+	const char *name;
+	uint64_t operation;
+	uint64_t startTime;
+	uint64_t endTime;
+	uint64_t threadIdentifier;
+	char tag[OTRKitTraceTagLength];
+} OTRKitTraceSpan;
+
+BOOL OTRKitTracingEnabled = NO;
+
+static _Atomic(uint64_t) OTRKitTraceLastOperation = 0;
+
+/* The ring buffer. Guarded by OTRKitTraceLock. */
+static pthread_mutex_t OTRKitTraceLock = PTHREAD_MUTEX_INITIALIZER;
+
+static OTRKitTraceSpan *OTRKitTraceSpans = NULL;
+
+static NSUInteger OTRKitTraceCapacity = kOTRKitTracerDefaultCapacity;
+
+static NSUInteger OTRKitTraceNextIndex = 0;
+
+static NSUInteger OTRKitTraceCount = 0;
+
+static uint64_t OTRKitTraceThreadIdentifier(void)
+{
+#ifdef __APPLE__
+	uint64_t threadIdentifier = 0;
+
+	pthread_threadid_np(NULL, &threadIdentifier);
+
+	return threadIdentifier;
+#else
+	return (uint64_t)(uintptr_t)pthread_self();
+#endif
+}
+
+uint64_t OTRKitTraceNewOperation(void)
+{
+	return (atomic_fetch_add_explicit(&OTRKitTraceLastOperation, 1, memory_order_relaxed) + 1);
+}
+
+void OTRKitTraceRecordSpan(const char *name, uint64_t operation, uint64_t startTime, uint64_t endTime, id _Nullable tag)
+{
+	NSCParameterAssert(name != NULL);
+
+	OTRKitTraceSpan span;
+
+	span.name = name;
+	span.operation = operation;
+	span.startTime = startTime;
+	span.endTime = endTime;
+	span.threadIdentifier = OTRKitTraceThreadIdentifier();
+
+	span.tag[0] = '\0';
+
+	/* Described outside the lock because -description may be slow */
+	if (tag) {
+		snprintf(span.tag, sizeof(span.tag), "%s", (([tag description].UTF8String) ?: ""));
+	}
+
+	pthread_mutex_lock(&OTRKitTraceLock);
+
+	if (OTRKitTraceSpans == NULL) {
+		OTRKitTraceSpans = calloc(OTRKitTraceCapacity, sizeof(OTRKitTraceSpan));
+	}
+
+	if (OTRKitTraceSpans) {
+		OTRKitTraceSpans[OTRKitTraceNextIndex] = span;
+
+		OTRKitTraceNextIndex = ((OTRKitTraceNextIndex + 1) % OTRKitTraceCapacity);
+
+		if (OTRKitTraceCount < OTRKitTraceCapacity) {
+			OTRKitTraceCount += 1;
+		}
+	}
+
+	pthread_mutex_unlock(&OTRKitTraceLock);
+}
+
+@implementation OTRKitTracer
+
++ (BOOL)isEnabled
+{
+	return OTRKitTracingEnabled;
+}
+
++ (void)setEnabled:(BOOL)enabled
+{
+	OTRKitTracingEnabled = enabled;
+}
+
++ (NSUInteger)capacity
+{
+	pthread_mutex_lock(&OTRKitTraceLock);
+
+	NSUInteger capacity = OTRKitTraceCapacity;
+
+	pthread_mutex_unlock(&OTRKitTraceLock);
+
+	return capacity;
+}
+
++ (void)setCapacity:(NSUInteger)capacity
+{
+	NSParameterAssert(capacity > 0);
+
+	pthread_mutex_lock(&OTRKitTraceLock);
+
+	free(OTRKitTraceSpans);
+
+	/* Allocated again by the next span */
+	OTRKitTraceSpans = NULL;
+
+	OTRKitTraceCapacity = capacity;
+
+	OTRKitTraceNextIndex = 0;
+
+	OTRKitTraceCount = 0;
+
+	pthread_mutex_unlock(&OTRKitTraceLock);
+}
+
++ (void)clear
+{
+	pthread_mutex_lock(&OTRKitTraceLock);
+
+	OTRKitTraceNextIndex = 0;
+
+	OTRKitTraceCount = 0;
+
+	pthread_mutex_unlock(&OTRKitTraceLock);
+}
+
++ (NSData *)chromeTraceData
+{
+	/* Copy the spans out so that the lock isn't held while formatting */
+	pthread_mutex_lock(&OTRKitTraceLock);
+
+	NSUInteger count = OTRKitTraceCount;
+
+	OTRKitTraceSpan *spans = NULL;
+
+	if (count > 0) {
+		spans = malloc(count * sizeof(OTRKitTraceSpan));
+	}
+
+	if (spans) {
+		/* Oldest first */
+		NSUInteger firstIndex = (((OTRKitTraceNextIndex + OTRKitTraceCapacity) - count) % OTRKitTraceCapacity);
+
+		for (NSUInteger i = 0; i < count; i++) {
+			spans[i] = OTRKitTraceSpans[((firstIndex + i) % OTRKitTraceCapacity)];
+		}
+	} else {
+		count = 0;
+	}
+
+	pthread_mutex_unlock(&OTRKitTraceLock);
+
+	NSMutableArray<NSDictionary *> *events = [NSMutableArray arrayWithCapacity:count];
+
+	NSNumber *processIdentifier = @(getpid());
+
+	for (NSUInteger i = 0; i < count; i++) {
+		OTRKitTraceSpan *span = &spans[i];
+
+		uint64_t duration = 0;
+
+		if (span->endTime > span->startTime) {
+			duration = (span->endTime - span->startTime);
+		}
+
+		NSMutableDictionary<NSString *, id> *arguments = [NSMutableDictionary dictionaryWithCapacity:2];
+
+		arguments[@"operation"] = @(span->operation);
+
+		if (span->tag[0] != '\0') {
+			NSString *tag = @(span->tag);
+
+			/* Truncation may have split a multibyte character */
+			if (tag) {
+				arguments[@"tag"] = tag;
+			}
+		}
+
+		/* Chrome expects microseconds */
+		[events addObject:@{
+			@"name"	: @(span->name),
+			@"cat"	: @"otrkit",
+			@"ph"	: @"X",
+			@"ts"	: @((double)span->startTime / NSEC_PER_USEC),
+			@"dur"	: @((double)duration / NSEC_PER_USEC),
+			@"pid"	: processIdentifier,
+			@"tid"	: @(span->threadIdentifier),
+			@"args"	: arguments
+		}];
+	}
+
+	free(spans);
+
+	NSDictionary *trace = @{
+		@"traceEvents"		: events,
+		@"displayTimeUnit"	: @"ms"
+	};
+
+	NSData *traceData = [NSJSONSerialization dataWithJSONObject:trace options:0 error:NULL];
+
+	return ((traceData) ?: [NSData data]);
+}
+
++ (BOOL)writeChromeTraceToPath:(NSString *)path error:(NSError **)error
+{
+	NSParameterAssert(path != nil);
+
+	return [[self chromeTraceData] writeToFile:path options:NSDataWritingAtomic error:error];
+}
+
+@end
+
+NS_ASSUME_NONNULL_END